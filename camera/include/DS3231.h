@@ -0,0 +1,68 @@
+/* DS3231 real time clock on the shared I2C bus. Ported from the Arduino
+ * DS3231 library (archive/archived/src/DS3231.cpp) onto I2CBus: the time
+ * is read and written as one register block, and errors are returned
+ * instead of exiting.
+ */
+
+#ifndef DS3231_H
+#define DS3231_H
+
+#include <cstdint>
+#include <time.h>
+
+#include "i2cbus.h"
+
+#define DS3231_ADDR 0x68
+
+
+class DS3231
+{
+public:
+	DS3231(I2CBus *i2c_bus);
+
+	/** Checks that the clock answers. Returns -1 if not.
+	 */
+	int init();
+
+	/** Date and time in 24h format, tm_year since 1900 as for mktime().
+	 *  Read as a single 7 byte block so the fields cannot roll over
+	 *  between reads.
+	 */
+	int getTime(struct tm *t);
+	int setTime(const struct tm *t);
+
+	/** Die temperature in deg C, 0.25 degree resolution.
+	 */
+	int getTemperature(float *temperature);
+
+	/** True if the oscillator stopped since the flag was last cleared,
+	 *  i.e. the time cannot be trusted. setTime() clears it.
+	 */
+	int oscillatorStopped(bool *stopped);
+
+	/** 1 Hz square wave on SQW/INT, whose falling edge is the seconds
+	 *  rollover. The alarms stop driving the pin.
+	 */
+	int enableSquareWave();
+
+	int setA1Time(uint8_t A1Day, uint8_t A1Hour, uint8_t A1Minute,
+	              uint8_t A1Second, uint8_t AlarmBits, bool A1Dy,
+	              bool A1h12, bool A1PM);
+	int turnOnAlarm(uint8_t Alarm);
+	int turnOffAlarm(uint8_t Alarm);
+	/** 1 if enabled, 0 if not, -1 on error.
+	 */
+	int checkAlarmEnabled(uint8_t Alarm);
+
+private:
+	I2CBus *bus;
+
+	uint8_t decToBcd(uint8_t val);
+	uint8_t bcdToDec(uint8_t val);
+	int readRegisters(uint8_t reg, uint8_t *buf, size_t len);
+	int writeRegisters(uint8_t reg, const uint8_t *buf, size_t len);
+	int readControlByte(bool which, uint8_t *control);
+	int writeControlByte(uint8_t control, bool which);
+};
+
+#endif
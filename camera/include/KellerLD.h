@@ -38,6 +38,10 @@ THE SOFTWARE.
 
 #include <cstdint>
 
+#include "i2cbus.h"
+
+#define LD_CONVERSION_US 9000	// Max conversion time per datasheet
+
 
 class KellerLD 
 {
@@ -46,13 +50,15 @@ public:
 	static constexpr float bar = 0.001f;
 	static constexpr float mbar = 1.0f;
 
-	KellerLD();
-	KellerLD(int i2c_bus);
+	/** The bus may be shared with other devices, see I2CBus.
+	 */
+	KellerLD(I2CBus *i2c_bus);
 
   /** Reads the onboard memory map to determine min and max pressure as 
-   *  well as manufacture date, mode, and customer ID.
+   *  well as manufacture date, mode, and customer ID. Returns -1 on
+   *  I2C errors.
    */
-	void init();
+	int init();
 
 	/** Provide the density of the working fluid in kg/m^3. Default is for 
 	 * seawater. Should be 997 for freshwater.
@@ -60,8 +66,17 @@ public:
 	void setFluidDensity(float density);
 
 	/** The read from I2C takes up for 40 ms, so use sparingly is possible.
+	 *  Blocks for the whole conversion; returns -1 on I2C errors.
+	 */
+	int readData();
+
+	/** Non-blocking sampling: startConversion() requests a measurement,
+	 *  collect() fetches it once the conversion is done (LD_CONVERSION_US
+	 *  at most). collect() returns 1 with new data, 0 while the sensor is
+	 *  still busy and -1 on I2C errors.
 	 */
-	void readData();
+	int startConversion();
+	int collect();
 
 	/** Checks if the attached sensor is connectored or not. */
 	bool status();
@@ -106,16 +121,14 @@ public:
 	float P_max;
 
 private:
-	int fd;
-	int bus;
+	I2CBus *bus;
 
 	float fluidDensity;
 	float T_degc;
 
 	uint16_t cust_id0;
 	uint16_t cust_id1;
-	int selectDevice(uint8_t dev_addr);
-	uint16_t readMemoryMap(uint8_t mtp_address);
+	int readMemoryMap(uint8_t mtp_address, uint16_t *memory_map);
 };
 
 #endif
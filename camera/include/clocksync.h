@@ -0,0 +1,119 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <stddef.h>
+
+/*
+ * One TPSN round: T1 and T4 on our clock, T2 and T3 on the server's
+ */
+struct TpsnSample
+{
+    long long T1, T2, T3, T4;
+
+    long long offset() const { return ((T2 - T1) - (T4 - T3)) / 2; }
+    long long rtt() const { return (T4 - T1) - (T3 - T2); }
+};
+
+/*
+ * How a batch of TPSN rounds becomes one offset. A WiFi retransmit makes a
+ * round slow and asymmetric, so everything but Mean discards such rounds.
+ */
+enum class OffsetEstimator
+{
+    Mean,           // the old behaviour
+    MinRtt,         // the round with the smallest round trip
+    Median,
+    TrimmedMean     // mean of the middle half by offset
+};
+
+bool parseOffsetEstimator(const char *name, OffsetEstimator *estimator);
+const char *offsetEstimatorName(OffsetEstimator estimator);
+
+/*
+ * Offset (server - local, ns) of n rounds. rtt gets the smallest round trip
+ * and may be NULL. samples is reordered.
+ */
+long long estimateOffset(TpsnSample *samples, size_t n, OffsetEstimator estimator, long long *rtt);
+
+/*
+ * The filter's estimate at one moment: server = local + offset_n + freq
+ * ns per second since t_ref_n. A plain value, so another thread can map
+ * server times on a copy while the filter moves on.
+ */
+struct ClockLine
+{
+    long long t_ref_n;
+    long long offset_n;
+    double freq;
+
+    long long offsetAt(long long t_n) const
+    {
+        return offset_n + (long long) (freq * double(t_n - t_ref_n) / 1e9);
+    }
+    long long toServer(long long t_n) const { return t_n + offsetAt(t_n); }
+    /** Local time at which the server clock reads server_n
+     */
+    long long toLocal(long long server_n) const
+    {
+        // two rounds are plenty for ppm drifts
+        long long t = server_n - offset_n;
+        t = server_n - offsetAt(t);
+        return server_n - offsetAt(t);
+    }
+};
+
+/*
+ * Two-state Kalman filter over offset (ns) and frequency error (ns per
+ * second) of our clock against the server's. Each update() is one offset
+ * estimate; between updates the offset is extrapolated with the frequency.
+ */
+class ClockFilter
+{
+public:
+    ClockFilter();
+
+    /** Add an offset measured at local time t_n. Returns the residual:
+     *  measurement minus what the filter predicted (0 for the first one).
+     */
+    long long update(long long t_n, long long offset_n);
+    void reset();
+    /** Start from an offset at t_n and a frequency known from before, e.g.
+     *  after a reboot, instead of from scratch. offsetVar is the variance
+     *  of offset_n in ns^2, 0 for a fresh measurement.
+     */
+    void resume(long long t_n, long long offset_n, double freq_ns, double freqVar, double offsetVar);
+    /** Without measurements: carry the offset on to t_n and continue with
+     *  freq_ns from another reference, e.g. the RTC, from there.
+     */
+    void holdFrequency(long long t_n, double freq_ns);
+
+    bool valid() const { return initialized; }
+    /** Offset predicted for local time t_n
+     */
+    long long offsetAt(long long t_n) const;
+    /** How many ns the server clock gains on ours per second
+     */
+    double frequency() const { return freq; }
+    double frequencyVariance() const { return P[1][1]; }
+    /** Length of one server second on our clock
+     */
+    long long serverSecond() const;
+    /** Local time at which the server clock reads server_n
+     */
+    long long toLocal(long long server_n) const;
+    /** The current estimate as a line
+     */
+    ClockLine line() const { return {t0, (long long) offset, freq}; }
+
+private:
+    bool initialized;
+    long long t0;           // local time of the last update
+    double offset;          // ns, at t0
+    double freq;            // ns/s
+    double P[2][2];         // covariance
+    double R;               // measurement variance, ns^2
+    double qOffset;         // offset random walk, ns^2/s
+    double qFreq;           // frequency random walk, (ns/s)^2/s
+};
+
+#endif
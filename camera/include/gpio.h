@@ -0,0 +1,58 @@
+#ifndef GPIO_H
+#define GPIO_H
+
+#include <stdint.h>
+
+#define GPIO_MAX_PINS 8
+#define GPIO_CHIP "gpiochip0"
+#define GPIO_CONSUMER "minions"
+
+/*
+ * Where the GPIOs of the board are driven from
+ */
+enum class GpioKind
+{
+    Mem,            // /dev/gpiomem registers, one store per set or clear
+    Gpiod,          // GPIO character device through libgpiod
+    WiringPi        // the old digitalWrite path
+};
+
+bool parseGpioKind(const char *name, GpioKind *kind);
+const char *gpioKindName(GpioKind kind);
+
+/*
+ * Header pins of the board, numbered like wiringPi numbers them so the
+ * pin macros of peripheral.h mean the same pins on every backend. Pins
+ * are addressed through backend-specific masks from mask(), so several
+ * outputs change with one write() and the trigger thread never maps pin
+ * numbers. write() and read() are safe from any thread, they touch
+ * different pins.
+ */
+class Gpio
+{
+public:
+    virtual ~Gpio() {}
+
+    /** Claim the pins: outputs start low, inputs get their pull up.
+     *  -1 if the backend is not available on this board.
+     */
+    virtual int open(const int *outputs, int nOutputs, const int *inputs, int nInputs) = 0;
+
+    /** Bit(s) to pass to write() for an output given to open()
+     */
+    virtual uint32_t mask(int pin) const = 0;
+    /** Drive the pins of set high and those of clear low
+     */
+    virtual void write(uint32_t set, uint32_t clear) = 0;
+    virtual bool read(int pin) = 0;
+};
+
+/** A not yet opened backend of kind
+ */
+Gpio *makeGpio(GpioKind kind);
+
+/** BCM GPIO number of a wiringPi pin, -1 if there is none
+ */
+int gpioBcmPin(int pin);
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+
+#define HIST_MAX_BUCKETS 200
+
+/*
+ * Fixed-bucket histogram, cheap enough to record from the trigger thread:
+ * record() is a handful of relaxed atomic operations, no locks, no stdio.
+ * Buckets are width wide starting at lo; values outside land in an
+ * underflow or overflow bucket.
+ */
+class Histogram
+{
+public:
+    Histogram(const char *name, long long lo, long long width, int buckets);
+
+    void record(long long value);
+    void reset();
+
+    /** Text summary with percentiles and every non-empty bucket. Returns
+     *  the number of bytes put in buf, truncated to len.
+     */
+    size_t format(char *buf, size_t len) const;
+
+    uint32_t count() const { return nCount.load(std::memory_order_relaxed); }
+
+private:
+    const char *name;
+    long long lo;
+    long long width;
+    int buckets;
+
+    // [0] underflow, [1..buckets] buckets, [buckets+1] overflow
+    std::atomic<uint32_t> bins[HIST_MAX_BUCKETS + 2];
+    std::atomic<uint32_t> nCount;
+    std::atomic<long long> sum;
+    std::atomic<long long> min;
+    std::atomic<long long> max;
+
+    long long percentile(double q) const;
+};
+
+#endif
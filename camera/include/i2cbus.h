@@ -0,0 +1,47 @@
+#ifndef I2CBUS_H
+#define I2CBUS_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <mutex>
+
+#include <linux/i2c.h>
+
+#define I2C_MAX_MSGS 16
+
+/*
+ * One /dev/i2c-N shared by every device on it. All transfers go through
+ * the I2C_RDWR ioctl, so each message carries its own device address (no
+ * I2C_SLAVE switching) and a write-then-read is one transaction with a
+ * repeated start instead of two syscalls and a sleep. Thread-safe; every
+ * call returns -1 on error instead of exiting.
+ */
+class I2CBus
+{
+public:
+    I2CBus();
+    ~I2CBus();
+
+    I2CBus(const I2CBus&) = delete;
+    I2CBus& operator= (const I2CBus&) = delete;
+
+    int open(int bus);
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    int write(uint16_t addr, const uint8_t *data, size_t len);
+    int read(uint16_t addr, uint8_t *data, size_t len);
+    /** Write reg (e.g. a register or command), then read len bytes back
+     */
+    int writeRead(uint16_t addr, const uint8_t *reg, size_t regLen, uint8_t *data, size_t len);
+    /** Any batch of up to I2C_MAX_MSGS messages in a single transaction
+     */
+    int transfer(struct i2c_msg *msgs, int n);
+
+private:
+    int fd;
+    int busNum;
+    std::mutex mtx;
+};
+
+#endif
@@ -1,27 +1,47 @@
-#ifndef LOGGER_H
-#define LOGGER_H
-
-#include <string>
-#include <chrono>
-#include <iostream>
-#include <fstream> // ofstream
-#include <iostream>
-
-class Logger
-{
-public:
-    Logger();
-    Logger(uint8_t maxCount);
-
-    void log(long long t_nsec, std::string t_rtc, float pressure, float temperature);
-    void open(std::string path);
-    void close();
-
-private:
-    uint8_t logCount;
-    uint8_t logFlushCount;
-    std::string logPath;
-    std::ofstream logF;
-};
-
-#endif
\ No newline at end of file
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <string>
+#include <chrono>
+#include <iostream>
+#include <fstream> // ofstream
+#include <iostream>
+
+#include "binlog.h"
+#include "telemetry.h"
+
+/*
+ * Sensor log, either CSV through an ofstream or fixed binary records
+ * written in batches by a background thread (see BinLog). The binary
+ * format drops t_rtc; tools/binlog2csv converts it back to CSV.
+ */
+class Logger
+{
+public:
+    Logger();
+    Logger(uint8_t maxCount);
+
+    void log(long long t_nsec, const std::string &t_rtc, float pressure, float temperature,
+             uint64_t frameId = 0);
+    void open(std::string path);
+    void openBinary(std::string path, int flushMs = BINLOG_FLUSH_MS);
+    void close();
+    /** Time the writes to the card: every flush of the CSV, every batch
+     *  of the binary log. Before open().
+     */
+    void setWriteLatency(LatencyRecorder *rec);
+    /** Records the binary log has not written yet, 0 for CSV
+     */
+    size_t queued();
+
+private:
+    uint8_t logCount;
+    uint8_t logFlushCount;
+    std::string logPath;
+    std::ofstream logF;
+    bool binary;
+    BinLog binLog;
+    LatencyRecorder *writeLatency;
+};
+
+#endif
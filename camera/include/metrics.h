@@ -0,0 +1,32 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include "histogram.h"
+
+#define METRICS_PATH "timing_hist.txt"
+#define METRICS_DUMP_SEC 60
+
+/*
+ * Always-on timing histograms of the firmware, all in ns
+ */
+struct Metrics
+{
+    Histogram triggerDelay;     // trigger thread wake up - scheduled edge
+    Histogram pulseWidth;       // trigger GPIO high time
+    Histogram ledWidth;         // LED strobe GPIO high time
+    Histogram syncRtt;          // TPSN round trip, server time excluded
+    Histogram driftCorrection;  // trigger period change per second, after drift computation
+    Histogram syncResidual;     // measured skew - clock filter prediction
+    Histogram triggerPhase;     // locked trigger edge - server edge on the clock line
+
+    Metrics();
+
+    /** Replace path with the current state of all histograms, via write(2)
+     *  and rename(2) so a reader never sees half a file. Main loop only.
+     */
+    int dump(const char *path = METRICS_PATH);
+};
+
+extern Metrics metrics;
+
+#endif
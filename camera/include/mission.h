@@ -0,0 +1,67 @@
+#ifndef MISSION_H
+#define MISSION_H
+
+#include <vector>
+
+/*
+ * Framerate used from depth on down, until the next deeper band
+ */
+struct DepthBand
+{
+    float depth;    // m
+    float fps;
+};
+
+struct MissionConfig
+{
+    // Start capturing below this depth (m)
+    float startDepth = 20.f;
+    // Go back up this far past a threshold before switching back (m)
+    float hysteresis = 2.f;
+    // Consecutive depth samples that must agree before switching
+    int confirm = 3;
+    // Sorted by depth. The first band applies from startDepth on, whatever
+    // its depth. Empty means a single band at 1 fps.
+    std::vector<DepthBand> bands;
+};
+
+/*
+ * Decides from the depth whether the float is at the surface (no
+ * triggering, LEDs off, nothing written) or capturing, and at what
+ * framerate. Thresholds have hysteresis and need a few agreeing samples, so
+ * swell at a threshold does not toggle the cameras.
+ */
+class MissionScheduler
+{
+public:
+    MissionScheduler(const MissionConfig &config);
+
+    /** New thresholds and bands while running. Stays capturing in the
+     *  band of the same index, if there still is one, until the next
+     *  samples decide.
+     */
+    void reconfigure(const MissionConfig &config);
+
+    /** Feed a depth reading (m). True if the state or band changed.
+     */
+    bool update(float depth);
+
+    bool capturing() const { return band >= 0; }
+    /** Framerate of the current band, 0 at the surface
+     */
+    float framerate() const;
+    /** Current band, -1 at the surface
+     */
+    int currentBand() const { return band; }
+
+private:
+    MissionConfig config;
+    int band;
+    int pending;
+    int pendingCount;
+
+    int target(float depth) const;
+    void normalize();
+};
+
+#endif
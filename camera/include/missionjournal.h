@@ -0,0 +1,48 @@
+#ifndef MISSIONJOURNAL_H
+#define MISSIONJOURNAL_H
+
+#include <stdint.h>
+
+#include "clocksync.h"
+#include "synchronization.h"
+
+#define MISSION_JOURNAL_PATH "mission_state.jnl"
+// Saved at least every this many triggers; a resumed run starts its ids
+// this far past the saved one, so no trigger id is ever used twice
+#define MISSION_SAVE_TRIGGERS 64
+// How fast CLOCK_REALTIME may walk off while we are down, ns per second
+#define MISSION_REALTIME_DRIFT_NS 20000.0
+
+#define MISSION_SYNCED 0x1
+
+/*
+ * Where the mission stood, kept in a StateJournal so a reboot mid
+ * deployment carries on instead of starting over. CLOCK_MONOTONIC starts
+ * from zero on every boot, so the offset is kept against CLOCK_REALTIME
+ * and the trigger schedule on the server's clock.
+ */
+struct MissionRecord
+{
+    uint32_t run;               // counts starts, names the logs of each
+    uint32_t flags;             // MISSION_SYNCED
+    uint64_t nextTriggerId;
+    int64_t serverStartN;       // trigger schedule on the server's clock
+    int64_t serverPeriodN;
+    int64_t offsetRealtimeN;    // server - CLOCK_REALTIME at realtimeN
+    int64_t realtimeN;
+    double freq;                // ClockFilter frequency, ns/s
+    double freqVar;
+};
+
+/** Copy the sync state of filter and TI into rec, as of now
+ */
+void missionSaveSync(MissionRecord *rec, const ClockFilter &filter, const struct timeinfo *TI);
+
+/** Warm start the filter from rec. With a fresh TPSN measurement in TI
+ *  (measured true) only the frequency comes from rec; without one the
+ *  offset is carried over by way of CLOCK_REALTIME. Fills in the server
+ *  schedule of TI either way.
+ */
+void missionRestoreSync(const MissionRecord &rec, bool measured, ClockFilter *filter, struct timeinfo *TI);
+
+#endif
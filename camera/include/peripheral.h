@@ -1,38 +1,138 @@
-#ifndef PERIPHERAL_H
-#define PERIPHERAL_H
-
-#include "KellerLD.h"
-
-#define I2C_BUS 1 
-#define LED_EN_PIN 17
-#define LED_FAULT_PIN 18
-#define LED_PIN 4 //23
-#define TRIG_PIN 2 //5 //24
-
-class Peripheral
-{
-public:
-    Peripheral();
-    Peripheral(int i2c_bus);
-    
-    int init();
-    void triggerOn();
-    void triggerOff();
-    void ledOn();
-    void ledOff();
-    void setup();
-    float getPressure();
-    float getTemperature();
-    void readData();
-
-private:
-    int i2c_bus = I2C_BUS;
-    KellerLD *k_sensor;
-
-    void setupPi();
-    void k_sensor_init();
-};
-
-
-
-#endif
+#ifndef PERIPHERAL_H
+#define PERIPHERAL_H
+
+#include <thread>
+#include <atomic>
+
+#include "KellerLD.h"
+#include "i2cbus.h"
+#include "sensortimeline.h"
+#include "gpio.h"
+#include "rtcclock.h"
+
+#define I2C_BUS 1 
+#define LED_EN_PIN 17
+#define LED_FAULT_PIN 18
+#define LED_FAULT_LEVEL 0     // open drain fault output of the LED driver
+#define LED_PIN 4 //23
+#define TRIG_PIN 2 //5 //24
+#define RTC_SQW_PIN -1        // DS3231 SQW, -1 if not wired
+
+#define SAMPLE_RATE_HZ 10
+#define SURFACE_SAMPLE_RATE_HZ 1
+
+/*
+ * Where the board is wired, wiringPi numbers
+ */
+struct PeripheralPins
+{
+    int trig = TRIG_PIN;
+    int led = LED_PIN;
+    int ledEn = LED_EN_PIN;
+    int ledFault = LED_FAULT_PIN;
+    int ledFaultLevel = LED_FAULT_LEVEL;
+    int rtcSqw = RTC_SQW_PIN;
+};
+
+class Peripheral
+{
+public:
+    Peripheral();
+    Peripheral(int i2c_bus);
+    
+    /** GPIO backend for init(), the default is Mem. Falls back to
+     *  wiringPi if the chosen one is not available.
+     */
+    void setGpio(GpioKind kind) { gpioKind = kind; }
+    GpioKind gpioUsed() const { return gpioKind; }
+    /** Pins and I2C bus for init(), e.g. from the mission file
+     */
+    void setPins(const PeripheralPins &p) { pins = p; }
+    void setI2cBus(int bus) { i2c_bus = bus; }
+    /** Look for the DS3231 in init(), on by default
+     */
+    void setRtc(bool on) { rtcWanted = on; }
+
+    int init();
+    /** With led, the LED goes on in the same GPIO write as the trigger
+     */
+    void triggerOn(bool led = false);
+    void triggerOff();
+    void ledOn();
+    void ledOff();
+    /** True while the LED driver reports a fault (open or shorted LED,
+     *  over temperature). Cheap enough for the trigger thread.
+     */
+    bool ledFault();
+    /** Power the LED driver up or down
+     */
+    void ledEnable(bool on);
+    void setup();
+    float getPressure();
+    float getTemperature();
+    void readData();
+
+    /** Sample the pressure sensor on its own thread at rateHz. The I2C
+     *  conversions never run on the caller's thread.
+     */
+    int startSampler(int rateHz = SAMPLE_RATE_HZ);
+    void stopSampler();
+    /** Takes effect after the current sample
+     */
+    void setSampleRate(int rateHz);
+
+    /** Latest sample, lock-free and safe from the trigger thread. False if
+     *  there is none yet.
+     */
+    bool latestSample(SensorSample *sample) const;
+    /** Sample interpolated at t_nsec (CLOCK_MONOTONIC) from the sampler's
+     *  history, lock-free as well. False if there is none yet.
+     */
+    bool sampleAt(long long t_nsec, SensorSample *sample) const { return timeline.at(t_nsec, sample); }
+    const SensorTimeline &sensorTimeline() const { return timeline; }
+
+    bool hasSensor() const { return sensorOk; }
+
+    /** Follow the RTC second edges on their own thread, if init() found
+     *  the RTC. -1 if not.
+     */
+    int startRtc() { return rtc.start(); }
+    void stopRtc() { rtc.stop(); }
+    RtcClock &rtcClock() { return rtc; }
+
+    /** eventfd written after every new sample. Set before startSampler().
+     */
+    void setNotify(int fd) { notifyFd = fd; }
+
+    /** Shared by every I2C device of the board
+     */
+    I2CBus *i2c() { return &bus; }
+
+private:
+    int i2c_bus = I2C_BUS;
+    I2CBus bus;
+    KellerLD *k_sensor = nullptr;
+    bool sensorOk = false;
+    int notifyFd = -1;
+    bool rtcWanted = true;
+    RtcClock rtc{&bus};
+
+    PeripheralPins pins;
+    GpioKind gpioKind = GpioKind::Mem;
+    Gpio *gpio = nullptr;
+    uint32_t trigMask = 0, ledMask = 0, ledEnMask = 0;
+
+    SensorTimeline timeline;
+    std::thread sampler;
+    std::atomic<bool> sampling{false};
+    std::atomic<int> sampleRateHz{SAMPLE_RATE_HZ};
+
+    void setupPi();
+    int k_sensor_init();
+    int rtc_init();
+    void samplerLoop();
+};
+
+
+
+#endif
@@ -0,0 +1,102 @@
+#ifndef RTCCLOCK_H
+#define RTCCLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+#include <thread>
+#include <atomic>
+
+#include "DS3231.h"
+#include "gpio.h"
+#include "seqlock.h"
+
+// RTC seconds the rate is fitted over
+#define RTC_FIT_EDGES 64
+// Wake up this long before the next expected second edge
+#define RTC_EDGE_GUARD_NS 3000000LL
+// Level (SQW) or seconds register polling interval around the edge
+#define RTC_POLL_SQW_NS 20000LL
+#define RTC_POLL_REG_NS 1000000LL
+// SQW polling interval while searching a whole second for the edge, so
+// the SCHED_FIFO thread does not keep the core busy until it locks
+#define RTC_POLL_SEARCH_NS 1000000LL
+// Pause after a missed edge or a bus error, and how many of those in a
+// row until the RTC is given up on
+#define RTC_RETRY_NS 1000000000LL
+#define RTC_MAX_ERRORS 10
+// Read the full date again every this many seconds to check the count
+#define RTC_READ_SEC 60
+
+/*
+ * The RTC second edges on CLOCK_MONOTONIC: the local time of one edge,
+ * its wall clock second and how long an RTC second is on our clock
+ */
+struct RtcFit
+{
+    long long t_ref_n;
+    long long wall_ref_s;       // UTC seconds at t_ref_n
+    double second_n;            // 0 until two edges were seen
+    int edges;                  // in the fit
+};
+
+/*
+ * DS3231 as a wall clock and holdover reference. A thread catches every
+ * second edge of the RTC, from its 1 Hz SQW output on a GPIO where that is
+ * wired, else from the seconds register rolling over (about 1 ms instead
+ * of tens of us), and fits the edges of the last RTC_FIT_EDGES seconds.
+ * The DS3231 is temperature compensated to 2 ppm, so underwater, without
+ * the sync server, the length of its second on our clock tracks how our
+ * crystal drifts with temperature. Readers never touch the I2C bus.
+ * After RTC_MAX_ERRORS failed edges in a row the thread stops and the
+ * RTC reads as not ok, with no fit.
+ */
+class RtcClock
+{
+public:
+    RtcClock(I2CBus *bus);
+    ~RtcClock();
+
+    RtcClock(const RtcClock&) = delete;
+    RtcClock& operator= (const RtcClock&) = delete;
+
+    /** Check the DS3231 answers and has not lost its time. With sqwPin
+     *  >= 0 (an input of gpio) it is switched to the 1 Hz square wave.
+     */
+    int init(Gpio *gpio, int sqwPin);
+    int start();
+    void stop();
+
+    bool ok() const { return initialized; }
+    /** Wall clock (UTC) read over I2C, whole seconds. Slow.
+     */
+    int readWall(time_t *wall);
+
+    /** UTC at local time t_n from the fit. False until the first edge.
+     *  Lock-free, cheap enough for every frame.
+     */
+    bool wallAt(long long t_n, struct timespec *wall) const;
+    /** Length of one RTC second on CLOCK_MONOTONIC, 0 until the fit
+     *  spans RTC_FIT_EDGES seconds
+     */
+    double second() const;
+
+private:
+    DS3231 rtc;
+    Gpio *gpio;
+    int sqwPin;
+    std::atomic<bool> initialized;
+
+    Seqlock<RtcFit> fit;
+    std::thread thread;
+    std::atomic<bool> running;
+
+    long long edgeTimes[RTC_FIT_EDGES];
+    long long edgeWalls[RTC_FIT_EDGES];
+    int nEdges;
+
+    void loop();
+    int waitEdge(long long expected, long long *t_edge);
+    void addEdge(long long t_edge, long long wall);
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef SENSORTIMELINE_H
+#define SENSORTIMELINE_H
+
+#include <stdint.h>
+#include <atomic>
+
+#include "seqlock.h"
+
+// About 100 s of history at the default 10 Hz
+#define SENSOR_TIMELINE_SLOTS 1024
+
+/*
+ * One pressure/temperature reading
+ */
+struct SensorSample
+{
+    long long t_nsec;       // CLOCK_MONOTONIC when the conversion finished
+    float pressure;         // mbar
+    float temperature;      // deg C
+    float depth;            // m, for the configured fluid density
+};
+
+/*
+ * Recent sensor samples by time, so a trigger or a log line gets the
+ * pressure, temperature and depth at its own timestamp instead of whatever
+ * was read last, and nothing on the frame path touches the I2C bus. One
+ * writer (the sampler thread) and any number of lock-free readers; every
+ * slot is a seqlock.
+ */
+class SensorTimeline
+{
+public:
+    SensorTimeline() : count(0) {}
+
+    SensorTimeline(const SensorTimeline&) = delete;
+    SensorTimeline& operator= (const SensorTimeline&) = delete;
+
+    /** Samples in time order, from one thread
+     */
+    void push(const SensorSample &s);
+
+    /** Sample at t_n, interpolated between the samples around it. Past the
+     *  newest sample it is extrapolated from the last two, at most as far
+     *  as they are apart, and held after that; before the oldest one kept
+     *  it is the oldest one. False if there is no sample yet, or if the
+     *  history moved on under the reader.
+     */
+    bool at(long long t_n, SensorSample *out) const;
+
+    bool latest(SensorSample *out) const;
+
+    /** Time of the newest sample, 0 if there is none
+     */
+    long long newest() const;
+
+    uint64_t samples() const { return count.load(std::memory_order_acquire); }
+
+private:
+    struct Entry
+    {
+        uint64_t index;     // tells a slot that was overwritten meanwhile
+        SensorSample sample;
+    };
+
+    Seqlock<Entry> slots[SENSOR_TIMELINE_SLOTS];
+    std::atomic<uint64_t> count;
+
+    bool read(uint64_t i, SensorSample *out) const;
+};
+
+#endif
@@ -1,30 +1,63 @@
-#ifndef SYNC_H
-#define SYNC_H
-
-#include <stdlib.h>
-#include <stdio.h>
-#include <sys/socket.h> 
-#include <arpa/inet.h> 
-#include <unistd.h> 
-#include <sys/types.h>
-#include <signal.h>
-#include <time.h>
-
-#define BILLION 1000000000LL
-#define NUM_AVG 25
-#define PORT 8080 
-#define SERVER_IP "192.168.4.1"
-
-struct timeinfo
-{
-    long long T_skew_n;
-    long long T_start_n;
-};
-
-long long as_nsec(struct timespec *T);
-long long bytes_to_nsec(char *buffer);
-void as_timespec(long long t, struct timespec *T);
-int synchronize(struct timeinfo* TI, uint8_t isFirst);
-int get_skew(struct timeinfo* TI);
-
-#endif
+#ifndef SYNC_H
+#define SYNC_H
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <sys/socket.h> 
+#include <arpa/inet.h> 
+#include <unistd.h> 
+#include <sys/types.h>
+#include <signal.h>
+#include <time.h>
+
+#include "clocksync.h"
+
+#define BILLION 1000000000LL
+// Defaults, a mission file may set others with sync_set_server() and
+// sync_set_rounds()
+#define NUM_AVG 25
+#define PORT 8080 
+#define SERVER_IP "192.168.4.1"
+#define SYNC_MAX_ROUNDS 100
+// Give up on a silent server after this long instead of blocking the main loop
+#define SYNC_TIMEOUT_SEC 2
+// TCP keepalive: first probe after idle, interval and probes before drop
+#define SYNC_KEEPIDLE_SEC 30
+#define SYNC_KEEPINTVL_SEC 5
+#define SYNC_KEEPCNT 3
+
+struct timeinfo
+{
+    long long T_skew_n;
+    long long T_start_n;
+    long long T_server_start_n; // T_start_n as the server sent it
+    long long T_server_period_n;// trigger period on the server's clock
+    long long T_meas_n;         // local time the skew was measured at
+};
+
+long long as_nsec(struct timespec *T);
+void as_timespec(long long t, struct timespec *T);
+int synchronize(struct timeinfo* TI, uint8_t isFirst);
+int get_skew(struct timeinfo* TI);
+/* Server to sync with from the next connect on. Drops the session.
+ */
+void sync_set_server(const char *ip, int port);
+/* TPSN rounds per skew measurement, at most SYNC_MAX_ROUNDS
+ */
+void sync_set_rounds(int rounds);
+/* How each batch of TPSN rounds is reduced to one skew, MinRtt
+ * unless changed.
+ */
+void sync_set_estimator(OffsetEstimator estimator);
+/* Take T1 and T4 from kernel (or NIC) timestamps of the sync packets
+ * instead of clock_gettime() around send() and read(). Rounds without a
+ * kernel timestamp fall back to the user space ones.
+ */
+void sync_set_timestamping(bool enable);
+/* The sync session stays connected between synchronize() and get_skew()
+ * calls and reconnects by itself after errors. sync_close() drops it.
+ */
+int sync_open();
+void sync_close();
+
+#endif
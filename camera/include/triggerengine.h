@@ -0,0 +1,157 @@
+#ifndef TRIGGERENGINE_H
+#define TRIGGERENGINE_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <atomic>
+
+#include "clocksync.h"
+#include "peripheral.h"
+#include "spscqueue.h"
+#include "triggerchannel.h"
+
+#define TRIGGER_PULSE_NS 500000LL
+#define TRIGGER_EVENTS 1024
+#define STROBE_PREFIRE_NS 200000LL
+#define STROBE_WIDTH_NS 1000000LL
+// Locked to the server, a new clock estimate moves the edges by at most
+// this fraction of a period per edge: 100 us per second
+#define TRIGGER_SLEW_PPM 100
+// Phase errors beyond this are stepped, not slewed out over minutes
+#define TRIGGER_STEER_MAX_NS 20000000LL
+
+/*
+ * What happened at one trigger, for whoever logs it
+ */
+struct TriggerEvent
+{
+    uint64_t id;
+    long long t_sched_n;    // when the edge was due
+    long long t_edge_n;     // right after the GPIO went high
+    long long lateness_n;   // wake up time - t_sched_n
+    long long pulse_n;      // how long the GPIO stayed high
+    long long led_n;        // how long the LED stayed on, 0 without strobe
+    bool ledFault;          // LED driver fault while the LED was on
+    uint32_t missed;        // periods skipped before this one
+    long long phase_n;      // t_sched_n - where the clock line puts the edge,
+                            // still to be slewed out; 0 unless locked
+    long long stepped_n;    // phase error stepped, not slewed, just before
+                            // this edge; 0 if none
+    float pressure;         // sensor timeline at the edge, 0 without samples
+    float temperature;
+};
+
+/*
+ * Camera trigger on its own SCHED_FIFO thread. The thread sleeps with
+ * clock_nanosleep(TIMER_ABSTIME) until each edge, toggles the trigger pin,
+ * publishes the trigger to the imaging processes and pushes a TriggerEvent
+ * into a lock-free queue. Nothing on the thread logs, allocates or takes a
+ * lock; the main loop drains the events with pop().
+ *
+ * With a strobe set the same thread also drives the LED: on prefire ns
+ * before each edge, so the light is up when the exposure starts, and off
+ * width ns after it went on. Every step is an absolute deadline from the
+ * edge schedule, so LED and trigger keep their offsets whatever the
+ * wake up latency.
+ *
+ * Locked to the server (lock()), edges are the local times of a grid on
+ * the server's clock, mapped through the clock filter's line. Each edge
+ * follows the last one at the line's rate; where a new line puts the edge
+ * elsewhere the difference is slewed out a little every edge, so edges
+ * never jump, double or drop for a drift correction.
+ */
+class TriggerEngine
+{
+public:
+    TriggerEngine(Peripheral *peripheral, TriggerChannel *channel);
+    ~TriggerEngine();
+
+    /** First edge at t_start_n (CLOCK_MONOTONIC), then every period_n.
+     *  The thread takes the Trigger role of the thread layout and runs on
+     *  with normal scheduling if SCHED_FIFO is not permitted.
+     */
+    int start(long long t_start_n, long long period_n);
+    void stop();
+
+    /** Replace the schedule, e.g. after synchronization. Takes effect
+     *  immediately, also while the thread is asleep. Edges stay at
+     *  t_start_n + k * period_n, the first one is the next in the future.
+     *  Main thread only.
+     */
+    void reschedule(long long t_start_n, long long period_n);
+    /** Trigger on the server's schedule: edges at server_start_n +
+     *  k * server_period_n on the server clock, k >= 0, at the local times
+     *  line gives for them. Called again with the same grid and a new line,
+     *  the edges slew onto it by TRIGGER_SLEW_PPM of a period per edge. A
+     *  new grid, or a phase error over TRIGGER_STEER_MAX_NS, starts at its
+     *  next edge instead. 0 server_period_n pauses. Main thread only.
+     */
+    void lock(long long server_start_n, long long server_period_n, const ClockLine &line);
+    /** Stop triggering until the next reschedule() or lock(), the thread
+     *  keeps running
+     */
+    void pause();
+
+    /** Main thread only. False once every event was consumed.
+     */
+    bool pop(TriggerEvent *ev);
+
+    unsigned long overflows() const { return nOverflows; }
+
+    /** eventfd the thread writes to after every event, so the main loop
+     *  can sleep until there is something to pop(). Set before start().
+     */
+    void setNotify(int fd) { notifyFd = fd; }
+
+    /** LED on prefire_n before every edge for width_n, 0 width leaves the
+     *  LED alone. Set before start().
+     */
+    void setStrobe(long long prefire_n, long long width_n);
+
+    unsigned long ledFaults() const { return nLedFaults; }
+
+    /** Id of the first trigger, e.g. to carry on after a reboot. Set
+     *  before start().
+     */
+    void setFirstId(uint64_t id) { nextId = id; }
+
+private:
+    struct Schedule
+    {
+        long long t_start_n;
+        long long period_n;
+        // lock(): t_start_n and period_n on the server clock
+        bool locked;
+        ClockLine line;
+    };
+
+    Peripheral *peripheral;
+    TriggerChannel *channel;
+    pthread_t thread;
+    bool started;
+    std::atomic<bool> running;
+    uint64_t nextId;
+    long long pulseNs;
+    long long prefireNs;
+    long long ledNs;
+    int notifyFd;
+
+    SpscQueue<Schedule, 4> schedules;
+    SpscQueue<TriggerEvent, TRIGGER_EVENTS> events;
+    std::atomic<unsigned long> nOverflows;
+    std::atomic<unsigned long> nLedFaults;
+
+    // Lock state, trigger thread only
+    bool locked;
+    Schedule grid;
+    long long edgeIndex;    // k of the next edge
+    long long phaseNs;
+    long long steppedNs;    // for the next event
+
+    static void *entry(void *arg);
+    void loop();
+    void apply(const Schedule &s, long long *next, long long *period);
+    long long lockedEdge(long long next);
+};
+
+#endif
@@ -0,0 +1,249 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "DS3231.h"
+
+
+#define DS3231_TIME         0x00
+#define DS3231_ALARM1       0x07
+#define DS3231_CONTROL      0x0e
+#define DS3231_STATUS       0x0f
+#define DS3231_TEMP         0x11
+#define DS3231_OSF          0x80
+
+
+// Constructor
+DS3231::DS3231(I2CBus *i2c_bus) 
+{
+	bus = i2c_bus;
+}
+
+
+int DS3231::init() 
+{
+	uint8_t control;
+	if (!bus || !bus->isOpen())
+		return -1;
+	return readControlByte(0, &control);
+}
+
+
+int DS3231::getTime(struct tm *t)
+{
+	uint8_t buf[7];
+	if (readRegisters(DS3231_TIME, buf, 7) == -1)
+		return -1;
+
+	memset(t, 0, sizeof(*t));
+	t->tm_sec = bcdToDec(buf[0] & 0x7f);
+	t->tm_min = bcdToDec(buf[1] & 0x7f);
+	if (buf[2] & 0b01000000) {
+		// 12h mode, bit 5 is PM
+		t->tm_hour = bcdToDec(buf[2] & 0x1f) % 12;
+		if (buf[2] & 0b00100000)
+			t->tm_hour += 12;
+	} else {
+		t->tm_hour = bcdToDec(buf[2] & 0x3f);
+	}
+	t->tm_wday = (buf[3] & 0x07) - 1;
+	t->tm_mday = bcdToDec(buf[4] & 0x3f);
+	t->tm_mon = bcdToDec(buf[5] & 0x1f) - 1;
+	// Century bit covers 2000-2199
+	t->tm_year = bcdToDec(buf[6]) + 100 + ((buf[5] & 0x80) ? 100 : 0);
+	return 0;
+}
+
+
+int DS3231::setTime(const struct tm *t)
+{
+	uint8_t buf[7];
+	int year = t->tm_year - 100;
+	buf[0] = decToBcd(t->tm_sec);
+	buf[1] = decToBcd(t->tm_min);
+	buf[2] = decToBcd(t->tm_hour);     // 24h mode
+	buf[3] = t->tm_wday + 1;
+	buf[4] = decToBcd(t->tm_mday);
+	buf[5] = decToBcd(t->tm_mon + 1) | (year >= 100 ? 0x80 : 0);
+	buf[6] = decToBcd(year % 100);
+	if (writeRegisters(DS3231_TIME, buf, 7) == -1)
+		return -1;
+
+	// The time is good again
+	uint8_t status;
+	if (readControlByte(1, &status) == -1)
+		return -1;
+	return writeControlByte(status & ~DS3231_OSF, 1);
+}
+
+
+int DS3231::getTemperature(float *temperature)
+{
+	uint8_t buf[2];
+	if (readRegisters(DS3231_TEMP, buf, 2) == -1)
+		return -1;
+	*temperature = (int8_t) buf[0] + (buf[1] >> 6) * 0.25f;
+	return 0;
+}
+
+
+int DS3231::oscillatorStopped(bool *stopped)
+{
+	uint8_t status;
+	if (readControlByte(1, &status) == -1)
+		return -1;
+	*stopped = status & DS3231_OSF;
+	return 0;
+}
+
+
+int DS3231::enableSquareWave()
+{
+	uint8_t control;
+	if (readControlByte(0, &control) == -1)
+		return -1;
+	// INTCN off, RS2:RS1 = 00 for 1 Hz
+	control &= ~(0b00011100);
+	return writeControlByte(control, 0);
+}
+
+
+int DS3231::setA1Time(uint8_t A1Day, uint8_t A1Hour, uint8_t A1Minute, 
+                      uint8_t A1Second, uint8_t AlarmBits, bool A1Dy, 
+                      bool A1h12, bool A1PM) 
+{
+	//	Sets the alarm-1 date and time on the DS3231, using A1* information
+	uint8_t temp_buffer;
+	uint8_t buf[4];
+	buf[0] = decToBcd(A1Second) | ((AlarmBits & 0b00000001) << 7);
+	buf[1] = decToBcd(A1Minute) | ((AlarmBits & 0b00000010) << 6);
+	// Figure out A1 hour 
+	if (A1h12) {
+		// Start by converting existing time to h12 if it was given in 24h.
+		if (A1Hour > 12) {
+			// well, then, this obviously isn't a h12 time, is it?
+			A1Hour = A1Hour - 12;
+			A1PM = true;
+		}
+		if (A1PM) {
+			// Afternoon
+			// Convert the hour to BCD and add appropriate flags.
+			temp_buffer = decToBcd(A1Hour) | 0b01100000;
+		} else {
+			// Morning
+			// Convert the hour to BCD and add appropriate flags.
+			temp_buffer = decToBcd(A1Hour) | 0b01000000;
+		}
+	} else {
+		// Now for 24h
+		temp_buffer = decToBcd(A1Hour); 
+	}
+	temp_buffer = temp_buffer | ((AlarmBits & 0b00000100)<<5);
+
+	// A1 hour is figured out, send it
+	buf[2] = temp_buffer;
+	// Figure out A1 day/date and A1M4
+	temp_buffer = ((AlarmBits & 0b00001000)<<4) | decToBcd(A1Day);
+	if (A1Dy) {
+		// Set A1 Day/Date flag (Otherwise it's zero)
+		temp_buffer = temp_buffer | 0b01000000;
+	}
+	buf[3] = temp_buffer;
+
+	return writeRegisters(DS3231_ALARM1, buf, 4);
+}
+
+
+int DS3231::turnOnAlarm(uint8_t Alarm) {
+	// turns on alarm number "Alarm". Defaults to 2 if Alarm is not 1.
+	uint8_t temp_buffer;
+	if (readControlByte(0, &temp_buffer) == -1)
+		return -1;
+	// modify control byte
+	if (Alarm == 1) {
+		temp_buffer = temp_buffer | 0b00000101;
+	} else {
+		temp_buffer = temp_buffer | 0b00000110;
+	}
+	return writeControlByte(temp_buffer, 0);
+}
+
+
+int DS3231::turnOffAlarm(uint8_t Alarm) {
+	// turns off alarm number "Alarm". Defaults to 2 if Alarm is not 1.
+	// Leaves interrupt pin alone.
+	uint8_t temp_buffer;
+	if (readControlByte(0, &temp_buffer) == -1)
+		return -1;
+	// modify control byte
+	if (Alarm == 1) {
+		temp_buffer = temp_buffer & 0b11111110;
+	} else {
+		temp_buffer = temp_buffer & 0b11111101;
+	}
+	return writeControlByte(temp_buffer, 0);
+}
+
+
+int DS3231::checkAlarmEnabled(uint8_t Alarm) {
+	// Checks whether the given alarm is enabled.
+	uint8_t temp_buffer;
+	if (readControlByte(0, &temp_buffer) == -1)
+		return -1;
+	if (Alarm == 1) {
+		return (temp_buffer & 0b00000001) ? 1 : 0;
+	} else {
+		return (temp_buffer & 0b00000010) ? 1 : 0;
+	}
+}
+
+
+/***************************************** 
+	Private Functions
+ *****************************************/
+
+uint8_t DS3231::decToBcd(uint8_t val) {
+// Convert normal decimal numbers to binary coded decimal
+	return ( (val/10*16) + (val%10) );
+}
+
+uint8_t DS3231::bcdToDec(uint8_t val) {
+// Convert binary coded decimal to normal decimal numbers
+	return ( (val/16*10) + (val%16) );
+}
+
+int DS3231::readRegisters(uint8_t reg, uint8_t *buf, size_t len) {
+	// Register pointer and read in one transaction, the DS3231
+	// auto-increments through the block
+	if (bus->writeRead(DS3231_ADDR, &reg, 1, buf, len) == -1)
+	{
+		fprintf(stderr, "Error reading from DS3231\n");
+		return -1;
+	}
+	return 0;
+}
+
+int DS3231::writeRegisters(uint8_t reg, const uint8_t *buf, size_t len) {
+	uint8_t out[16];
+	if (len + 1 > sizeof(out))
+		return -1;
+	out[0] = reg;
+	memcpy(out + 1, buf, len);
+	if (bus->write(DS3231_ADDR, out, len + 1) == -1)
+	{
+		fprintf(stderr, "Error writing to DS3231\n");
+		return -1;
+	}
+	return 0;
+}
+
+int DS3231::readControlByte(bool which, uint8_t *control) {
+	// Read selected control byte
+	// first byte (0) is 0x0e, second (1) is 0x0f
+	return readRegisters(which ? DS3231_STATUS : DS3231_CONTROL, control, 1);
+}
+
+int DS3231::writeControlByte(uint8_t control, bool which) {
+	// Write the selected control byte.
+	// which=false -> 0x0e, true->0x0f.
+	return writeRegisters(which ? DS3231_STATUS : DS3231_CONTROL, &control, 1);
+}
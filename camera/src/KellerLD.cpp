@@ -1,11 +1,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
-#include <fcntl.h>
 #include <unistd.h>
 #include <string.h>
-#include <sys/ioctl.h>
-#include <linux/i2c-dev.h>
 
 #include <cmath>
 
@@ -22,62 +19,55 @@
 #define LD_SCALING2                 0x14
 #define LD_SCALING3                 0x15
 #define LD_SCALING4                 0x16
+#define LD_STATUS_BUSY              0x20
 
 
-KellerLD::KellerLD() 
-{
-	fluidDensity = 1029;
-	bus = 0;
-}
-
-
-KellerLD::KellerLD(int i2c_bus) 
+KellerLD::KellerLD(I2CBus *i2c_bus) 
 {
 	fluidDensity = 1029;
 	bus = i2c_bus;
+	cust_id0 = 63 << 10;
 }
 
 
-void KellerLD::init()
+int KellerLD::init()
 {
-	char buf[16];
+	if (!bus || !bus->isOpen())
+		return -1;
 
-	sprintf(buf, "/dev/i2c-%d", bus);
-	
-	if ((fd = open(buf, O_RDWR)) < 0)
+	// Request memory map information
+	uint16_t scaling0, scaling1, scaling2, scaling3, scaling4;
+	if (readMemoryMap(LD_CUST_ID0, &cust_id0) == -1 ||
+		readMemoryMap(LD_CUST_ID1, &cust_id1) == -1 ||
+		readMemoryMap(LD_SCALING0, &scaling0) == -1 ||
+		readMemoryMap(LD_SCALING1, &scaling1) == -1 ||
+		readMemoryMap(LD_SCALING2, &scaling2) == -1 ||
+		readMemoryMap(LD_SCALING3, &scaling3) == -1 ||
+		readMemoryMap(LD_SCALING4, &scaling4) == -1)
 	{
-		fprintf(stderr, "Failed to open i2c bus /dev/i2c-%d\n", bus);
-		exit(1);
+		cust_id0 = 63 << 10;
+		return -1;
 	}
 
-	// Initialize Keller LD
-	selectDevice(LD_ADDR);
-
-	// Request memory map information
-	cust_id0 = readMemoryMap(LD_CUST_ID0);
-	cust_id1 = readMemoryMap(LD_CUST_ID1);
-
 	code = (uint32_t(cust_id1) << 16) | cust_id0;
 	equipment = cust_id0 >> 10;
 	place = cust_id0 & 0b000000111111111;
 	file = cust_id1;
 
-	uint16_t scaling0;
-	scaling0 = readMemoryMap(LD_SCALING0);
-
 	mode = scaling0 & 0b00000011;
 	year = scaling0 >> 11;
 	month = (scaling0 & 0b0000011110000000) >> 7;
 	day = (scaling0 & 0b0000000001111100) >> 2;
 
-	uint32_t scaling12 = (uint32_t(readMemoryMap(LD_SCALING1)) << 16) | readMemoryMap(LD_SCALING2);
+	uint32_t scaling12 = (uint32_t(scaling1) << 16) | scaling2;
 
 	P_min = *reinterpret_cast<float*>(&scaling12);
 
-	uint32_t scaling34 = (uint32_t(readMemoryMap(LD_SCALING3)) << 16) | readMemoryMap(LD_SCALING4);
+	uint32_t scaling34 = (uint32_t(scaling3) << 16) | scaling4;
 
 	P_max = *reinterpret_cast<float*>(&scaling34);
 
+	return 0;
 }
 
 
@@ -88,76 +78,75 @@ void KellerLD::setFluidDensity(float density) {
 }
 
 
-void KellerLD::readData() {
-	uint8_t status;
-	char buf[6];
+int KellerLD::readData() {
+	if (startConversion() == -1)
+		return -1;
+
+	usleep(LD_CONVERSION_US);
+
+	// Slow conversions take up to 40 ms
+	int ret;
+	for (int i = 0; (ret = collect()) == 0 && i < 40; i++)
+		usleep(1000);
+	return ret == 1 ? 0 : -1;
+}
+
+
+int KellerLD::startConversion() {
+	uint8_t buf[1];
 	buf[0] = LD_REQUEST;
 
-	if ((write(fd, buf, 1)) != 1)
+	if (bus->write(LD_ADDR, buf, 1) == -1)
 	{
 		fprintf(stderr, "Error writing to Keller LD\n");
-		exit(1);
+		return -1;
 	}
+	return 0;
+}
+
 
-	usleep(9000); // Max conversion time per datasheet
+int KellerLD::collect() {
+	uint8_t status;
+	uint8_t buf[6];
 
-	if (read(fd, buf, 5) != 5)
+	if (bus->read(LD_ADDR, buf, 5) == -1)
 	{
 		fprintf(stderr, "Error reading from Keller LD\n");
-		exit(1);
-	}
-	else 
-	{
-		status = buf[0];
-		P = buf[1] << 8 | buf[2];
-		uint16_t T = (buf[3] << 8) | buf[4];
-		P_bar = (float(P)-16384)*(P_max-P_min)/32768 + P_min + 1.01325;
-		T_degc = ((T>>4)-24)*0.05-50;
+		return -1;
 	}
-	
-}
-
-
 
-int KellerLD::selectDevice(uint8_t dev_addr)
-{
-   int s;
-
-    s = ioctl(fd, I2C_SLAVE, dev_addr);
+	status = buf[0];
+	if (status & LD_STATUS_BUSY)
+		return 0;
 
-    if (s == -1)
-    {
-       perror("selectDevice");
-    }
-
-    return s;
+	P = buf[1] << 8 | buf[2];
+	uint16_t T = (buf[3] << 8) | buf[4];
+	P_bar = (float(P)-16384)*(P_max-P_min)/32768 + P_min + 1.01325;
+	T_degc = ((T>>4)-24)*0.05-50;
+	return 1;
 }
 
 
-uint16_t KellerLD::readMemoryMap(uint8_t mtp_address) {
-	char buf[4];
-	uint8_t status;
-	uint16_t memory_map; 
 
-	buf[0] = mtp_address;
-	if ((write(fd, buf, 1)) != 1)
-	{
-		fprintf(stderr, "Error writing to Keller LD\n");
-		exit(1);
-	}
-	usleep(1000);
+int KellerLD::readMemoryMap(uint8_t mtp_address, uint16_t *memory_map) {
+	uint8_t cmd = mtp_address;
+	uint8_t buf[3];
 
-	if (read(fd, buf, 3) != 3)
+	// Command and read in one transaction; the answer is usually ready
+	// at once, otherwise the status is still busy and we read again
+	int ret = bus->writeRead(LD_ADDR, &cmd, 1, buf, 3);
+	for (int i = 0; ret == 0 && (buf[0] & LD_STATUS_BUSY) && i < 10; i++)
 	{
-		fprintf(stderr, "Error reading from Keller LD\n");
-		exit(1);
+		usleep(200);
+		ret = bus->read(LD_ADDR, buf, 3);
 	}
-	else 
+	if (ret == -1 || (buf[0] & LD_STATUS_BUSY))
 	{
-		status = buf[0];
-		memory_map = buf[1] << 8 | buf[2];
+		fprintf(stderr, "Error reading Keller LD memory map 0x%02x\n", mtp_address);
+		return -1;
 	}
-	return memory_map;
+	*memory_map = buf[1] << 8 | buf[2];
+	return 0;
 }
 
 
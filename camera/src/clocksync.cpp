@@ -0,0 +1,193 @@
+#include "clocksync.h"
+#include "synchronization.h"
+
+#include <string.h>
+#include <algorithm>
+
+
+// Expected noise of one offset estimate over WiFi
+#define CLOCK_MEAS_SIGMA_NS 100000.0
+// Offset wander between updates and how fast the crystal may drift
+#define CLOCK_Q_OFFSET 1.0e8
+#define CLOCK_Q_FREQ 100.0
+// Initial frequency uncertainty, 10 ppm
+#define CLOCK_FREQ_SIGMA 10000.0
+
+
+static const struct
+{
+    OffsetEstimator estimator;
+    const char *name;
+} estimator_names[] = {
+    {OffsetEstimator::Mean, "mean"},
+    {OffsetEstimator::MinRtt, "minrtt"},
+    {OffsetEstimator::Median, "median"},
+    {OffsetEstimator::TrimmedMean, "trimmed"},
+};
+
+bool parseOffsetEstimator(const char *name, OffsetEstimator *estimator)
+{
+    for (size_t i = 0; i < sizeof(estimator_names) / sizeof(estimator_names[0]); i++)
+    {
+        if (strcmp(name, estimator_names[i].name) == 0)
+        {
+            *estimator = estimator_names[i].estimator;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *offsetEstimatorName(OffsetEstimator estimator)
+{
+    for (size_t i = 0; i < sizeof(estimator_names) / sizeof(estimator_names[0]); i++)
+    {
+        if (estimator_names[i].estimator == estimator)
+            return estimator_names[i].name;
+    }
+    return "unknown";
+}
+
+
+long long estimateOffset(TpsnSample *samples, size_t n, OffsetEstimator estimator, long long *rtt)
+{
+    if (n == 0)
+        return 0;
+
+    size_t best = 0;
+    for (size_t i = 1; i < n; i++)
+    {
+        if (samples[i].rtt() < samples[best].rtt())
+            best = i;
+    }
+    if (rtt)
+        *rtt = samples[best].rtt();
+
+    auto byOffset = [](const TpsnSample &a, const TpsnSample &b) { return a.offset() < b.offset(); };
+    long long sum = 0;
+    switch (estimator)
+    {
+        case OffsetEstimator::MinRtt:
+            return samples[best].offset();
+        case OffsetEstimator::Median:
+            std::nth_element(samples, samples + n / 2, samples + n, byOffset);
+            return samples[n / 2].offset();
+        case OffsetEstimator::TrimmedMean:
+        {
+            std::sort(samples, samples + n, byOffset);
+            size_t lo = n / 4, hi = n - n / 4;
+            for (size_t i = lo; i < hi; i++)
+                sum += samples[i].offset();
+            return sum / (long long) (hi - lo);
+        }
+        case OffsetEstimator::Mean:
+        default:
+            for (size_t i = 0; i < n; i++)
+                sum += samples[i].offset();
+            return sum / (long long) n;
+    }
+}
+
+
+ClockFilter::ClockFilter()
+{
+    R = CLOCK_MEAS_SIGMA_NS * CLOCK_MEAS_SIGMA_NS;
+    qOffset = CLOCK_Q_OFFSET;
+    qFreq = CLOCK_Q_FREQ;
+    reset();
+}
+
+
+void ClockFilter::reset()
+{
+    initialized = false;
+    t0 = 0;
+    offset = 0;
+    freq = 0;
+    P[0][0] = R;
+    P[0][1] = P[1][0] = 0;
+    P[1][1] = CLOCK_FREQ_SIGMA * CLOCK_FREQ_SIGMA;
+}
+
+
+void ClockFilter::resume(long long t_n, long long offset_n, double freq_ns, double freqVar, double offsetVar)
+{
+    reset();
+    t0 = t_n;
+    offset = offset_n;
+    freq = freq_ns;
+    P[0][0] = offsetVar > 0 ? offsetVar : R;
+    P[1][1] = freqVar;
+    initialized = true;
+}
+
+
+void ClockFilter::holdFrequency(long long t_n, double freq_ns)
+{
+    if (!initialized)
+        return;
+    // Predict to t_n without a correction, the uncertainty only grows
+    double dt = double(t_n - t0) / BILLION;
+    offset += freq * dt;
+    P[0][0] += dt * (P[1][0] + P[0][1]) + dt * dt * P[1][1] + qOffset * dt;
+    P[0][1] += dt * P[1][1];
+    P[1][0] += dt * P[1][1];
+    P[1][1] += qFreq * dt;
+    freq = freq_ns;
+    t0 = t_n;
+}
+
+
+long long ClockFilter::update(long long t_n, long long offset_n)
+{
+    if (!initialized)
+    {
+        reset();
+        t0 = t_n;
+        offset = offset_n;
+        initialized = true;
+        return 0;
+    }
+
+    // Predict to t_n
+    double dt = double(t_n - t0) / BILLION;
+    offset += freq * dt;
+    double p00 = P[0][0] + dt * (P[1][0] + P[0][1]) + dt * dt * P[1][1] + qOffset * dt;
+    double p01 = P[0][1] + dt * P[1][1];
+    double p10 = P[1][0] + dt * P[1][1];
+    double p11 = P[1][1] + qFreq * dt;
+
+    // Correct with the measurement
+    double residual = double(offset_n) - offset;
+    double S = p00 + R;
+    double k0 = p00 / S, k1 = p10 / S;
+    offset += k0 * residual;
+    freq += k1 * residual;
+    P[0][0] = (1 - k0) * p00;
+    P[0][1] = (1 - k0) * p01;
+    P[1][0] = p10 - k1 * p00;
+    P[1][1] = p11 - k1 * p01;
+    t0 = t_n;
+    return (long long) residual;
+}
+
+
+long long ClockFilter::offsetAt(long long t_n) const
+{
+    return (long long) (offset + freq * double(t_n - t0) / BILLION);
+}
+
+
+long long ClockFilter::serverSecond() const
+{
+    return (long long) (double(BILLION) * double(BILLION) / (double(BILLION) + freq));
+}
+
+
+long long ClockFilter::toLocal(long long server_n) const
+{
+    // server = local + offset(local); two rounds are plenty for ppm drifts
+    long long t = server_n - offsetAt(t0);
+    t = server_n - offsetAt(t);
+    return server_n - offsetAt(t);
+}
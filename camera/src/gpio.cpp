@@ -0,0 +1,319 @@
+#include "gpio.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include <wiringPi.h>
+#ifdef HAVE_GPIOD
+#include <gpiod.h>
+#endif
+
+
+static const struct
+{
+    GpioKind kind;
+    const char *name;
+} kind_names[] = {
+    {GpioKind::Mem, "mem"},
+    {GpioKind::Gpiod, "gpiod"},
+    {GpioKind::WiringPi, "wiringpi"},
+};
+
+bool parseGpioKind(const char *name, GpioKind *kind)
+{
+    for (size_t i = 0; i < sizeof(kind_names) / sizeof(kind_names[0]); i++)
+    {
+        if (strcmp(name, kind_names[i].name) == 0)
+        {
+            *kind = kind_names[i].kind;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *gpioKindName(GpioKind kind)
+{
+    for (size_t i = 0; i < sizeof(kind_names) / sizeof(kind_names[0]); i++)
+    {
+        if (kind_names[i].kind == kind)
+            return kind_names[i].name;
+    }
+    return "unknown";
+}
+
+
+// wiringPi pin -> BCM GPIO, as wiringPiSetup() maps them on rev 2 boards
+static const int bcm_pins[] = {
+    17, 18, 27, 22, 23, 24, 25, 4, 2, 3, 8, 7, 10, 9, 11, 14,
+    15, 28, 29, 30, 31, 5, 6, 13, 19, 26, 12, 16, 20, 21, 0, 1
+};
+
+int gpioBcmPin(int pin)
+{
+    if (pin < 0 || pin >= (int) (sizeof(bcm_pins) / sizeof(bcm_pins[0])))
+        return -1;
+    return bcm_pins[pin];
+}
+
+
+/*
+ * The BCM283x/BCM2711 GPIO block through /dev/gpiomem, which needs no
+ * root. GPSET0/GPCLR0 change every pin of a mask in one store and leave
+ * the others alone, so threads driving different pins never race. The
+ * Pi 5 moved its GPIOs to RP1 and has no /dev/gpiomem; use gpiod there.
+ */
+#define GPIO_MEM_DEV "/dev/gpiomem"
+#define GPIO_MEM_SIZE 4096
+// Register offsets in 32 bit words
+#define GPFSEL0 0
+#define GPSET0 7
+#define GPCLR0 10
+#define GPLEV0 13
+#define GPPUD 37            // BCM2835-7 pull up/down
+#define GPPUDCLK0 38
+#define GPPUPPDN0 57        // BCM2711 pull up/down, 2 bits per pin
+#define GPPUPPDN3 60
+// What the unused registers read as on the BCM2835-7
+#define GPIO_MEM_UNUSED 0x6770696f
+
+class MemGpio : public Gpio
+{
+public:
+    ~MemGpio()
+    {
+        if (reg)
+            munmap((void *) reg, GPIO_MEM_SIZE);
+    }
+
+    int open(const int *outputs, int nOutputs, const int *inputs, int nInputs) override
+    {
+        int fd = ::open(GPIO_MEM_DEV, O_RDWR | O_SYNC | O_CLOEXEC);
+        if (fd < 0)
+        {
+            perror("GPIO: " GPIO_MEM_DEV);
+            return -1;
+        }
+        void *mem = mmap(NULL, GPIO_MEM_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (mem == MAP_FAILED)
+        {
+            perror("GPIO: mmap");
+            return -1;
+        }
+        reg = (volatile uint32_t *) mem;
+
+        for (int i = 0; i < nOutputs; i++)
+        {
+            int bcm = gpioBcmPin(outputs[i]);
+            if (bcm < 0)
+                return -1;
+            reg[GPCLR0] = 1u << bcm;
+            setMode(bcm, 1);
+        }
+        for (int i = 0; i < nInputs; i++)
+        {
+            int bcm = gpioBcmPin(inputs[i]);
+            if (bcm < 0)
+                return -1;
+            setMode(bcm, 0);
+            pullUp(bcm);
+        }
+        return 0;
+    }
+
+    uint32_t mask(int pin) const override
+    {
+        int bcm = gpioBcmPin(pin);
+        return bcm < 0 ? 0 : 1u << bcm;
+    }
+
+    void write(uint32_t set, uint32_t clear) override
+    {
+        if (set)
+            reg[GPSET0] = set;
+        if (clear)
+            reg[GPCLR0] = clear;
+    }
+
+    bool read(int pin) override
+    {
+        return (reg[GPLEV0] & mask(pin)) != 0;
+    }
+
+private:
+    volatile uint32_t *reg = nullptr;
+
+    // Three mode bits per pin, ten pins per GPFSEL register
+    void setMode(int bcm, uint32_t mode)
+    {
+        int shift = (bcm % 10) * 3;
+        volatile uint32_t *fsel = &reg[GPFSEL0 + bcm / 10];
+        *fsel = (*fsel & ~(7u << shift)) | (mode << shift);
+    }
+
+    void pullUp(int bcm)
+    {
+        if (reg[GPPUPPDN3] != GPIO_MEM_UNUSED)
+        {
+            int shift = (bcm % 16) * 2;
+            volatile uint32_t *pud = &reg[GPPUPPDN0 + bcm / 16];
+            *pud = (*pud & ~(3u << shift)) | (1u << shift);
+            return;
+        }
+        // The BCM2835 sequence: control, clock it into the pin, release;
+        // 150 cycles between the steps
+        reg[GPPUD] = 2;
+        usleep(10);
+        reg[GPPUDCLK0] = 1u << bcm;
+        usleep(10);
+        reg[GPPUD] = 0;
+        reg[GPPUDCLK0] = 0;
+    }
+};
+
+
+#ifdef HAVE_GPIOD
+/*
+ * libgpiod (v1 API) on the GPIO character device: works on every Pi and
+ * kernel, one ioctl per pin changed
+ */
+class GpiodGpio : public Gpio
+{
+public:
+    ~GpiodGpio()
+    {
+        if (chip)
+            gpiod_chip_close(chip);
+    }
+
+    int open(const int *outputs, int nOutputs, const int *inputs, int nInputs) override
+    {
+        if (nOutputs + nInputs > GPIO_MAX_PINS)
+            return -1;
+        chip = gpiod_chip_open_by_name(GPIO_CHIP);
+        if (chip == nullptr)
+        {
+            perror("GPIO: " GPIO_CHIP);
+            return -1;
+        }
+        for (int i = 0; i < nOutputs + nInputs; i++)
+        {
+            bool out = i < nOutputs;
+            int pin = out ? outputs[i] : inputs[i - nOutputs];
+            int bcm = gpioBcmPin(pin);
+            gpiod_line *line = bcm < 0 ? nullptr : gpiod_chip_get_line(chip, bcm);
+            int err = line == nullptr ? -1
+                : out ? gpiod_line_request_output(line, GPIO_CONSUMER, 0)
+                : gpiod_line_request_input_flags(line, GPIO_CONSUMER, GPIOD_LINE_REQUEST_FLAG_BIAS_PULL_UP);
+            if (err != 0)
+            {
+                fprintf(stderr, "GPIO: cannot claim pin %d\n", pin);
+                return -1;
+            }
+            pins[nLines] = pin;
+            lines[nLines++] = line;
+        }
+        return 0;
+    }
+
+    uint32_t mask(int pin) const override
+    {
+        for (int i = 0; i < nLines; i++)
+        {
+            if (pins[i] == pin)
+                return 1u << i;
+        }
+        return 0;
+    }
+
+    void write(uint32_t set, uint32_t clear) override
+    {
+        for (int i = 0; i < nLines; i++)
+        {
+            if (set & (1u << i))
+                gpiod_line_set_value(lines[i], 1);
+            else if (clear & (1u << i))
+                gpiod_line_set_value(lines[i], 0);
+        }
+    }
+
+    bool read(int pin) override
+    {
+        uint32_t m = mask(pin);
+        return m != 0 && gpiod_line_get_value(lines[__builtin_ctz(m)]) == 1;
+    }
+
+private:
+    gpiod_chip *chip = nullptr;
+    gpiod_line *lines[GPIO_MAX_PINS];
+    int pins[GPIO_MAX_PINS];
+    int nLines = 0;
+};
+#endif
+
+
+/*
+ * wiringPi's digitalWrite, one call per pin
+ */
+class WiringPiGpio : public Gpio
+{
+public:
+    int open(const int *outputs, int nOutputs, const int *inputs, int nInputs) override
+    {
+        if (wiringPiSetup() == -1)
+            return -1;
+        for (int i = 0; i < nOutputs; i++)
+        {
+            pinMode(outputs[i], OUTPUT);
+            digitalWrite(outputs[i], LOW);
+        }
+        for (int i = 0; i < nInputs; i++)
+        {
+            pinMode(inputs[i], INPUT);
+            pullUpDnControl(inputs[i], PUD_UP);
+        }
+        return 0;
+    }
+
+    uint32_t mask(int pin) const override
+    {
+        return pin >= 0 && pin < 32 ? 1u << pin : 0;
+    }
+
+    void write(uint32_t set, uint32_t clear) override
+    {
+        for (; set; set &= set - 1)
+            digitalWrite(__builtin_ctz(set), HIGH);
+        for (; clear; clear &= clear - 1)
+            digitalWrite(__builtin_ctz(clear), LOW);
+    }
+
+    bool read(int pin) override
+    {
+        return digitalRead(pin) == HIGH;
+    }
+};
+
+
+Gpio *makeGpio(GpioKind kind)
+{
+    switch (kind)
+    {
+        case GpioKind::Mem:
+            return new MemGpio();
+        case GpioKind::Gpiod:
+#ifdef HAVE_GPIOD
+            return new GpiodGpio();
+#else
+            fprintf(stderr, "GPIO: built without libgpiod\n");
+            return nullptr;
+#endif
+        case GpioKind::WiringPi:
+            return new WiringPiGpio();
+    }
+    return nullptr;
+}
@@ -0,0 +1,109 @@
+#include "histogram.h"
+
+#include <stdio.h>
+#include <limits.h>
+
+
+Histogram::Histogram(const char *n, long long l, long long w, int b)
+{
+    name = n;
+    lo = l;
+    width = w > 0 ? w : 1;
+    buckets = b > HIST_MAX_BUCKETS ? HIST_MAX_BUCKETS : b;
+    reset();
+}
+
+
+void Histogram::reset()
+{
+    for (int i = 0; i < HIST_MAX_BUCKETS + 2; i++)
+        bins[i].store(0, std::memory_order_relaxed);
+    nCount.store(0, std::memory_order_relaxed);
+    sum.store(0, std::memory_order_relaxed);
+    min.store(LLONG_MAX, std::memory_order_relaxed);
+    max.store(LLONG_MIN, std::memory_order_relaxed);
+}
+
+
+void Histogram::record(long long value)
+{
+    int i;
+    if (value < lo)
+        i = 0;
+    else if (value >= lo + width * buckets)
+        i = buckets + 1;
+    else
+        i = (int) ((value - lo) / width) + 1;
+    bins[i].fetch_add(1, std::memory_order_relaxed);
+    nCount.fetch_add(1, std::memory_order_relaxed);
+    sum.fetch_add(value, std::memory_order_relaxed);
+
+    long long cur = min.load(std::memory_order_relaxed);
+    while (value < cur && !min.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+        ;
+    cur = max.load(std::memory_order_relaxed);
+    while (value > cur && !max.compare_exchange_weak(cur, value, std::memory_order_relaxed))
+        ;
+}
+
+
+// Upper edge of the bucket holding the q-th value
+long long Histogram::percentile(double q) const
+{
+    uint32_t total = count();
+    uint32_t target = (uint32_t) (q * total);
+    uint32_t seen = 0;
+    for (int i = 0; i < buckets + 2; i++)
+    {
+        seen += bins[i].load(std::memory_order_relaxed);
+        if (seen > target)
+        {
+            if (i == 0)
+                return lo;
+            if (i == buckets + 1)
+                return max.load(std::memory_order_relaxed);
+            return lo + width * i;
+        }
+    }
+    return max.load(std::memory_order_relaxed);
+}
+
+
+size_t Histogram::format(char *buf, size_t len) const
+{
+    size_t n = 0;
+    int w;
+    uint32_t total = count();
+
+    if (total == 0)
+    {
+        w = snprintf(buf, len, "%s: no samples\n", name);
+        return w < 0 ? 0 : ((size_t) w < len ? (size_t) w : len);
+    }
+
+    w = snprintf(buf, len, "%s: count %u mean %lld min %lld max %lld p50 %lld p99 %lld p99.9 %lld\n",
+                 name, total, sum.load(std::memory_order_relaxed) / total,
+                 min.load(std::memory_order_relaxed), max.load(std::memory_order_relaxed),
+                 percentile(0.5), percentile(0.99), percentile(0.999));
+    if (w < 0)
+        return 0;
+    n = (size_t) w;
+
+    for (int i = 0; i < buckets + 2 && n < len; i++)
+    {
+        uint32_t c = bins[i].load(std::memory_order_relaxed);
+        if (c == 0)
+            continue;
+        if (i == 0)
+            w = snprintf(buf + n, len - n, "  < %lld: %u\n", lo, c);
+        else if (i == buckets + 1)
+            w = snprintf(buf + n, len - n, "  >= %lld: %u\n", lo + width * buckets, c);
+        else
+            w = snprintf(buf + n, len - n, "  %lld..%lld: %u\n",
+                         lo + width * (i - 1), lo + width * i, c);
+        if (w < 0)
+            break;
+        n += (size_t) w;
+    }
+    return n < len ? n : len;
+}
@@ -0,0 +1,86 @@
+#include "i2cbus.h"
+
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <linux/i2c-dev.h>
+
+
+I2CBus::I2CBus()
+{
+    fd = -1;
+    busNum = -1;
+}
+
+
+I2CBus::~I2CBus()
+{
+    close();
+}
+
+
+int I2CBus::open(int bus)
+{
+    char buf[16];
+    close();
+    snprintf(buf, sizeof(buf), "/dev/i2c-%d", bus);
+    fd = ::open(buf, O_RDWR);
+    if (fd < 0)
+    {
+        fprintf(stderr, "Failed to open i2c bus /dev/i2c-%d\n", bus);
+        return -1;
+    }
+    busNum = bus;
+    return 0;
+}
+
+
+void I2CBus::close()
+{
+    if (fd >= 0)
+        ::close(fd);
+    fd = -1;
+}
+
+
+int I2CBus::transfer(struct i2c_msg *msgs, int n)
+{
+    if (fd < 0 || n < 1 || n > I2C_MAX_MSGS)
+        return -1;
+    struct i2c_rdwr_ioctl_data data;
+    data.msgs = msgs;
+    data.nmsgs = n;
+
+    std::lock_guard<std::mutex> lck(mtx);
+    if (ioctl(fd, I2C_RDWR, &data) != n)
+    {
+        fprintf(stderr, "i2c-%d: transfer to 0x%02x failed\n", busNum, msgs[0].addr);
+        return -1;
+    }
+    return 0;
+}
+
+
+int I2CBus::write(uint16_t addr, const uint8_t *data, size_t len)
+{
+    struct i2c_msg msg = {addr, 0, (uint16_t) len, (uint8_t *) data};
+    return transfer(&msg, 1);
+}
+
+
+int I2CBus::read(uint16_t addr, uint8_t *data, size_t len)
+{
+    struct i2c_msg msg = {addr, I2C_M_RD, (uint16_t) len, data};
+    return transfer(&msg, 1);
+}
+
+
+int I2CBus::writeRead(uint16_t addr, const uint8_t *reg, size_t regLen, uint8_t *data, size_t len)
+{
+    struct i2c_msg msgs[2] = {
+        {addr, 0, (uint16_t) regLen, (uint8_t *) reg},
+        {addr, I2C_M_RD, (uint16_t) len, data},
+    };
+    return transfer(msgs, 2);
+}
@@ -1,40 +1,80 @@
-#include "logger.h"
-
-Logger::Logger()
-{
-    logCount = 0;
-    logFlushCount = 10;
-}
-
-Logger::Logger(uint8_t maxCount)
-{
-    logCount = 0;
-    logFlushCount = maxCount;
-}
-
-void Logger::open(std::string path)
-{
-    logPath = path;
-    logF.open(logPath);
-    logF << std::fixed;
-    logF.precision(2);
-    logF << "Timestamp(ns),RTC,Pressure(mbar),Temperature(C)\n";
-}
-
-void Logger::log(long long t_nsec, std::string t_rtc, float pressure, float temperature)
-{
-    logF << t_nsec << ",";
-    logF << t_rtc << ",";
-    logF << pressure << ",";
-    logF << temperature << "\n";
-    logCount++;
-    if (logCount > logFlushCount)
-    {
-        logF.flush();
-    }
-}
-
-void Logger::close()
-{
-    logF.close();
-}
+#include "logger.h"
+
+Logger::Logger()
+{
+    logCount = 0;
+    logFlushCount = 10;
+    binary = false;
+    writeLatency = NULL;
+}
+
+Logger::Logger(uint8_t maxCount)
+{
+    logCount = 0;
+    logFlushCount = maxCount;
+    binary = false;
+    writeLatency = NULL;
+}
+
+void Logger::open(std::string path)
+{
+    logPath = path;
+    binary = false;
+    logF.open(logPath);
+    logF << std::fixed;
+    logF.precision(2);
+    logF << "Timestamp(ns),RTC,Frame,Pressure(mbar),Temperature(C)\n";
+}
+
+void Logger::openBinary(std::string path, int flushMs)
+{
+    logPath = path;
+    binary = true;
+    if (binLog.open(logPath.c_str(), BINLOG_CAPACITY, flushMs) == -1)
+        std::cerr << "Logger: cannot open " << logPath << std::endl;
+}
+
+void Logger::log(long long t_nsec, const std::string &t_rtc, float pressure, float temperature,
+                 uint64_t frameId)
+{
+    if (binary)
+    {
+        BinLogSensor rec = {pressure, temperature, frameId};
+        binLog.append(BINLOG_SENSOR, t_nsec, &rec, sizeof(rec));
+        return;
+    }
+    logF << t_nsec << ",";
+    logF << t_rtc << ",";
+    logF << frameId << ",";
+    logF << pressure << ",";
+    logF << temperature << "\n";
+    logCount++;
+    if (logCount >= logFlushCount)
+    {
+        auto t0 = std::chrono::steady_clock::now();
+        logF.flush();
+        if (writeLatency)
+            writeLatency->record(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - t0).count());
+        logCount = 0;
+    }
+}
+
+void Logger::close()
+{
+    if (binary)
+        binLog.close();
+    else
+        logF.close();
+}
+
+void Logger::setWriteLatency(LatencyRecorder *rec)
+{
+    writeLatency = rec;
+    binLog.setFlushLatency(rec);
+}
+
+size_t Logger::queued()
+{
+    return binary ? binLog.queued() : 0;
+}
@@ -18,9 +18,11 @@
  * 
  *   4. Synchronize time with the slave camera
  * 
- *   Jobs 1 and 2 are done by a timer interrupt, which toggles
- *   a flag. Inside the main loop, appropriate GPIO pins are
- *   toggled and sensor data is logged on a CSV file.
+ *   Job 1 runs on a SCHED_FIFO thread (TriggerEngine) that only
+ *   toggles the trigger pin. The main loop picks up what it
+ *   triggered and logs it with the sensor data on a CSV file.
+ *   Every thread schedules and pins itself by its role
+ *   (rtthreads.h), so no chrt or taskset is needed around us.
  * 
  *   Jobs 2 happens when the images arrive through the USB, images
  *   are saved along with the timestamp.
@@ -40,77 +42,434 @@
  *   - Time synchronization interval (sec)
  *   - sensor measurement rate (regular) (sec (period))
  *   - Post deployment sensor measurement rate (sec (period))
+ * They come from the mission file (-M, see missionsettings.h), shared
+ * with simple-snapimage; SIGHUP reads it again.
  */
 
 #include <iostream>
 #include <stdexcept>
 #include <string>
+#include <deque>
 #include <stdio.h>
 #include <time.h>
 #include <sys/time.h>
 #include <signal.h>
 #include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/eventfd.h>
+#include <sys/signalfd.h>
 #include "synchronization.h"
 #include "peripheral.h"
 #include "logger.h"
+#include "triggerchannel.h"
+#include "triggerengine.h"
+#include "metrics.h"
+#include "mission.h"
+#include "missionjournal.h"
+#include "statejournal.h"
+#include "missionsettings.h"
+#include "rtthreads.h"
+#include "telemetry.h"
 
 
 
-#define PERIOD 1 
 #define MIN 60
 #define TEN_MIN 600
-#define OFFSET 2 
+// Print trigger lateness every this many triggers
+#define LATENESS_REPORT 60
+// epoll events handled per wake up
+#define MAX_EVENTS 8
+// Longest a trigger waits in the sensor log for a sample after its edge
+#define SENSOR_LOG_WAIT_NS 2000000000LL
 
 Peripheral *peripheral = new Peripheral(1);
 Logger *logger = new Logger();
+// Hands every trigger to the imaging processes
+TriggerChannel triggerChannel;
+TriggerEngine triggerEngine(peripheral, &triggerChannel);
+// The mission file (-M) with the command line options on top, and what
+// the file itself held, to tell which keys a SIGHUP changed
+const char *settingsPath = NULL;
+MissionSettings settings;
+MissionSettings fileSettings;
+// depth_gating: trigger only below a depth, framerate by depth band
+MissionScheduler *scheduler = NULL;
+// Per-trigger timing, to check the jitter of the trigger edge
+FILE *timingLog = NULL;
 
 int count = 0;
-uint8_t fTrig = 0, fSync = 0, fDrift = 0;
-std::string t_rtc;
-timer_t cameraTimerID, syncTimerID, driftTimerID;
+// The main loop sleeps in epoll until one of these is ready: timerfds for
+// sync, drift and the metrics dump, an eventfd the trigger and sampler
+// threads write to, and a signalfd for SIGINT/SIGTERM and SIGHUP.
+int epollFd = -1, eventFd = -1, signalFd = -1;
+int syncTimerFd = -1, driftTimerFd = -1, dumpTimerFd = -1;
 struct timespec now;
 long long T_skew_prev, T_skew_now;
+// Offset and drift against the server, fed by every sync and drift check
+ClockFilter clockFilter;
+// Where the mission stood, so a reboot carries on where it was
+StateJournal journal;
+MissionRecord missionState;
+// CPU, temperature, throttling, queues and write latencies of this run
+// (telemetry_period_s), to tell after recovery what dropped frames
+Telemetry telemetry;
+LatencyRecorder *journalLatency = NULL;
+LatencyRecorder *triggerLateness = NULL;
+// One server second in RTC seconds, learnt while the server answers, to
+// keep the trigger on the server's rate from the RTC when it does not
+double serverPerRtc = 0;
+
+// Add fd to the main loop
+int watch(int fd)
+{
+    struct epoll_event ev;
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epollFd, EPOLL_CTL_ADD, fd, &ev) == -1)
+    {
+        perror("epoll_ctl");
+        return -1;
+    }
+    return 0;
+}
+
+
+// Journal where we are; a failed save only costs the next warm start
+void saveMission()
+{
+    // On the sync thread, so a slow card shows here first
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    int status = journal.save(&missionState);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    if (journalLatency)
+        journalLatency->record(as_nsec(&t1) - as_nsec(&t0));
+    if (status == -1)
+        printf("error saving the mission state\n");
+}
+
+
+// UTC of local time t_n from the RTC, "YYYY-MM-DD HH:MM:SS.mmm", empty
+// without one
+std::string rtcStamp(long long t_n)
+{
+    struct timespec wall;
+    if (!peripheral->rtcClock().wallAt(t_n, &wall))
+        return "";
+    struct tm t;
+    char buf[32];
+    gmtime_r(&wall.tv_sec, &t);
+    size_t n = strftime(buf, sizeof(buf), "%Y-%m-%d %H:%M:%S", &t);
+    snprintf(buf + n, sizeof(buf) - n, ".%03ld", wall.tv_nsec / 1000000);
+    return buf;
+}
+
+
+// After a reboot without network the system clock starts from whenever it
+// was last saved; the RTC kept counting. Like hwclock --hctosys, but only
+// forward, so a clock set by NTP or the server is never undone.
+void setSystemClock()
+{
+    time_t wall;
+    if (!peripheral->rtcClock().ok() || peripheral->rtcClock().readWall(&wall) == -1)
+        return;
+    struct timespec t;
+    clock_gettime(CLOCK_REALTIME, &t);
+    if (wall - t.tv_sec <= 2)
+        return;
+    struct timespec set = {wall, 0};
+    if (clock_settime(CLOCK_REALTIME, &set) == -1)
+        perror("RTC: clock_settime");
+    else
+        printf("System clock set from the RTC, %lld s forward\n", (long long) (wall - t.tv_sec));
+}
 
-void triggerCamera();
 
-static void timer_handler(int sig, siginfo_t *si, void *uc)
+// Learn the server's rate against the RTC after a good update
+void trackRtc()
 {
-    timer_t *tidp;
-    tidp = (timer_t *) si->si_value.sival_ptr;
-    if ( *tidp == cameraTimerID )
+    double rtcSec = peripheral->rtcClock().second();
+    if (rtcSec > 0)
+        serverPerRtc = clockFilter.serverSecond() / rtcSec;
+}
+
+
+// The server did not answer: keep going on the filter's last estimate,
+// with its rate taken over by the RTC if that has been learnt. The RTC
+// follows our crystal where the temperature changes, the estimate does not.
+void holdOver()
+{
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    double rtcSec = peripheral->rtcClock().second();
+    if (serverPerRtc > 0 && rtcSec > 0)
     {
-		//auto start = std::chrono::steady_clock::now();
-        triggerCamera();
-        //fTrig = 1;
-		//auto finish = std::chrono::steady_clock::now();
-		//std::cout << "Handler: ";
-		//std::cout << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << std::endl;
+        double serverSec = serverPerRtc * rtcSec;
+        clockFilter.holdFrequency(as_nsec(&now), double(BILLION) * BILLION / serverSec - BILLION);
+        printf("holding over on the RTC, %.1f ppm\n", clockFilter.frequency() / 1000);
     }
-    else if ( *tidp == syncTimerID )
+    else
+        printf("holding over on the last estimate\n");
+}
+
+
+// Sensor log lines of the triggers since the last call. A trigger waits
+// for the first sample after its edge, so its pressure and temperature are
+// interpolated instead of extrapolated. flush: log the rest as they are.
+void logSensor(const TriggerEvent *ev, bool flush)
+{
+    static std::deque<TriggerEvent> pending;
+    if (ev)
+        pending.push_back(*ev);
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long t_now = as_nsec(&now);
+    long long t_sample = peripheral->sensorTimeline().newest();
+    while (!pending.empty())
     {
-        fSync = 1;
+        const TriggerEvent &p = pending.front();
+        if (!flush && peripheral->hasSensor() && t_sample < p.t_edge_n &&
+            t_now - p.t_edge_n < SENSOR_LOG_WAIT_NS)
+            break;
+        SensorSample sample;
+        float pressure = p.pressure, temperature = p.temperature;
+        if (peripheral->sampleAt(p.t_edge_n, &sample))
+        {
+            pressure = sample.pressure;
+            temperature = sample.temperature;
+        }
+        logger->log(p.t_edge_n, rtcStamp(p.t_edge_n), pressure, temperature, p.id);
+        pending.pop_front();
     }
-    else if ( *tidp == driftTimerID )
+}
+
+
+// Log what the trigger thread did since the last call
+void logTriggers(bool flush = false)
+{
+    static long long latenessSum = 0, latenessMax = 0;
+    static int latenessCount = 0;
+    static bool ledFault = false;
+    TriggerEvent ev;
+    while (triggerEngine.pop(&ev))
     {
-        fDrift = 1;
+        logSensor(&ev, false);
+        if (timingLog)
+            fprintf(timingLog, "%llu,%lld,%lld,%lld,%lld,%lld,%d,%u,%lld\n", (unsigned long long) ev.id,
+                    ev.t_sched_n, ev.t_edge_n, ev.lateness_n, ev.pulse_n, ev.led_n,
+                    ev.ledFault, ev.missed, ev.phase_n);
+        if (ev.missed)
+            printf("Trigger %llu: missed %u edges\n", (unsigned long long) ev.id, ev.missed);
+        if (ev.stepped_n)
+            printf("Trigger %llu: %lld us off the server, stepped\n", (unsigned long long) ev.id,
+                   ev.stepped_n / 1000);
+        // Only report changes, a failed LED would otherwise print every edge
+        if (ev.ledFault != ledFault)
+        {
+            printf("Trigger %llu: LED fault %s (%lu so far)\n", (unsigned long long) ev.id,
+                   ev.ledFault ? "raised" : "cleared", triggerEngine.ledFaults());
+            ledFault = ev.ledFault;
+        }
+        count++;
+        missionState.nextTriggerId = ev.id + 1;
+        if (ev.id % MISSION_SAVE_TRIGGERS == 0)
+            saveMission();
+
+        if (triggerLateness)
+            triggerLateness->record(ev.lateness_n);
+        latenessSum += ev.lateness_n;
+        if (ev.lateness_n > latenessMax)
+            latenessMax = ev.lateness_n;
+        if (++latenessCount == LATENESS_REPORT)
+        {
+            printf("Trigger lateness over %d: mean %lld us, max %lld us\n", latenessCount,
+                   latenessSum / latenessCount / 1000, latenessMax / 1000);
+            if (timingLog)
+                fflush(timingLog);
+            latenessSum = latenessMax = 0;
+            latenessCount = 0;
+        }
     }
+    // A new sample alone may let waiting triggers go
+    logSensor(NULL, flush);
 }
 
 
-void triggerCamera()
+// Local time of the first server trigger edge (counted from the server's
+// start time in its announced period) at least a period away, trimmed
+// like synchronize() does
+long long nextServerEdge(const struct timeinfo *TI)
 {
-    // trigger camera
-    peripheral->triggerOn();
-    // Save timestamp, depth and temperature, frame id
+    long long period = TI->T_server_period_n > 0 ? TI->T_server_period_n : BILLION;
     clock_gettime(CLOCK_MONOTONIC, &now);
-	long long now_n = as_nsec(&now);
-	//now_n += T_skew_now;
-	t_rtc = "abc";
-	t_rtc.pop_back();
-	logger->log(now_n, t_rtc, 0.f, 0.f); //peripheral->getPressure(),  peripheral->getTemperature());
-	peripheral->triggerOff();
-	count++;
-	//std::cout<<"TICK" << std::endl;
+    long long t = as_nsec(&now);
+    long long k = (t + clockFilter.offsetAt(t) - TI->T_server_start_n) / period + 2;
+    return clockFilter.toLocal(TI->T_server_start_n + k*period) + 1000000;
+}
+
+
+// Trigger period on the server's clock for the current mission state, 0
+// while at the surface
+long long triggerPeriod()
+{
+    if (!scheduler)
+        return (long long) (BILLION / settings.framerate);
+    if (!scheduler->capturing())
+        return 0;
+    return (long long) (BILLION / scheduler->framerate());
+}
+
+
+// Trigger on the server's edges as the clock filter now maps them. The
+// trigger thread slews onto every new estimate instead of starting a new
+// schedule, which would step the phase and skip or double an edge.
+void lockTrigger(const struct timeinfo *TI)
+{
+    // 1 ms after the server's edge, as synchronize() puts the start
+    triggerEngine.lock(TI->T_server_start_n + 1000000, triggerPeriod(), clockFilter.line());
+}
+
+
+// Sync and drift timers fire this far after a trigger edge, so that they
+// never compete with it
+long long timerOffset(long long server_sec)
+{
+    return server_sec * settings.timer_offset_ms / 1000;
+}
+
+
+// Surface mode: no triggers, LEDs off, sensor sampled just often enough
+// to notice the dive
+void applyMissionState()
+{
+    if (scheduler->capturing())
+    {
+        printf("Mission: capturing at %.2f fps (band %d)\n", scheduler->framerate(),
+               scheduler->currentBand());
+        peripheral->ledEnable(true);
+        peripheral->setSampleRate(settings.sample_rate_hz);
+    }
+    else
+    {
+        printf("Mission: at the surface, triggering stopped\n");
+        peripheral->ledEnable(false);
+        peripheral->setSampleRate(settings.surface_sample_rate_hz);
+    }
+}
+
+
+// "depth:fps,depth:fps"
+int parseBands(const std::string &arg, std::vector<DepthBand> *bands)
+{
+    for (const std::string &tok : splitList(arg))
+    {
+        DepthBand band;
+        if (sscanf(tok.c_str(), "%f:%f", &band.depth, &band.fps) != 2 || band.fps <= 0)
+            return -1;
+        bands->push_back(band);
+    }
+    return 0;
+}
+
+
+// "prefire_us:width_us", width 0 turns the strobe off
+int parseStrobe(const char *arg, double *prefire_us, double *width_us)
+{
+    if (sscanf(arg, "%lf:%lf", prefire_us, width_us) != 2 || *prefire_us < 0 || *width_us < 0)
+        return -1;
+    return 0;
+}
+
+
+// Depth gating part of the mission settings
+MissionConfig missionConfigOf(const MissionSettings &s)
+{
+    MissionConfig config;
+    config.startDepth = (float) s.start_depth;
+    config.hysteresis = (float) s.hysteresis;
+    config.confirm = s.confirm;
+    parseBands(s.bands, &config.bands);
+    return config;
+}
+
+
+// The names only minions knows, on top of what loadMissionSettings() checks
+bool checkSettings(const MissionSettings &s, std::string *error)
+{
+    OffsetEstimator estimator;
+    GpioKind gpioKind;
+    std::vector<DepthBand> bands;
+    if (!parseOffsetEstimator(s.sync_estimator.c_str(), &estimator))
+        *error = "sync_estimator is one of mean, minrtt, median, trimmed";
+    else if (!parseGpioKind(s.gpio.c_str(), &gpioKind))
+        *error = "gpio is one of mem, gpiod, wiringpi";
+    else if (parseBands(s.bands, &bands) == -1)
+        *error = "bands are depth:fps[,depth:fps...]";
+    else
+        return true;
+    return false;
+}
+
+
+// Settings that may change while running, at start and after a SIGHUP
+void applyRuntimeSettings()
+{
+    OffsetEstimator estimator = OffsetEstimator::MinRtt;
+    parseOffsetEstimator(settings.sync_estimator.c_str(), &estimator);
+    sync_set_estimator(estimator);
+    sync_set_rounds(settings.sync_rounds);
+    static int timestamping = -1;
+    // Switching reconnects, so only on a change
+    if (timestamping != (int) settings.kernel_timestamps)
+    {
+        sync_set_timestamping(settings.kernel_timestamps);
+        timestamping = settings.kernel_timestamps;
+    }
+}
+
+
+// SIGHUP: read the mission file again. False if nothing could change.
+bool reloadSettings()
+{
+    if (settingsPath == NULL)
+    {
+        printf("SIGHUP without a mission file (-M), nothing to reload\n");
+        return false;
+    }
+    MissionSettings next = settings, nextFile = fileSettings;
+    std::vector<std::string> restart;
+    std::string error;
+    if (reloadMissionSettings(settingsPath, &nextFile, &next, &restart, &error) == -1 ||
+        !checkSettings(next, &error))
+    {
+        printf("Mission file not reloaded: %s\n", error.c_str());
+        return false;
+    }
+    for (const std::string &key : restart)
+        printf("Mission file: %s only changes on a restart\n", key.c_str());
+    settings = next;
+    fileSettings = nextFile;
+    applyRuntimeSettings();
+
+    // A gated mission needs the pressure sensor, like at start
+    if (settings.depth_gating && peripheral->hasSensor())
+    {
+        if (scheduler)
+            scheduler->reconfigure(missionConfigOf(settings));
+        else
+            scheduler = new MissionScheduler(missionConfigOf(settings));
+        applyMissionState();
+    }
+    else
+    {
+        delete scheduler;
+        scheduler = NULL;
+        peripheral->ledEnable(true);
+        peripheral->setSampleRate(settings.sample_rate_hz);
+    }
+    printf("Mission file %s reloaded\n", settingsPath);
+    return true;
 }
 
 
@@ -121,80 +480,263 @@ void setup()
         printf("error connecting to peripherals\n");
         return;
     }
-    // CSV setup
-    std::string logName="changeme.csv";
-    logger->open(logName);
+    setSystemClock();
+    if (peripheral->startRtc() == -1)
+        printf("no RTC, no wall clock in the log and no holdover reference\n");
+    if (peripheral->startSampler(settings.sample_rate_hz) == -1)
+    {
+        printf("no pressure sensor, logging zero pressure\n");
+        if (scheduler)
+        {
+            printf("depth gating needs the pressure sensor, capturing all the time\n");
+            delete scheduler;
+            scheduler = NULL;
+        }
+    }
+    if (scheduler)
+        applyMissionState();
+    // CSV setup, one set of logs per run so a restart never truncates
+    std::string run = std::to_string(missionState.run);
+    if (settings.telemetry_period_s > 0)
+    {
+        logger->setWriteLatency(telemetry.addLatency("log_write"));
+        journalLatency = telemetry.addLatency("journal");
+        triggerLateness = telemetry.addLatency("trig_late");
+        telemetry.addGauge("log_queue", []{ return (long long) logger->queued(); });
+        telemetry.addGauge("trig_overflow", []{ return (long long) triggerEngine.overflows(); });
+        telemetry.addGauge("led_faults", []{ return (long long) triggerEngine.ledFaults(); });
+        if (telemetry.start(("telemetry_" + run + ".bin").c_str(), settings.telemetry_period_s) == -1)
+            printf("error opening the telemetry log\n");
+    }
+    if (settings.binary_log)
+    {
+        logger->openBinary("changeme_" + run + ".bin", settings.log_flush_ms);
+    }
+    else
+    {
+        std::string logName="changeme_" + run + ".csv";
+        logger->open(logName);
+    }
+    // Not fatal, the imaging side then numbers frames on its own
+    if (triggerChannel.create() == -1)
+        printf("error creating trigger channel\n");
+    // What this run went with, file and options, as a mission file
+    FILE *used = fopen(("mission_" + run + ".conf").c_str(), "w");
+    if (used)
+    {
+        printMissionSettings(used, settings);
+        fclose(used);
+    }
+    timingLog = fopen(("trigger_timing_" + run + ".csv").c_str(), "w");
+    if (timingLog)
+        fprintf(timingLog, "Trigger,Scheduled(ns),Edge(ns),Lateness(ns),Pulse(ns),Led(ns),LedFault,Missed,Phase(ns)\n");
 
 }
 
 
-int makeTimer(std::string name, timer_t *timerID, struct timespec *T_start, int it_sec, int it_nsec)
+int makeTimer(std::string name, int *timerFd, struct timespec *T_start, int it_sec, int it_nsec)
 {
-    // varaibles
-    struct sigaction act;
-    struct sigevent te;
     struct itimerspec tim_spec = {.it_interval= {.tv_sec=it_sec,.tv_nsec=it_nsec},
                     .it_value = *T_start};
 	std::cout << "ST: " << T_start->tv_sec << ", " << T_start->tv_nsec << std::endl;
 	std::cout << "IT: " << it_sec << ", " << it_nsec << std::endl;
-    // Signals 
-    act.sa_flags = SA_SIGINFO | SA_RESTART;
-    act.sa_sigaction = &timer_handler;
-    sigemptyset(&act.sa_mask);
 
-    if (sigaction(SIGALRM, &act, NULL) == -1)
+    *timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (*timerFd == -1)
     {
-        fprintf(stderr, "Minions: Failed to setup signal handling for %s.\n", name);
+        fprintf(stderr, "Minions: Failed to create %s.\n", name.c_str());
         return -1;
     }
-
-    // Timer setup
-    te.sigev_notify = SIGEV_SIGNAL;
-    te.sigev_signo = SIGALRM;
-    te.sigev_value.sival_ptr = timerID;
-    if (timer_create(CLOCK_MONOTONIC, &te, timerID))
+    if (timerfd_settime(*timerFd, TFD_TIMER_ABSTIME, &tim_spec, NULL))
     {
-        perror("timer_create");
+        perror("timerfd_settime"); 
         return -1;
     }
-    
-    if (timer_settime(*timerID, TIMER_ABSTIME, &tim_spec, NULL))
-    {
-        perror("timer_settime"); 
-        return -1;
-    }
-    return 0;
-
+    return watch(*timerFd);
 }
 
-void resetTimer(timer_t *timerID, struct timespec *T_start, long long t_nsec)
+void resetTimer(int timerFd, struct timespec *T_start, long long t_nsec)
 {
     int it_sec = (int) (t_nsec / BILLION);
     int it_nsec = (int) (t_nsec % BILLION);
     struct itimerspec tim_spec = {.it_interval= {.tv_sec=it_sec,.tv_nsec=it_nsec},
                     .it_value = *T_start};
-    if (timer_settime(*timerID, TIMER_ABSTIME, &tim_spec, NULL))
-        perror("timer_settime"); 
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &tim_spec, NULL))
+        perror("timerfd_settime"); 
+}
+
+// Event sources that exist before any thread starts. The signal mask is
+// inherited, so SIGINT/SIGTERM and SIGHUP only ever arrive through signalFd.
+int setupEvents()
+{
+    epollFd = epoll_create1(EPOLL_CLOEXEC);
+    eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGHUP);
+    if (epollFd == -1 || eventFd == -1 || sigprocmask(SIG_BLOCK, &mask, NULL) == -1)
+    {
+        perror("event setup");
+        return -1;
+    }
+    signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signalFd == -1 || watch(eventFd) == -1 || watch(signalFd) == -1)
+        return -1;
+    triggerEngine.setNotify(eventFd);
+    peripheral->setNotify(eventFd);
+    return 0;
 }
 
 int main(int argc, char* argv[])
 {
     long long T_trig_n, T_sync_n, T_drift_n;
-    int trig_period = PERIOD, drift_period = 61, sync_period = 301;
     int status;
     struct timespec T_trig, T_sync, T_drift;
     long long server_sec = BILLION;
-    // TODO: What to do if power goes off intermittently and reboots in the 
-    // mean time? Wait until connect to server and re-initiate
+    int opt;
+    const char *optstring = "M:bf:p:d:B:s:kl:g:N:";
+    int readyFd = -1;
+    // The mission file first, whatever the order: options override it
+    opterr = 0;
+    while ((opt = getopt(argc, argv, optstring)) != -1)
+        if (opt == 'M')
+            settingsPath = optarg;
+    opterr = 1;
+    optind = 1;
+    std::string error;
+    if (settingsPath && loadMissionSettings(settingsPath, &fileSettings, &error) == -1)
+    {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+    settings = fileSettings;
+    while ((opt = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (opt)
+        {
+            case 'M':
+                break;
+            case 'b':
+                settings.binary_log = true;
+                break;
+            case 'f':
+                settings.log_flush_ms = atoi(optarg);
+                break;
+            case 'p':
+                settings.sample_rate_hz = atoi(optarg);
+                break;
+            case 'd':
+                settings.start_depth = atof(optarg);
+                settings.depth_gating = true;
+                break;
+            case 'B':
+                settings.bands = optarg;
+                settings.depth_gating = true;
+                break;
+            case 's':
+                settings.sync_estimator = optarg;
+                break;
+            case 'k':
+                settings.kernel_timestamps = true;
+                break;
+            case 'l':
+                if (parseStrobe(optarg, &settings.strobe_prefire_us, &settings.strobe_width_us) == -1)
+                {
+                    printf("strobe is prefire_us:width_us\n");
+                    return 1;
+                }
+                break;
+            case 'g':
+                settings.gpio = optarg;
+                break;
+            case 'N':
+                readyFd = atoi(optarg);
+                break;
+            default:
+                printf("usage: minions [-M mission file] [-b] [-f flush ms] [-p sample Hz] [-d start depth m]\n"
+                       "               [-B depth:fps[,depth:fps...]] [-s skew estimator] [-k]\n"
+                       "               [-l prefire_us:width_us] [-g gpio backend] [-N ready fd]\n");
+                return 1;
+        }
+    }
+    if (!checkSettings(settings, &error))
+    {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+    if (settingsPath)
+        printf("Mission file: %s\n", settingsPath);
+    // Before any thread starts: they inherit the locked stack size, and
+    // this thread's role, until they take their own
+    setThreadLayout(threadLayoutOf(settings));
+    lockMemory();
+    setThreadRole(ThreadRole::Sync);
+    if (settings.depth_gating)
+        scheduler = new MissionScheduler(missionConfigOf(settings));
+    sync_set_server(settings.server_ip.c_str(), settings.server_port);
+    applyRuntimeSettings();
+    printf("Skew estimator: %s, %d rounds\n", settings.sync_estimator.c_str(), settings.sync_rounds);
+    GpioKind gpioKind = GpioKind::Mem;
+    parseGpioKind(settings.gpio.c_str(), &gpioKind);
+    peripheral->setGpio(gpioKind);
+    PeripheralPins pins;
+    pins.trig = settings.trig_pin;
+    pins.led = settings.led_pin;
+    pins.ledEn = settings.led_en_pin;
+    pins.ledFault = settings.led_fault_pin;
+    pins.ledFaultLevel = settings.led_fault_level;
+    pins.rtcSqw = settings.rtc_sqw_pin;
+    peripheral->setPins(pins);
+    peripheral->setI2cBus(settings.i2c_bus);
+    peripheral->setRtc(settings.rtc);
+    if (setupEvents() == -1)
+    {
+        printf("error setting up the event loop\n");
+        exit(1);
+    }
+    // Power may go off and the Pi reboot in the middle of a mission: carry
+    // on from the journal instead of starting over
+    bool resumed = false;
+    if (journal.open(MISSION_JOURNAL_PATH, sizeof(missionState)) == 0)
+        resumed = journal.load(&missionState);
+    if (!resumed)
+        memset(&missionState, 0, sizeof(missionState));
+    missionState.run++;
+    printf("Mission run %u%s\n", missionState.run, resumed ? ", resuming" : "");
+    // Ids of the last run may have been handed out after its last save
+    if (resumed)
+        triggerEngine.setFirstId(missionState.nextTriggerId + MISSION_SAVE_TRIGGERS);
     setup();
+    printf("GPIO: %s\n", gpioKindName(peripheral->gpioUsed()));
     // 1. synchronize the time to that of the server, and make sure
     // we start triggering at the same time.
+    // A resumed mission keeps the server's trigger schedule and the drift
+    // learnt so far: one skew measurement is enough, and without the
+    // server the offset is held over from CLOCK_REALTIME. Only a new
+    // mission asks the server for a start time.
     struct timeinfo TI = {.T_skew_n = 0, .T_start_n = 0};
-    if (synchronize(&TI, 1) == -1) 
+    if (resumed && (missionState.flags & MISSION_SYNCED))
     {
-        printf("Sychronization error\n");
-        exit(1);
+        bool measured = get_skew(&TI) == 0;
+        if (!measured)
+            printf("No server, holding over the saved clock offset\n");
+        missionRestoreSync(missionState, measured, &clockFilter, &TI);
+        server_sec = clockFilter.serverSecond();
+        TI.T_start_n = nextServerEdge(&TI);
     }
+    else
+    {
+        if (synchronize(&TI, 1) == -1) 
+        {
+            printf("Sychronization error\n");
+            exit(1);
+        }
+        clockFilter.update(TI.T_meas_n, TI.T_skew_n);
+    }
+    missionSaveSync(&missionState, clockFilter, &TI);
+    saveMission();
     // 2. Setup trigger, drift and sychronization timer
     //  Do sync and drift timer 250ms after every second so that no
     //  conflict happens
@@ -203,8 +745,18 @@ int main(int argc, char* argv[])
     as_timespec(TI.T_start_n, &T_trig);
 	std::cout << T_trig.tv_nsec << std::endl;
     //int status = clock_gettime(CLOCK_REALTIME, &T_trig);
-    status = makeTimer("Trigger Timer", &cameraTimerID, &T_trig, PERIOD, 0);
+    triggerEngine.setStrobe((long long) (settings.strobe_prefire_us * 1000),
+                            (long long) (settings.strobe_width_us * 1000));
+    if (settings.strobe_width_us > 0)
+        printf("LED strobe: %.0f us before the edge for %.0f us\n", settings.strobe_prefire_us,
+               settings.strobe_width_us);
+    // Paused until locked onto the server's grid, which starts at its first
+    // edge after now: TI.T_start_n
+    status = triggerEngine.start(TI.T_start_n, 0);
+    lockTrigger(&TI);
     printf("status: %d\n", status);
+    // Synchronized and triggering, whoever started us may go on
+    notifyReady(readyFd);
 
     T_trig_n = TI.T_start_n;
     T_skew_now = TI.T_skew_n;
@@ -212,31 +764,90 @@ int main(int argc, char* argv[])
 
 
     // Drift
-    T_drift_n = T_trig_n + drift_period*server_sec + server_sec/OFFSET;
+    // Periods and the offset from the trigger edge are read whenever a
+    // timer is set again, so a reload takes effect from the next one on
+    T_drift_n = T_trig_n + settings.drift_period_s*server_sec + timerOffset(server_sec);
     as_timespec(T_drift_n, &T_drift);
-    status = makeTimer("Drift Timer", &driftTimerID, &T_drift, 0, 0); //MIN, server_sec/4);
+    status = makeTimer("Drift Timer", &driftTimerFd, &T_drift, 0, 0); //MIN, server_sec/4);
     printf("status: %d\n", status);
 
     // Synchronization
-    T_sync_n = T_trig_n + sync_period*server_sec + server_sec/OFFSET;
+    T_sync_n = T_trig_n + settings.sync_period_s*server_sec + timerOffset(server_sec);
     std::cout<< T_sync_n << std::endl;
     as_timespec(T_sync_n, &T_sync);
-    status = makeTimer("Sync Timer", &syncTimerID, &T_sync, 0, 0); //TEN_MIN, server_sec/4);
+    status = makeTimer("Sync Timer", &syncTimerFd, &T_sync, 0, 0); //TEN_MIN, server_sec/4);
     T_sync_n = T_trig_n;
     printf("status: %d\n", status);
+    // Timing histograms, replaced in place every so often
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    struct timespec T_dump = {.tv_sec = now.tv_sec + METRICS_DUMP_SEC, .tv_nsec = now.tv_nsec};
+    status = makeTimer("Metrics Timer", &dumpTimerFd, &T_dump, METRICS_DUMP_SEC, 0);
+    printf("status: %d\n", status);
     printf("Start loopin\n"); 
 
 
-    // Routine for timer handling
-    while (1)
+    // Routine for event handling: nothing runs until an event is ready
+    struct epoll_event events[MAX_EVENTS];
+    bool running = true;
+    while (running)
     {
-        // Log upon triggering
-/*        if (fTrig)
+        int n = epoll_wait(epollFd, events, MAX_EVENTS, -1);
+        if (n == -1)
         {
-            //peripheral->readData();
-            fTrig = 0;
-            //std::cout << "tick" << std::endl;
-        }*/
+            if (errno == EINTR)
+                continue;
+            perror("epoll_wait");
+            break;
+        }
+        bool fSync = false, fDrift = false, fEvents = false, fDump = false, fReload = false;
+        for (int i = 0; i < n; i++)
+        {
+            int fd = events[i].data.fd;
+            if (fd == signalFd)
+            {
+                struct signalfd_siginfo si;
+                if (read(fd, &si, sizeof(si)) != sizeof(si))
+                    continue;
+                if (si.ssi_signo == SIGHUP)
+                {
+                    fReload = true;
+                }
+                else
+                {
+                    printf("Signal %u, stopping\n", si.ssi_signo);
+                    running = false;
+                }
+                continue;
+            }
+            // timerfd expirations or the eventfd counter, either way 8 bytes
+            uint64_t ticks;
+            if (read(fd, &ticks, sizeof(ticks)) != sizeof(ticks))
+                continue;
+            fSync |= fd == syncTimerFd;
+            fDrift |= fd == driftTimerFd;
+            fEvents |= fd == eventFd;
+            fDump |= fd == dumpTimerFd;
+        }
+
+        if (fEvents)
+        {
+            // Log upon triggering
+            logTriggers();
+
+            // Depth decides whether and how fast we trigger
+            SensorSample sample;
+            if (scheduler && peripheral->latestSample(&sample) && scheduler->update(sample.depth))
+            {
+                applyMissionState();
+                lockTrigger(&TI);
+            }
+        }
+
+        if (fReload && reloadSettings())
+            lockTrigger(&TI);
+
+        if (fDump && metrics.dump() == -1)
+            perror("metrics dump");
 
         // set time for 10 min synchronization
         if (fSync)
@@ -260,9 +871,19 @@ int main(int argc, char* argv[])
 			std::cout << temp ;*/
             if (synchronize(&TI, 0) == -1) 
             {
-                printf("Sychronization error\n");
-                exit(1);
-            }            
+                // Underwater the server is out of reach: keep the schedule
+                printf("Sychronization error, ");
+                holdOver();
+                TI.T_start_n = nextServerEdge(&TI);
+            }
+            else
+            {
+                metrics.syncResidual.record(clockFilter.update(TI.T_meas_n, TI.T_skew_n));
+                trackRtc();
+            }
+            server_sec = clockFilter.serverSecond();
+            missionSaveSync(&missionState, clockFilter, &TI);
+            saveMission();
 			/*clock_gettime(CLOCK_REALTIME, &now);
 			temp = as_nsec(&now);
 			std::cout << ", " << temp;*/
@@ -270,21 +891,18 @@ int main(int argc, char* argv[])
 //			auto finish = std::chrono::steady_clock::now();
 //			std::cout << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << std::endl;
 			//TI.T_start_n += server_sec;// * PERIOD;
-            as_timespec(TI.T_start_n, &T_trig);
-            resetTimer(&cameraTimerID, &T_trig, server_sec*PERIOD);
-			T_trig_n = TI.T_start_n;
+            lockTrigger(&TI);
 		//	std::cout << ", "<< TI.T_start_n-temp << std::endl;
             count = 0; // THis doesn't make sense?
 
-            T_drift_n = TI.T_start_n + (drift_period * server_sec) + server_sec/OFFSET;
+            T_drift_n = TI.T_start_n + (settings.drift_period_s * server_sec) + timerOffset(server_sec);
             as_timespec(T_drift_n, &T_drift);
-            resetTimer(&driftTimerID, &T_drift, 0);
+            resetTimer(driftTimerFd, &T_drift, 0);
 
             T_sync_n = TI.T_start_n;
             // resetTimer(&driftTimerID, &T_start, server_sec*MIN+(server_sec/4));
 
             T_skew_now = TI.T_skew_n;
-            fSync = 0;
         }
 
         // set time for 1 min drift computation
@@ -296,11 +914,12 @@ int main(int argc, char* argv[])
 			//clock_gettime(CLOCK_REALTIME, &now);
 			/*long long temp = as_nsec(&now);
 			std::cout << temp ;*/
-            if (get_skew(&TI) == -1) 
+            bool measured = get_skew(&TI) == 0;
+            if (!measured)
             {
-                printf("skew error\n");
-                exit(1);
-            }                       
+                printf("skew error, ");
+                holdOver();
+            }
 			// do something
 			/*clock_gettime(CLOCK_REALTIME, &now);
 			temp = as_nsec(&now);
@@ -309,35 +928,44 @@ int main(int argc, char* argv[])
 //			std::cout << std::chrono::duration_cast<std::chrono::microseconds>(finish - start).count() << std::endl;
 			T_skew_now = TI.T_skew_n;
 
-            // T_diff is skew difference over a minute that could be locally
-            // compensated assuming no change in Temperature over 10 minutes
-            // Instead of setting trigger to 1second, we adjust to what is
-            // "1 second in server".
-            // We also adjust the T_start to the next second that the trigger
-            // will start so that the timer is triggered properly.
-			double server_period = double((T_skew_now - T_skew_prev)/drift_period + BILLION);
-			server_sec = (long long) (double(BILLION)*(double(BILLION) / server_period));
-			T_trig_n += (drift_period+1) * server_sec;
-			//std::cout << ", "<< T_trig_n << std::endl;
+            // The clock filter tracks offset and drift over every skew we
+            // measured, so one noisy measurement no longer sets the trigger
+            // period for the next minute. Instead of setting trigger to
+            // 1 second, we adjust to what is "1 second in server", and put
+            // the next trigger on the local time of a server second edge.
+            if (measured)
+            {
+                metrics.syncResidual.record(clockFilter.update(TI.T_meas_n, T_skew_now));
+                trackRtc();
+            }
+			server_sec = clockFilter.serverSecond();
+			metrics.driftCorrection.record(server_sec - BILLION);
+            missionSaveSync(&missionState, clockFilter, &TI);
+            saveMission();
             count = 0;
-            as_timespec(T_trig_n, &T_trig);
-            resetTimer(&cameraTimerID, &T_trig, server_sec*PERIOD);
+            lockTrigger(&TI);
 
             // T_drift_n = T_drift_n + drift_period * server_sec;
             // as_timespec(T_drift_n, &T_drift);
             // resetTimer(&syncTimerID, &T_drift, 0);
 
             // reset synchronization time with new server second
-            T_sync_n = T_sync_n + sync_period * server_sec + server_sec/OFFSET;
+            T_sync_n = T_sync_n + settings.sync_period_s * server_sec + timerOffset(server_sec);
             as_timespec(T_sync_n, &T_sync);
-            resetTimer(&syncTimerID, &T_sync, 0);
-
-            fDrift = 0;
+            resetTimer(syncTimerFd, &T_sync, 0);
         }
-		// sleep for 1ms
-		usleep(100000);
     }
+    triggerEngine.stop();
+    peripheral->stopSampler();
+    peripheral->stopRtc();
+    logTriggers(true);
+    saveMission();
+    journal.close();
+    metrics.dump();
+    telemetry.stop();
     logger->close();
+    if (timingLog)
+        fclose(timingLog);
     // Done Data Acquisition
     // Programmed data acquisition duration elapsed
     //  - Regularly measure depth and temperature until powered off.
@@ -0,0 +1,44 @@
+#include "metrics.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+Metrics metrics;
+
+
+Metrics::Metrics()
+    : triggerDelay("trigger_delay_ns", 0, 5000, 200),          // 0 - 1 ms in 5 us
+      pulseWidth("pulse_width_ns", 0, 10000, 200),             // 0 - 2 ms in 10 us
+      ledWidth("led_width_ns", 0, 10000, 200),                 // 0 - 2 ms in 10 us
+      syncRtt("sync_rtt_ns", 0, 250000, 200),                  // 0 - 50 ms in 250 us
+      driftCorrection("drift_correction_ns", -100000, 1000, 200), // +-100 us/s in 1 us
+      syncResidual("sync_residual_ns", -1000000, 10000, 200),   // +-1 ms in 10 us
+      triggerPhase("trigger_phase_ns", -1000000, 10000, 200)    // +-1 ms in 10 us
+{
+}
+
+
+int Metrics::dump(const char *path)
+{
+    // Worst case is every bucket of every histogram filled
+    static char buf[7 * (HIST_MAX_BUCKETS + 3) * 48];
+    char tmp[256];
+    size_t n = 0;
+    const Histogram *all[] = {&triggerDelay, &pulseWidth, &ledWidth, &syncRtt, &driftCorrection, &syncResidual,
+                              &triggerPhase};
+
+    for (const Histogram *h : all)
+        n += h->format(buf + n, sizeof(buf) - n);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    int fd = open(tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    ssize_t w = write(fd, buf, n);
+    close(fd);
+    if (w != (ssize_t) n)
+        return -1;
+    return rename(tmp, path);
+}
@@ -0,0 +1,88 @@
+#include "mission.h"
+
+#include <algorithm>
+
+
+MissionScheduler::MissionScheduler(const MissionConfig &c)
+    : config(c)
+{
+    normalize();
+    band = -1;
+    pending = -1;
+    pendingCount = 0;
+}
+
+
+void MissionScheduler::reconfigure(const MissionConfig &c)
+{
+    config = c;
+    normalize();
+    if (band >= (int) config.bands.size())
+        band = (int) config.bands.size() - 1;
+    pending = -1;
+    pendingCount = 0;
+}
+
+
+void MissionScheduler::normalize()
+{
+    if (config.bands.empty())
+        config.bands.push_back(DepthBand{config.startDepth, 1.f});
+    std::sort(config.bands.begin(), config.bands.end(),
+              [](const DepthBand &a, const DepthBand &b) { return a.depth < b.depth; });
+    if (config.confirm < 1)
+        config.confirm = 1;
+}
+
+
+// Band the depth asks for, given where we are now
+int MissionScheduler::target(float depth) const
+{
+    int n = (int) config.bands.size();
+    int t = band;
+
+    if (t < 0)
+    {
+        if (depth < config.startDepth)
+            return -1;
+        t = 0;
+    }
+    else if (depth < config.startDepth - config.hysteresis)
+    {
+        return -1;
+    }
+
+    while (t + 1 < n && depth >= config.bands[t + 1].depth)
+        t++;
+    while (t > 0 && depth < config.bands[t].depth - config.hysteresis)
+        t--;
+    return t;
+}
+
+
+bool MissionScheduler::update(float depth)
+{
+    int t = target(depth);
+    if (t == band)
+    {
+        pendingCount = 0;
+        return false;
+    }
+    if (t != pending)
+    {
+        pending = t;
+        pendingCount = 0;
+    }
+    if (++pendingCount < config.confirm)
+        return false;
+
+    band = t;
+    pendingCount = 0;
+    return true;
+}
+
+
+float MissionScheduler::framerate() const
+{
+    return band < 0 ? 0.f : config.bands[band].fps;
+}
@@ -0,0 +1,47 @@
+#include "missionjournal.h"
+
+#include <time.h>
+
+
+static long long clock_nsec(clockid_t clk)
+{
+    struct timespec t;
+    clock_gettime(clk, &t);
+    return (long long) t.tv_sec * BILLION + t.tv_nsec;
+}
+
+
+void missionSaveSync(MissionRecord *rec, const ClockFilter &filter, const struct timeinfo *TI)
+{
+    long long t_mono = clock_nsec(CLOCK_MONOTONIC);
+    long long t_real = clock_nsec(CLOCK_REALTIME);
+    // server - realtime = (server - monotonic) + (monotonic - realtime)
+    rec->offsetRealtimeN = filter.offsetAt(t_mono) + (t_mono - t_real);
+    rec->realtimeN = t_real;
+    rec->freq = filter.frequency();
+    rec->freqVar = filter.frequencyVariance();
+    rec->serverStartN = TI->T_server_start_n;
+    rec->serverPeriodN = TI->T_server_period_n;
+    rec->flags |= MISSION_SYNCED;
+}
+
+
+void missionRestoreSync(const MissionRecord &rec, bool measured, ClockFilter *filter, struct timeinfo *TI)
+{
+    TI->T_server_start_n = rec.serverStartN;
+    TI->T_server_period_n = rec.serverPeriodN;
+    if (measured)
+    {
+        filter->resume(TI->T_meas_n, TI->T_skew_n, rec.freq, rec.freqVar, 0);
+        return;
+    }
+
+    long long t_mono = clock_nsec(CLOCK_MONOTONIC);
+    long long t_real = clock_nsec(CLOCK_REALTIME);
+    double down_s = double(t_real - rec.realtimeN) / BILLION;
+    long long offset = rec.offsetRealtimeN + (long long) (rec.freq * down_s) + (t_real - t_mono);
+    double sigma = MISSION_REALTIME_DRIFT_NS * (down_s > 0 ? down_s : 0);
+    filter->resume(t_mono, offset, rec.freq, rec.freqVar, sigma * sigma);
+    TI->T_skew_n = offset;
+    TI->T_meas_n = t_mono;
+}
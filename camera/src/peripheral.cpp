@@ -1,89 +1,232 @@
-#include "peripheral.h"
-#include <iostream>
-
-#include <wiringPi.h>
-
-
-Peripheral::Peripheral(){}
-
-
-Peripheral::Peripheral(int bus)
-{
-    i2c_bus = bus;
-}
-
-int Peripheral::init()
-{
-    // WiringPI and GPIO
-    setupPi();
-    //k_sensor_init();
-}
-
-void Peripheral::k_sensor_init()
-{
-    k_sensor = new KellerLD(i2c_bus);
-    k_sensor->init();
-    if (k_sensor->isInitialized())
-    {
-        std::cout << "Sensor isInitialized\n" << std::endl;
-    }
-    else
-    {
-        std::cout << "Sensor NOT connected\n" << std::endl;
-    }
-}
-
-void Peripheral::setupPi()
-{
-    wiringPiSetup();
-
-    pinMode(LED_FAULT_PIN, INPUT);
-
-    pinMode(LED_PIN, OUTPUT);
-    pinMode(TRIG_PIN, OUTPUT);
-    pinMode(LED_EN_PIN, OUTPUT);
-    digitalWrite(LED_EN_PIN, HIGH);
-}
-
-
-void Peripheral::triggerOn() 
-{
-    digitalWrite(TRIG_PIN, HIGH);
-}
-
-
-void Peripheral::triggerOff()
-{
-    digitalWrite(TRIG_PIN, LOW);
-}
-
-
-void Peripheral::ledOn()
-{
-    digitalWrite(LED_PIN, HIGH);
-}
-
-
-void Peripheral::ledOff()
-{
-    digitalWrite(LED_PIN, LOW);
-}
-
-
-void Peripheral::readData()
-{
-    k_sensor->readData();
-}
-
-
-float Peripheral::getPressure()
-{
-    return k_sensor->pressure();
-}
-
-
-float Peripheral::getTemperature()
-{
-    return k_sensor->temperature();
-}
-
+#include "peripheral.h"
+#include <iostream>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "rtthreads.h"
+
+#define BILLION 1000000000LL
+
+
+Peripheral::Peripheral(){}
+
+
+Peripheral::Peripheral(int bus)
+{
+    i2c_bus = bus;
+}
+
+int Peripheral::init()
+{
+    // GPIO pins
+    setupPi();
+    // Without the sensor we still trigger, but log zero pressure
+    k_sensor_init();
+    // Without the RTC there is no holdover reference and no wall clock
+    rtc_init();
+    return 0;
+}
+
+int Peripheral::k_sensor_init()
+{
+    if (!bus.isOpen() && bus.open(i2c_bus) == -1)
+    {
+        sensorOk = false;
+        return -1;
+    }
+    k_sensor = new KellerLD(&bus);
+    if (k_sensor->init() == 0 && k_sensor->isInitialized())
+    {
+        std::cout << "Sensor isInitialized\n" << std::endl;
+        sensorOk = true;
+        return 0;
+    }
+    std::cout << "Sensor NOT connected\n" << std::endl;
+    sensorOk = false;
+    return -1;
+}
+
+int Peripheral::rtc_init()
+{
+    if (!rtcWanted || (!bus.isOpen() && bus.open(i2c_bus) == -1))
+        return -1;
+    if (rtc.init(gpio, pins.rtcSqw) == -1)
+    {
+        std::cout << "RTC NOT connected\n" << std::endl;
+        return -1;
+    }
+    std::cout << "RTC isInitialized" << (pins.rtcSqw >= 0 ? ", SQW" : "") << "\n" << std::endl;
+    return 0;
+}
+
+void Peripheral::setupPi()
+{
+    const int outputs[] = {pins.led, pins.trig, pins.ledEn};
+    const int inputs[] = {pins.ledFault, pins.rtcSqw};
+    const int nOut = sizeof(outputs) / sizeof(outputs[0]);
+    // The SQW input only where it is wired
+    const int nIn = pins.rtcSqw >= 0 ? 2 : 1;
+
+    gpio = makeGpio(gpioKind);
+    if (gpio == nullptr || gpio->open(outputs, nOut, inputs, nIn) == -1)
+    {
+        fprintf(stderr, "GPIO: %s not available, falling back to wiringPi\n", gpioKindName(gpioKind));
+        delete gpio;
+        gpioKind = GpioKind::WiringPi;
+        gpio = makeGpio(gpioKind);
+        gpio->open(outputs, nOut, inputs, nIn);
+    }
+    trigMask = gpio->mask(pins.trig);
+    ledMask = gpio->mask(pins.led);
+    ledEnMask = gpio->mask(pins.ledEn);
+    gpio->write(ledEnMask, 0);
+}
+
+
+void Peripheral::triggerOn(bool led)
+{
+    gpio->write(led ? trigMask | ledMask : trigMask, 0);
+}
+
+
+void Peripheral::triggerOff()
+{
+    gpio->write(0, trigMask);
+}
+
+
+void Peripheral::ledOn()
+{
+    gpio->write(ledMask, 0);
+}
+
+
+void Peripheral::ledOff()
+{
+    gpio->write(0, ledMask);
+}
+
+
+bool Peripheral::ledFault()
+{
+    return (int) gpio->read(pins.ledFault) == pins.ledFaultLevel;
+}
+
+
+void Peripheral::ledEnable(bool on)
+{
+    gpio->write(on ? ledEnMask : 0, on ? 0 : ledEnMask);
+}
+
+
+static long long now_nsec()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * BILLION + t.tv_nsec;
+}
+
+
+// Blocking read, for use without the sampler thread
+void Peripheral::readData()
+{
+    if (!sensorOk || k_sensor->readData() == -1)
+        return;
+    SensorSample s = {now_nsec(), k_sensor->pressure(), k_sensor->temperature(), k_sensor->depth()};
+    timeline.push(s);
+}
+
+
+float Peripheral::getPressure()
+{
+    SensorSample s;
+    return latestSample(&s) ? s.pressure : 0.f;
+}
+
+
+float Peripheral::getTemperature()
+{
+    SensorSample s;
+    return latestSample(&s) ? s.temperature : 0.f;
+}
+
+
+bool Peripheral::latestSample(SensorSample *s) const
+{
+    return timeline.latest(s);
+}
+
+
+int Peripheral::startSampler(int rateHz)
+{
+    if (!sensorOk)
+        return -1;
+    if (sampling)
+        return 0;
+    setSampleRate(rateHz);
+    sampling = true;
+    sampler = std::thread(&Peripheral::samplerLoop, this);
+    return 0;
+}
+
+
+void Peripheral::stopSampler()
+{
+    if (!sampling)
+        return;
+    sampling = false;
+    sampler.join();
+}
+
+
+void Peripheral::setSampleRate(int rateHz)
+{
+    sampleRateHz = rateHz > 0 ? rateHz : SAMPLE_RATE_HZ;
+}
+
+
+void Peripheral::samplerLoop()
+{
+    long long next = now_nsec();
+    unsigned long errors = 0;
+    struct timespec ts;
+    setThreadRole(ThreadRole::Sensor);
+
+    while (sampling)
+    {
+        int ret = k_sensor->startConversion();
+        if (ret == 0)
+        {
+            usleep(LD_CONVERSION_US);
+            // Slow conversions take up to 40 ms
+            for (int i = 0; (ret = k_sensor->collect()) == 0 && i < 40; i++)
+                usleep(1000);
+        }
+        if (ret == 1)
+        {
+            SensorSample s = {now_nsec(), k_sensor->pressure(), k_sensor->temperature(),
+                              k_sensor->depth()};
+            timeline.push(s);
+            if (notifyFd >= 0)
+            {
+                uint64_t one = 1;
+                ssize_t w = write(notifyFd, &one, sizeof(one));
+                (void) w;
+            }
+        }
+        else if (++errors == 1 || errors % 100 == 0)
+        {
+            fprintf(stderr, "Peripheral: pressure sample failed (%lu so far)\n", errors);
+        }
+
+        next += BILLION / sampleRateHz;
+        long long now = now_nsec();
+        if (next < now)
+            next = now;
+        ts.tv_sec = next / BILLION;
+        ts.tv_nsec = next % BILLION;
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
@@ -0,0 +1,268 @@
+#include "rtcclock.h"
+
+#include <stdio.h>
+#include <math.h>
+
+#include "rtthreads.h"
+
+#define BILLION 1000000000LL
+
+
+static long long now_nsec()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * BILLION + t.tv_nsec;
+}
+
+
+static void sleep_until(long long t_n)
+{
+    struct timespec t = {(time_t) (t_n / BILLION), (long) (t_n % BILLION)};
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+        ;
+}
+
+
+RtcClock::RtcClock(I2CBus *bus)
+    : rtc(bus), gpio(nullptr), sqwPin(-1), initialized(false), running(false), nEdges(0)
+{
+}
+
+
+RtcClock::~RtcClock()
+{
+    stop();
+}
+
+
+int RtcClock::init(Gpio *g, int pin)
+{
+    bool stopped = true;
+    if (rtc.init() == -1 || rtc.oscillatorStopped(&stopped) == -1)
+        return -1;
+    if (stopped)
+    {
+        // Lost power at some point: the count runs again, but from a wrong time
+        fprintf(stderr, "RTC: oscillator stopped, time not trusted until set\n");
+        return -1;
+    }
+    gpio = g;
+    sqwPin = pin;
+    if (sqwPin >= 0 && (gpio == nullptr || rtc.enableSquareWave() == -1))
+        sqwPin = -1;
+    initialized = true;
+    return 0;
+}
+
+
+int RtcClock::readWall(time_t *wall)
+{
+    struct tm t;
+    if (rtc.getTime(&t) == -1)
+        return -1;
+    // Kept in UTC
+    *wall = timegm(&t);
+    return 0;
+}
+
+
+int RtcClock::start()
+{
+    if (!initialized)
+        return -1;
+    if (running)
+        return 0;
+    running = true;
+    thread = std::thread(&RtcClock::loop, this);
+    return 0;
+}
+
+
+void RtcClock::stop()
+{
+    if (!running)
+        return;
+    running = false;
+    thread.join();
+}
+
+
+bool RtcClock::wallAt(long long t_n, struct timespec *wall) const
+{
+    RtcFit f;
+    if (!fit.load(&f) || f.edges == 0)
+        return false;
+    double sec = f.second_n > 0 ? f.second_n : (double) BILLION;
+    double s = double(t_n - f.t_ref_n) / sec;
+    double whole = floor(s);
+    wall->tv_sec = (time_t) (f.wall_ref_s + (long long) whole);
+    wall->tv_nsec = (long) ((s - whole) * BILLION);
+    return true;
+}
+
+
+double RtcClock::second() const
+{
+    RtcFit f;
+    return fit.load(&f) && f.edges >= RTC_FIT_EDGES ? f.second_n : 0;
+}
+
+
+// Local time of the next second edge, searched from a little before
+// expected (0: not locked yet, search the next second and a half, at
+// RTC_POLL_SEARCH_NS on SQW). -1 if it did not show up.
+int RtcClock::waitEdge(long long expected, long long *t_edge)
+{
+    long long from = expected ? expected - RTC_EDGE_GUARD_NS : now_nsec();
+    long long until = expected ? expected + RTC_EDGE_GUARD_NS : from + 3 * BILLION / 2;
+    sleep_until(from);
+
+    if (sqwPin >= 0)
+    {
+        // Falling edge of SQW
+        long long poll = expected ? RTC_POLL_SQW_NS : RTC_POLL_SEARCH_NS;
+        long long t_prev = now_nsec();
+        bool prev = gpio->read(sqwPin);
+        for (long long t = t_prev; t < until; t_prev = t)
+        {
+            sleep_until(t + poll);
+            t = now_nsec();
+            bool level = gpio->read(sqwPin);
+            if (prev && !level)
+            {
+                *t_edge = (t_prev + t) / 2;
+                return 0;
+            }
+            prev = level;
+        }
+        return -1;
+    }
+
+    // Seconds register rolling over, each read is a bus transaction
+    struct tm tm;
+    long long t_prev = now_nsec();
+    if (rtc.getTime(&tm) == -1)
+        return -1;
+    int sec = tm.tm_sec;
+    for (long long t = t_prev; t < until; t_prev = t)
+    {
+        sleep_until(t + RTC_POLL_REG_NS);
+        t = now_nsec();
+        if (rtc.getTime(&tm) == -1)
+            return -1;
+        if (tm.tm_sec != sec)
+        {
+            *t_edge = (t_prev + t) / 2;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+
+// Least squares line through the edges of the last RTC_FIT_EDGES seconds
+void RtcClock::addEdge(long long t_edge, long long wall)
+{
+    edgeTimes[nEdges % RTC_FIT_EDGES] = t_edge;
+    edgeWalls[nEdges % RTC_FIT_EDGES] = wall;
+    nEdges++;
+    int n = nEdges < RTC_FIT_EDGES ? nEdges : RTC_FIT_EDGES;
+
+    RtcFit f = {t_edge, wall, 0, n};
+    if (n >= 2)
+    {
+        // Relative to the newest edge, so the sums stay small
+        double sx = 0, sy = 0, sxx = 0, sxy = 0;
+        for (int i = 0; i < n; i++)
+        {
+            double x = double(edgeWalls[i] - wall);
+            double y = double(edgeTimes[i] - t_edge);
+            sx += x;
+            sy += y;
+            sxx += x * x;
+            sxy += x * y;
+        }
+        double d = n * sxx - sx * sx;
+        if (d > 0)
+        {
+            f.second_n = (n * sxy - sx * sy) / d;
+            // The fitted line at the newest edge, not the noisy edge itself
+            f.t_ref_n = t_edge + (long long) ((sy - f.second_n * sx) / n);
+        }
+    }
+    fit.store(f);
+}
+
+
+void RtcClock::loop()
+{
+    // The edge is timestamped by when this thread gets to run
+    setThreadRole(ThreadRole::Sensor);
+    long long expected = 0;
+    long long wall = 0;
+    int sinceRead = RTC_READ_SEC;
+    int errors = 0;
+    while (running)
+    {
+        long long t_edge;
+        bool searched = expected == 0;
+        bool failed = waitEdge(expected, &t_edge) == -1;
+        if (!failed && (wall == 0 || sinceRead >= RTC_READ_SEC))
+        {
+            // Right after the edge, so this is the second that just began
+            time_t w;
+            if (readWall(&w) == 0)
+            {
+                if (wall != 0 && w != wall + 1)
+                {
+                    fprintf(stderr, "RTC: expected %lld, read %lld, starting over\n",
+                            wall + 1, (long long) w);
+                    nEdges = 0;
+                }
+                wall = w;
+                sinceRead = 0;
+            }
+            else if (wall != 0)
+                wall++;
+            else
+                failed = true;
+        }
+        else if (!failed)
+            wall++;
+        if (failed)
+        {
+            // Missed the edge or the bus failed: find the next one from
+            // scratch. How many seconds went by is unknown, so the wall
+            // second is read again rather than counted on.
+            expected = 0;
+            wall = 0;
+            if (++errors >= RTC_MAX_ERRORS)
+            {
+                fprintf(stderr, "RTC: %d second edges missed in a row, giving up on it\n", errors);
+                RtcFit none = {0, 0, 0, 0};
+                fit.store(none);
+                initialized = false;
+                return;
+            }
+            // A failed bus fails again at once: do not spin at this
+            // priority, nor keep the bus the pressure sensor shares busy
+            sleep_until(now_nsec() + RTC_RETRY_NS);
+            continue;
+        }
+        errors = 0;
+        sinceRead++;
+        if (searched)
+        {
+            // Only placed to RTC_POLL_SEARCH_NS: lock onto the next edge
+            // and count from there. A skipped second would break the count
+            nEdges = 0;
+            expected = t_edge + BILLION;
+            continue;
+        }
+        addEdge(t_edge, wall);
+        RtcFit f;
+        double sec = fit.load(&f) ? f.second_n : 0;
+        expected = t_edge + (long long) (sec > 0 ? sec : BILLION);
+    }
+}
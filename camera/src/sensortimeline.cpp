@@ -0,0 +1,88 @@
+#include "sensortimeline.h"
+
+
+static SensorSample lerp(const SensorSample &a, const SensorSample &b, long long t_n)
+{
+    double f = b.t_nsec == a.t_nsec ? 0 : double(t_n - a.t_nsec) / double(b.t_nsec - a.t_nsec);
+    SensorSample s;
+    s.t_nsec = t_n;
+    s.pressure = (float) (a.pressure + f * (b.pressure - a.pressure));
+    s.temperature = (float) (a.temperature + f * (b.temperature - a.temperature));
+    s.depth = (float) (a.depth + f * (b.depth - a.depth));
+    return s;
+}
+
+
+void SensorTimeline::push(const SensorSample &s)
+{
+    uint64_t n = count.load(std::memory_order_relaxed);
+    Entry e = {n, s};
+    slots[n % SENSOR_TIMELINE_SLOTS].store(e);
+    count.store(n + 1, std::memory_order_release);
+}
+
+
+bool SensorTimeline::read(uint64_t i, SensorSample *out) const
+{
+    Entry e;
+    if (!slots[i % SENSOR_TIMELINE_SLOTS].load(&e) || e.index != i)
+        return false;
+    *out = e.sample;
+    return true;
+}
+
+
+bool SensorTimeline::latest(SensorSample *out) const
+{
+    uint64_t n = samples();
+    return n > 0 && read(n - 1, out);
+}
+
+
+long long SensorTimeline::newest() const
+{
+    SensorSample s;
+    return latest(&s) ? s.t_nsec : 0;
+}
+
+
+bool SensorTimeline::at(long long t_n, SensorSample *out) const
+{
+    uint64_t n = samples();
+    if (n == 0)
+        return false;
+    // Leave the slot the writer may be filling next alone
+    uint64_t oldest = n > SENSOR_TIMELINE_SLOTS - 1 ? n - (SENSOR_TIMELINE_SLOTS - 1) : 0;
+
+    SensorSample newer, older;
+    if (!read(n - 1, &newer))
+        return false;
+    if (t_n >= newer.t_nsec)
+    {
+        // Usually a trigger right now: extrapolate, but never further than
+        // the last two samples are apart, so noise is not amplified
+        if (n < 2 || !read(n - 2, &older) || t_n - newer.t_nsec > newer.t_nsec - older.t_nsec)
+        {
+            *out = newer;
+            out->t_nsec = t_n;
+            return true;
+        }
+        *out = lerp(older, newer, t_n);
+        return true;
+    }
+    // Newest first: queries are nearly always about the last few samples
+    for (uint64_t i = n - 1; i-- > oldest; )
+    {
+        // Only if the writer went round the whole ring meanwhile
+        if (!read(i, &older))
+            return false;
+        if (older.t_nsec <= t_n)
+        {
+            *out = lerp(older, newer, t_n);
+            return true;
+        }
+        newer = older;
+    }
+    *out = newer;
+    return true;
+}
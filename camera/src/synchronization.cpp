@@ -1,194 +1,436 @@
-#include <stdlib.h>
-#include <iostream>
-#include "synchronization.h"
-
-
-long long as_nsec(struct timespec *T)
-{
-    return ((long long) T->tv_sec) * BILLION + (long long) T->tv_nsec;
-}
-
-long long bytes_to_nsec(char *buffer)
-{
-    time_t sec = (buffer[3] << 24) | (buffer[2] << 16) | (buffer[1] << 8) | buffer[0];  
-    int nsec = (buffer[7] << 24) | (buffer[6] << 16) | (buffer[5] << 8) | buffer[4];
-    return ((long long) sec) * BILLION + (long long) nsec;
-}
-
-void as_timespec(long long t, struct timespec *T)
-{
-    T->tv_sec = (long) (t / BILLION);
-    T->tv_nsec = (long) (t % BILLION);
-    return;
-}
-
-long long get_TPSN_data(int sock)
-{
-    int valread;
-    char buffer[16] = {0}; 
-
-    struct timespec T1 = {.tv_sec = 0, .tv_nsec = 0};
-    struct timespec T4 = {.tv_sec = 0, .tv_nsec = 0};
-    long long T1n, T2n, T3n, T4n;
-    long long T_skew_n = 0;
-    for (int i = 0; i < NUM_AVG; i++) {
-        clock_gettime(CLOCK_MONOTONIC, &T1);
-        // convert time_t to byte array
-        char *T1_arr = (char *) &T1; // RPI is 32-bit so time_t is 32bit long
-        send(sock, T1_arr, 8, 0); 
-        valread = read( sock , buffer, 16);
-        if (valread != 16)
-        {
-            std::cout << valread << std::endl;
-            printf("getting T3 and T4 from server failed\n");
-            return -1;
-        }
-        // Timestamp T4
-        clock_gettime(CLOCK_MONOTONIC, &T4);
-        // Receive T2 and T3
-        T2n = bytes_to_nsec(buffer);
-        T3n = bytes_to_nsec(buffer+8);
-        //time_t T3_sec_i = (buffer[11] << 24) | (buffer[10] << 16) | (buffer[9] << 8) | buffer[8];  
-        //int T3_nsec_i = (buffer[15] << 24) | (buffer[14] << 16) | (buffer[13] << 8) | buffer[12];
-        //struct timespec T2 = {.tv_sec = T2_sec_i, .tv_nsec=T2_nsec_i};
-        //T3.tv_sec = T3_sec_i;
-        //T3.tv_nsec = T3_nsec_i;
-        T1n = as_nsec(&T1);
-        //T2n = as_nsec(&T2);
-        //T3n = as_nsec(&T3);
-        T4n = as_nsec(&T4);
-        T_skew_n += ((T2n - T1n) - (T4n - T3n));
-    }
-    // compute average time skew
-    T_skew_n /= (NUM_AVG * 2);
-    return T_skew_n;
-}
-
-int synchronize(struct timeinfo *TI, uint8_t isFirst)
-{
-    int sock = 0; 
-    struct sockaddr_in serv_addr; 
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
-    { 
-        printf("\n Socket creation error \n"); 
-        return -1; 
-    } 
-   
-    serv_addr.sin_family = AF_INET; 
-    serv_addr.sin_port = htons(PORT); 
-       
-    // Convert IPv4 and IPv6 addresses from text to binary form 
-    if(inet_pton(AF_INET, SERVER_IP, &serv_addr.sin_addr)<=0)  
-    { 
-        printf("\nInvalid address/ Address not supported \n"); 
-        return -1; 
-    } 
-   
-
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) 
-    { 
-        printf("\nConnection Failed \n"); 
-        return -1; 
-    } 
-
-
-    char timeData[8];
-    char status_buf[8] = {0};
-    char ones[8] = {0xFF};
-    char buffer[16] = {0}; 
-
-    struct timespec T_start;
-    struct timespec T_skew;
-    long long T_skew_n = get_TPSN_data(sock);
-    as_timespec(T_skew_n, &T_skew);
-    printf("%lld skew: %d.%d\n", T_skew_n, T_skew.tv_sec, T_skew.tv_nsec);
-
-    // Ping the server to about start time
-    int start = 0, valread;
-    long long temp_n=0, T_start_n = 0;
-    while (!start)
-    {
-        usleep(10);
-        send(sock, status_buf, 8, 0);
-        valread = read(sock, buffer, 16);
-        if (valread == 0 && status_buf[4] == 1)
-        {
-            // the server has moved onto timer, so we will break
-            break;
-        }
-        temp_n = bytes_to_nsec(buffer);
-        //printf("%lld\n", temp_n);
-        if (temp_n > 1)
-        {
-            T_start_n = temp_n;
-            if (isFirst) status_buf[4] = 1;
-        }
-        start = (temp_n == 1) || !isFirst;
-    }
-    close(sock);
-    
-//    printf("start: %lld\n", T_start_n);
-    T_start_n -= T_skew_n;
-    TI->T_skew_n = T_skew_n;
-    TI->T_start_n = T_start_n + 1000000;
-    //struct timespec T_delay = {.tv_sec = 5, .tv_nsec = 0};
-    //long long T_delay_n = as_nsec(&T_delay);
-    //long long T_start_n = T3n - T_skew_n + T_delay_n;
-    // as_timespec(T_start_n, &T_start);
-}
-
-// TODO: FIgure out
-
-int get_skew(struct timeinfo* TI)
-{
-    int sock = 0; 
-    struct sockaddr_in serv_addr; 
-    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
-    { 
-        printf("\n Socket creation error \n"); 
-        return -1; 
-    } 
-   
-    serv_addr.sin_family = AF_INET; 
-    serv_addr.sin_port = htons(PORT); 
-       
-    // Convert IPv4 and IPv6 addresses from text to binary form 
-    if(inet_pton(AF_INET, SERVER_IP, &serv_addr.sin_addr)<=0)  
-    { 
-        printf("\nInvalid address/ Address not supported \n"); 
-        return -1; 
-    } 
-
-    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) 
-    { 
-        printf("\nConnection Failed \n"); 
-        return -1; 
-    }
-    
-
-    // Compute the skew upon averaging using TPSN
-    struct timespec T_start;
-    struct timespec T_skew;
-    long long T_skew_n = get_TPSN_data(sock);
-    //as_timespec(T_skew_n, &T_skew);
-    TI->T_skew_n = T_skew_n;
-    close(sock);
-    // // Ping the server to about next trigger time
-    // // send 2
-    // char status_buf[8] = {0};
-    // status_buf[4] = 2;
-    // char buffer[16] = {0}; 
-
-    // int start = 0, valread;
-    // long long T_start_n = 0;
-    // send(sock, status_buf, 8, 0);
-    // valread = read(sock, buffer, 16);
-    // if (valread != 16) {
-    //     return -1;
-    // }
-    // T_start_n = bytes_to_nsec(buffer);
-
-    close(sock);
-
-    return 0;
-}
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/uio.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+#include "synchronization.h"
+#include "syncproto.h"
+#include "metrics.h"
+
+
+long long as_nsec(struct timespec *T)
+{
+    return ((long long) T->tv_sec) * BILLION + (long long) T->tv_nsec;
+}
+
+void as_timespec(long long t, struct timespec *T)
+{
+    T->tv_sec = (long) (t / BILLION);
+    T->tv_nsec = (long) (t % BILLION);
+    return;
+}
+
+// Long-lived connection to the sync server, -1 when not connected
+static int syncSock = -1;
+static OffsetEstimator syncEstimator = OffsetEstimator::MinRtt;
+static bool syncTimestamping = false;
+static std::string syncServerIp = SERVER_IP;
+static int syncPort = PORT;
+static int syncRounds = NUM_AVG;
+// Sequence number of the last request, replies must echo it
+static uint32_t syncSeq = 0;
+// Multicast schedule announcements, -1 until subscribed
+static int announceSock = -1;
+
+
+void sync_set_estimator(OffsetEstimator estimator)
+{
+    syncEstimator = estimator;
+}
+
+void sync_set_server(const char *ip, int port)
+{
+    syncServerIp = ip;
+    syncPort = port;
+    sync_close();
+}
+
+void sync_set_rounds(int rounds)
+{
+    syncRounds = rounds < 1 ? 1 : rounds > SYNC_MAX_ROUNDS ? SYNC_MAX_ROUNDS : rounds;
+}
+
+void sync_set_timestamping(bool enable)
+{
+    syncTimestamping = enable;
+    // the option is set on connect
+    sync_close();
+}
+
+
+// Kernel timestamps are CLOCK_REALTIME, the rest of our timeline is
+// CLOCK_MONOTONIC
+static long long realtime_to_mono(long long t)
+{
+    struct timespec rt, mono;
+    clock_gettime(CLOCK_REALTIME, &rt);
+    clock_gettime(CLOCK_MONOTONIC, &mono);
+    return t + as_nsec(&mono) - as_nsec(&rt);
+}
+
+// SCM_TIMESTAMPING of a received message, hardware when the NIC stamped it
+static bool cmsg_timestamp(struct msghdr *msg, long long *t)
+{
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(msg); c != NULL; c = CMSG_NXTHDR(msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING)
+            continue;
+        struct scm_timestamping *ts = (struct scm_timestamping *) CMSG_DATA(c);
+        struct timespec *T = (ts->ts[2].tv_sec || ts->ts[2].tv_nsec) ? &ts->ts[2] : &ts->ts[0];
+        if (T->tv_sec == 0 && T->tv_nsec == 0)
+            return false;
+        *t = realtime_to_mono(as_nsec(T));
+        return true;
+    }
+    return false;
+}
+
+// read_full() that also returns the receive timestamp of the last part
+// of the data, 0 if there was none
+static ssize_t read_stamped(int sock, char *buffer, size_t len, long long *t)
+{
+    size_t done = 0;
+    *t = 0;
+    while (done < len)
+    {
+        char control[256];
+        struct iovec iov = {.iov_base = buffer + done, .iov_len = len - done};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+
+        ssize_t n = recvmsg(sock, &msg, 0);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (!cmsg_timestamp(&msg, t))
+            *t = 0;
+        done += (size_t) n;
+    }
+    return (ssize_t) len;
+}
+
+// Drain the transmit timestamps queued on the error queue. t gets the most
+// recent one, i.e. that of the last send(); false if there was none.
+static bool tx_timestamp(int sock, long long *t)
+{
+    bool found = false;
+    while (1)
+    {
+        char control[256], data[64];
+        struct iovec iov = {.iov_base = data, .iov_len = sizeof(data)};
+        struct msghdr msg = {};
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(sock, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+        if (cmsg_timestamp(&msg, t))
+            found = true;
+    }
+    return found;
+}
+
+
+int sync_open()
+{
+    if (syncSock >= 0)
+        return syncSock;
+
+    int sock = 0; 
+    struct sockaddr_in serv_addr; 
+    if ((sock = socket(AF_INET, SOCK_STREAM, 0)) < 0) 
+    { 
+        printf("\n Socket creation error \n"); 
+        return -1; 
+    } 
+
+    // Every exchange is one small packet each way: never wait for Nagle
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    // Notice a server that went away while we were idle
+    int idle = SYNC_KEEPIDLE_SEC, intvl = SYNC_KEEPINTVL_SEC, cnt = SYNC_KEEPCNT;
+    setsockopt(sock, SOL_SOCKET, SO_KEEPALIVE, &one, sizeof(one));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPIDLE, &idle, sizeof(idle));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPINTVL, &intvl, sizeof(intvl));
+    setsockopt(sock, IPPROTO_TCP, TCP_KEEPCNT, &cnt, sizeof(cnt));
+    struct timeval tv = {.tv_sec = SYNC_TIMEOUT_SEC, .tv_usec = 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+    if (syncTimestamping)
+    {
+        // Hardware stamps only show up if the interface has them enabled
+        // and its clock follows the system clock (phc2sys)
+        int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE |
+                    SOF_TIMESTAMPING_TX_HARDWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                    SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE |
+                    SOF_TIMESTAMPING_OPT_TSONLY;
+        if (setsockopt(sock, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+            perror("SO_TIMESTAMPING, using user space timestamps");
+    }
+   
+    serv_addr.sin_family = AF_INET; 
+    serv_addr.sin_port = htons(syncPort); 
+       
+    // Convert IPv4 and IPv6 addresses from text to binary form 
+    if(inet_pton(AF_INET, syncServerIp.c_str(), &serv_addr.sin_addr)<=0)  
+    { 
+        printf("\nInvalid address/ Address not supported \n"); 
+        close(sock);
+        return -1; 
+    } 
+
+    if (connect(sock, (struct sockaddr *)&serv_addr, sizeof(serv_addr)) < 0) 
+    { 
+        printf("\nConnection Failed \n"); 
+        close(sock);
+        return -1; 
+    } 
+    syncSock = sock;
+    return syncSock;
+}
+
+
+void sync_close()
+{
+    if (syncSock >= 0)
+        close(syncSock);
+    syncSock = -1;
+}
+
+
+// Next packet of the session, which has to answer request seq
+static int sync_reply(int sock, uint32_t seq, struct sync_packet *pkt, long long *t_rx)
+{
+    int ret;
+    if (syncTimestamping)
+    {
+        uint8_t buf[SYNC_PACKET_SIZE];
+        if (read_stamped(sock, (char *) buf, SYNC_PACKET_SIZE, t_rx) != SYNC_PACKET_SIZE)
+            return -1;
+        ret = sync_decode(buf, pkt);
+    }
+    else
+    {
+        *t_rx = 0;
+        ret = sync_recv(sock, pkt);
+    }
+    if (ret == -1 || pkt->seq != seq)
+    {
+        printf("bad reply from the sync server\n");
+        return -1;
+    }
+    return 0;
+}
+
+
+// One request/reply exchange without timestamps of interest
+static int sync_request(int sock, uint8_t type, struct sync_packet *pkt)
+{
+    long long t_rx;
+    *pkt = {};
+    pkt->type = type;
+    pkt->seq = ++syncSeq;
+    if (sync_send(sock, pkt) == -1 || sync_reply(sock, syncSeq, pkt, &t_rx) == -1)
+        return -1;
+    if (syncTimestamping)
+        tx_timestamp(sock, &t_rx);
+    return 0;
+}
+
+
+// Subscribe to the master's schedule announcements, -1 if we cannot
+static int announce_open()
+{
+    if (announceSock >= 0)
+        return announceSock;
+
+    int sock = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (sock < 0)
+    {
+        perror("announce socket");
+        return -1;
+    }
+    int one = 1;
+    setsockopt(sock, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    struct timeval tv = {.tv_sec = SYNC_TIMEOUT_SEC, .tv_usec = 0};
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(SYNC_MCAST_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    struct ip_mreq mreq = {};
+    inet_pton(AF_INET, SYNC_MCAST_GROUP, &mreq.imr_multiaddr);
+    mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+    if (bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 ||
+        setsockopt(sock, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq)) < 0)
+    {
+        perror("announce subscribe");
+        close(sock);
+        return -1;
+    }
+    announceSock = sock;
+    return announceSock;
+}
+
+// Wait up to SYNC_TIMEOUT_SEC for a schedule announcement
+static int announce_recv(struct sync_packet *pkt)
+{
+    if (announce_open() < 0)
+    {
+        // no multicast: fall back to asking the server every so often
+        sleep(SYNC_TIMEOUT_SEC);
+        return -1;
+    }
+    uint8_t buf[SYNC_PACKET_SIZE];
+    ssize_t n = recv(announceSock, buf, sizeof(buf), 0);
+    if (n != SYNC_PACKET_SIZE || sync_decode(buf, pkt) == -1 || pkt->type != SYNC_ANNOUNCE)
+        return -1;
+    return 0;
+}
+
+
+int get_TPSN_data(int sock, long long *skew, long long *t_meas)
+{
+    struct timespec T1 = {.tv_sec = 0, .tv_nsec = 0};
+    struct timespec T4 = {.tv_sec = 0, .tv_nsec = 0};
+    long long T1k, T4k = 0;
+    struct sync_packet pkt = {};
+    TpsnSample samples[SYNC_MAX_ROUNDS];
+    int rounds = syncRounds;
+    for (int i = 0; i < rounds; i++) {
+        // Only the timestamp of this round's send may be left afterwards
+        if (syncTimestamping)
+            tx_timestamp(sock, &T1k);
+        clock_gettime(CLOCK_MONOTONIC, &T1);
+        pkt.type = SYNC_TPSN_REQ;
+        pkt.seq = ++syncSeq;
+        pkt.t[0] = as_nsec(&T1);
+        if (sync_send(sock, &pkt) == -1)
+        {
+            printf("sending T1 to server failed\n");
+            return -1;
+        }
+        if (sync_reply(sock, syncSeq, &pkt, &T4k) == -1 || pkt.type != SYNC_TPSN_REPLY)
+        {
+            printf("getting T3 and T4 from server failed\n");
+            return -1;
+        }
+        // Timestamp T4
+        clock_gettime(CLOCK_MONOTONIC, &T4);
+        // Receive T2 and T3
+        TpsnSample &s = samples[i];
+        s.T2 = pkt.t[0];
+        s.T3 = pkt.t[1];
+        s.T1 = as_nsec(&T1);
+        s.T4 = as_nsec(&T4);
+        if (syncTimestamping)
+        {
+            if (tx_timestamp(sock, &T1k))
+                s.T1 = T1k;
+            if (T4k)
+                s.T4 = T4k;
+        }
+        metrics.syncRtt.record(s.rtt());
+    }
+    // The batch takes a few RTTs, so its midpoint stands for all of it
+    *t_meas = (samples[0].T1 + samples[rounds - 1].T4) / 2;
+    *skew = estimateOffset(samples, rounds, syncEstimator, NULL);
+    return 0;
+}
+
+// One attempt over the current session; -1 if the session is broken
+static int sync_exchange(int sock, struct timeinfo *TI, uint8_t isFirst)
+{
+    struct timespec T_skew;
+    long long T_skew_n, T_meas_n;
+    if (get_TPSN_data(sock, &T_skew_n, &T_meas_n) == -1)
+        return -1;
+    as_timespec(T_skew_n, &T_skew);
+    printf("%lld skew: %ld.%ld\n", T_skew_n, (long) T_skew.tv_sec, (long) T_skew.tv_nsec);
+
+    // Tell the server we are done averaging. Until every client is, it
+    // has no start time; the master then announces it to all of us at
+    // once over multicast. We only ask again over TCP when no announcement
+    // arrived for SYNC_TIMEOUT_SEC, in case multicast does not get through.
+    struct sync_packet pkt = {};
+    long long T_start_n = 0, T_period_n = BILLION;
+    while (T_start_n == 0)
+    {
+        if (sync_request(sock, SYNC_START_REQ, &pkt) == -1 || pkt.type != SYNC_START)
+        {
+            printf("waiting for start time failed\n");
+            return -1;
+        }
+        if (pkt.t[0] == 0 && announce_recv(&pkt) == -1)
+            continue;
+        T_start_n = pkt.t[0];
+        if (pkt.t[1] > 0)
+            T_period_n = pkt.t[1];
+    }
+    // The first time around the server arms the trigger once all of us
+    // acknowledged the start time
+    if (isFirst && (sync_request(sock, SYNC_READY, &pkt) == -1 || pkt.type != SYNC_READY_ACK))
+    {
+        printf("start time acknowledgement failed\n");
+        return -1;
+    }
+    
+//    printf("start: %lld\n", T_start_n);
+    TI->T_server_start_n = T_start_n;
+    TI->T_server_period_n = T_period_n;
+    T_start_n -= T_skew_n;
+    TI->T_skew_n = T_skew_n;
+    TI->T_meas_n = T_meas_n;
+    TI->T_start_n = T_start_n + 1000000;
+    return 0;
+}
+
+int synchronize(struct timeinfo *TI, uint8_t isFirst)
+{
+    // A broken session gets one reconnect before we report the error
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int sock = sync_open();
+        if (sock < 0)
+            return -1;
+        if (sync_exchange(sock, TI, isFirst) == 0)
+            return 0;
+        sync_close();
+    }
+    return -1;
+}
+
+// TODO: FIgure out
+
+int get_skew(struct timeinfo* TI)
+{
+    // Compute the skew upon averaging using TPSN
+    for (int attempt = 0; attempt < 2; attempt++)
+    {
+        int sock = sync_open();
+        if (sock < 0)
+            return -1;
+        long long T_skew_n, T_meas_n;
+        if (get_TPSN_data(sock, &T_skew_n, &T_meas_n) == 0)
+        {
+            TI->T_skew_n = T_skew_n;
+            TI->T_meas_n = T_meas_n;
+            return 0;
+        }
+        sync_close();
+    }
+    return -1;
+}
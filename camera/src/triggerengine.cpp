@@ -0,0 +1,366 @@
+#include "triggerengine.h"
+#include "synchronization.h"
+#include "metrics.h"
+#include "rtthreads.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+
+// Interrupts the trigger thread's sleep when the schedule changes
+#define WAKE_SIGNAL SIGUSR1
+
+
+static void wake_handler(int sig)
+{
+    (void) sig;
+}
+
+
+TriggerEngine::TriggerEngine(Peripheral *p, TriggerChannel *ch)
+    : running(false), nOverflows(0), nLedFaults(0)
+{
+    peripheral = p;
+    channel = ch;
+    started = false;
+    nextId = 0;
+    pulseNs = TRIGGER_PULSE_NS;
+    prefireNs = 0;
+    ledNs = 0;
+    notifyFd = -1;
+    locked = false;
+    grid = {0, 0, false, {0, 0, 0}};
+    edgeIndex = 0;
+    phaseNs = 0;
+    steppedNs = 0;
+}
+
+
+TriggerEngine::~TriggerEngine()
+{
+    stop();
+}
+
+
+int TriggerEngine::start(long long t_start_n, long long period_n)
+{
+    if (started)
+    {
+        reschedule(t_start_n, period_n);
+        return 0;
+    }
+
+    // No SA_RESTART: clock_nanosleep has to come back with EINTR
+    struct sigaction act;
+    memset(&act, 0, sizeof(act));
+    act.sa_handler = &wake_handler;
+    sigemptyset(&act.sa_mask);
+    if (sigaction(WAKE_SIGNAL, &act, NULL) == -1)
+    {
+        perror("TriggerEngine: sigaction");
+        return -1;
+    }
+
+    Schedule s = {t_start_n, period_n, false, {0, 0, 0}};
+    schedules.push(s);
+    running = true;
+
+    int err = pthread_create(&thread, NULL, &TriggerEngine::entry, this);
+    if (err != 0)
+    {
+        fprintf(stderr, "TriggerEngine: pthread_create: %s\n", strerror(err));
+        running = false;
+        return -1;
+    }
+    started = true;
+    return 0;
+}
+
+
+void TriggerEngine::stop()
+{
+    if (!started)
+        return;
+    running = false;
+    pthread_kill(thread, WAKE_SIGNAL);
+    pthread_join(thread, NULL);
+    started = false;
+}
+
+
+void TriggerEngine::setStrobe(long long prefire_n, long long width_n)
+{
+    prefireNs = width_n > 0 ? prefire_n : 0;
+    ledNs = width_n > 0 ? width_n : 0;
+}
+
+
+void TriggerEngine::reschedule(long long t_start_n, long long period_n)
+{
+    Schedule s = {t_start_n, period_n, false, {0, 0, 0}};
+    if (!schedules.push(s))
+    {
+        fprintf(stderr, "TriggerEngine: schedule queue full, dropping reschedule\n");
+        return;
+    }
+    if (started)
+        pthread_kill(thread, WAKE_SIGNAL);
+}
+
+
+void TriggerEngine::lock(long long server_start_n, long long server_period_n, const ClockLine &line)
+{
+    Schedule s = {server_start_n, server_period_n, true, line};
+    if (!schedules.push(s))
+    {
+        fprintf(stderr, "TriggerEngine: schedule queue full, dropping lock\n");
+        return;
+    }
+    if (started)
+        pthread_kill(thread, WAKE_SIGNAL);
+}
+
+
+void TriggerEngine::pause()
+{
+    reschedule(0, 0);
+}
+
+
+bool TriggerEngine::pop(TriggerEvent *ev)
+{
+    return events.pop(ev);
+}
+
+
+// For the steps of one edge: signals only wake the first sleep of a period
+static void sleep_until(long long t_n)
+{
+    struct timespec ts;
+    as_timespec(t_n, &ts);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+}
+
+
+// Rounded towards minus infinity, server times may lie before the start
+static long long floorDiv(long long a, long long b)
+{
+    long long q = a / b;
+    return (a % b != 0 && (a < 0) != (b < 0)) ? q - 1 : q;
+}
+
+
+// Take a new schedule, next is the edge to fire next
+void TriggerEngine::apply(const Schedule &s, long long *next, long long *period)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long t_now = as_nsec(&now);
+    bool wasLocked = locked && *period > 0;
+    locked = s.locked && s.period_n > 0;
+    *period = s.period_n;
+    phaseNs = 0;
+    if (!s.locked)
+    {
+        *next = s.t_start_n;
+        // Keep the phase of t_start_n but never fire for the past
+        if (*period > 0 && *next - prefireNs < t_now)
+            *next += ((t_now - *next + prefireNs) / *period + 1) * *period;
+        return;
+    }
+    if (!locked)
+        return;
+
+    // Same grid, if maybe from another start edge: stay on the edge we
+    // were about to fire and slew from there, unless the new line puts it
+    // too far off
+    bool steer = wasLocked && s.period_n == grid.period_n && (s.t_start_n - grid.t_start_n) % s.period_n == 0;
+    if (steer)
+        edgeIndex += (grid.t_start_n - s.t_start_n) / s.period_n;
+    grid = s;
+    if (steer)
+    {
+        long long target = s.line.toLocal(s.t_start_n + edgeIndex * s.period_n);
+        phaseNs = *next - target;
+        if (phaseNs <= TRIGGER_STEER_MAX_NS && phaseNs >= -TRIGGER_STEER_MAX_NS)
+            return;
+        // Reported by the main loop with the next event, printing here
+        // could block this thread on stdout
+        steppedNs = phaseNs;
+        phaseNs = 0;
+    }
+    // The first edge of the grid that is not past
+    long long k = floorDiv(s.line.toServer(t_now + prefireNs) - s.t_start_n, s.period_n) + 1;
+    edgeIndex = k > 0 ? k : 0;
+    *next = s.line.toLocal(s.t_start_n + edgeIndex * s.period_n);
+}
+
+
+// The locked edge after next: a period of the line on from next, moved
+// towards where the line puts the edge by at most TRIGGER_SLEW_PPM of it
+long long TriggerEngine::lockedEdge(long long next)
+{
+    const ClockLine &line = grid.line;
+    long long step = line.toLocal(grid.t_start_n + (edgeIndex + 1) * grid.period_n) -
+                     line.toLocal(grid.t_start_n + edgeIndex * grid.period_n);
+    edgeIndex++;
+    long long target = line.toLocal(grid.t_start_n + edgeIndex * grid.period_n);
+    long long slew = step * TRIGGER_SLEW_PPM / 1000000;
+    long long error = target - (next + step);
+    if (error > slew)
+        error = slew;
+    else if (error < -slew)
+        error = -slew;
+    next += step + error;
+    phaseNs = next - target;
+    return next;
+}
+
+
+void *TriggerEngine::entry(void *arg)
+{
+    // Every signal blocked except WAKE_SIGNAL, which interrupts the sleep
+    // for a new schedule or stop()
+    sigset_t set;
+    sigfillset(&set);
+    sigdelset(&set, WAKE_SIGNAL);
+    pthread_sigmask(SIG_SETMASK, &set, NULL);
+    // SCHED_FIFO on its own core, reported if refused
+    setThreadRole(ThreadRole::Trigger);
+
+    ((TriggerEngine *) arg)->loop();
+    return NULL;
+}
+
+
+void TriggerEngine::loop()
+{
+    long long next = 0, period = BILLION;
+    struct timespec ts, now;
+    uint32_t missed = 0;
+    Schedule s;
+
+    while (running)
+    {
+        while (schedules.pop(&s))
+        {
+            apply(s, &next, &period);
+            missed = 0;
+        }
+
+        if (period <= 0)
+        {
+            // Paused until the next reschedule wakes us
+            struct timespec idle = {1, 0};
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        // A reschedule landing between the pop above and the sleep is only
+        // seen after the next edge, one period late at worst
+        bool strobe = ledNs > 0;
+        as_timespec(next - prefireNs, &ts);
+        if (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) != 0)
+            continue;   // woken for a new schedule or stop()
+
+        // Without a pre-fire the LED goes on in the trigger's GPIO write
+        long long t_led = 0;
+        bool ledWithTrigger = strobe && prefireNs == 0;
+        if (strobe && !ledWithTrigger)
+        {
+            peripheral->ledOn();
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            t_led = as_nsec(&now);
+            sleep_until(next);
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long t_wake = as_nsec(&now);
+        peripheral->triggerOn(ledWithTrigger);
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long t_edge = as_nsec(&now);
+        if (ledWithTrigger)
+            t_led = t_edge;
+
+        // From the sampler thread's history at the edge; never touches the
+        // I2C bus
+        SensorSample sample = {0, 0.f, 0.f, 0.f};
+        peripheral->sampleAt(t_edge, &sample);
+        TriggerRecord rec = {nextId, t_edge, sample.pressure, sample.temperature};
+        channel->publish(rec);
+
+        // Trigger and LED off in whichever order they are due, the LED
+        // deadline from the scheduled LED on, not from t_led
+        long long t_led_due = next - prefireNs + ledNs;
+        long long t_led_off = 0;
+        bool ledFault = false;
+        bool ledFirst = strobe && t_led_due < t_edge + pulseNs;
+        if (ledFirst)
+        {
+            sleep_until(t_led_due);
+            ledFault = peripheral->ledFault();
+            peripheral->ledOff();
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            t_led_off = as_nsec(&now);
+        }
+        sleep_until(t_edge + pulseNs);
+        peripheral->triggerOff();
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long t_trig_off = as_nsec(&now);
+        long long t_off = t_trig_off;
+        if (strobe && !ledFirst)
+        {
+            sleep_until(t_led_due);
+            ledFault = peripheral->ledFault();
+            peripheral->ledOff();
+            clock_gettime(CLOCK_MONOTONIC, &now);
+            t_led_off = as_nsec(&now);
+            t_off = t_led_off;
+        }
+
+        if (strobe)
+            metrics.ledWidth.record(t_led_off - t_led);
+        if (ledFault)
+            nLedFaults++;
+
+        metrics.triggerDelay.record(t_wake - next);
+        metrics.pulseWidth.record(t_trig_off - t_edge);
+        if (locked)
+            metrics.triggerPhase.record(phaseNs);
+        TriggerEvent ev = {nextId, next, t_edge, t_wake - next, t_trig_off - t_edge,
+                           strobe ? t_led_off - t_led : 0, ledFault, missed, phaseNs, steppedNs,
+                           sample.pressure, sample.temperature};
+        steppedNs = 0;
+        if (!events.push(ev))
+            nOverflows++;
+        else if (notifyFd >= 0)
+        {
+            uint64_t one = 1;
+            ssize_t w = write(notifyFd, &one, sizeof(one));
+            (void) w;
+        }
+        nextId++;
+
+        // Skip edges we are already too late for instead of firing a burst,
+        // counting the pre-fire as part of the edge
+        missed = 0;
+        if (locked)
+        {
+            next = lockedEdge(next);
+            for (; t_off >= next - prefireNs; missed++)
+                next = lockedEdge(next);
+            continue;
+        }
+        next += period;
+        if (t_off >= next - prefireNs)
+        {
+            long long behind = (t_off - next + prefireNs) / period + 1;
+            next += behind * period;
+            missed = (uint32_t) behind;
+        }
+    }
+}
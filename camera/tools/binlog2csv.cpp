@@ -0,0 +1,176 @@
+/* --------------------------------------------------------------------------
+ *   binlog2csv: convert a binary minions log (see common/include/binlog.h)
+ *   back to CSV, e.g. after recovering a float. With -t the telemetry of
+ *   either program (telemetry_*.bin, see telemetry.h) instead, one line per
+ *   record by kind:
+ *
+ *     system   SoC temperature (C), throttling flags (hex), CPU clock (MHz)
+ *     thread   threads of the name, CPU and waiting for a CPU (% of a core)
+ *     gauge    value
+ *     latency  count, p50, p99 and max (us)
+ *
+ *   usage: binlog2csv [-t] <log.bin> [out.csv]
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <map>
+#include <string>
+
+#include "binlog.h"
+
+
+// Channel names of the telemetry records so far
+static std::map<uint16_t, std::string> channels;
+
+static const char *channelName(uint16_t channel)
+{
+    auto it = channels.find(channel);
+    return it != channels.end() ? it->second.c_str() : "?";
+}
+
+// One telemetry record, false if it is of no telemetry kind
+static bool printTelemetry(FILE *out, const BinLogRecord &rec)
+{
+    switch (rec.type)
+    {
+        case BINLOG_CHANNEL:
+        {
+            BinLogChannel c;
+            memcpy(&c, rec.payload, sizeof(c));
+            c.name[sizeof(c.name) - 1] = '\0';
+            channels[c.channel] = c.name;
+            return true;
+        }
+        case BINLOG_SYSTEM:
+        {
+            BinLogSystem s;
+            memcpy(&s, rec.payload, sizeof(s));
+            fprintf(out, "%" PRId64 ",system,,", rec.t_nsec);
+            if (s.soc_mdegc != INT32_MIN)
+                fprintf(out, "%.1f", s.soc_mdegc / 1000.0);
+            fprintf(out, ",");
+            if (s.throttled != BINLOG_NO_THROTTLE_INFO)
+                fprintf(out, "%x", s.throttled);
+            fprintf(out, ",%u,\n", s.cpu_khz / 1000);
+            return true;
+        }
+        case BINLOG_THREAD:
+        {
+            BinLogThread t;
+            memcpy(&t, rec.payload, sizeof(t));
+            double period = t.period_us > 0 ? t.period_us : 1;
+            fprintf(out, "%" PRId64 ",thread,%s,%u,%.1f,%.1f,\n", rec.t_nsec, channelName(t.channel),
+                    t.threads, 100.0 * t.cpu_us / period, 100.0 * t.wait_us / period);
+            return true;
+        }
+        case BINLOG_GAUGE:
+        {
+            BinLogGauge g;
+            memcpy(&g, rec.payload, sizeof(g));
+            fprintf(out, "%" PRId64 ",gauge,%s,%" PRId64 ",,,\n", rec.t_nsec, channelName(g.channel), g.value);
+            return true;
+        }
+        case BINLOG_LATENCY:
+        {
+            BinLogLatency l;
+            memcpy(&l, rec.payload, sizeof(l));
+            fprintf(out, "%" PRId64 ",latency,%s,%u,%u,%u,%u\n", rec.t_nsec, channelName(l.channel),
+                    l.count, l.p50_us, l.p99_us, l.max_us);
+            return true;
+        }
+        default:
+            return false;
+    }
+}
+
+
+int main(int argc, char* argv[])
+{
+    bool telemetry = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "t")) != -1)
+    {
+        if (opt != 't')
+        {
+            fprintf(stderr, "usage: binlog2csv [-t] <log.bin> [out.csv]\n");
+            return 1;
+        }
+        telemetry = true;
+    }
+    argc -= optind - 1;
+    argv += optind - 1;
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: binlog2csv [-t] <log.bin> [out.csv]\n");
+        return 1;
+    }
+    FILE *in = fopen(argv[1], "rb");
+    if (!in)
+    {
+        perror(argv[1]);
+        return 1;
+    }
+    FILE *out = argc > 2 ? fopen(argv[2], "w") : stdout;
+    if (!out)
+    {
+        perror(argv[2]);
+        return 1;
+    }
+
+    BinLogHeader hdr;
+    if (fread(&hdr, sizeof(hdr), 1, in) != 1 || memcmp(hdr.magic, BINLOG_MAGIC, 4) != 0)
+    {
+        fprintf(stderr, "%s: not a binary log\n", argv[1]);
+        return 1;
+    }
+    if (hdr.version != BINLOG_VERSION || hdr.record_size != sizeof(BinLogRecord))
+    {
+        fprintf(stderr, "%s: unsupported version %u, record size %u\n", argv[1],
+                hdr.version, hdr.record_size);
+        return 1;
+    }
+    fprintf(stderr, "%s: opened at %" PRId64 " ns monotonic, %" PRId64 " ns realtime\n",
+            argv[1], hdr.t_open_nsec, hdr.t_open_realtime);
+
+    if (telemetry)
+        fprintf(out, "Timestamp(ns),Kind,Name,Value1,Value2,Value3,Value4\n");
+    else
+        fprintf(out, "Timestamp(ns),Frame,Pressure(mbar),Temperature(C)\n");
+    BinLogRecord rec;
+    unsigned long records = 0, lost = 0, skipped = 0;
+    uint32_t expect = 0;
+    while (fread(&rec, sizeof(rec), 1, in) == 1)
+    {
+        if (rec.seq != expect)
+            lost += rec.seq - expect;
+        expect = rec.seq + 1;
+        records++;
+        if (telemetry)
+        {
+            if (!printTelemetry(out, rec))
+                skipped++;
+            continue;
+        }
+        if (rec.type != BINLOG_SENSOR)
+        {
+            skipped++;
+            continue;
+        }
+        BinLogSensor s;
+        memcpy(&s, rec.payload, sizeof(s));
+        fprintf(out, "%" PRId64 ",%" PRIu64 ",%.2f,%.2f\n", rec.t_nsec, s.frame_id,
+                s.pressure, s.temperature);
+    }
+    fprintf(stderr, "%lu records, %lu dropped while logging, %lu of other types\n",
+            records, lost, skipped);
+    if (!feof(in))
+        perror(argv[1]);
+
+    fclose(in);
+    if (out != stdout)
+        fclose(out);
+    return 0;
+}
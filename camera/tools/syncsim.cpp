@@ -0,0 +1,518 @@
+/* --------------------------------------------------------------------------
+ *   syncsim: accuracy of the camera's clock sync without Pis. Runs the
+ *   real client (synchronization.cpp, ClockFilter) against a simulated
+ *   server over loopback, through an in-process network emulator that
+ *   delays every packet by a base delay plus exponential jitter, adds an
+ *   uplink asymmetry and stalls "lost" packets for a TCP retransmit. The
+ *   server's clock runs off ours with a constant drift and a slow
+ *   temperature-like swing, so the true offset is known at any time.
+ *
+ *   Time between measurements is skipped, not waited for: the server
+ *   reads its clock at our time plus a virtual shift that advances by the
+ *   drift period after every measurement, so an hour's mission takes
+ *   seconds. Each configuration, estimator x rounds x timestamping, runs
+ *   the same mission with the same network seed and reports the error of
+ *   single measurements, the error of the filter's prediction just before
+ *   the next measurement (what the trigger schedule sees), when that
+ *   stays within the target, and bytes on air.
+ *
+ *   usage: syncsim [-T hours] [-i drift s] [-S sync s] [-e estimators]
+ *                  [-n rounds,...] [-k] [-d delay us] [-j jitter us]
+ *                  [-a asymmetry] [-l loss %] [-D drift ppm]
+ *                  [-A swing ppm] [-P swing s] [-t target us] [-s seed]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <atomic>
+#include <random>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "synchronization.h"
+#include "clocksync.h"
+#include "syncproto.h"
+
+// TCP/IP with timestamps plus 802.2 LLC/SNAP per packet; MAC framing,
+// acks without data and retransmits are not counted
+#define SIM_HEADER_BYTES 60
+// Minimum Linux TCP retransmit timeout, what a lost packet costs
+#define SIM_RTO_NS 200000000LL
+
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return as_nsec(&t);
+}
+
+static void sleep_until(long long t_n)
+{
+    struct timespec t;
+    as_timespec(t_n, &t);
+    while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &t, NULL) != 0)
+        ;
+}
+
+
+/*
+ * The server's oscillator against ours, on the virtual timeline
+ */
+struct ServerClock
+{
+    double offset0 = 3.0e9;     // ns at virtual time 0
+    double driftPpm = 20;
+    double swingPpm = 2;
+    double swingPeriod = 3600;  // s
+
+    // Server - local at virtual local time t (ns)
+    double offsetAt(double t) const
+    {
+        double s = t / BILLION;
+        double swing = swingPpm * swingPeriod / (2 * M_PI) * (1 - cos(2 * M_PI * s / swingPeriod));
+        return offset0 + 1000 * (driftPpm * s + swing);
+    }
+};
+
+struct NetworkModel
+{
+    double delayUs = 2000;      // one way
+    double jitterUs = 500;      // mean of the exponential extra delay
+    double asymmetry = 0;       // uplink delay extra, fraction of delayUs
+    double lossPct = 0;
+};
+
+static ServerClock serverClock;
+static NetworkModel network;
+// Virtual local time = CLOCK_MONOTONIC + shift
+static std::atomic<long long> shift{0};
+static long long t_origin = 0;
+
+static long long virtualNow()
+{
+    return now_ns() - t_origin + shift.load();
+}
+
+static long long serverNow()
+{
+    long long t = virtualNow();
+    return t + (long long) serverClock.offsetAt((double) t);
+}
+
+
+// Listening loopback socket, its port in *port
+static int listenLoopback(int *port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0 || listen(sock, 4) < 0 ||
+        getsockname(sock, (struct sockaddr *) &addr, &len) < 0)
+    {
+        perror("listen");
+        exit(1);
+    }
+    *port = ntohs(addr.sin_port);
+    return sock;
+}
+
+static int connectLoopback(int port)
+{
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (sock < 0 || connect(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    return sock;
+}
+
+
+// The LED server's side of the exchange, one client, every start request
+// answered at once with the server second two seconds ahead
+static void serverLoop(int listenSock)
+{
+    while (true)
+    {
+        int sock = accept(listenSock, NULL, NULL);
+        if (sock < 0)
+            return;
+        int one = 1;
+        setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        struct sync_packet pkt;
+        while (sync_recv(sock, &pkt) == 0)
+        {
+            long long T2 = serverNow();
+            switch (pkt.type)
+            {
+                case SYNC_TPSN_REQ:
+                    pkt.type = SYNC_TPSN_REPLY;
+                    pkt.t[0] = T2;
+                    pkt.t[1] = serverNow();
+                    break;
+                case SYNC_START_REQ:
+                    pkt.type = SYNC_START;
+                    pkt.t[0] = (T2 / BILLION + 2) * BILLION;
+                    pkt.t[1] = BILLION;
+                    break;
+                case SYNC_READY:
+                    pkt.type = SYNC_READY_ACK;
+                    break;
+                default:
+                    continue;
+            }
+            if (sync_send(sock, &pkt) == -1)
+                break;
+        }
+        close(sock);
+    }
+}
+
+
+/*
+ * Network emulator between client and server, one thread per direction.
+ * Packets leave in order, so a stalled one holds up the next like TCP.
+ */
+class Link
+{
+    public:
+        void reset(unsigned seed)
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            rng.seed(seed);
+            packets = 0;
+            bytes = 0;
+        }
+
+        long long delay(bool uplink)
+        {
+            std::lock_guard<std::mutex> lck(mtx);
+            std::exponential_distribution<double> jitter(network.jitterUs > 0 ? 1 / network.jitterUs : 1e9);
+            std::uniform_real_distribution<double> uniform(0, 100);
+            double us = network.delayUs * (uplink ? 1 + network.asymmetry : 1) + jitter(rng);
+            long long ns = (long long) (us * 1000);
+            if (uniform(rng) < network.lossPct)
+                ns += SIM_RTO_NS;
+            packets++;
+            bytes += SYNC_PACKET_SIZE + SIM_HEADER_BYTES;
+            return ns;
+        }
+
+        unsigned long packets = 0;
+        unsigned long long bytes = 0;
+
+    private:
+        std::mutex mtx;
+        std::mt19937 rng;
+};
+
+static Link wire;
+
+static void forward(int from, int to, bool uplink)
+{
+    uint8_t buf[SYNC_PACKET_SIZE];
+    long long last = 0;
+    while (read_full(from, buf, sizeof(buf)) == SYNC_PACKET_SIZE)
+    {
+        long long t = std::max(now_ns() + wire.delay(uplink), last);
+        sleep_until(t);
+        last = t;
+        if (write_full(to, buf, sizeof(buf)) != SYNC_PACKET_SIZE)
+            break;
+    }
+    shutdown(to, SHUT_WR);
+}
+
+static void proxyLoop(int listenSock, int serverPort)
+{
+    while (true)
+    {
+        int client = accept(listenSock, NULL, NULL);
+        if (client < 0)
+            return;
+        int one = 1;
+        setsockopt(client, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        int server = connectLoopback(serverPort);
+        std::thread down(forward, server, client, false);
+        forward(client, server, true);
+        down.join();
+        close(client);
+        close(server);
+    }
+}
+
+
+struct Config
+{
+    OffsetEstimator estimator;
+    int rounds;
+    bool kernel;
+};
+
+struct Result
+{
+    std::vector<double> measErr;     // us, measured - true offset
+    std::vector<double> predErr;     // us, filter prediction - true, just before an update
+    double convergedS = -1;          // virtual s after which |predErr| stayed within target
+    int measurements = 0;
+    int failures = 0;
+    double wallMs = 0;               // per measurement
+    unsigned long long bytes = 0;
+};
+
+static double percentile(std::vector<double> v, double q)
+{
+    if (v.empty())
+        return 0;
+    for (double &x : v)
+        x = fabs(x);
+    std::sort(v.begin(), v.end());
+    return v[std::min(v.size() - 1, (size_t) (q * v.size()))];
+}
+
+static double rms(const std::vector<double> &v)
+{
+    double s = 0;
+    for (double x : v)
+        s += x * x;
+    return v.empty() ? 0 : sqrt(s / v.size());
+}
+
+
+// One mission: synchronize, then a skew every drift period and a full
+// sync every sync period, like the main loop of minions
+static Result runMission(const Config &c, double hours, int driftS, int syncS, double targetUs, unsigned seed)
+{
+    Result r;
+    sync_set_estimator(c.estimator);
+    sync_set_rounds(c.rounds);
+    sync_set_timestamping(c.kernel);
+    sync_close();
+    wire.reset(seed);
+    shift = 0;
+    t_origin = now_ns();
+
+    ClockFilter filter;
+    struct timeinfo TI = {};
+    long long end = (long long) (hours * 3600 * BILLION);
+    long long nextSync = (long long) syncS * BILLION;
+    long long wall = 0, lastBad = 0;
+    bool first = true;
+    while (virtualNow() < end)
+    {
+        long long shiftNow = shift.load(), t0 = now_ns();
+        bool full = first || virtualNow() >= nextSync;
+        int ret = full ? synchronize(&TI, first) : get_skew(&TI);
+        wall += now_ns() - t0;
+        r.measurements++;
+        if (ret == -1)
+        {
+            r.failures++;
+        }
+        else
+        {
+            // Back onto the virtual timeline the server clock lives on
+            long long t = TI.T_meas_n - t_origin + shiftNow;
+            long long offset = TI.T_skew_n + t_origin - shiftNow;
+            double truth = serverClock.offsetAt((double) t);
+            r.measErr.push_back((offset - truth) / 1000.0);
+            if (filter.valid())
+            {
+                double e = (filter.offsetAt(t) - truth) / 1000.0;
+                r.predErr.push_back(e);
+                if (fabs(e) > targetUs)
+                    lastBad = t;
+            }
+            else
+                lastBad = t;
+            filter.update(t, offset);
+        }
+        if (full && !first)
+            nextSync += (long long) syncS * BILLION;
+        first = false;
+        shift += (long long) driftS * BILLION;
+    }
+    if (!r.predErr.empty() && fabs(r.predErr.back()) <= targetUs)
+        r.convergedS = lastBad / 1e9;
+    r.wallMs = r.measurements ? wall / 1e6 / r.measurements : 0;
+    r.bytes = wire.bytes;
+    sync_close();
+    return r;
+}
+
+
+static std::vector<int> parseInts(const char *arg)
+{
+    std::vector<int> v;
+    for (const char *p = arg; *p; p++)
+    {
+        v.push_back(atoi(p));
+        p = strchr(p, ',');
+        if (p == NULL)
+            break;
+    }
+    return v;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: syncsim [-T hours] [-i drift s] [-S sync s] [-e estimator[,estimator...]]\n"
+                    "               [-n rounds[,rounds...]] [-k] [-d delay us] [-j jitter us]\n"
+                    "               [-a asymmetry] [-l loss %%] [-D drift ppm] [-A swing ppm]\n"
+                    "               [-P swing s] [-t target us] [-s seed]\n");
+}
+
+int main(int argc, char **argv)
+{
+    double hours = 1, targetUs = 100;
+    int driftS = 61, syncS = 301;
+    unsigned seed = 1;
+    bool kernel = false;
+    std::vector<OffsetEstimator> estimators = {OffsetEstimator::Mean, OffsetEstimator::MinRtt,
+                                               OffsetEstimator::Median, OffsetEstimator::TrimmedMean};
+    std::vector<int> rounds = {NUM_AVG};
+    int opt;
+    while ((opt = getopt(argc, argv, "T:i:S:e:n:kd:j:a:l:D:A:P:t:s:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'T':
+                hours = atof(optarg);
+                break;
+            case 'i':
+                driftS = atoi(optarg);
+                break;
+            case 'S':
+                syncS = atoi(optarg);
+                break;
+            case 'e':
+                estimators.clear();
+                for (char *tok = strtok(optarg, ","); tok; tok = strtok(NULL, ","))
+                {
+                    OffsetEstimator e;
+                    if (!parseOffsetEstimator(tok, &e))
+                    {
+                        fprintf(stderr, "unknown estimator %s\n", tok);
+                        return 1;
+                    }
+                    estimators.push_back(e);
+                }
+                break;
+            case 'n':
+                rounds = parseInts(optarg);
+                break;
+            case 'k':
+                kernel = true;
+                break;
+            case 'd':
+                network.delayUs = atof(optarg);
+                break;
+            case 'j':
+                network.jitterUs = atof(optarg);
+                break;
+            case 'a':
+                network.asymmetry = atof(optarg);
+                break;
+            case 'l':
+                network.lossPct = atof(optarg);
+                break;
+            case 'D':
+                serverClock.driftPpm = atof(optarg);
+                break;
+            case 'A':
+                serverClock.swingPpm = atof(optarg);
+                break;
+            case 'P':
+                serverClock.swingPeriod = atof(optarg);
+                break;
+            case 't':
+                targetUs = atof(optarg);
+                break;
+            case 's':
+                seed = (unsigned) atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (hours <= 0 || driftS < 1 || syncS < driftS || estimators.empty() || rounds.empty() || serverClock.swingPeriod <= 0)
+    {
+        usage();
+        return 1;
+    }
+
+    // The report, the sync client prints every measurement on stdout
+    FILE *out = fdopen(dup(STDOUT_FILENO), "w");
+    if (out == NULL || freopen("/dev/null", "w", stdout) == NULL)
+    {
+        perror("stdout");
+        return 1;
+    }
+
+    int serverPort, proxyPort;
+    int serverSock = listenLoopback(&serverPort);
+    int proxySock = listenLoopback(&proxyPort);
+    std::thread(serverLoop, serverSock).detach();
+    std::thread(proxyLoop, proxySock, serverPort).detach();
+    sync_set_server("127.0.0.1", proxyPort);
+
+    fprintf(out, "%.1f h, skew every %d s, sync every %d s; network %.0f us + %.0f us jitter, "
+           "asymmetry %.2f, loss %.1f%%; server %+.1f ppm, swing %.1f ppm over %.0f s\n\n",
+           hours, driftS, syncS, network.delayUs, network.jitterUs, network.asymmetry, network.lossPct,
+           serverClock.driftPpm, serverClock.swingPpm, serverClock.swingPeriod);
+    fprintf(out, "%-8s %6s %4s | %9s %9s %9s | %9s %9s %9s | %9s | %8s %8s %8s\n",
+           "estim", "rounds", "ts", "meas mean", "rms", "p95", "pred p50", "p95", "max",
+           "conv s", "B/meas", "kB/h", "ms/meas");
+    std::vector<bool> stamps = {false};
+    if (kernel)
+        stamps.push_back(true);
+    for (OffsetEstimator e : estimators)
+        for (int n : rounds)
+            for (bool k : stamps)
+            {
+                Config c = {e, n, k};
+                Result r = runMission(c, hours, driftS, syncS, targetUs, seed);
+                double mean = 0;
+                for (double x : r.measErr)
+                    mean += x;
+                mean = r.measErr.empty() ? 0 : mean / r.measErr.size();
+                char conv[16];
+                if (r.convergedS >= 0)
+                    snprintf(conv, sizeof(conv), "%.0f", r.convergedS);
+                else
+                    snprintf(conv, sizeof(conv), "never");
+                fprintf(out, "%-8s %6d %4s | %9.1f %9.1f %9.1f | %9.1f %9.1f %9.1f | %9s | %8.0f %8.1f %8.1f",
+                       offsetEstimatorName(e), n, k ? "kern" : "user", mean, rms(r.measErr),
+                       percentile(r.measErr, 0.95), percentile(r.predErr, 0.5), percentile(r.predErr, 0.95),
+                       percentile(r.predErr, 1), conv, r.measurements ? (double) r.bytes / r.measurements : 0,
+                       r.bytes / 1024.0 / hours, r.wallMs);
+                if (r.failures)
+                    fprintf(out, "  %d failed", r.failures);
+                fprintf(out, "\n");
+                fflush(out);
+            }
+    fprintf(out, "\nerrors in us; pred: filter prediction just before each measurement; "
+           "conv: virtual time after which pred stays within %.0f us\n", targetUs);
+    return 0;
+}
@@ -0,0 +1,169 @@
+#ifndef BINLOG_H
+#define BINLOG_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+class LatencyRecorder;
+
+#define BINLOG_MAGIC "MBLG"
+#define BINLOG_VERSION 1
+#define BINLOG_CAPACITY 4096        // records held in memory
+#define BINLOG_FLUSH_MS 5000
+#define BINLOG_PAYLOAD 16
+
+/*
+ * File layout: one BinLogHeader, then BinLogRecords back to back, all
+ * little-endian. A crash loses at most the records since the last flush
+ * and may leave a partial record at the end, which readers ignore.
+ */
+struct BinLogHeader
+{
+    char magic[4];              // BINLOG_MAGIC
+    uint16_t version;           // BINLOG_VERSION
+    uint16_t record_size;       // sizeof(BinLogRecord)
+    int64_t t_open_nsec;        // CLOCK_MONOTONIC when the log was opened
+    int64_t t_open_realtime;    // CLOCK_REALTIME at the same moment
+    uint32_t reserved[2];
+};
+
+// Record types
+#define BINLOG_SENSOR 1
+// Telemetry (see telemetry.h)
+#define BINLOG_CHANNEL 2
+#define BINLOG_SYSTEM 3
+#define BINLOG_THREAD 4
+#define BINLOG_GAUGE 5
+#define BINLOG_LATENCY 6
+
+struct BinLogRecord
+{
+    uint16_t type;
+    uint16_t flags;
+    uint32_t seq;               // gaps mean records were dropped
+    int64_t t_nsec;
+    uint8_t payload[BINLOG_PAYLOAD];
+};
+
+// BINLOG_SENSOR payload
+struct BinLogSensor
+{
+    float pressure;             // mbar
+    float temperature;          // deg C
+    uint64_t frame_id;
+};
+
+// BINLOG_CHANNEL payload: names the channel of later THREAD, GAUGE and
+// LATENCY records, once before the first of them
+struct BinLogChannel
+{
+    uint16_t channel;
+    uint16_t type;              // of the records it names
+    char name[12];              // NUL terminated, truncated
+};
+
+// BINLOG_SYSTEM payload
+#define BINLOG_NO_THROTTLE_INFO 0x80000000u
+
+struct BinLogSystem
+{
+    int32_t soc_mdegc;          // SoC temperature, INT32_MIN if unknown
+    uint32_t throttled;         // firmware get_throttled bits, or BINLOG_NO_THROTTLE_INFO
+    uint32_t cpu_khz;           // clock of cpu0, 0 if unknown
+    uint32_t reserved;
+};
+
+// BINLOG_THREAD payload: the threads of one name over the last period
+struct BinLogThread
+{
+    uint16_t channel;
+    uint16_t threads;
+    uint32_t cpu_us;            // on a CPU
+    uint32_t wait_us;           // runnable, waiting for a CPU
+    uint32_t period_us;
+};
+
+// BINLOG_GAUGE payload
+struct BinLogGauge
+{
+    uint16_t channel;
+    uint16_t reserved;
+    uint32_t reserved2;
+    int64_t value;
+};
+
+// BINLOG_LATENCY payload: what was recorded over the last period, rounded
+// up to the bucket, at most 12.5 % high
+struct BinLogLatency
+{
+    uint16_t channel;
+    uint16_t count;             // saturates
+    uint32_t p50_us;
+    uint32_t p99_us;
+    uint32_t max_us;            // exact
+};
+
+/*
+ * Append-only binary log. append() copies a record into a ring that is
+ * allocated by open(); a background thread writes whatever accumulated with
+ * write(2) every flush interval (or once the ring is half full) and
+ * fdatasync()s it. When the ring is full new records are dropped and
+ * counted, the caller never waits on the SD card.
+ */
+class BinLog
+{
+public:
+    BinLog();
+    ~BinLog();
+
+    BinLog(const BinLog&) = delete;
+    BinLog& operator= (const BinLog&) = delete;
+
+    int open(const char *path, size_t capacity = BINLOG_CAPACITY, int flushMs = BINLOG_FLUSH_MS);
+    /** Write out what is left, then close the file
+     */
+    void close();
+    bool isOpen() const { return fd >= 0; }
+
+    /** len is at most BINLOG_PAYLOAD. False if the record was dropped.
+     */
+    bool append(uint16_t type, long long t_nsec, const void *payload, size_t len);
+
+    /** Records waiting for the writer thread
+     */
+    size_t queued();
+    /** Time every write and fdatasync into rec (telemetry.h), NULL for
+     *  none. Set before open().
+     */
+    void setFlushLatency(LatencyRecorder *rec) { flushLatency = rec; }
+
+    unsigned long written() const { return nWritten; }
+    unsigned long dropped() const { return nDropped; }
+
+private:
+    int fd;
+    int flushMs;
+    std::vector<BinLogRecord> ring;
+    size_t head;                // oldest record not on disk yet
+    size_t count;
+    uint32_t seq;
+
+    std::mutex mtx;
+    std::condition_variable wake;
+    bool running;
+    std::thread writer;
+
+    std::atomic<unsigned long> nWritten;
+    std::atomic<unsigned long> nDropped;
+    LatencyRecorder *flushLatency;
+
+    void loop();
+    int flush();
+};
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef MISSIONSETTINGS_H
+#define MISSIONSETTINGS_H
+
+#include <stdio.h>
+#include <string>
+#include <vector>
+
+#include "binlog.h"
+#include "rtthreads.h"
+#include "telemetry.h"
+
+#define MISSION_SETTINGS_PATH "mission.conf"
+
+/*
+ * Everything that differs between deployments, read by both minions and
+ * simple-snapimage from one mission file of "key = value" lines, '#'
+ * starting a comment. Keys are the member names; a key left out keeps the
+ * default below, which is what both programs do without a file. Per key
+ * the file table in missionsettings.cpp says whether minions may take a new
+ * value on SIGHUP or only on the next start.
+ */
+struct MissionSettings
+{
+    // Time sync with the server (minions)
+    std::string server_ip = "192.168.4.1";
+    int server_port = 8080;
+    int sync_rounds = 25;               // TPSN rounds per skew measurement
+    std::string sync_estimator = "minrtt";
+    bool kernel_timestamps = false;
+    int sync_period_s = 301;            // full resync
+    int drift_period_s = 61;            // skew and drift check
+    int timer_offset_ms = 500;          // sync and drift timers this far off the trigger edge
+
+    // Triggering
+    double framerate = 1;               // fps without depth gating
+    double strobe_prefire_us = 200;
+    double strobe_width_us = 0;         // 0: no strobe, LED as wired
+    std::string gpio = "mem";
+
+    // Board, wiringPi pin numbers
+    int i2c_bus = 1;
+    int trig_pin = 2;
+    int led_pin = 4;
+    int led_en_pin = 17;
+    int led_fault_pin = 18;
+    int led_fault_level = 0;
+    bool rtc = true;                    // DS3231 on the I2C bus for wall clock and holdover
+    int rtc_sqw_pin = -1;               // its 1 Hz SQW output, -1 if not wired
+
+    // Thread layout of both programs, see rtthreads.h; cores -1 for any
+    bool realtime = true;               // SCHED_FIFO, pinned threads, locked memory
+    int trigger_cpu = RT_TRIGGER_CPU;
+    int capture_cpu = RT_CAPTURE_CPU;
+    int service_cpu = RT_SERVICE_CPU;   // sync and sensors
+
+    // Pressure sensor and its log
+    int sample_rate_hz = 10;
+    int surface_sample_rate_hz = 1;
+    bool binary_log = false;
+    int log_flush_ms = BINLOG_FLUSH_MS;
+    // Resource telemetry of both programs (telemetry.h), 0 for none
+    int telemetry_period_s = TELEMETRY_PERIOD_S;
+
+    // Depth gating: capture only below start_depth, fps by depth band
+    bool depth_gating = false;
+    double start_depth = 20;            // m
+    double hysteresis = 2;              // m
+    int confirm = 3;                    // agreeing samples before switching
+    std::string bands;                  // "depth:fps[,depth:fps...]", empty for 1 fps
+
+    // Capture (simple-snapimage)
+    std::string serials = "15410110,41810422";  // by serial index
+    int capture_width = 2592;
+    int capture_height = 1944;
+    int capture_fps_num = 15;
+    int capture_fps_den = 2;
+    std::string capture_mode = "full";  // readout: full, binN, skipN, roi:WxH[+X+Y]
+    // Survey: a smaller, faster readout where full frames are not needed,
+    // shallower than survey_depth (back to full hysteresis deeper) and
+    // after survey_blank_frames blank frames in a row; both 0 and it is
+    // never used
+    std::string survey_mode = "bin2";
+    int survey_fps_num = 30;
+    int survey_fps_den = 1;
+    double survey_depth = 0;            // m
+    int survey_blank_frames = 0;
+    // Live frames to the master (simple-snapimage), see streamproto.h
+    std::string stream_host = "";       // empty for none, e.g. 192.168.4.1
+    int stream_port = 8082;
+    int stream_scale = 8;               // downscaled by this
+    double stream_fps = 1;              // all cameras together
+    int stream_kbps = 500;
+    std::string data_dir = "/home/pi/data";
+    double mission_hours = 0;           // planned deployment, 0 if open ended
+};
+
+/** Read path into *settings. Keys missing from the file keep their value
+ *  in *settings. Unknown keys, values out of range and settings that do
+ *  not fit together are errors: -1 with the first one in *error, and
+ *  *settings left unchanged.
+ */
+int loadMissionSettings(const char *path, MissionSettings *settings, std::string *error);
+
+/** Read path again while running. *file is what path held last time
+ *  (loaded onto the defaults), *settings what is in force, e.g. with
+ *  command line options on top. Keys changed in the file that are safe to
+ *  change take their new value in both; changed keys that need a restart
+ *  keep the old one and are listed in *restart. -1 and nothing changed on
+ *  errors.
+ */
+int reloadMissionSettings(const char *path, MissionSettings *file, MissionSettings *settings,
+                          std::vector<std::string> *restart, std::string *error);
+
+/** Every key with its value, itself a complete mission file
+ */
+void printMissionSettings(FILE *out, const MissionSettings &settings);
+
+/** Split a comma separated list, e.g. serials
+ */
+std::vector<std::string> splitList(const std::string &list);
+
+/** The thread layout keys
+ */
+ThreadLayout threadLayoutOf(const MissionSettings &settings);
+
+#endif
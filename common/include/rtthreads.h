@@ -0,0 +1,77 @@
+#ifndef RTTHREADS_H
+#define RTTHREADS_H
+
+#include <stddef.h>
+
+// Default layout, the cores run_cset.sh shields (1-3): the trigger alone
+// on 3, the cameras' streaming threads on 2, sync and sensors on 1
+#define RT_TRIGGER_CPU 3
+#define RT_CAPTURE_CPU 2
+#define RT_SERVICE_CPU 1
+#define RT_PRIORITY_TRIGGER 99
+#define RT_PRIORITY_SENSOR 80
+#define RT_PRIORITY_SYNC 70
+#define RT_PRIORITY_CAPTURE 60
+// Stack touched up front by every real-time thread, so the first deep
+// call does not page fault
+#define RT_STACK_PREFAULT (64 * 1024)
+// Default stack of threads created after lockMemory(), mlockall() maps
+// in all of it
+#define RT_THREAD_STACK (512 * 1024)
+// cpu argument of setThreadRole(): the layout's core for the role
+#define RT_CPU_DEFAULT -2
+
+/*
+ * What a thread does, which decides how it is scheduled: SCHED_FIFO,
+ * pinned to its core, down to plain time sharing for anything that may
+ * block on the SD card, and below that what may as well not run at all.
+ */
+enum class ThreadRole
+{
+    Trigger,        // camera trigger edges (minions), SCHED_FIFO 99
+    Sensor,         // pressure sampler, RTC second edges, SCHED_FIFO 80
+    Sync,           // main loop and TPSN exchanges (minions), SCHED_FIFO 70
+    Capture,        // a camera's streaming thread, SCHED_FIFO 60
+    Writer,         // encoding and writing frames or logs, SCHED_OTHER
+    Background,     // anything else, SCHED_OTHER
+    Idle            // only on spare time, e.g. streaming previews, SCHED_IDLE
+};
+
+const char *threadRoleName(ThreadRole role);
+
+/*
+ * Where the roles go. With realtime off nothing is changed but the thread
+ * names and cores given explicitly, as without root.
+ */
+struct ThreadLayout
+{
+    bool realtime = true;
+    int triggerCpu = RT_TRIGGER_CPU;
+    int captureCpu = RT_CAPTURE_CPU;
+    int serviceCpu = RT_SERVICE_CPU;    // sensor and sync
+};
+
+/** Set once at start, before any thread takes its role
+ */
+void setThreadLayout(const ThreadLayout &layout);
+const ThreadLayout &threadLayout();
+
+/** Lock all memory, current and future, and prefault the calling thread's
+ *  stack. Threads created afterwards default to RT_THREAD_STACK. Without
+ *  realtime in the layout this does nothing. -1 if not permitted.
+ */
+int lockMemory();
+
+/** The calling thread takes role: scheduling, core (cpu, -1 for any, or
+ *  the layout's), name, and a prefaulted stack if it is real-time. -1 if
+ *  the system refused some of it, which is reported once per role; the
+ *  thread runs on regardless.
+ */
+int setThreadRole(ThreadRole role, int cpu = RT_CPU_DEFAULT);
+
+/** Tell whoever started us that we are up: one line to fd, which is then
+ *  closed (the s6 readiness convention). Does nothing for fd < 0.
+ */
+void notifyReady(int fd);
+
+#endif
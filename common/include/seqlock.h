@@ -0,0 +1,60 @@
+#ifndef SEQLOCK_H
+#define SEQLOCK_H
+
+#include <stdint.h>
+#include <atomic>
+
+/*
+ * Single writer, many reader seqlock for small trivially copyable values.
+ * The writer never waits; readers retry while a write is in progress.
+ * Readers give up after a number of tries instead of spinning, so a
+ * high-priority reader cannot starve a preempted writer on the same core.
+ */
+template <typename T>
+class Seqlock
+{
+public:
+    Seqlock() : seq(0), value() {}
+
+    Seqlock(const Seqlock&) = delete;
+    Seqlock& operator= (const Seqlock&) = delete;
+
+    void store(const T &v)
+    {
+        uint32_t s = seq.load(std::memory_order_relaxed);
+        seq.store(s + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        value = v;
+        seq.store(s + 2, std::memory_order_release);
+    }
+
+    /** False if no consistent copy was had within tries attempts.
+     */
+    bool load(T *out, int tries = 100) const
+    {
+        for (int i = 0; i < tries; i++)
+        {
+            uint32_t before = seq.load(std::memory_order_acquire);
+            if (before & 1)
+                continue;
+            T copy = value;
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (seq.load(std::memory_order_relaxed) == before)
+            {
+                *out = copy;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /** Number of stores so far
+     */
+    uint32_t version() const { return seq.load(std::memory_order_acquire) / 2; }
+
+private:
+    std::atomic<uint32_t> seq;
+    T value;
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+/*
+ * Bounded single producer, single consumer queue. push() and pop() never
+ * block, never allocate and are safe from a real-time thread. N must be a
+ * power of two; one slot stays unused to tell full from empty.
+ */
+template <typename T, size_t N>
+class SpscQueue
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "SpscQueue size must be a power of two");
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue& operator= (const SpscQueue&) = delete;
+
+    /** Producer only. False if the queue is full.
+     */
+    bool push(const T &item)
+    {
+        size_t t = tail.load(std::memory_order_relaxed);
+        size_t next = (t + 1) & (N - 1);
+        if (next == head.load(std::memory_order_acquire))
+            return false;
+        buf[t] = item;
+        tail.store(next, std::memory_order_release);
+        return true;
+    }
+
+    /** Consumer only. False if the queue is empty.
+     */
+    bool pop(T *item)
+    {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return false;
+        *item = buf[h];
+        head.store((h + 1) & (N - 1), std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    // Keep the indices on separate cache lines so producer and consumer
+    // do not bounce one line between cores
+    alignas(64) std::atomic<size_t> head;
+    alignas(64) std::atomic<size_t> tail;
+    T buf[N];
+};
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef STATEJOURNAL_H
+#define STATEJOURNAL_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define STATE_JOURNAL_MAGIC "MJNL"
+#define STATE_JOURNAL_VERSION 1
+#define STATE_JOURNAL_SLOT 512
+
+/*
+ * Each slot starts with this, followed by the record. crc is the CRC-32
+ * of header (with crc 0) and record. Little-endian.
+ */
+struct StateSlotHeader
+{
+    char magic[4];              // STATE_JOURNAL_MAGIC
+    uint16_t version;           // STATE_JOURNAL_VERSION
+    uint16_t size;              // record bytes
+    uint32_t crc;
+    uint32_t reserved;
+    uint64_t seq;               // the newest valid slot wins
+};
+
+/*
+ * Crash-safe store of one small fixed-size record, e.g. where a mission
+ * stood. The file holds two slots that are written alternately with one
+ * pwrite(2) and fdatasync(2) each, so a power cut halfway through a save
+ * only damages the slot being written and load() falls back to the other.
+ * Costs one sector write per save; not thread safe.
+ */
+class StateJournal
+{
+public:
+    StateJournal();
+    ~StateJournal();
+
+    StateJournal(const StateJournal&) = delete;
+    StateJournal& operator= (const StateJournal&) = delete;
+
+    /** Open or create path for records of size bytes, at most
+     *  STATE_JOURNAL_SLOT - sizeof(StateSlotHeader)
+     */
+    int open(const char *path, size_t size);
+    void close();
+
+    /** Newest intact record into record. False if there is none, e.g. on
+     *  the first start.
+     */
+    bool load(void *record);
+    /** Call load() first, or the first save may replace the newest record
+     */
+    int save(const void *record);
+
+private:
+    int fd;
+    size_t size;
+    uint64_t seq;
+};
+
+uint32_t crc32(const void *data, size_t len, uint32_t crc = 0);
+
+#endif
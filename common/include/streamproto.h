@@ -0,0 +1,134 @@
+#ifndef STREAMPROTO_H
+#define STREAMPROTO_H
+
+/*
+ * Wire format of the live frame stream from simple-snapimage to the
+ * master, UDP to STREAM_PORT. Plain C like syncproto.h, so a receiver on
+ * the master can include it.
+ *
+ * One frame is one PNG, downscaled, cut into datagrams of at most
+ * STREAM_DATAGRAM bytes. Every datagram carries the whole header, so a
+ * receiver can start with any of them and tell a frame complete by its
+ * chunk count. All fields little-endian:
+ *
+ *      0   uint16  magic       STREAM_MAGIC
+ *      2   uint8   version     STREAM_VERSION
+ *      3   uint8   scale       the full frame is scale times larger
+ *      4   uint32  seq         frame number of this sender
+ *      8   uint16  chunk       index of this datagram in the frame
+ *     10   uint16  chunks
+ *     12   uint32  size        PNG bytes of the whole frame
+ *     16   int64   frame_id
+ *     24   int64   timestamp   ns, CLOCK_MONOTONIC of the float at arrival
+ *     32   int64   trigger_id  -1 without a trigger
+ *     40   uint32  pressure    mbar, IEEE 754 single
+ *     44   uint32  temperature degC, IEEE 754 single
+ *     48   uint16  camera_id
+ *     50   uint16  width       of the full frame
+ *     52   uint16  height
+ *     54   uint16  reserved, 0
+ *     56   PNG bytes chunk * STREAM_CHUNK_BYTES on, STREAM_CHUNK_BYTES of
+ *          them but in the last chunk
+ */
+
+#include <stdint.h>
+#include <string.h>
+
+#define STREAM_MAGIC 0x5346         // "SF"
+#define STREAM_VERSION 1
+#define STREAM_PORT 8082
+#define STREAM_HEADER_SIZE 56
+// Below the WiFi path MTU, so no datagram is fragmented
+#define STREAM_DATAGRAM 1200
+#define STREAM_CHUNK_BYTES (STREAM_DATAGRAM - STREAM_HEADER_SIZE)
+
+struct stream_header
+{
+    uint8_t scale;
+    uint32_t seq;
+    uint16_t chunk;
+    uint16_t chunks;
+    uint32_t size;
+    int64_t frame_id;
+    int64_t timestamp_ns;
+    int64_t trigger_id;
+    float pressure;
+    float temperature;
+    uint16_t camera_id;
+    uint16_t width;
+    uint16_t height;
+};
+
+
+static inline void stream_put_le(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (uint8_t) (v >> (8 * i));
+}
+
+static inline uint64_t stream_get_le(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v |= ((uint64_t) p[i]) << (8 * i);
+    return v;
+}
+
+static inline uint32_t stream_float_bits(float f)
+{
+    uint32_t v;
+    memcpy(&v, &f, sizeof(v));
+    return v;
+}
+
+static inline float stream_bits_float(uint32_t v)
+{
+    float f;
+    memcpy(&f, &v, sizeof(f));
+    return f;
+}
+
+static inline void stream_encode(const struct stream_header *h, uint8_t *buf)
+{
+    stream_put_le(buf, STREAM_MAGIC, 2);
+    buf[2] = STREAM_VERSION;
+    buf[3] = h->scale;
+    stream_put_le(buf + 4, h->seq, 4);
+    stream_put_le(buf + 8, h->chunk, 2);
+    stream_put_le(buf + 10, h->chunks, 2);
+    stream_put_le(buf + 12, h->size, 4);
+    stream_put_le(buf + 16, (uint64_t) h->frame_id, 8);
+    stream_put_le(buf + 24, (uint64_t) h->timestamp_ns, 8);
+    stream_put_le(buf + 32, (uint64_t) h->trigger_id, 8);
+    stream_put_le(buf + 40, stream_float_bits(h->pressure), 4);
+    stream_put_le(buf + 44, stream_float_bits(h->temperature), 4);
+    stream_put_le(buf + 48, h->camera_id, 2);
+    stream_put_le(buf + 50, h->width, 2);
+    stream_put_le(buf + 52, h->height, 2);
+    stream_put_le(buf + 54, 0, 2);
+}
+
+/* Returns -1 if buf is not a datagram of this version */
+static inline int stream_decode(const uint8_t *buf, size_t len, struct stream_header *h)
+{
+    if (len < STREAM_HEADER_SIZE || stream_get_le(buf, 2) != STREAM_MAGIC || buf[2] != STREAM_VERSION)
+        return -1;
+    h->scale = buf[3];
+    h->seq = (uint32_t) stream_get_le(buf + 4, 4);
+    h->chunk = (uint16_t) stream_get_le(buf + 8, 2);
+    h->chunks = (uint16_t) stream_get_le(buf + 10, 2);
+    h->size = (uint32_t) stream_get_le(buf + 12, 4);
+    h->frame_id = (int64_t) stream_get_le(buf + 16, 8);
+    h->timestamp_ns = (int64_t) stream_get_le(buf + 24, 8);
+    h->trigger_id = (int64_t) stream_get_le(buf + 32, 8);
+    h->pressure = stream_bits_float((uint32_t) stream_get_le(buf + 40, 4));
+    h->temperature = stream_bits_float((uint32_t) stream_get_le(buf + 44, 4));
+    h->camera_id = (uint16_t) stream_get_le(buf + 48, 2);
+    h->width = (uint16_t) stream_get_le(buf + 50, 2);
+    h->height = (uint16_t) stream_get_le(buf + 52, 2);
+    if (h->chunks == 0 || h->chunk >= h->chunks)
+        return -1;
+    return 0;
+}
+
+#endif
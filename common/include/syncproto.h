@@ -0,0 +1,148 @@
+#ifndef SYNCPROTO_H
+#define SYNCPROTO_H
+
+/*
+ * Wire format of the TPSN sync exchange between the cameras and the LED
+ * server (modules/tcp_synchronization_c/server/server2.c). Plain C so the
+ * server can include it as well: build it with -I../../../common/include.
+ *
+ * Every message is one fixed size packet, all fields little-endian no
+ * matter what time_t or the host byte order are:
+ *
+ *      0   uint16  magic       SYNC_MAGIC
+ *      2   uint8   version     SYNC_VERSION
+ *      3   uint8   type        enum sync_type
+ *      4   uint32  seq         chosen by the client, echoed in the reply
+ *      8   int64   t[3]        nanoseconds, meaning depends on type
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#define SYNC_MAGIC 0x534d          // "MS"
+#define SYNC_VERSION 1
+#define SYNC_PACKET_SIZE 32
+// The master announces the trigger schedule to every client at once here
+#define SYNC_MCAST_GROUP "239.255.77.1"
+#define SYNC_MCAST_PORT 8081
+
+enum sync_type
+{
+    SYNC_TPSN_REQ = 1,      // client -> server, t[0] = T1
+    SYNC_TPSN_REPLY,        // server -> client, t[0] = T2, t[1] = T3
+    SYNC_START_REQ,         // client -> server, done averaging, asks for the start time
+    SYNC_START,             // server -> client, t[0] = trigger start time, 0 if not set yet,
+                            // t[1] = trigger period
+    SYNC_READY,             // client -> server, start time received, ready to trigger
+    SYNC_READY_ACK,         // server -> client
+    SYNC_ANNOUNCE           // server -> SYNC_MCAST_GROUP, t[0] and t[1] as SYNC_START,
+                            // t[2] = send time; seq changes with the schedule
+};
+
+struct sync_packet
+{
+    uint8_t type;
+    uint32_t seq;
+    int64_t t[3];
+};
+
+
+static inline void sync_put_le(uint8_t *p, uint64_t v, int bytes)
+{
+    for (int i = 0; i < bytes; i++)
+        p[i] = (uint8_t) (v >> (8 * i));
+}
+
+static inline uint64_t sync_get_le(const uint8_t *p, int bytes)
+{
+    uint64_t v = 0;
+    for (int i = 0; i < bytes; i++)
+        v |= ((uint64_t) p[i]) << (8 * i);
+    return v;
+}
+
+static inline void sync_encode(const struct sync_packet *pkt, uint8_t *buf)
+{
+    sync_put_le(buf, SYNC_MAGIC, 2);
+    buf[2] = SYNC_VERSION;
+    buf[3] = pkt->type;
+    sync_put_le(buf + 4, pkt->seq, 4);
+    for (int i = 0; i < 3; i++)
+        sync_put_le(buf + 8 + 8 * i, (uint64_t) pkt->t[i], 8);
+}
+
+/* Returns -1 if buf is not a packet of this version */
+static inline int sync_decode(const uint8_t *buf, struct sync_packet *pkt)
+{
+    if (sync_get_le(buf, 2) != SYNC_MAGIC || buf[2] != SYNC_VERSION)
+        return -1;
+    pkt->type = buf[3];
+    pkt->seq = (uint32_t) sync_get_le(buf + 4, 4);
+    for (int i = 0; i < 3; i++)
+        pkt->t[i] = (int64_t) sync_get_le(buf + 8 + 8 * i, 8);
+    return 0;
+}
+
+
+/* read() until len bytes arrived. Returns len, 0 if the peer closed the
+ * connection first and -1 on errors (including SO_RCVTIMEO timeouts).
+ */
+static inline ssize_t read_full(int fd, void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = read(fd, (uint8_t *) buf + done, len - done);
+        if (n == 0)
+            return 0;
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += (size_t) n;
+    }
+    return (ssize_t) len;
+}
+
+/* send() all of buf, without SIGPIPE. Returns len or -1.
+ */
+static inline ssize_t write_full(int fd, const void *buf, size_t len)
+{
+    size_t done = 0;
+    while (done < len)
+    {
+        ssize_t n = send(fd, (const uint8_t *) buf + done, len - done, MSG_NOSIGNAL);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        done += (size_t) n;
+    }
+    return (ssize_t) len;
+}
+
+static inline int sync_send(int fd, const struct sync_packet *pkt)
+{
+    uint8_t buf[SYNC_PACKET_SIZE];
+    sync_encode(pkt, buf);
+    return write_full(fd, buf, SYNC_PACKET_SIZE) == SYNC_PACKET_SIZE ? 0 : -1;
+}
+
+/* Returns 0, or -1 on errors, a closed connection or a foreign packet */
+static inline int sync_recv(int fd, struct sync_packet *pkt)
+{
+    uint8_t buf[SYNC_PACKET_SIZE];
+    if (read_full(fd, buf, SYNC_PACKET_SIZE) != SYNC_PACKET_SIZE)
+        return -1;
+    return sync_decode(buf, pkt);
+}
+
+#endif
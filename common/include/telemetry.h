@@ -0,0 +1,159 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <functional>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+
+#include "binlog.h"
+
+#define TELEMETRY_PERIOD_S 10
+// Thread names past this many share the channel "other"
+#define TELEMETRY_THREAD_CHANNELS 48
+// Latency buckets: 1 us wide below 8 us, then 8 per doubling, up to
+// 2^(LATENCY_OCTAVES + 2) us (about 9 min)
+#define LATENCY_SUB_BITS 3
+#define LATENCY_OCTAVES 27
+#define LATENCY_BUCKETS (LATENCY_OCTAVES << LATENCY_SUB_BITS)
+
+/*
+ * Latency of one operation, e.g. a write to the SD card, over a telemetry
+ * period. record() is a few relaxed atomic operations, so it is fine from
+ * any thread, real-time ones included. The telemetry thread takes the
+ * period's distribution and starts over.
+ */
+class LatencyRecorder
+{
+public:
+    LatencyRecorder();
+
+    LatencyRecorder(const LatencyRecorder&) = delete;
+    LatencyRecorder& operator= (const LatencyRecorder&) = delete;
+
+    void record(long long ns)
+    {
+        long long us = ns > 0 ? ns / 1000 : 0;
+        bins[bucket(us)].fetch_add(1, std::memory_order_relaxed);
+        long long m = maxNs.load(std::memory_order_relaxed);
+        while (ns > m && !maxNs.compare_exchange_weak(m, ns, std::memory_order_relaxed))
+            ;
+    }
+
+    /** Count, p50, p99 and max since the last call, then clear. Channel is
+     *  left alone.
+     */
+    void take(BinLogLatency *out);
+
+private:
+    std::atomic<uint32_t> bins[LATENCY_BUCKETS];
+    std::atomic<long long> maxNs;
+
+    static int bucket(long long us)
+    {
+        if (us < (1 << LATENCY_SUB_BITS))
+            return (int) us;
+        int msb = 63 - __builtin_clzll((unsigned long long) us);
+        int octave = msb - LATENCY_SUB_BITS + 1;
+        if (octave >= LATENCY_OCTAVES)
+            return LATENCY_BUCKETS - 1;
+        int sub = (int) (us >> (msb - LATENCY_SUB_BITS)) & ((1 << LATENCY_SUB_BITS) - 1);
+        return (octave << LATENCY_SUB_BITS) + sub;
+    }
+    // First us past bucket i
+    static long long bucketEnd(int i);
+};
+
+/*
+ * What the process and the board were up to, every period into a binary
+ * log of its own (BINLOG_SYSTEM, THREAD, GAUGE and LATENCY records, see
+ * binlog.h), so a float that dropped frames can tell why once it is
+ * recovered: SoC temperature, the firmware's throttling and under-voltage
+ * flags and the CPU clock from sysfs; CPU and run queue wait time per
+ * thread name from /proc/self/task; the gauges and latencies registered
+ * by the program. A background thread does all of it, a handful of file
+ * reads per period; nothing is asked of the threads being watched. New
+ * throttling flags are also printed when they appear.
+ */
+class Telemetry
+{
+public:
+    typedef std::function<long long()> Gauge;
+
+    Telemetry();
+    ~Telemetry();
+
+    Telemetry(const Telemetry&) = delete;
+    Telemetry& operator= (const Telemetry&) = delete;
+
+    /** A value read on the telemetry thread every period, e.g. a queue
+     *  depth or a count. Before start().
+     */
+    void addGauge(const char *name, Gauge read);
+    /** A latency to record into, valid as long as this Telemetry. Before
+     *  start().
+     */
+    LatencyRecorder *addLatency(const char *name);
+
+    /** Open the log at path and sample every periodS. -1 if the log cannot
+     *  be opened.
+     */
+    int start(const char *path, int periodS = TELEMETRY_PERIOD_S);
+    /** One last sample, then close the log
+     */
+    void stop();
+
+private:
+    struct GaugeEntry
+    {
+        uint16_t channel;
+        std::string name;
+        Gauge read;
+    };
+    struct LatencyEntry
+    {
+        uint16_t channel;
+        std::string name;
+        std::unique_ptr<LatencyRecorder> rec;
+    };
+    // Time on a CPU and waiting for one so far, ns
+    struct ThreadTimes
+    {
+        long long cpu;
+        long long wait;
+    };
+
+    BinLog log;
+    int periodS;
+    uint16_t nextChannel;
+    std::vector<GaugeEntry> gauges;
+    std::vector<LatencyEntry> latencies;
+    std::map<std::string, uint16_t> threadChannels;
+    std::map<int, ThreadTimes> threadTimes;
+    long long tLast;
+    uint32_t throttled;
+
+    int thermalFd;
+    int throttleFd;
+    int freqFd;
+
+    std::mutex mtx;
+    std::condition_variable wake;
+    bool running;
+    std::thread sampler;
+
+    void loop();
+    void sample();
+    void sampleSystem(long long t);
+    void sampleThreads(long long t, bool baseline);
+    uint16_t nameChannel(uint16_t type, const std::string &name);
+};
+
+#endif
@@ -0,0 +1,120 @@
+#ifndef TRIGGERCHANNEL_H
+#define TRIGGERCHANNEL_H
+
+#include <stdint.h>
+#include <time.h>
+#include <atomic>
+
+#define TRIGGER_CHANNEL_NAME "/minions-trigger"
+#define TRIGGER_CHANNEL_SLOTS 256
+#define TRIGGER_CHANNEL_MAGIC 0x4d545247  // "MTRG"
+#define TRIGGER_CHANNEL_VERSION 1
+
+/*
+ * What minions knows about one camera trigger
+ */
+struct TriggerRecord
+{
+    uint64_t frame_id;      // trigger count since minions started
+    int64_t trigger_ns;     // CLOCK_MONOTONIC time of the trigger edge
+    float pressure;         // mbar
+    float temperature;      // deg C
+};
+
+/*
+ * Broadcast ring in POSIX shared memory. minions publishes one record per
+ * trigger; every imaging process maps it read-only and keeps its own read
+ * cursor, so several consumers see every record and none of them can slow
+ * the producer down. Each slot is a seqlock: a reader that races the writer
+ * notices and drops the record instead of reading a torn one.
+ */
+class TriggerChannel
+{
+public:
+    TriggerChannel();
+    ~TriggerChannel();
+
+    TriggerChannel(const TriggerChannel&) = delete;
+    TriggerChannel& operator= (const TriggerChannel&) = delete;
+
+    /** Producer side. Creates the ring or reuses an existing one, so a
+     *  restarted producer continues the sequence. Returns -1 on error.
+     */
+    int create(const char *name = TRIGGER_CHANNEL_NAME);
+
+    /** Consumer side. Returns -1 if the producer has not created it yet.
+     */
+    int attach(const char *name = TRIGGER_CHANNEL_NAME);
+
+    void close();
+    bool isOpen() const { return shm != nullptr; }
+
+    /** Lock-free and async-signal-safe.
+     */
+    void publish(const TriggerRecord &rec);
+
+    /** Sequence number the next published record will get.
+     */
+    uint32_t head() const;
+
+    /** Copy record seq. False if it is not published yet or was overwritten.
+     */
+    bool read(uint32_t seq, TriggerRecord *rec) const;
+
+private:
+    struct Slot
+    {
+        std::atomic<uint32_t> seq;  // record seq + 1 when valid, 0 while written
+        TriggerRecord rec;
+    };
+
+    struct Shared
+    {
+        uint32_t magic;
+        uint32_t version;
+        uint32_t slots;
+        std::atomic<uint32_t> head;
+        Slot slot[TRIGGER_CHANNEL_SLOTS];
+    };
+
+    Shared *shm;
+    bool writable;
+
+    int map(const char *name, bool create);
+};
+
+/*
+ * Consumer cursor that pairs frames with the trigger that exposed them.
+ * A frame arriving at t takes the newest unused trigger fired between
+ * max_latency_ns and min_latency_ns before t, and every older one is
+ * passed over, so a trigger whose frame was dropped never shifts later
+ * matches, whatever the trigger period. This assumes a frame arrives
+ * before the next trigger fires plus min_latency_ns; raise
+ * min_latency_ns towards the delivery latency when that is longer than a
+ * period. Attaches lazily, so consumers may start before minions.
+ */
+class TriggerMatcher
+{
+public:
+    TriggerMatcher(int64_t min_latency_ns, int64_t max_latency_ns,
+                   const char *name = TRIGGER_CHANNEL_NAME);
+
+    /** Returns false if no trigger fits, rec is left untouched then.
+     */
+    bool match(int64_t arrival_ns, TriggerRecord *rec);
+
+    unsigned long matched() const { return nMatched; }
+    unsigned long unmatched() const { return nUnmatched; }
+
+private:
+    TriggerChannel channel;
+    const char *name;
+    int64_t minLatency;
+    int64_t maxLatency;
+    uint32_t cursor;
+    int64_t lastAttempt;
+    unsigned long nMatched;
+    unsigned long nUnmatched;
+};
+
+#endif
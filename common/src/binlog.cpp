@@ -0,0 +1,200 @@
+#include "binlog.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <chrono>
+
+#include "rtthreads.h"
+#include "telemetry.h"
+
+static_assert(sizeof(BinLogHeader) == 32, "BinLogHeader layout changed");
+static_assert(sizeof(BinLogRecord) == 32, "BinLogRecord layout changed");
+static_assert(sizeof(BinLogSensor) <= BINLOG_PAYLOAD, "BinLogSensor too large");
+static_assert(sizeof(BinLogChannel) <= BINLOG_PAYLOAD, "BinLogChannel too large");
+static_assert(sizeof(BinLogSystem) <= BINLOG_PAYLOAD, "BinLogSystem too large");
+static_assert(sizeof(BinLogThread) <= BINLOG_PAYLOAD, "BinLogThread too large");
+static_assert(sizeof(BinLogGauge) <= BINLOG_PAYLOAD, "BinLogGauge too large");
+static_assert(sizeof(BinLogLatency) <= BINLOG_PAYLOAD, "BinLogLatency too large");
+
+
+static long long clock_nsec(clockid_t clk)
+{
+    struct timespec t;
+    clock_gettime(clk, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+BinLog::BinLog()
+    : nWritten(0), nDropped(0)
+{
+    fd = -1;
+    flushMs = BINLOG_FLUSH_MS;
+    head = 0;
+    count = 0;
+    seq = 0;
+    running = false;
+    flushLatency = NULL;
+}
+
+
+BinLog::~BinLog()
+{
+    close();
+}
+
+
+int BinLog::open(const char *path, size_t capacity, int ms)
+{
+    close();
+    fd = ::open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        perror("BinLog: open");
+        return -1;
+    }
+
+    BinLogHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, BINLOG_MAGIC, 4);
+    hdr.version = BINLOG_VERSION;
+    hdr.record_size = sizeof(BinLogRecord);
+    hdr.t_open_nsec = clock_nsec(CLOCK_MONOTONIC);
+    hdr.t_open_realtime = clock_nsec(CLOCK_REALTIME);
+    if (write(fd, &hdr, sizeof(hdr)) != (ssize_t) sizeof(hdr))
+    {
+        perror("BinLog: write header");
+        ::close(fd);
+        fd = -1;
+        return -1;
+    }
+
+    // Allocate and touch the whole ring now, not on the first records
+    ring.assign(capacity > 2 ? capacity : 2, BinLogRecord());
+    head = 0;
+    count = 0;
+    seq = 0;
+    flushMs = ms > 0 ? ms : BINLOG_FLUSH_MS;
+    running = true;
+    writer = std::thread(&BinLog::loop, this);
+    return 0;
+}
+
+
+void BinLog::close()
+{
+    if (fd < 0)
+        return;
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        running = false;
+    }
+    wake.notify_one();
+    writer.join();
+    ::close(fd);
+    fd = -1;
+    if (nDropped)
+        fprintf(stderr, "BinLog: %lu records written, %lu dropped\n",
+                (unsigned long) nWritten, (unsigned long) nDropped);
+}
+
+
+bool BinLog::append(uint16_t type, long long t_nsec, const void *payload, size_t len)
+{
+    std::unique_lock<std::mutex> lck(mtx);
+    if (!running)
+        return false;
+    if (count == ring.size())
+    {
+        seq++;      // leave a gap so the reader sees the loss
+        lck.unlock();
+        nDropped++;
+        return false;
+    }
+
+    BinLogRecord &rec = ring[(head + count) % ring.size()];
+    rec.type = type;
+    rec.flags = 0;
+    rec.seq = seq++;
+    rec.t_nsec = t_nsec;
+    memset(rec.payload, 0, sizeof(rec.payload));
+    memcpy(rec.payload, payload, len < sizeof(rec.payload) ? len : sizeof(rec.payload));
+    count++;
+    bool half = count == ring.size() / 2;
+    lck.unlock();
+    if (half)
+        wake.notify_one();
+    return true;
+}
+
+
+size_t BinLog::queued()
+{
+    std::lock_guard<std::mutex> lck(mtx);
+    return count;
+}
+
+
+// Write out everything queued so far. Only the writer thread calls this,
+// appenders only ever touch slots behind head + count.
+int BinLog::flush()
+{
+    size_t start, n;
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        start = head;
+        n = count;
+    }
+    if (n == 0)
+        return 0;
+
+    struct iovec iov[2];
+    int iovcnt = 1;
+    size_t first = ring.size() - start < n ? ring.size() - start : n;
+    iov[0].iov_base = &ring[start];
+    iov[0].iov_len = first * sizeof(BinLogRecord);
+    if (first < n)
+    {
+        iov[1].iov_base = &ring[0];
+        iov[1].iov_len = (n - first) * sizeof(BinLogRecord);
+        iovcnt = 2;
+    }
+    ssize_t total = n * sizeof(BinLogRecord);
+    long long t0 = flushLatency ? clock_nsec(CLOCK_MONOTONIC) : 0;
+    ssize_t w = writev(fd, iov, iovcnt);
+    if (w != total)
+        perror("BinLog: write");
+    fdatasync(fd);
+    if (flushLatency)
+        flushLatency->record(clock_nsec(CLOCK_MONOTONIC) - t0);
+
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        head = (head + n) % ring.size();
+        count -= n;
+    }
+    nWritten += n;
+    return w == total ? 0 : -1;
+}
+
+
+void BinLog::loop()
+{
+    // fdatasync may block for a while, never at real-time priority
+    setThreadRole(ThreadRole::Writer);
+    std::unique_lock<std::mutex> lck(mtx);
+    while (running)
+    {
+        wake.wait_for(lck, std::chrono::milliseconds(flushMs),
+                      [this]{ return !running || count >= ring.size() / 2; });
+        lck.unlock();
+        flush();
+        lck.lock();
+    }
+    lck.unlock();
+    flush();
+}
@@ -0,0 +1,373 @@
+#include "missionsettings.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fstream>
+
+enum class SettingType { Int, Double, Bool, String };
+
+/*
+ * One key of the mission file. min/max bound numbers; member points the
+ * key at its field. reload: minions takes a new value on SIGHUP, the rest
+ * is only read at start (pins, the server, the capture format...).
+ */
+struct SettingKey
+{
+    const char *name;
+    SettingType type;
+    double min, max;
+    bool reload;
+    void *(*member)(MissionSettings *s);
+};
+
+#define SETTING(key, type, min, max, reload) \
+    {#key, SettingType::type, min, max, reload, [](MissionSettings *s) -> void * { return &s->key; }}
+
+static const SettingKey keys[] = {
+    SETTING(server_ip, String, 0, 0, false),
+    SETTING(server_port, Int, 1, 65535, false),
+    SETTING(sync_rounds, Int, 1, 100, true),
+    SETTING(sync_estimator, String, 0, 0, true),
+    SETTING(kernel_timestamps, Bool, 0, 0, true),
+    SETTING(sync_period_s, Int, 10, 86400, true),
+    SETTING(drift_period_s, Int, 5, 86400, true),
+    SETTING(timer_offset_ms, Int, 0, 999, true),
+    SETTING(framerate, Double, 0.01, 30, true),
+    SETTING(strobe_prefire_us, Double, 0, 100000, false),
+    SETTING(strobe_width_us, Double, 0, 100000, false),
+    SETTING(gpio, String, 0, 0, false),
+    SETTING(i2c_bus, Int, 0, 16, false),
+    SETTING(trig_pin, Int, 0, 31, false),
+    SETTING(led_pin, Int, 0, 31, false),
+    SETTING(led_en_pin, Int, 0, 31, false),
+    SETTING(led_fault_pin, Int, 0, 31, false),
+    SETTING(led_fault_level, Int, 0, 1, false),
+    SETTING(rtc, Bool, 0, 0, false),
+    SETTING(rtc_sqw_pin, Int, -1, 31, false),
+    SETTING(realtime, Bool, 0, 0, false),
+    SETTING(trigger_cpu, Int, -1, 63, false),
+    SETTING(capture_cpu, Int, -1, 63, false),
+    SETTING(service_cpu, Int, -1, 63, false),
+    SETTING(sample_rate_hz, Int, 1, 1000, true),
+    SETTING(surface_sample_rate_hz, Int, 1, 1000, true),
+    SETTING(binary_log, Bool, 0, 0, false),
+    SETTING(log_flush_ms, Int, 10, 600000, false),
+    SETTING(telemetry_period_s, Int, 0, 3600, false),
+    SETTING(depth_gating, Bool, 0, 0, true),
+    SETTING(start_depth, Double, 0, 11000, true),
+    SETTING(hysteresis, Double, 0, 1000, true),
+    SETTING(confirm, Int, 1, 1000, true),
+    SETTING(bands, String, 0, 0, true),
+    SETTING(serials, String, 0, 0, false),
+    SETTING(capture_width, Int, 1, 65535, false),
+    SETTING(capture_height, Int, 1, 65535, false),
+    SETTING(capture_fps_num, Int, 1, 10000, false),
+    SETTING(capture_fps_den, Int, 1, 10000, false),
+    SETTING(capture_mode, String, 0, 0, false),
+    SETTING(survey_mode, String, 0, 0, false),
+    SETTING(survey_fps_num, Int, 1, 10000, false),
+    SETTING(survey_fps_den, Int, 1, 10000, false),
+    SETTING(survey_depth, Double, 0, 11000, false),
+    SETTING(survey_blank_frames, Int, 0, 1000000, false),
+    SETTING(stream_host, String, 0, 0, false),
+    SETTING(stream_port, Int, 1, 65535, false),
+    SETTING(stream_scale, Int, 1, 64, false),
+    SETTING(stream_fps, Double, 0.01, 30, false),
+    SETTING(stream_kbps, Int, 8, 100000, false),
+    SETTING(data_dir, String, 0, 0, false),
+    SETTING(mission_hours, Double, 0, 100000, false),
+};
+
+#undef SETTING
+
+static const int nKeys = sizeof(keys) / sizeof(keys[0]);
+
+
+static std::string trim(const std::string &s)
+{
+    size_t b = s.find_first_not_of(" \t\r");
+    if (b == std::string::npos)
+        return "";
+    size_t e = s.find_last_not_of(" \t\r");
+    return s.substr(b, e - b + 1);
+}
+
+
+std::vector<std::string> splitList(const std::string &list)
+{
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= list.size())
+    {
+        size_t end = list.find(',', start);
+        if (end == std::string::npos)
+            end = list.size();
+        std::string item = trim(list.substr(start, end - start));
+        if (!item.empty())
+            items.push_back(item);
+        start = end + 1;
+    }
+    return items;
+}
+
+
+ThreadLayout threadLayoutOf(const MissionSettings &s)
+{
+    ThreadLayout layout;
+    layout.realtime = s.realtime;
+    layout.triggerCpu = s.trigger_cpu;
+    layout.captureCpu = s.capture_cpu;
+    layout.serviceCpu = s.service_cpu;
+    return layout;
+}
+
+
+static const SettingKey *findKey(const std::string &name)
+{
+    for (int i = 0; i < nKeys; i++)
+        if (name == keys[i].name)
+            return &keys[i];
+    return NULL;
+}
+
+
+// Parse value into the field of key, false if it is not one
+static bool parseValue(const SettingKey &key, const std::string &value, MissionSettings *s)
+{
+    void *field = key.member(s);
+    char *end;
+    errno = 0;
+    switch (key.type)
+    {
+        case SettingType::Int:
+        {
+            long v = strtol(value.c_str(), &end, 0);
+            if (value.empty() || *end || errno || v < key.min || v > key.max)
+                return false;
+            *(int *) field = (int) v;
+            return true;
+        }
+        case SettingType::Double:
+        {
+            double v = strtod(value.c_str(), &end);
+            if (value.empty() || *end || errno || v < key.min || v > key.max)
+                return false;
+            *(double *) field = v;
+            return true;
+        }
+        case SettingType::Bool:
+            if (value == "true" || value == "yes" || value == "on" || value == "1")
+                *(bool *) field = true;
+            else if (value == "false" || value == "no" || value == "off" || value == "0")
+                *(bool *) field = false;
+            else
+                return false;
+            return true;
+        case SettingType::String:
+            *(std::string *) field = value;
+            return true;
+    }
+    return false;
+}
+
+
+static std::string formatValue(const SettingKey &key, const MissionSettings &s)
+{
+    void *field = key.member(const_cast<MissionSettings *>(&s));
+    char buf[32];
+    switch (key.type)
+    {
+        case SettingType::Int:
+            return std::to_string(*(int *) field);
+        case SettingType::Double:
+            snprintf(buf, sizeof(buf), "%g", *(double *) field);
+            return buf;
+        case SettingType::Bool:
+            return *(bool *) field ? "true" : "false";
+        case SettingType::String:
+            return *(std::string *) field;
+    }
+    return "";
+}
+
+
+static bool sameValue(const SettingKey &key, const MissionSettings &a, const MissionSettings &b)
+{
+    void *x = key.member(const_cast<MissionSettings *>(&a));
+    void *y = key.member(const_cast<MissionSettings *>(&b));
+    switch (key.type)
+    {
+        case SettingType::Int:
+            return *(int *) x == *(int *) y;
+        case SettingType::Double:
+            return *(double *) x == *(double *) y;
+        case SettingType::Bool:
+            return *(bool *) x == *(bool *) y;
+        case SettingType::String:
+            return *(std::string *) x == *(std::string *) y;
+    }
+    return true;
+}
+
+
+static void copyValue(const SettingKey &key, const MissionSettings &from, MissionSettings *to)
+{
+    void *x = key.member(const_cast<MissionSettings *>(&from));
+    void *y = key.member(to);
+    switch (key.type)
+    {
+        case SettingType::Int:
+            *(int *) y = *(int *) x;
+            break;
+        case SettingType::Double:
+            *(double *) y = *(double *) x;
+            break;
+        case SettingType::Bool:
+            *(bool *) y = *(bool *) x;
+            break;
+        case SettingType::String:
+            *(std::string *) y = *(std::string *) x;
+            break;
+    }
+}
+
+
+// Checks across keys; the names of the camera side (estimator, gpio) are
+// checked by minions, the capture modes by simple-snapimage, which know them
+static bool validate(const MissionSettings &s, std::string *error)
+{
+    if (s.drift_period_s >= s.sync_period_s)
+    {
+        *error = "drift_period_s must be shorter than sync_period_s";
+        return false;
+    }
+    const int pins[] = {s.trig_pin, s.led_pin, s.led_en_pin, s.led_fault_pin, s.rtc_sqw_pin};
+    // rtc_sqw_pin last, it may be -1 for not wired
+    const int nPins = s.rtc_sqw_pin >= 0 ? 5 : 4;
+    for (int i = 0; i < nPins; i++)
+        for (int j = i + 1; j < nPins; j++)
+            if (pins[i] == pins[j])
+            {
+                *error = "trig_pin, led_pin, led_en_pin, led_fault_pin and rtc_sqw_pin must differ";
+                return false;
+            }
+    for (const std::string &band : splitList(s.bands))
+    {
+        float depth, fps;
+        char rest;
+        if (sscanf(band.c_str(), "%f:%f%c", &depth, &fps, &rest) != 2 || fps <= 0)
+        {
+            *error = "bands: \"" + band + "\" is not depth:fps";
+            return false;
+        }
+    }
+    if (splitList(s.serials).empty())
+    {
+        *error = "serials: need at least one camera";
+        return false;
+    }
+    if (s.server_ip.empty() || s.data_dir.empty())
+    {
+        *error = "server_ip and data_dir may not be empty";
+        return false;
+    }
+    return true;
+}
+
+
+int loadMissionSettings(const char *path, MissionSettings *settings, std::string *error)
+{
+    std::ifstream in(path);
+    if (!in)
+    {
+        *error = std::string(path) + ": " + strerror(errno);
+        return -1;
+    }
+    MissionSettings s = *settings;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(in, line))
+    {
+        lineNo++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        line = trim(line);
+        if (line.empty())
+            continue;
+        std::string where = std::string(path) + ":" + std::to_string(lineNo) + ": ";
+        size_t eq = line.find('=');
+        if (eq == std::string::npos)
+        {
+            *error = where + "expected key = value";
+            return -1;
+        }
+        std::string name = trim(line.substr(0, eq)), value = trim(line.substr(eq + 1));
+        const SettingKey *key = findKey(name);
+        if (key == NULL)
+        {
+            *error = where + "unknown key " + name;
+            return -1;
+        }
+        if (!parseValue(*key, value, &s))
+        {
+            *error = where + name + ": bad value \"" + value + "\"";
+            if (key->type == SettingType::Int || key->type == SettingType::Double)
+            {
+                char range[64];
+                snprintf(range, sizeof(range), ", %g to %g", key->min, key->max);
+                *error += range;
+            }
+            return -1;
+        }
+    }
+    if (!validate(s, error))
+    {
+        *error = std::string(path) + ": " + *error;
+        return -1;
+    }
+    *settings = s;
+    return 0;
+}
+
+
+int reloadMissionSettings(const char *path, MissionSettings *file, MissionSettings *settings,
+                          std::vector<std::string> *restart, std::string *error)
+{
+    // From the defaults, so a key taken out of the file goes back to its
+    // default like it would on a restart
+    MissionSettings next;
+    if (loadMissionSettings(path, &next, error) == -1)
+        return -1;
+    MissionSettings merged = *settings;
+    restart->clear();
+    for (int i = 0; i < nKeys; i++)
+    {
+        if (sameValue(keys[i], next, *file))
+            continue;
+        if (keys[i].reload)
+            copyValue(keys[i], next, &merged);
+        else
+            restart->push_back(keys[i].name);
+    }
+    // A mix of old and new values has to fit together as well
+    if (!validate(merged, error))
+    {
+        *error = std::string(path) + ": " + *error;
+        return -1;
+    }
+    *settings = merged;
+    for (int i = 0; i < nKeys; i++)
+        if (keys[i].reload)
+            copyValue(keys[i], next, file);
+    return 0;
+}
+
+
+void printMissionSettings(FILE *out, const MissionSettings &settings)
+{
+    for (int i = 0; i < nKeys; i++)
+        fprintf(out, "%s = %s%s\n", keys[i].name, formatValue(keys[i], settings).c_str(),
+                keys[i].reload ? "" : "  # restart");
+}
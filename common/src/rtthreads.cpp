@@ -0,0 +1,173 @@
+#include "rtthreads.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <atomic>
+
+static ThreadLayout layout;
+// Cores we may run on at all (e.g. the cset shield), for threads that are
+// not pinned: they would inherit the core of whoever created them
+static cpu_set_t allowed;
+static bool haveAllowed = false;
+
+static const struct
+{
+    ThreadRole role;
+    const char *name;
+    int policy;
+    int priority;
+} roles[] = {
+    {ThreadRole::Trigger, "trigger", SCHED_FIFO, RT_PRIORITY_TRIGGER},
+    {ThreadRole::Sensor, "sensor", SCHED_FIFO, RT_PRIORITY_SENSOR},
+    {ThreadRole::Sync, "sync", SCHED_FIFO, RT_PRIORITY_SYNC},
+    {ThreadRole::Capture, "capture", SCHED_FIFO, RT_PRIORITY_CAPTURE},
+    {ThreadRole::Writer, "writer", SCHED_OTHER, 0},
+    {ThreadRole::Background, "background", SCHED_OTHER, 0},
+    {ThreadRole::Idle, "idle", SCHED_IDLE, 0},
+};
+
+static const int nRoles = sizeof(roles) / sizeof(roles[0]);
+// One warning per role, not one per thread
+static std::atomic<unsigned> warned{0};
+
+
+const char *threadRoleName(ThreadRole role)
+{
+    for (int i = 0; i < nRoles; i++)
+        if (roles[i].role == role)
+            return roles[i].name;
+    return "unknown";
+}
+
+
+void setThreadLayout(const ThreadLayout &l)
+{
+    layout = l;
+    haveAllowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+}
+
+
+const ThreadLayout &threadLayout()
+{
+    return layout;
+}
+
+
+// Touch bytes of stack below us, so the pages are there before they count
+static void prefaultStack(size_t bytes)
+{
+    volatile unsigned char stack[RT_STACK_PREFAULT];
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < bytes && i < sizeof(stack); i += page)
+        stack[i] = 0;
+}
+
+
+int lockMemory()
+{
+    if (!layout.realtime)
+        return 0;
+    // Before mlockall, or every thread stack would be locked at 8 MB
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    pthread_attr_setstacksize(&attr, RT_THREAD_STACK);
+    pthread_setattr_default_np(&attr);
+    pthread_attr_destroy(&attr);
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1)
+    {
+        fprintf(stderr, "mlockall: %s, memory may page out\n", strerror(errno));
+        return -1;
+    }
+    prefaultStack(RT_STACK_PREFAULT);
+    return 0;
+}
+
+
+static void warnOnce(int index, const char *what, int err)
+{
+    unsigned bit = 1u << index;
+    if (warned.fetch_or(bit) & bit)
+        return;
+    fprintf(stderr, "%s thread: %s: %s\n", roles[index].name, what, strerror(err));
+}
+
+
+int setThreadRole(ThreadRole role, int cpu)
+{
+    int i = 0;
+    while (i < nRoles - 1 && roles[i].role != role)
+        i++;
+    pthread_setname_np(pthread_self(), roles[i].name);
+
+    if (cpu == RT_CPU_DEFAULT)
+    {
+        cpu = -1;
+        if (layout.realtime)
+        {
+            switch (role)
+            {
+                case ThreadRole::Trigger:
+                    cpu = layout.triggerCpu;
+                    break;
+                case ThreadRole::Capture:
+                    cpu = layout.captureCpu;
+                    break;
+                case ThreadRole::Sensor:
+                case ThreadRole::Sync:
+                    cpu = layout.serviceCpu;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    int status = 0;
+    if (cpu >= 0 || (layout.realtime && haveAllowed))
+    {
+        cpu_set_t set = allowed;
+        if (cpu >= 0)
+        {
+            CPU_ZERO(&set);
+            CPU_SET(cpu, &set);
+        }
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if (err != 0)
+        {
+            // e.g. the core is outside our cpuset
+            warnOnce(i, "cannot pin", err);
+            status = -1;
+        }
+    }
+    if (!layout.realtime)
+        return status;
+
+    // Explicitly, a thread inherits the policy of its creator
+    struct sched_param param;
+    memset(&param, 0, sizeof(param));
+    param.sched_priority = roles[i].priority;
+    int err = pthread_setschedparam(pthread_self(), roles[i].policy, &param);
+    if (err != 0)
+    {
+        warnOnce(i, "no real-time scheduling, timing will suffer", err);
+        return -1;
+    }
+    if (roles[i].policy == SCHED_FIFO)
+        prefaultStack(RT_STACK_PREFAULT);
+    return status;
+}
+
+
+void notifyReady(int fd)
+{
+    if (fd < 0)
+        return;
+    ssize_t w = write(fd, "\n", 1);
+    (void) w;
+    close(fd);
+}
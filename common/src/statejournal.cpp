@@ -0,0 +1,128 @@
+#include "statejournal.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+static_assert(sizeof(StateSlotHeader) == 24, "StateSlotHeader layout changed");
+
+
+uint32_t crc32(const void *data, size_t len, uint32_t crc)
+{
+    // Bitwise: records are a few hundred bytes, saved a few times a minute
+    const uint8_t *p = (const uint8_t *) data;
+    crc = ~crc;
+    while (len--)
+    {
+        crc ^= *p++;
+        for (int k = 0; k < 8; k++)
+            crc = (crc >> 1) ^ (0xEDB88320u & (0u - (crc & 1)));
+    }
+    return ~crc;
+}
+
+
+static uint32_t slot_crc(const uint8_t *slot, size_t size)
+{
+    StateSlotHeader hdr;
+    memcpy(&hdr, slot, sizeof(hdr));
+    hdr.crc = 0;
+    uint32_t crc = crc32(&hdr, sizeof(hdr));
+    return crc32(slot + sizeof(hdr), size, crc);
+}
+
+
+StateJournal::StateJournal()
+{
+    fd = -1;
+    size = 0;
+    seq = 0;
+}
+
+
+StateJournal::~StateJournal()
+{
+    close();
+}
+
+
+int StateJournal::open(const char *path, size_t n)
+{
+    close();
+    if (n > STATE_JOURNAL_SLOT - sizeof(StateSlotHeader))
+        return -1;
+    fd = ::open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd < 0)
+    {
+        perror("StateJournal: open");
+        return -1;
+    }
+    size = n;
+    seq = 0;
+    return 0;
+}
+
+
+void StateJournal::close()
+{
+    if (fd < 0)
+        return;
+    ::close(fd);
+    fd = -1;
+}
+
+
+bool StateJournal::load(void *record)
+{
+    if (fd < 0)
+        return false;
+    uint8_t slot[STATE_JOURNAL_SLOT];
+    bool found = false;
+    for (int i = 0; i < 2; i++)
+    {
+        if (pread(fd, slot, sizeof(slot), (off_t) i * STATE_JOURNAL_SLOT) != (ssize_t) sizeof(slot))
+            continue;
+        StateSlotHeader hdr;
+        memcpy(&hdr, slot, sizeof(hdr));
+        if (memcmp(hdr.magic, STATE_JOURNAL_MAGIC, 4) != 0 || hdr.version != STATE_JOURNAL_VERSION
+            || hdr.size != size || hdr.crc != slot_crc(slot, size))
+            continue;
+        if (!found || hdr.seq > seq)
+        {
+            memcpy(record, slot + sizeof(hdr), size);
+            seq = hdr.seq;
+            found = true;
+        }
+    }
+    return found;
+}
+
+
+int StateJournal::save(const void *record)
+{
+    if (fd < 0)
+        return -1;
+    uint8_t slot[STATE_JOURNAL_SLOT];
+    memset(slot, 0, sizeof(slot));
+    StateSlotHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, STATE_JOURNAL_MAGIC, 4);
+    hdr.version = STATE_JOURNAL_VERSION;
+    hdr.size = size;
+    hdr.seq = seq + 1;
+    memcpy(slot, &hdr, sizeof(hdr));
+    memcpy(slot + sizeof(hdr), record, size);
+    hdr.crc = slot_crc(slot, size);
+    memcpy(slot, &hdr, sizeof(hdr));
+
+    // Never the slot holding the newest good record
+    off_t offset = (off_t) (hdr.seq % 2) * STATE_JOURNAL_SLOT;
+    if (pwrite(fd, slot, sizeof(slot), offset) != (ssize_t) sizeof(slot) || fdatasync(fd) != 0)
+    {
+        perror("StateJournal: save");
+        return -1;
+    }
+    seq = hdr.seq;
+    return 0;
+}
@@ -0,0 +1,388 @@
+#include "telemetry.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <chrono>
+
+#include "rtthreads.h"
+
+#define THERMAL_PATH "/sys/class/thermal/thermal_zone0/temp"
+// Raspberry Pi firmware driver, the bits vcgencmd get_throttled prints
+#define THROTTLE_PATH "/sys/devices/platform/soc/soc:firmware/get_throttled"
+#define CPU_FREQ_PATH "/sys/devices/system/cpu/cpu0/cpufreq/scaling_cur_freq"
+
+// get_throttled bits as they are now; the same shifted by 16 have
+// happened since boot
+static const struct
+{
+    uint32_t bit;
+    const char *name;
+} throttleFlags[] = {
+    {0x1, "under-voltage"},
+    {0x2, "frequency capped"},
+    {0x4, "throttled"},
+    {0x8, "soft temperature limit"},
+};
+
+
+static long long clock_nsec(clockid_t clk)
+{
+    struct timespec t;
+    clock_gettime(clk, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+// A number from a sysfs file kept open; false if there is none
+static bool readNumber(int fd, int base, long long *value)
+{
+    char buf[32];
+    if (fd < 0)
+        return false;
+    ssize_t n = pread(fd, buf, sizeof(buf) - 1, 0);
+    if (n <= 0)
+        return false;
+    buf[n] = '\0';
+    char *end;
+    *value = strtoll(buf, &end, base);
+    return end != buf;
+}
+
+
+// All of a small /proc file into buf, false if it is gone (the thread exited)
+static bool readFile(const char *path, char *buf, size_t len)
+{
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+        return false;
+    ssize_t n = read(fd, buf, len - 1);
+    close(fd);
+    if (n <= 0)
+        return false;
+    buf[n] = '\0';
+    return true;
+}
+
+
+LatencyRecorder::LatencyRecorder()
+    : maxNs(0)
+{
+    for (auto &b : bins)
+        b.store(0, std::memory_order_relaxed);
+}
+
+
+long long LatencyRecorder::bucketEnd(int i)
+{
+    if (i < (1 << LATENCY_SUB_BITS))
+        return i + 1;
+    int shift = (i >> LATENCY_SUB_BITS) - 1;
+    long long lo = (long long) ((1 << LATENCY_SUB_BITS) + (i & ((1 << LATENCY_SUB_BITS) - 1))) << shift;
+    return lo + (1LL << shift);
+}
+
+
+void LatencyRecorder::take(BinLogLatency *out)
+{
+    uint32_t counts[LATENCY_BUCKETS];
+    unsigned long long n = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        counts[i] = bins[i].exchange(0, std::memory_order_relaxed);
+        n += counts[i];
+    }
+    long long maxUs = (maxNs.exchange(0, std::memory_order_relaxed) + 999) / 1000;
+
+    out->count = n > 0xffff ? 0xffff : (uint16_t) n;
+    out->max_us = (uint32_t) maxUs;
+    out->p50_us = out->p99_us = 0;
+    if (n == 0)
+        return;
+    // Smallest bucket end with at least q of the records at or below it,
+    // never past the exact maximum
+    unsigned long long p50 = (n + 1) / 2, p99 = n - n / 100, seen = 0;
+    for (int i = 0; i < LATENCY_BUCKETS; i++)
+    {
+        seen += counts[i];
+        long long end = bucketEnd(i) < maxUs ? bucketEnd(i) : maxUs;
+        if (out->p50_us == 0 && seen >= p50)
+            out->p50_us = (uint32_t) end;
+        if (seen >= p99)
+        {
+            out->p99_us = (uint32_t) end;
+            break;
+        }
+    }
+}
+
+
+Telemetry::Telemetry()
+{
+    periodS = TELEMETRY_PERIOD_S;
+    nextChannel = 0;
+    tLast = 0;
+    throttled = 0;
+    thermalFd = throttleFd = freqFd = -1;
+    running = false;
+}
+
+
+Telemetry::~Telemetry()
+{
+    stop();
+}
+
+
+void Telemetry::addGauge(const char *name, Gauge read)
+{
+    GaugeEntry g;
+    g.channel = nextChannel++;
+    g.name = name;
+    g.read = read;
+    gauges.push_back(std::move(g));
+}
+
+
+LatencyRecorder *Telemetry::addLatency(const char *name)
+{
+    LatencyEntry l;
+    l.channel = nextChannel++;
+    l.name = name;
+    l.rec.reset(new LatencyRecorder());
+    latencies.push_back(std::move(l));
+    return latencies.back().rec.get();
+}
+
+
+int Telemetry::start(const char *path, int s)
+{
+    stop();
+    if (log.open(path) == -1)
+        return -1;
+    periodS = s > 0 ? s : TELEMETRY_PERIOD_S;
+    thermalFd = open(THERMAL_PATH, O_RDONLY);
+    throttleFd = open(THROTTLE_PATH, O_RDONLY);
+    freqFd = open(CPU_FREQ_PATH, O_RDONLY);
+
+    long long t = clock_nsec(CLOCK_MONOTONIC);
+    for (const GaugeEntry &g : gauges)
+    {
+        BinLogChannel ch = {g.channel, BINLOG_GAUGE, {0}};
+        strncpy(ch.name, g.name.c_str(), sizeof(ch.name) - 1);
+        log.append(BINLOG_CHANNEL, t, &ch, sizeof(ch));
+    }
+    for (const LatencyEntry &l : latencies)
+    {
+        BinLogChannel ch = {l.channel, BINLOG_LATENCY, {0}};
+        strncpy(ch.name, l.name.c_str(), sizeof(ch.name) - 1);
+        log.append(BINLOG_CHANNEL, t, &ch, sizeof(ch));
+    }
+    // Baseline of the thread times, now rather than a period late
+    sampleThreads(t, true);
+    tLast = t;
+
+    std::lock_guard<std::mutex> lck(mtx);
+    running = true;
+    sampler = std::thread(&Telemetry::loop, this);
+    return 0;
+}
+
+
+void Telemetry::stop()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx);
+        if (!running)
+            return;
+        running = false;
+    }
+    wake.notify_one();
+    sampler.join();
+    log.close();
+    for (int *fd : {&thermalFd, &throttleFd, &freqFd})
+    {
+        if (*fd >= 0)
+            close(*fd);
+        *fd = -1;
+    }
+}
+
+
+void Telemetry::loop()
+{
+    setThreadRole(ThreadRole::Background);
+    std::unique_lock<std::mutex> lck(mtx);
+    bool more = true;
+    while (more)
+    {
+        wake.wait_for(lck, std::chrono::seconds(periodS), [this]{ return !running; });
+        more = running;
+        lck.unlock();
+        sample();
+        lck.lock();
+    }
+}
+
+
+void Telemetry::sample()
+{
+    long long t = clock_nsec(CLOCK_MONOTONIC);
+    sampleSystem(t);
+    sampleThreads(t, false);
+    for (const GaugeEntry &g : gauges)
+    {
+        BinLogGauge rec = {g.channel, 0, 0, g.read()};
+        log.append(BINLOG_GAUGE, t, &rec, sizeof(rec));
+    }
+    for (const LatencyEntry &l : latencies)
+    {
+        BinLogLatency rec;
+        l.rec->take(&rec);
+        rec.channel = l.channel;
+        log.append(BINLOG_LATENCY, t, &rec, sizeof(rec));
+    }
+    tLast = t;
+}
+
+
+void Telemetry::sampleSystem(long long t)
+{
+    BinLogSystem rec;
+    memset(&rec, 0, sizeof(rec));
+    long long v;
+    rec.soc_mdegc = readNumber(thermalFd, 10, &v) ? (int32_t) v : INT32_MIN;
+    rec.throttled = readNumber(throttleFd, 16, &v) ? (uint32_t) v : BINLOG_NO_THROTTLE_INFO;
+    rec.cpu_khz = readNumber(freqFd, 10, &v) ? (uint32_t) v : 0;
+    log.append(BINLOG_SYSTEM, t, &rec, sizeof(rec));
+
+    // Say so when a flag comes or goes, the log is only read after recovery
+    if (rec.throttled == BINLOG_NO_THROTTLE_INFO || (rec.throttled & 0xf) == (throttled & 0xf))
+        return;
+    char line[128];
+    size_t n = 0;
+    line[0] = '\0';
+    for (const auto &f : throttleFlags)
+        if (rec.throttled & f.bit)
+            n += snprintf(line + n, sizeof(line) - n, "%s%s", n ? ", " : "", f.name);
+    fprintf(stderr, "Telemetry: %s, SoC at %.1f C\n", n ? line : "no longer throttled",
+            rec.soc_mdegc / 1000.0);
+    throttled = rec.throttled;
+}
+
+
+// schedstat has both in ns where the kernel keeps it; stat only CPU time,
+// in clock ticks
+static bool readThreadTimes(int tid, char *name, size_t nameLen, long long *cpu, long long *wait)
+{
+    char path[64], buf[512];
+    snprintf(path, sizeof(path), "/proc/self/task/%d/stat", tid);
+    if (!readFile(path, buf, sizeof(buf)))
+        return false;
+    // "tid (name) state ...", the name may hold spaces and parentheses
+    char *lp = strchr(buf, '(');
+    char *rp = strrchr(buf, ')');
+    if (!lp || !rp || rp < lp)
+        return false;
+    size_t len = (size_t) (rp - lp - 1) < nameLen - 1 ? (size_t) (rp - lp - 1) : nameLen - 1;
+    memcpy(name, lp + 1, len);
+    name[len] = '\0';
+
+    snprintf(path, sizeof(path), "/proc/self/task/%d/schedstat", tid);
+    char sched[128];
+    if (readFile(path, sched, sizeof(sched)) && sscanf(sched, "%lld %lld", cpu, wait) == 2)
+        return true;
+    // Fields 14 and 15 (utime, stime), counted from the state at 3
+    unsigned long long utime, stime;
+    if (sscanf(rp + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu", &utime, &stime) != 2)
+        return false;
+    long long tick = 1000000000LL / sysconf(_SC_CLK_TCK);
+    *cpu = (long long) (utime + stime) * tick;
+    *wait = 0;
+    return true;
+}
+
+
+// Time of every thread since the last sample, summed by thread name: the
+// threads of one role (rtthreads.h) share one. Baseline only reads.
+void Telemetry::sampleThreads(long long t, bool baseline)
+{
+    struct Sum
+    {
+        unsigned threads;
+        long long cpu;
+        long long wait;
+    };
+    std::map<std::string, Sum> sums;
+    std::map<int, ThreadTimes> now;
+
+    DIR *d = opendir("/proc/self/task");
+    if (d == NULL)
+        return;
+    struct dirent *e;
+    while ((e = readdir(d)) != NULL)
+    {
+        if (e->d_name[0] < '0' || e->d_name[0] > '9')
+            continue;
+        int tid = atoi(e->d_name);
+        char name[16];
+        ThreadTimes times;
+        if (!readThreadTimes(tid, name, sizeof(name), &times.cpu, &times.wait))
+            continue;
+        now[tid] = times;
+        // A thread new since the last sample ran all of its time in this period
+        auto last = threadTimes.find(tid);
+        ThreadTimes before = last != threadTimes.end() ? last->second : ThreadTimes{0, 0};
+        Sum &s = sums[name];
+        s.threads++;
+        s.cpu += times.cpu - before.cpu;
+        s.wait += times.wait - before.wait;
+    }
+    closedir(d);
+    threadTimes.swap(now);
+    if (baseline)
+        return;
+
+    std::map<uint16_t, Sum> byChannel;
+    for (const auto &s : sums)
+    {
+        Sum &c = byChannel[nameChannel(BINLOG_THREAD, s.first)];
+        c.threads += s.second.threads;
+        c.cpu += s.second.cpu;
+        c.wait += s.second.wait;
+    }
+    for (const auto &c : byChannel)
+    {
+        BinLogThread rec;
+        rec.channel = c.first;
+        rec.threads = (uint16_t) c.second.threads;
+        rec.cpu_us = (uint32_t) (c.second.cpu / 1000);
+        rec.wait_us = (uint32_t) (c.second.wait / 1000);
+        rec.period_us = (uint32_t) ((t - tLast) / 1000);
+        log.append(BINLOG_THREAD, t, &rec, sizeof(rec));
+    }
+}
+
+
+// Channel of a thread name, named in the log the first time
+uint16_t Telemetry::nameChannel(uint16_t type, const std::string &name)
+{
+    auto it = threadChannels.find(name);
+    if (it != threadChannels.end())
+        return it->second;
+    std::string key = threadChannels.size() < TELEMETRY_THREAD_CHANNELS ? name : "other";
+    it = threadChannels.find(key);
+    if (it != threadChannels.end())
+        return it->second;
+    uint16_t channel = nextChannel++;
+    threadChannels[key] = channel;
+    BinLogChannel rec = {channel, type, {0}};
+    strncpy(rec.name, key.c_str(), sizeof(rec.name) - 1);
+    log.append(BINLOG_CHANNEL, clock_nsec(CLOCK_MONOTONIC), &rec, sizeof(rec));
+    return channel;
+}
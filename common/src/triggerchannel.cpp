@@ -0,0 +1,211 @@
+#include "triggerchannel.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define BILLION 1000000000LL
+
+
+TriggerChannel::TriggerChannel()
+{
+    shm = nullptr;
+    writable = false;
+}
+
+
+TriggerChannel::~TriggerChannel()
+{
+    close();
+}
+
+
+int TriggerChannel::map(const char *name, bool create)
+{
+    int fd = shm_open(name, create ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd < 0)
+    {
+        if (create)
+            perror("TriggerChannel: shm_open");
+        return -1;
+    }
+    if (create && ftruncate(fd, sizeof(Shared)) < 0)
+    {
+        perror("TriggerChannel: ftruncate");
+        ::close(fd);
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(Shared))
+    {
+        // producer is still setting it up
+        ::close(fd);
+        return -1;
+    }
+    void *mem = mmap(NULL, sizeof(Shared), create ? (PROT_READ | PROT_WRITE) : PROT_READ,
+                     MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (mem == MAP_FAILED)
+    {
+        perror("TriggerChannel: mmap");
+        return -1;
+    }
+    shm = (Shared *) mem;
+    writable = create;
+    return 0;
+}
+
+
+int TriggerChannel::create(const char *name)
+{
+    close();
+    if (map(name, true) < 0)
+        return -1;
+    if (shm->magic != TRIGGER_CHANNEL_MAGIC || shm->version != TRIGGER_CHANNEL_VERSION ||
+        shm->slots != TRIGGER_CHANNEL_SLOTS)
+    {
+        memset((void *) shm, 0, sizeof(Shared));
+        shm->version = TRIGGER_CHANNEL_VERSION;
+        shm->slots = TRIGGER_CHANNEL_SLOTS;
+        std::atomic_thread_fence(std::memory_order_release);
+        shm->magic = TRIGGER_CHANNEL_MAGIC;
+    }
+    return 0;
+}
+
+
+int TriggerChannel::attach(const char *name)
+{
+    close();
+    if (map(name, false) < 0)
+        return -1;
+    if (shm->magic != TRIGGER_CHANNEL_MAGIC || shm->version != TRIGGER_CHANNEL_VERSION ||
+        shm->slots != TRIGGER_CHANNEL_SLOTS)
+    {
+        close();
+        return -1;
+    }
+    return 0;
+}
+
+
+void TriggerChannel::close()
+{
+    if (shm)
+        munmap((void *) shm, sizeof(Shared));
+    shm = nullptr;
+    writable = false;
+}
+
+
+void TriggerChannel::publish(const TriggerRecord &rec)
+{
+    if (!shm || !writable)
+        return;
+    uint32_t seq = shm->head.load(std::memory_order_relaxed);
+    Slot &slot = shm->slot[seq % TRIGGER_CHANNEL_SLOTS];
+
+    slot.seq.store(0, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_release);
+    slot.rec = rec;
+    slot.seq.store(seq + 1, std::memory_order_release);
+    shm->head.store(seq + 1, std::memory_order_release);
+}
+
+
+uint32_t TriggerChannel::head() const
+{
+    if (!shm)
+        return 0;
+    return shm->head.load(std::memory_order_acquire);
+}
+
+
+bool TriggerChannel::read(uint32_t seq, TriggerRecord *rec) const
+{
+    if (!shm)
+        return false;
+    const Slot &slot = shm->slot[seq % TRIGGER_CHANNEL_SLOTS];
+    uint32_t before = slot.seq.load(std::memory_order_acquire);
+    if (before != seq + 1)
+        return false;
+    TriggerRecord copy = slot.rec;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (slot.seq.load(std::memory_order_relaxed) != before)
+        return false;
+    *rec = copy;
+    return true;
+}
+
+
+TriggerMatcher::TriggerMatcher(int64_t min_latency_ns, int64_t max_latency_ns, const char *name_)
+{
+    name = name_;
+    minLatency = min_latency_ns;
+    maxLatency = max_latency_ns;
+    cursor = 0;
+    lastAttempt = 0;
+    nMatched = 0;
+    nUnmatched = 0;
+}
+
+
+bool TriggerMatcher::match(int64_t arrival_ns, TriggerRecord *rec)
+{
+    if (!channel.isOpen())
+    {
+        // Retry at most once a second until minions is up
+        if (arrival_ns - lastAttempt < BILLION)
+        {
+            nUnmatched++;
+            return false;
+        }
+        lastAttempt = arrival_ns;
+        if (channel.attach(name) < 0)
+        {
+            nUnmatched++;
+            return false;
+        }
+        cursor = channel.head();
+        printf("TriggerMatcher: attached to %s at trigger %u\n", name, cursor);
+    }
+
+    uint32_t head = channel.head();
+    // The producer lapped us; everything older is gone
+    if (head - cursor > TRIGGER_CHANNEL_SLOTS)
+        cursor = head - TRIGGER_CHANNEL_SLOTS;
+
+    // The newest trigger old enough is the frame's. Older ones still in
+    // the window are triggers whose frame was dropped: at trigger periods
+    // below max_latency_ns taking the oldest would hand every later frame
+    // its predecessor's trigger.
+    TriggerRecord candidate;
+    bool found = false;
+    while (cursor != head)
+    {
+        if (!channel.read(cursor, &candidate))
+        {
+            cursor++;
+            continue;
+        }
+        int64_t age = arrival_ns - candidate.trigger_ns;
+        if (age < minLatency)
+            break;
+        // past the window, or a newer trigger fits too; either way its
+        // frame was dropped or never came
+        cursor++;
+        if (age <= maxLatency)
+        {
+            *rec = candidate;
+            found = true;
+        }
+    }
+    if (found)
+        nMatched++;
+    else
+        nUnmatched++;
+    return found;
+}
@@ -16,7 +16,8 @@ using namespace std;
 // --------- HANDOUT  PS00 ------------------------------
 // ------------------------------------------------------
 
-long long Image::number_of_elements()const {
+template <typename T>
+long long ImageT<T>::number_of_elements()const {
     // --------- HANDOUT  PS00 ------------------------------
     // returns the number of elements in the im- age. An RGB (3 color channels)
     // image of 100 × 100 pixels has 30000 elements
@@ -31,87 +32,94 @@ long long Image::number_of_elements()const {
 
 
 // -------------- Accessors and Setters -------------------------
-const float & Image::operator()(int x) const {
+template <typename T>
+const T & ImageT<T>::operator()(int x) const {
     // --------- HANDOUT  PS00 ------------------------------
     // Linear accessor to the image data
-    if (x < 0 || x > number_of_elements()) {
+    if (x < 0 || x >= number_of_elements()) {
         throw OutOfBoundsException();
     }
-    return image_data[x];
+    return data_[linear_offset(x)];
 }
 
 
-const float & Image::operator()(int x, int y) const {
+template <typename T>
+const T & ImageT<T>::operator()(int x, int y) const {
     // --------- HANDOUT  PS00 ------------------------------
     // Accessor to the image data at channel 0
-    if ((x < 0 || x > width()) || (y < 0 || y > height())) {
+    if ((x < 0 || x >= width()) || (y < 0 || y >= height())) {
         throw OutOfBoundsException();
     }
-    return image_data[y*stride(1)+x];
+    return data_[y*stride(1)+x];
 }
 
 
-const float & Image::operator()(int x, int y, int z) const {
+template <typename T>
+const T & ImageT<T>::operator()(int x, int y, int z) const {
     // --------- HANDOUT  PS00 ------------------------------
     // Accessor to the image data at channel z
-    if ((x < 0 || x > width()) 
-        || (y < 0 || y > height()) 
-        || (z < 0 || z > channels())) {
+    if ((x < 0 || x >= width()) 
+        || (y < 0 || y >= height()) 
+        || (z < 0 || z >= channels())) {
         throw OutOfBoundsException();
     }
-    return image_data[z*stride(2)+y*stride(1)+x];
+    return data_[z*stride(2)+y*stride(1)+x];
 }
 
 
-float & Image::operator()(int x) {
+template <typename T>
+T & ImageT<T>::operator()(int x) {
     // --------- HANDOUT  PS00 ------------------------------
     // Linear setter to the image data
-    if (x < 0 || x > number_of_elements()) {
+    if (x < 0 || x >= number_of_elements()) {
         throw OutOfBoundsException();
     }
-    return image_data[x];
+    return data_[linear_offset(x)];
 }
 
 
-float & Image::operator()(int x, int y) {
+template <typename T>
+T & ImageT<T>::operator()(int x, int y) {
     // --------- HANDOUT  PS00 ------------------------------
     // Setter to the image data at channel 0
-    if ((x < 0 || x > width()) || (y < 0 || y > height())) {
+    if ((x < 0 || x >= width()) || (y < 0 || y >= height())) {
         throw OutOfBoundsException();
     }
-    return image_data[y*stride(1)+x];
+    return data_[y*stride(1)+x];
 }
 
 
-float & Image::operator()(int x, int y, int z) {
+template <typename T>
+T & ImageT<T>::operator()(int x, int y, int z) {
     // --------- HANDOUT  PS00 ------------------------------
     // Setter to the image data at channel z
-    if ((x < 0 || x > width()) 
-        || (y < 0 || y > height()) 
-        || (z < 0 || z > channels())) {
+    if ((x < 0 || x >= width()) 
+        || (y < 0 || y >= height()) 
+        || (z < 0 || z >= channels())) {
         throw OutOfBoundsException();
     }
-    return image_data[z*stride(2)+y*stride(1)+x];
+    return data_[z*stride(2)+y*stride(1)+x];
 }
 
-void Image::set_color(float r, float g, float b) {
+template <typename T>
+void ImageT<T>::set_color(float r, float g, float b) {
     // --------- HANDOUT  PS00 ------------------------------
     // Set the image pixels to the corresponding values
     if (r < 0 || r > 1 || g < 0 || g > 1 || b < 0 || b > 1) {
         throw OutOfBoundsException();
     }
-    if (dimensions() < 3) {
+    if (dimensions() < 3 || channels() < 3) {
         for (int j = 0; j < height(); j++) {
             for (int i = 0; i < width(); i++) {
-                image_data[i+j*stride(1)] = r;
+                data_[i+j*stride(1)] = from_unit(r);
             }
         }
-    } else if (dimensions() == 3) {
+    } else if (dimensions() == 3 && channels() >= 3) {
         for (int j = 0; j < height(); j++) {
             for (int i = 0; i < width(); i++) {
-                image_data[i+j*stride(1)] = r;
-                image_data[i+j*stride(1)+1*stride(2)] = g;
-                image_data[i+j*stride(1)+2*stride(2)] = b;
+                data_[i+j*stride(1)] = from_unit(r);
+                data_[i+j*stride(1)+1*stride(2)] = from_unit(g);
+                data_[i+j*stride(1)+2*stride(2)] = from_unit(b);
             }
         }
     } else {
@@ -120,7 +128,8 @@ void Image::set_color(float r, float g, float b) {
 }
 
 
-void Image::create_rectangle(int xstart, int ystart, int xend, int yend,
+template <typename T>
+void ImageT<T>::create_rectangle(int xstart, int ystart, int xend, int yend,
                              float r, float g, float b) {
     // --------- HANDOUT  PS00 ------------------------------
     // Set the pixels inside the rectangle to the specified color
@@ -133,18 +142,18 @@ void Image::create_rectangle(int xstart, int ystart, int xend, int yend,
     if (r < 0 || r > 1 || g < 0 || g > 1 || b < 0 || b > 1) {
         throw InvalidArgument();
     }
-    if (dimensions() < 3) {
+    if (dimensions() < 3 || channels() < 3) {
         for (int j = ystart; j <= yend; j++) {
-            for (int i = xstart; i <= xstart; i++) {
-                image_data[i+j*stride(1)] = r;
+            for (int i = xstart; i <= xend; i++) {
+                data_[i+j*stride(1)] = from_unit(r);
             }
         }
-    } else if (dimensions() == 3) {
+    } else if (dimensions() == 3 && channels() >= 3) {
         for (int j = ystart; j <= yend; j++) {
             for (int i = xstart; i <= xend; i++) {
-                image_data[i+j*stride(1)] = r;
-                image_data[i+j*stride(1)+1*stride(2)] = g;
-                image_data[i+j*stride(1)+2*stride(2)] = b;
+                data_[i+j*stride(1)] = from_unit(r);
+                data_[i+j*stride(1)+1*stride(2)] = from_unit(g);
+                data_[i+j*stride(1)+2*stride(2)] = from_unit(b);
             }
         }
     } else {
@@ -152,7 +161,8 @@ void Image::create_rectangle(int xstart, int ystart, int xend, int yend,
     }
 }
 
-void Image::create_line(int xstart, int ystart, int xend, int yend,
+template <typename T>
+void ImageT<T>::create_line(int xstart, int ystart, int xend, int yend,
                         float r, float g, float b) {
     // --------- HANDOUT  PS00 ------------------------------
     // Create a line segment with specified color
@@ -174,23 +184,23 @@ void Image::create_line(int xstart, int ystart, int xend, int yend,
     if (xstart == xend) {
         delta_err = y_diff;
     } else {
-        delta_err = abs(y_diff/x_diff);
+        delta_err = std::abs(y_diff/x_diff);
     }
     float err = 0.0f;
     int y = ystart;
     for (int x = xstart; x <= xend; x++) {
-        image_data[x + y*stride(1)] = r;
-        if (dimensions() == 3) {
-            image_data[x + y*stride(1) + 1*stride(2)] = g;
-            image_data[x + y*stride(1) + 2*stride(2)] = b;
+        data_[x + y*stride(1)] = from_unit(r);
+        if (channels() >= 3) {
+            data_[x + y*stride(1) + 1*stride(2)] = from_unit(g);
+            data_[x + y*stride(1) + 2*stride(2)] = from_unit(b);
         }
         err += delta_err;
         while (err > 0.5f) {
             y = y + y_gradient;
-            image_data[x + y*stride(1)] = r;
-            if (dimensions() == 3) {
-                image_data[x + y*stride(1) + 1*stride(2)] = g;
-                image_data[x + y*stride(1) + 2*stride(2)] = b;
+            data_[x + y*stride(1)] = from_unit(r);
+            if (channels() >= 3) {
+                data_[x + y*stride(1) + 1*stride(2)] = from_unit(g);
+                data_[x + y*stride(1) + 2*stride(2)] = from_unit(b);
             }
             err -= 1.0f;
         }
@@ -204,19 +214,155 @@ void Image::create_line(int xstart, int ystart, int xend, int yend,
  *                    DO NOT EDIT BELOW THIS LINE                    *
  *********************************************************************/
 
-int Image::debugWriteNumber = 0;
+template <typename T>
+int ImageT<T>::debugWriteNumber = 0;
 
-Image::Image(int x, int y, int z, const std::string &name_) {
+template <typename T>
+ImageT<T>::ImageT(int x, int y, int z, const std::string &name_) {
     initialize_image_metadata(x,y,z,name_);
     long long size_of_data = 1;
     for (int k = 0; k < dimensions(); k++) {
         size_of_data *= dim_values[k];
     }
-    image_data = std::vector<float>(size_of_data,0);
+    image_data = std::vector<T>(size_of_data,0);
+    data_ = image_data.data();
+}
+
+template <typename T>
+ImageT<T>::ImageT(T *data, int x, int y, int z, int row_stride, const std::string &name_) {
+    initialize_image_metadata(x,y,z,name_);
+    if (row_stride < 0 || (row_stride > 0 && row_stride < x))
+        throw InvalidArgument();
+    if (row_stride > 0 && dims > 1) {
+        stride_[1] = row_stride;
+        stride_[2] = row_stride*y;
+    }
+    data_ = data;
+}
+
+template <typename T>
+ImageT<T>::ImageT(const ImageT &other) {
+    copy_from(other);
+}
+
+template <typename T>
+ImageT<T>::ImageT(ImageT &&other)
+    : dims(other.dims), image_name(std::move(other.image_name)) {
+    for (int k = 0; k < 3; k++) {
+        dim_values[k] = other.dim_values[k];
+        stride_[k] = other.stride_[k];
+    }
+    bool owned = other.owns_data();
+    image_data = std::move(other.image_data);
+    data_ = owned ? image_data.data() : other.data_;
+    other.data_ = other.image_data.data();
+}
+
+template <typename T>
+ImageT<T> & ImageT<T>::operator= (const ImageT &other) {
+    if (this != &other)
+        copy_from(other);
+    return *this;
+}
+
+template <typename T>
+ImageT<T> & ImageT<T>::operator= (ImageT &&other) {
+    if (this == &other)
+        return *this;
+    dims = other.dims;
+    image_name = std::move(other.image_name);
+    for (int k = 0; k < 3; k++) {
+        dim_values[k] = other.dim_values[k];
+        stride_[k] = other.stride_[k];
+    }
+    bool owned = other.owns_data();
+    image_data = std::move(other.image_data);
+    data_ = owned ? image_data.data() : other.data_;
+    other.data_ = other.image_data.data();
+    return *this;
+}
+
+template <typename T>
+void ImageT<T>::copy_from(const ImageT &other) {
+    initialize_image_metadata(other.extent(0), other.extent(1), other.extent(2), other.name());
+    long long size_of_data = other.number_of_elements();
+    if (other.is_compact()) {
+        image_data.assign(other.data_, other.data_ + size_of_data);
+    } else {
+        image_data.resize(size_of_data);
+        for (long long i = 0; i < size_of_data; i++)
+            image_data[i] = other.data_[other.linear_offset((int) i)];
+    }
+    data_ = image_data.data();
+}
+
+template <typename T>
+long long ImageT<T>::linear_offset(int x) const {
+    if (is_compact())
+        return x;
+    // Padded rows: rebuild x, y and z from the compact index
+    long long plane = (long long) width() * height();
+    long long z = x / plane, rest = x % plane;
+    return z*stride(2) + (rest / width())*stride(1) + rest % width();
+}
+
+template <typename T>
+long long ImageT<T>::run(long long x, long long n, long long *len) const {
+    if (is_compact()) {
+        *len = n;
+        return x;
+    }
+    *len = std::min<long long>(n, width() - x % width());
+    return linear_offset((int) x);
+}
 
+template <typename T>
+void ImageT<T>::eval_block(long long x, int n, T *out) const {
+    for (long long done = 0, len; done < n; done += len) {
+        long long offset = run(x + done, n - done, &len);
+        std::copy(data_ + offset, data_ + offset + len, out + done);
+    }
 }
 
-void Image::initialize_image_metadata(int x, int y, int z,  const std::string &name_) {
+// The pixel statistics walk the image in contiguous runs: one for compact
+// images, one per row for wrapped frames with padded rows
+
+template <typename T>
+void ImageT<T>::clamp(T lo, T hi) {
+    long long total_pixels = number_of_elements();
+    for (long long done = 0, len; done < total_pixels; done += len) {
+        long long offset = run(done, total_pixels - done, &len);
+        pixel_clamp(data_ + offset, len, lo, hi);
+    }
+}
+
+template <typename T>
+void ImageT<T>::min_max(T *lo, T *hi) const {
+    long long total_pixels = number_of_elements();
+    if (total_pixels == 0)
+        throw InvalidArgument();
+    *lo = *hi = data_[0];
+    for (long long done = 0, len; done < total_pixels; done += len) {
+        long long offset = run(done, total_pixels - done, &len);
+        pixel_min_max(data_ + offset, len, lo, hi);
+    }
+}
+
+template <typename T>
+double ImageT<T>::mean() const {
+    long long total_pixels = number_of_elements();
+    if (total_pixels == 0)
+        throw InvalidArgument();
+    double sum = 0;
+    for (long long done = 0, len; done < total_pixels; done += len) {
+        long long offset = run(done, total_pixels - done, &len);
+        sum += pixel_sum(data_ + offset, len);
+    }
+    return sum / total_pixels;
+}
+
+template <typename T>
+void ImageT<T>::initialize_image_metadata(int x, int y, int z,  const std::string &name_) {
     dim_values[0] = 0;
     dim_values[1] = 0;
     dim_values[2] = 0;
@@ -260,7 +406,8 @@ void Image::initialize_image_metadata(int x, int y, int z,  const std::string &n
 
 }
 
-Image::Image(const std::string & filename) {
+template <typename T>
+ImageT<T>::ImageT(const std::string & filename) {
     std::vector<unsigned char> uint8_image;
     unsigned int height_;
     unsigned int width_;
@@ -271,43 +418,59 @@ Image::Image(const std::string & filename) {
         throw FileNotFoundException();
     }
 
-    image_data = std::vector<float>(height_*width_*outputchannels_,0);
+    image_data = std::vector<T>(height_*width_*outputchannels_,0);
 
     for (unsigned int x= 0; x < width_; x++) {
         for (unsigned int y = 0; y < height_; y++) {
             for (unsigned int c = 0; c < outputchannels_; c++) {
-                image_data[x+y*width_+c*width_*height_] = uint8_to_float(uint8_image[c + x*channels_ + y*channels_*width_]);
+                image_data[x+y*width_+c*width_*height_] = uint8_to_pixel(uint8_image[c + x*channels_ + y*channels_*width_]);
             }
         }
     }
 
     initialize_image_metadata(width_, height_, outputchannels_, filename);
+    data_ = image_data.data();
 
 }
 
-Image::~Image() { } // Nothing to clean up
+template <typename T>
+ImageT<T>::~ImageT() { } // Nothing to clean up
 
-void Image::write(const std::string &filename) const {
+template <typename T>
+void ImageT<T>::write(const std::string &filename) const {
     if (channels() != 1 && channels() != 3 && channels() != 4)
         throw ChannelException();
+    if (channels() == 1) {
+        // Grey PNG, straight from the pixels for uint8 images
+        std::vector<unsigned char> png;
+        if (std::is_same<T, uint8_t>::value) {
+            lodepng::encode_grey(png, (const unsigned char *) data_, width(), height(), stride(1),
+                                 lodepng::GREY_DEFAULT);
+        } else {
+            std::vector<unsigned char> grey((size_t) width() * height());
+            for (int y = 0; y < height(); y++)
+                for (int x = 0; x < width(); x++)
+                    grey[x + y*width()] = pixel_to_uint8(data_[x+y*stride(1)]);
+            lodepng::encode_grey(png, grey.data(), width(), height(), 0, lodepng::GREY_DEFAULT);
+        }
+        lodepng::save_file(png, filename);
+        return;
+    }
     int png_channels = 4;
     std::vector<unsigned char> uint8_image(height()*width()*png_channels, 255);
     int c;
     for (int x= 0; x < width(); x++) {
         for (int y = 0; y < height(); y++) {
             for (c = 0; c < channels(); c++) {
-                uint8_image[c + x*png_channels + y*png_channels*width()] = float_to_uint8(image_data[x+y*width()+c*width()*height()]);
-            }
-            for ( ; c < 3; c++) { // Only executes when there is one channel
-
-                uint8_image[c + x*png_channels + y*png_channels*width()] = float_to_uint8(image_data[x+y*width()+0*width()*height()]);
+                uint8_image[c + x*png_channels + y*png_channels*width()] = pixel_to_uint8(data_[x+y*stride(1)+c*stride(2)]);
             }
         }
     }
     lodepng::encode(filename.c_str(), uint8_image, width(), height());
 }
 
-void Image::debug_write() const {
+template <typename T>
+void ImageT<T>::debug_write() const {
     std::ostringstream ss;
     ss << "./Output/" <<  debugWriteNumber << ".png";
     std::string filename = ss.str();
@@ -315,147 +478,33 @@ void Image::debug_write() const {
     debugWriteNumber++;
 }
 
-float Image::uint8_to_float(const unsigned char &in) {
-    return ((float) in)/(255.0f);
+template <typename T>
+T ImageT<T>::from_unit(float in) {
+    float out = in * PixelTraits<T>::max();
+    if (PixelTraits<T>::integer())
+        out = std::min(std::max(out + 0.5f, 0.0f), PixelTraits<T>::max());
+    return (T) out;
 }
 
-unsigned char Image::float_to_uint8(const float &in) {
-    float out = in;
+template <typename T>
+T ImageT<T>::uint8_to_pixel(const unsigned char &in) {
+    return from_unit(((float) in)/(255.0f));
+}
+
+template <typename T>
+unsigned char ImageT<T>::pixel_to_uint8(const T &in) {
+    float out = ((float) in) / PixelTraits<T>::max();
     if (out < 0)
         out = 0;
     if (out > 1)
         out = 1;
-    return (unsigned char) (255.0f*out);
-
-}
-
-// --------- HANDOUT  PS00 ------------------------------
-// ------------------------------------------------------
-
-void compareDimensions(const Image & im1, const Image & im2)  {
-    if(im1.dimensions() != im2.dimensions())
-        throw MismatchedDimensionsException();
-    for (int i = 0; i < im1.dimensions(); i++ ) {
-        if (im1.extent(i) != im2.extent(i))
-            throw MismatchedDimensionsException();
-    }
-}
-
-
-Image operator+ (const Image & im1, const Image & im2) {
-    compareDimensions(im1, im2);
-    long long total_pixels = im1.number_of_elements();
-
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) + im2(i);
-    }
-    return output;
-}
-
-Image operator- (const Image & im1, const Image & im2) {
-    compareDimensions(im1, im2);
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) - im2(i);
-    }
-    return output;
-}
-
-Image operator* (const Image & im1, const Image & im2) {
-    compareDimensions(im1, im2);
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) * im2(i);
-    }
-    return output;
-
-}
-
-Image operator/ (const Image & im1, const Image & im2) {
-    compareDimensions(im1, im2);
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        if (im2(i) == 0)
-            throw DivideByZeroException();
-        output(i) = im1(i) / im2(i);
-    }
-    return output;
-}
+    // integer pixels round; floats truncate like they always did
+    if (PixelTraits<T>::integer())
+        out += 0.5f / 255.0f;
+    return (unsigned char) std::min(255.0f*out, 255.0f);
 
-Image operator+ (const Image & im1, const float & c) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) + c;
-    }
-    return output;
-}
-
-Image operator- (const Image & im1, const float & c) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) -  c;
-    }
-    return output;
-}
-Image operator* (const Image & im1, const float & c) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) * c;
-    }
-    return output;
-}
-Image operator/ (const Image & im1, const float & c) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    if (c==0)
-        throw DivideByZeroException();
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i)/c;
-    }
-    return output;
 }
 
-Image operator+(const float & c, const Image & im1) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) + c;
-    }
-    return output;
-}
-
-Image operator- (const float & c, const Image & im1) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = c - im1(i);
-    }
-    return output;
-}
-
-Image operator* (const float & c, const Image & im1) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        output(i) = im1(i) * c;
-    }
-    return output;
-}
-Image operator/ (const float & c, const Image & im1) {
-    long long total_pixels = im1.number_of_elements();
-    Image output(im1.extent(0), im1.extent(1), im1.extent(2));
-    for (int i = 0 ; i < total_pixels; i++) {
-        if (im1(i) == 0)
-            throw DivideByZeroException();
-        output(i) = c/im1(i);
-    }
-    return output;
-}
-// ---------------- END of PS00 -------------------------------------
+template class ImageT<uint8_t>;
+template class ImageT<uint16_t>;
+template class ImageT<float>;
@@ -5,6 +5,11 @@
  *
  * The 6.815/6.865 Image class
  *
+ * ImageT<T> holds uint8_t, uint16_t or float pixels; Image is the float
+ * image of the original class. Channels are planar. An image either owns
+ * its pixels or wraps memory it does not own (a camera or GstBuffer
+ * frame), see the wrapping constructor.
+ *
  * ---------------------------------------------------------------*/
 
 
@@ -17,22 +22,98 @@
 #include <sstream>
 #include <cfloat>
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
+#include <type_traits>
 
 #include "ImageException.h"
 #include "lodepng.h"
+#include "pixelkernels.h"
+
+/*
+ * Value range of a pixel type: [0, max()] maps to [0, 1] in set_color()
+ * and friends, and to 0 - 255 when reading or writing PNGs.
+ */
+template <typename T> struct PixelTraits;
+
+template <> struct PixelTraits<uint8_t>
+{
+    static constexpr float max() { return 255.0f; }
+    static constexpr bool integer() { return true; }
+};
 
-class Image {
+template <> struct PixelTraits<uint16_t>
+{
+    static constexpr float max() { return 65535.0f; }
+    static constexpr bool integer() { return true; }
+};
+
+template <> struct PixelTraits<float>
+{
+    static constexpr float max() { return 1.0f; }
+    static constexpr bool integer() { return false; }
+};
+
+
+/*
+ * Base of everything that can stand in an image expression: images and
+ * the lazy nodes the arithmetic operators return. An expression is only
+ * evaluated, in one pass and without temporaries, when it is assigned to
+ * an image, so keep the result in an Image rather than auto.
+ */
+template <typename E>
+struct ImageExpr
+{
+    const E & self() const { return static_cast<const E &>(*this); }
+};
+
+
+template <typename T>
+class ImageT : public ImageExpr<ImageT<T> > {
 public:
+    typedef T value_type;
+
     // Constructor to initialize an image of size width_*height_*channels_
     // If height_ and channels_ are zero, the image will be one dimensional
     // If channels_ is zero, the image will be two dimensional
-    Image(int width_, int height_ = 0, int channels_ = 0,  const std::string &name="");
+    ImageT(int width_, int height_ = 0, int channels_ = 0,  const std::string &name="");
+
+    // Wrap pixels owned by someone else, without copying. Rows are
+    // row_stride values apart (width_ if 0), channel planes
+    // row_stride*height_. data has to outlive the image; copies of the
+    // image own their pixels again.
+    ImageT(T *data, int width_, int height_, int channels_ = 0, int row_stride = 0,
+           const std::string &name="");
 
     // Constructor to create an image from a file. The file needs to be in the PNG format
-    Image(const std::string & filename);
+    ImageT(const std::string & filename);
+
+    ImageT(const ImageT &other);
+    ImageT(ImageT &&other);
+    ImageT & operator= (const ImageT &other);
+    ImageT & operator= (ImageT &&other);
+
+    // Evaluate an expression of images and scalars, e.g.
+    // Image flat = (raw - dark) * gain + offset; walks the pixels once.
+    // Assigning to an image of the same size writes in place, also into
+    // wrapped memory.
+    template <typename E>
+    ImageT(const ImageExpr<E> &expr);
+    template <typename E>
+    ImageT & operator= (const ImageExpr<E> &expr);
+
+    // In-place arithmetic, no temporaries
+    template <typename E> ImageT & operator+= (const ImageExpr<E> &expr);
+    template <typename E> ImageT & operator-= (const ImageExpr<E> &expr);
+    template <typename E> ImageT & operator*= (const ImageExpr<E> &expr);
+    template <typename E> ImageT & operator/= (const ImageExpr<E> &expr);
+    ImageT & operator+= (const T &c);
+    ImageT & operator-= (const T &c);
+    ImageT & operator*= (const T &c);
+    ImageT & operator/= (const T &c);
 
     // Destructor. Because there is no explicit memory management here, this doesn't do anything
-    ~Image();
+    ~ImageT();
 
     // set image pixels to corresponding values (only if channel is valid)
     void set_color(float r = 0.0f, float g = 0.0f, float b = 0.0f);
@@ -62,6 +143,13 @@ public:
 
     int extent(int dim) const { return dim_values[dim]; } // Size of dimension
 
+    // The pixels, and whether they are ours or wrapped
+    T *data() { return data_; }
+    const T *data() const { return data_; }
+    bool owns_data() const { return data_ == image_data.data(); }
+    // Elements are back to back, so operator()(int) is a plain index
+    bool is_compact() const { return dims < 2 || stride_[1] == dim_values[0]; }
+
     // Write an image to a file.
     void write(const std::string & filename) const;
     void debug_write() const; // Writes image to Output directory with automatically chosen name
@@ -72,16 +160,25 @@ public:
     long long number_of_elements() const;
 
     // Accessors for the pixel values
-    const float & operator()(int x) const;
-    const float & operator()(int x, int y) const;
-    const float & operator()(int x, int y, int z) const;
+    const T & operator()(int x) const;
+    const T & operator()(int x, int y) const;
+    const T & operator()(int x, int y, int z) const;
 
     // Setters for the pixel values. A reference to the value in image_data is returned
-    float & operator()(int x);
-    float & operator()(int x, int y);
-    float & operator()(int x, int y, int z);
+    T & operator()(int x);
+    T & operator()(int x, int y);
+    T & operator()(int x, int y, int z);
     // ------------------------------------------------------
 
+    // Limit the pixels to [lo, hi]
+    void clamp(T lo, T hi);
+    // Smallest and largest pixel, and the mean over all of them
+    void min_max(T *lo, T *hi) const;
+    double mean() const;
+
+    // Copy n elements from x on in linear order to out, for expressions
+    void eval_block(long long x, int n, T *out) const;
+
     static int debugWriteNumber; // Image number for debug write
 
 
@@ -93,40 +190,287 @@ private:
     unsigned int stride_[3];    // strides
     std::string image_name;     // Image name, will be the filename if read from a file
 
-    // This vector stores the values of the pixels. A vector in C++ is an array
-    // that manages its own memory
-    std::vector<float> image_data;
+    // This vector stores the values of the pixels when the image owns
+    // them. A vector in C++ is an array that manages its own memory
+    std::vector<T> image_data;
+    // The pixels: image_data.data() or wrapped memory
+    T *data_;
+
+    // Offset of element x in linear order
+    long long linear_offset(int x) const;
+    // Offset of element x and how many of the next n are contiguous from
+    // there, at least one: all n when compact, else up to the row end
+    long long run(long long x, long long n, long long *len) const;
 
     // Helper functions for reading and writing
-    static float uint8_to_float(const unsigned char &in); // Converts uint8 to float, 255 -> 1, 0 -> 0
-    static unsigned char float_to_uint8(const float &in); // Converts floats to uint8 0 -> 0, 1 -> 255
+    static T from_unit(float in);                  // [0, 1] -> [0, max]
+    static T uint8_to_pixel(const unsigned char &in); // 255 -> max, 0 -> 0
+    static unsigned char pixel_to_uint8(const T &in); // max -> 255, 0 -> 0
 
     // Common code shared between constructors
     // This does not allocate the image; it only initializes image metadata -
     // image name, width, height, number of channels and number of pixels
     void initialize_image_metadata(int x, int y, int z, const std::string &name_);
+    // Own a compact copy of other's pixels
+    void copy_from(const ImageT &other);
 };
 
+typedef ImageT<float> Image;
+typedef ImageT<uint8_t> Image8;
+typedef ImageT<uint16_t> Image16;
+
 // --------- HANDOUT  PS00 ------------------------------
-void compareDimensions(const Image & im1, const Image & im2);
+template <typename T, typename U>
+void compareDimensions(const ImageT<T> & im1, const ImageT<U> & im2)  {
+    if(im1.dimensions() != im2.dimensions())
+        throw MismatchedDimensionsException();
+    for (int i = 0; i < im1.dimensions(); i++ ) {
+        if (im1.extent(i) != im2.extent(i))
+            throw MismatchedDimensionsException();
+    }
+}
+
+// Expressions are evaluated IMAGE_BLOCK elements at a time, each node
+// running one pixel kernel over the block. Each node computes in the pixel
+// type, so a fused expression gives exactly what the same steps on whole
+// images would.
+#define IMAGE_BLOCK 256
+
+struct ImageAdd {
+    template <typename T> static void apply(const T *a, const T *b, T *out, int n) { pixel_add(a, b, out, n); }
+    template <typename T> static void apply(const T *a, T c, T *out, int n) { pixel_add(a, c, out, n); }
+};
+struct ImageSub {
+    template <typename T> static void apply(const T *a, const T *b, T *out, int n) { pixel_sub(a, b, out, n); }
+    template <typename T> static void apply(const T *a, T c, T *out, int n) { pixel_sub(a, c, out, n); }
+};
+struct ImageMul {
+    template <typename T> static void apply(const T *a, const T *b, T *out, int n) { pixel_mul(a, b, out, n); }
+    template <typename T> static void apply(const T *a, T c, T *out, int n) { pixel_mul(a, c, out, n); }
+};
+struct ImageDiv {
+    template <typename T> static void apply(const T *a, const T *b, T *out, int n) {
+        if (pixel_any_zero(b, n))
+            throw DivideByZeroException();
+        pixel_div(a, b, out, n);
+    }
+    template <typename T> static void apply(const T *a, T c, T *out, int n) {
+        if (c == 0)
+            throw DivideByZeroException();
+        pixel_div(a, c, out, n);
+    }
+};
+
+// A scalar operand, the same value at every pixel
+template <typename T>
+struct ImageScalar
+{
+    typedef T value_type;
+    T c;
+    explicit ImageScalar(T c_) : c(c_) {}
+    void eval_block(long long, int n, T *out) const { std::fill(out, out + n, c); }
+};
+
+// Images are held by reference, nodes and scalars by value
+template <typename E> struct ImageOperand { typedef const E type; };
+template <typename T> struct ImageOperand<ImageT<T> > { typedef const ImageT<T> & type; };
+
+template <typename Op, typename L, typename R>
+class ImageBinary : public ImageExpr<ImageBinary<Op, L, R> > {
+public:
+    typedef typename L::value_type value_type;
+    static_assert(std::is_same<value_type, typename R::value_type>::value,
+                  "image expressions need one pixel type, see convert()");
+
+    ImageBinary(const L &l_, const R &r_) : l(l_), r(r_) {
+        take_shape(l_);
+        take_shape(r_);
+    }
+
+    // out must not be memory of an operand, see ImageT::operator=
+    void eval_block(long long x, int n, value_type *out) const {
+        l.eval_block(x, n, out);
+        apply_right(r, x, n, out);
+    }
+
+    int dimensions() const { return dims; }
+    int extent(int dim) const { return dim_values[dim]; }
+    long long number_of_elements() const {
+        long long n = 1;
+        for (int k = 0; k < dims; k++)
+            n *= dim_values[k];
+        return n;
+    }
+
+private:
+    typename ImageOperand<L>::type l;
+    typename ImageOperand<R>::type r;
+    int dims = 0;
+    int dim_values[3] = {0, 0, 0};
+
+    // The first image operand sets the shape, the others have to match
+    template <typename E>
+    void take_shape(const E &e) {
+        if (dims == 0) {
+            dims = e.dimensions();
+            for (int k = 0; k < 3; k++)
+                dim_values[k] = e.extent(k);
+            return;
+        }
+        if (e.dimensions() != dims)
+            throw MismatchedDimensionsException();
+        for (int k = 0; k < dims; k++)
+            if (e.extent(k) != dim_values[k])
+                throw MismatchedDimensionsException();
+    }
+    template <typename U>
+    void take_shape(const ImageScalar<U> &) {}
+
+    template <typename E>
+    void apply_right(const E &e, long long x, int n, value_type *out) const {
+        value_type block[IMAGE_BLOCK];
+        e.eval_block(x, n, block);
+        Op::apply(out, block, out, n);
+    }
+    void apply_right(const ImageScalar<value_type> &e, long long, int n, value_type *out) const {
+        Op::apply(out, e.c, out, n);
+    }
+};
 
 // Image/Image element-wise operations
-Image operator+ (const Image & im1, const Image & im2);
-Image operator- (const Image & im1, const Image & im2);
-Image operator* (const Image & im1, const Image & im2);
-Image operator/ (const Image & im1, const Image & im2);
-
-// Image/scalar operations
-Image operator+ (const Image & im1, const float & c);
-Image operator- (const Image & im1, const float & c);
-Image operator* (const Image & im1, const float & c);
-Image operator/ (const Image & im1, const float & c);
-
-// scalar/Image operations
-Image operator+ (const float & c, const Image & im1);
-Image operator- (const float & c, const Image & im1);
-Image operator* (const float & c, const Image & im1);
-Image operator/ (const float & c, const Image & im1);
+template <typename L, typename R>
+ImageBinary<ImageAdd, L, R> operator+ (const ImageExpr<L> & im1, const ImageExpr<R> & im2) {
+    return ImageBinary<ImageAdd, L, R>(im1.self(), im2.self());
+}
+template <typename L, typename R>
+ImageBinary<ImageSub, L, R> operator- (const ImageExpr<L> & im1, const ImageExpr<R> & im2) {
+    return ImageBinary<ImageSub, L, R>(im1.self(), im2.self());
+}
+template <typename L, typename R>
+ImageBinary<ImageMul, L, R> operator* (const ImageExpr<L> & im1, const ImageExpr<R> & im2) {
+    return ImageBinary<ImageMul, L, R>(im1.self(), im2.self());
+}
+template <typename L, typename R>
+ImageBinary<ImageDiv, L, R> operator/ (const ImageExpr<L> & im1, const ImageExpr<R> & im2) {
+    return ImageBinary<ImageDiv, L, R>(im1.self(), im2.self());
+}
+
+// Image/scalar and scalar/Image operations. Scalars take the image's pixel
+// type, so im * 2 works for integer images as well.
+#define IMAGE_SCALAR_OPERATORS(op, Op)                                              \
+template <typename E>                                                               \
+ImageBinary<Op, E, ImageScalar<typename E::value_type> >                            \
+operator op (const ImageExpr<E> & im1, const typename E::value_type & c) {          \
+    typedef ImageScalar<typename E::value_type> S;                                  \
+    return ImageBinary<Op, E, S>(im1.self(), S(c));                                 \
+}                                                                                   \
+template <typename E>                                                               \
+ImageBinary<Op, ImageScalar<typename E::value_type>, E>                             \
+operator op (const typename E::value_type & c, const ImageExpr<E> & im1) {          \
+    typedef ImageScalar<typename E::value_type> S;                                  \
+    return ImageBinary<Op, S, E>(S(c), im1.self());                                 \
+}
+
+IMAGE_SCALAR_OPERATORS(+, ImageAdd)
+IMAGE_SCALAR_OPERATORS(-, ImageSub)
+IMAGE_SCALAR_OPERATORS(*, ImageMul)
+IMAGE_SCALAR_OPERATORS(/, ImageDiv)
+
+#undef IMAGE_SCALAR_OPERATORS
 // ------------------------------------------------------
 
+
+template <typename T>
+template <typename E>
+ImageT<T>::ImageT(const ImageExpr<E> &expr)
+    : ImageT(expr.self().extent(0), expr.self().extent(1), expr.self().extent(2)) {
+    *this = expr;
+}
+
+template <typename T>
+template <typename E>
+ImageT<T> & ImageT<T>::operator= (const ImageExpr<E> &expr) {
+    const E &e = expr.self();
+    static_assert(std::is_same<T, typename E::value_type>::value,
+                  "image expressions need one pixel type, see convert()");
+    bool same = e.dimensions() == dimensions();
+    for (int k = 0; same && k < dimensions(); k++)
+        same = e.extent(k) == extent(k);
+    if (!same) {
+        // evaluate first: e may refer to this image
+        *this = ImageT<T>(e);
+        return *this;
+    }
+    // Blocks are evaluated aside and then stored, so e may refer to this
+    // image: element x only reads element x
+    T block[IMAGE_BLOCK];
+    long long total_pixels = number_of_elements();
+    for (long long i = 0; i < total_pixels; i += IMAGE_BLOCK) {
+        int n = (int) std::min<long long>(IMAGE_BLOCK, total_pixels - i);
+        e.eval_block(i, n, block);
+        for (long long done = 0, len; done < n; done += len) {
+            long long offset = run(i + done, n - done, &len);
+            std::copy(block + done, block + done + len, data_ + offset);
+        }
+    }
+    return *this;
+}
+
+template <typename T>
+template <typename E>
+ImageT<T> & ImageT<T>::operator+= (const ImageExpr<E> &expr) { return *this = *this + expr; }
+template <typename T>
+template <typename E>
+ImageT<T> & ImageT<T>::operator-= (const ImageExpr<E> &expr) { return *this = *this - expr; }
+template <typename T>
+template <typename E>
+ImageT<T> & ImageT<T>::operator*= (const ImageExpr<E> &expr) { return *this = *this * expr; }
+template <typename T>
+template <typename E>
+ImageT<T> & ImageT<T>::operator/= (const ImageExpr<E> &expr) { return *this = *this / expr; }
+
+template <typename T>
+ImageT<T> & ImageT<T>::operator+= (const T &c) { return *this = *this + c; }
+template <typename T>
+ImageT<T> & ImageT<T>::operator-= (const T &c) { return *this = *this - c; }
+template <typename T>
+ImageT<T> & ImageT<T>::operator*= (const T &c) { return *this = *this * c; }
+template <typename T>
+ImageT<T> & ImageT<T>::operator/= (const T &c) { return *this = *this / c; }
+
+// Pixel runs of convert(), with kernels for the conversions the camera
+// frames go through
+template <typename To, typename From>
+void convert_run(const From *in, To *out, int n, float scale) {
+    for (int i = 0; i < n; i++) {
+        float v = in[i] * scale;
+        if (PixelTraits<To>::integer())
+            v = std::min(std::max(v + 0.5f, 0.0f), PixelTraits<To>::max());
+        out[i] = (To) v;
+    }
+}
+inline void convert_run(const uint8_t *in, float *out, int n, float scale) { pixel_to_float(in, out, n, scale); }
+inline void convert_run(const uint16_t *in, float *out, int n, float scale) { pixel_to_float(in, out, n, scale); }
+inline void convert_run(const float *in, uint8_t *out, int n, float scale) { pixel_from_float(in, out, n, scale); }
+inline void convert_run(const float *in, uint16_t *out, int n, float scale) { pixel_from_float(in, out, n, scale); }
+
+// Convert between pixel types, 0 - max of one onto 0 - max of the other
+template <typename To, typename From>
+ImageT<To> convert(const ImageT<From> & im) {
+    ImageT<To> output(im.extent(0), im.extent(1), im.extent(2), im.name());
+    float scale = PixelTraits<To>::max() / PixelTraits<From>::max();
+    From block[IMAGE_BLOCK];
+    long long total_pixels = im.number_of_elements();
+    for (long long i = 0 ; i < total_pixels; i += IMAGE_BLOCK) {
+        int n = (int) std::min<long long>(IMAGE_BLOCK, total_pixels - i);
+        const From *in = block;
+        if (im.is_compact())
+            in = im.data() + i;
+        else
+            im.eval_block(i, n, block);
+        convert_run(in, output.data() + i, n, scale);
+    }
+    return output;
+}
+
 #endif
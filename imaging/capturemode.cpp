@@ -0,0 +1,93 @@
+#include "capturemode.h"
+
+#include <stdio.h>
+
+using namespace gsttcam;
+
+// Sea water, as the KellerLD depth in minions
+#define SURVEY_FLUID_DENSITY 1029.0
+#define SURVEY_SURFACE_MBAR 1013.25
+
+bool parseCaptureMode(const std::string &text, CaptureMode *mode)
+{
+    CaptureMode m = *mode;
+    int factor, w, h, x, y;
+    char rest;
+    m.offset = FrameSize{-1, -1};
+    if (text == "full")
+    {
+        m.readout = Readout::Full;
+        m.factor = 1;
+    }
+    else if (sscanf(text.c_str(), "bin%d%c", &factor, &rest) == 1 && factor >= 2 && factor <= 8)
+    {
+        m.readout = Readout::Binning;
+        m.factor = factor;
+    }
+    else if (sscanf(text.c_str(), "skip%d%c", &factor, &rest) == 1 && factor >= 2 && factor <= 8)
+    {
+        m.readout = Readout::Skipping;
+        m.factor = factor;
+    }
+    else if (sscanf(text.c_str(), "roi:%dx%d+%d+%d%c", &w, &h, &x, &y, &rest) == 4 && w > 0 && h > 0 &&
+             x >= 0 && y >= 0)
+    {
+        m.readout = Readout::Roi;
+        m.factor = 1;
+        m.size = FrameSize{w, h};
+        m.offset = FrameSize{x, y};
+    }
+    else if (sscanf(text.c_str(), "roi:%dx%d%c", &w, &h, &rest) == 2 && w > 0 && h > 0)
+    {
+        m.readout = Readout::Roi;
+        m.factor = 1;
+        m.size = FrameSize{w, h};
+    }
+    else
+        return false;
+    *mode = m;
+    return true;
+}
+
+std::string captureModeName(const CaptureMode &mode)
+{
+    char buf[96];
+    double fps = mode.framerate.denominator > 0 ? (double) mode.framerate.numerator / mode.framerate.denominator : 0;
+    int n = snprintf(buf, sizeof(buf), "%s", readout_name(mode.readout));
+    if (mode.readout == Readout::Binning || mode.readout == Readout::Skipping)
+        n += snprintf(buf + n, sizeof(buf) - n, " %dx%d", mode.factor, mode.factor);
+    snprintf(buf + n, sizeof(buf) - n, ", %s %dx%d at %.2f fps", mode.format.c_str(), mode.size.width,
+             mode.size.height, fps);
+    return buf;
+}
+
+SurveyPolicy::SurveyPolicy(const SurveyConfig &config)
+    : config_(config)
+{
+}
+
+void SurveyPolicy::notePressure(float pressure)
+{
+    if (config_.above_depth <= 0 || pressure <= 0)
+        return;
+    double depth = (pressure - SURVEY_SURFACE_MBAR) * 100 / (SURVEY_FLUID_DENSITY * 9.80665);
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (depth < config_.above_depth)
+        shallow_ = true;
+    else if (depth > config_.above_depth + config_.hysteresis)
+        shallow_ = false;
+}
+
+void SurveyPolicy::noteContent(bool blank)
+{
+    if (config_.blank_frames <= 0)
+        return;
+    std::lock_guard<std::mutex> lck(mtx_);
+    blank_run_ = blank ? blank_run_ + 1 : 0;
+}
+
+bool SurveyPolicy::survey()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return shallow_ || (config_.blank_frames > 0 && blank_run_ >= config_.blank_frames);
+}
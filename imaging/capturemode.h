@@ -0,0 +1,56 @@
+#ifndef __CAPTUREMODE__
+#define __CAPTUREMODE__
+
+#include <string>
+#include <mutex>
+
+#include "tcamcamera.h"
+
+/*
+* "full", "bin2", "skip4", "roi:1296x972" or "roi:1296x972+640+480" (the
+* offset on the sensor, centered without). Framerate and format stay as
+* they were in *mode. False if text is none of these.
+*/
+bool parseCaptureMode(const std::string &text, gsttcam::CaptureMode *mode);
+std::string captureModeName(const gsttcam::CaptureMode &mode);
+
+struct SurveyConfig
+{
+    // Survey shallower than this (m), by the pressure at the matched
+    // triggers; 0 leaves depth out of it
+    double above_depth = 0;
+    // Back to full this much deeper, so a swell does not toggle it
+    double hysteresis = 2;
+    // Survey after this many blank frames in a row, back to full on the
+    // first frame with content; 0 leaves content out of it
+    int blank_frames = 0;
+};
+
+/*
+* When full resolution is not needed: near the surface or while there is
+* nothing but water in front of the cameras. The callbacks and writers
+* feed it, the main thread polls survey() and switches the cameras.
+*/
+class SurveyPolicy
+{
+    public:
+        explicit SurveyPolicy(const SurveyConfig &config);
+
+        /*
+        * Pressure (mbar) at a trigger. Thread safe.
+        */
+        void notePressure(float pressure);
+        /*
+        * Whether a frame was blank by the content filter. Thread safe.
+        */
+        void noteContent(bool blank);
+        bool survey();
+
+    private:
+        SurveyConfig config_;
+        std::mutex mtx_;
+        bool shallow_ = false;
+        int blank_run_ = 0;
+};
+
+#endif
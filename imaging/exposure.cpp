@@ -0,0 +1,92 @@
+#include "exposure.h"
+
+#include <math.h>
+#include <algorithm>
+
+ExposureController::ExposureController(const ExposureConfig &config, int exposure_us, int gain)
+    : config_(config), exposure_us_(exposure_us), gain_(gain)
+{
+}
+
+static double dbToLinear(double db)
+{
+    return pow(10.0, db / 20.0);
+}
+
+bool ExposureController::update(int camera, const FrameStats &stats, long long timestamp_ns,
+                                int *exposure_us, int *gain)
+{
+    long long interval_ns = config_.interval_ms * 1000000LL;
+    std::lock_guard<std::mutex> lck(mtx_);
+    // The settings as they are, whatever comes of this frame
+    *exposure_us = exposure_us_;
+    *gain = gain_;
+    // Only frames from the second half of the interval: the ones before
+    // were likely exposed with the old settings
+    if (timestamp_ns < last_change_ns_ + interval_ns / 2)
+        return false;
+
+    uint64_t n = 0;
+    for (int v = 0; v < 256; v++)
+        n += stats.histogram[v];
+    if (n == 0)
+        return false;
+    int level = histogramPercentile(stats, config_.percentile);
+    double ratio = (double) config_.target / std::max(level, 1);
+    if (100.0 * stats.histogram[255] / n > config_.max_saturated)
+        ratio = std::min(ratio, 0.7);
+    ratio_[camera] = ratio;
+
+    if (timestamp_ns < last_change_ns_ + interval_ns)
+        return false;
+    // The camera that wants the least light decides
+    double wanted = ratio_.begin()->second;
+    for (auto &r : ratio_)
+        wanted = std::min(wanted, r.second);
+    ratio_.clear();
+    if (fabs(wanted - 1.0) < config_.deadband || !apply(wanted))
+        return false;
+    last_change_ns_ = timestamp_ns;
+    *exposure_us = exposure_us_;
+    *gain = gain_;
+    return true;
+}
+
+int ExposureController::exposure_us() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return exposure_us_;
+}
+
+int ExposureController::gain() const
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return gain_;
+}
+
+// Exposure first on the way up, gain first on the way down. Returns
+// false if the limits leave the settings as they are.
+bool ExposureController::apply(double ratio)
+{
+    ratio = std::min(std::max(ratio, 1.0 / config_.max_step), config_.max_step);
+    double total = exposure_us_ * dbToLinear(gain_) * ratio;
+    int exposure, gain;
+    double min_gain = dbToLinear(config_.min_gain);
+    if (total <= config_.max_exposure_us * min_gain)
+    {
+        gain = config_.min_gain;
+        exposure = (int) lround(total / min_gain);
+    }
+    else
+    {
+        exposure = config_.max_exposure_us;
+        gain = (int) lround(20.0 * log10(total / exposure));
+    }
+    exposure = std::min(std::max(exposure, config_.min_exposure_us), config_.max_exposure_us);
+    gain = std::min(std::max(gain, config_.min_gain), config_.max_gain);
+    if (exposure == exposure_us_ && gain == gain_)
+        return false;
+    exposure_us_ = exposure;
+    gain_ = gain;
+    return true;
+}
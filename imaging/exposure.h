@@ -0,0 +1,69 @@
+#ifndef __EXPOSURE__
+#define __EXPOSURE__
+
+#include <mutex>
+#include <map>
+
+#include "framestats.h"
+
+/*
+* Limits and targets of the auto exposure. Exposure is in us, gain in the
+* camera's "Gain" units, taken to be dB. Longer exposure is used before
+* more gain; exposure beyond the LED pulse only adds ambient light, which
+* there is none of at depth, so max_exposure_us bounds it.
+*/
+struct ExposureConfig
+{
+    bool enabled = false;
+    // Grey level the percentile should sit at
+    int target = 180;
+    double percentile = 99.0;
+    // More than this percent of pixels at 255 always means darker
+    double max_saturated = 0.5;
+    int min_exposure_us = 100;
+    int max_exposure_us = 3000;
+    int min_gain = 0;
+    int max_gain = 36;
+    // Settings change at most this often and by at most max_step times
+    int interval_ms = 2000;
+    double max_step = 2.0;
+    // Brightness errors smaller than this fraction are left alone
+    double deadband = 0.1;
+};
+
+/*
+* Closed loop exposure control for all cameras of the rig from the
+* histograms of their frames. Every camera gets the same exposure and
+* gain, so stereo pairs stay matched; the brightest camera decides, so
+* neither saturates. Frames exposed before the last change are ignored.
+*/
+class ExposureController
+{
+    public:
+        ExposureController(const ExposureConfig &config, int exposure_us, int gain);
+
+        /*
+        * Feed the stats of one frame of camera, timestamp_ns its
+        * CLOCK_MONOTONIC arrival time. Returns true when the settings
+        * should change; exposure_us and gain are always set to the current
+        * ones, read together under the lock. Thread safe.
+        */
+        bool update(int camera, const FrameStats &stats, long long timestamp_ns,
+                    int *exposure_us, int *gain);
+
+        int exposure_us() const;
+        int gain() const;
+
+    private:
+        ExposureConfig config_;
+        mutable std::mutex mtx_;
+        int exposure_us_;
+        int gain_;
+        long long last_change_ns_ = 0;
+        // Latest wanted brightness change per camera since the last change
+        std::map<int, double> ratio_;
+
+        bool apply(double ratio);
+};
+
+#endif
@@ -0,0 +1,242 @@
+#include "framecodec.h"
+#include "tiffwriter.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <chrono>
+#include <vector>
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+static_assert(sizeof(Lz4FrameHeader) == 64, "Lz4FrameHeader layout changed");
+
+static const struct
+{
+    StorageCodec codec;
+    const char *name;
+} codec_names[] = {
+    {StorageCodec::None, "none"},
+    {StorageCodec::PackBits, "packbits"},
+    {StorageCodec::LZW, "lzw"},
+    {StorageCodec::Deflate, "deflate"},
+    {StorageCodec::LZ4Raw, "lz4"},
+};
+
+bool parseStorageCodec(const char *name, StorageCodec *codec)
+{
+    for (size_t i = 0; i < sizeof(codec_names) / sizeof(codec_names[0]); i++)
+    {
+        if (strcmp(name, codec_names[i].name) == 0)
+        {
+            *codec = codec_names[i].codec;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *storageCodecName(StorageCodec codec)
+{
+    for (size_t i = 0; i < sizeof(codec_names) / sizeof(codec_names[0]); i++)
+    {
+        if (codec_names[i].codec == codec)
+            return codec_names[i].name;
+    }
+    return "unknown";
+}
+
+const char *storageCodecExtension(StorageCodec codec)
+{
+    return codec == StorageCodec::LZ4Raw ? ".lz4f" : ".tif";
+}
+
+static uint16_t tiffCompression(StorageCodec codec)
+{
+    switch (codec)
+    {
+        case StorageCodec::None:
+            return COMPRESSION_NONE;
+        case StorageCodec::LZW:
+            return COMPRESSION_LZW;
+        case StorageCodec::Deflate:
+            return COMPRESSION_ADOBE_DEFLATE;
+        case StorageCodec::PackBits:
+        default:
+            return COMPRESSION_PACKBITS;
+    }
+}
+
+bool storageCodecAvailable(StorageCodec codec)
+{
+    if (codec == StorageCodec::LZ4Raw)
+    {
+#ifdef HAVE_LZ4
+        return true;
+#else
+        return false;
+#endif
+    }
+    return TIFFIsCODECConfigured(tiffCompression(codec));
+}
+
+size_t lz4BlockBound(size_t raw_bytes)
+{
+#ifdef HAVE_LZ4
+    return LZ4_compressBound((int) raw_bytes);
+#else
+    (void) raw_bytes;
+    return 0;
+#endif
+}
+
+int compressLz4Block(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                     int acceleration, char *dst, size_t capacity)
+{
+#ifdef HAVE_LZ4
+    size_t rawbytes = (size_t) width * height;
+    // Per writer thread, sized for the first frame and then reused
+    static thread_local std::vector<unsigned char> packed;
+
+    const unsigned char *src = buf;
+    if ((uint32_t) stride != width)
+    {
+        if (packed.size() < rawbytes)
+            packed.resize(rawbytes);
+        for (uint32_t row = 0; row < height; row++)
+            memcpy(packed.data() + (size_t) row * width, buf + (size_t) row * stride, width);
+        src = packed.data();
+    }
+    int n = LZ4_compress_fast((const char *) src, dst, (int) rawbytes, (int) capacity,
+                              acceleration > 0 ? acceleration : 1);
+    return n > 0 ? n : -1;
+#else
+    (void) buf; (void) width; (void) height; (void) stride;
+    (void) acceleration; (void) dst; (void) capacity;
+    return -1;
+#endif
+}
+
+int decompressLz4Block(const char *src, size_t size, unsigned char *dst, size_t raw_bytes)
+{
+#ifdef HAVE_LZ4
+    int n = LZ4_decompress_safe(src, (char *) dst, (int) size, (int) raw_bytes);
+    return n == (int) raw_bytes ? 0 : -1;
+#else
+    (void) src; (void) size; (void) dst; (void) raw_bytes;
+    return -1;
+#endif
+}
+
+#ifdef HAVE_LZ4
+static int writeLz4Frame(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                         const FrameMeta &meta, const char *path, int acceleration, size_t *stored)
+{
+    size_t rawbytes = (size_t) width * height;
+    // Per writer thread, like the packed rows
+    static thread_local std::vector<char> compressed;
+
+    size_t bound = lz4BlockBound(rawbytes);
+    if (compressed.size() < bound)
+        compressed.resize(bound);
+    int n = compressLz4Block(buf, width, height, stride, acceleration, compressed.data(), bound);
+    if (n <= 0)
+    {
+        fprintf(stderr, "%s: LZ4 compression failed.\n", path);
+        return -1;
+    }
+
+    Lz4FrameHeader hdr;
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, "MLZ4", 4);
+    hdr.version = LZ4_FRAME_VERSION;
+    hdr.header_size = sizeof(hdr);
+    hdr.width = width;
+    hdr.height = height;
+    hdr.camera_id = meta.camera_id;
+    hdr.flags = meta.has_trigger ? LZ4_FRAME_HAS_TRIGGER : 0;
+    hdr.frame_id = meta.frame_id;
+    hdr.timestamp_ns = meta.timestamp_ns;
+    hdr.raw_size = rawbytes;
+    hdr.compressed_size = n;
+    hdr.trigger_ns = meta.trigger_ns;
+    hdr.pressure = meta.pressure;
+    hdr.temperature = meta.temperature;
+
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: Cannot open file for output.\n", path);
+        return -1;
+    }
+    struct iovec iov[2];
+    iov[0].iov_base = &hdr;
+    iov[0].iov_len = sizeof(hdr);
+    iov[1].iov_base = compressed.data();
+    iov[1].iov_len = n;
+    ssize_t total = sizeof(hdr) + n;
+    ssize_t w = writev(fd, iov, 2);
+    close(fd);
+    if (w != total)
+    {
+        fprintf(stderr, "%s: Write error.\n", path);
+        return -1;
+    }
+    *stored = total;
+    return 0;
+}
+#endif
+
+int encodeFrame(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                const FrameMeta &meta, const char *basename, const CodecOptions &options, EncodeResult *result)
+{
+    char path[256];
+    snprintf(path, sizeof(path), "%s%s", basename, storageCodecExtension(options.codec));
+
+    auto t0 = std::chrono::steady_clock::now();
+    int ret;
+    size_t stored = 0;
+    if (options.codec == StorageCodec::LZ4Raw)
+    {
+#ifdef HAVE_LZ4
+        ret = writeLz4Frame(buf, width, height, stride, meta, path, options.level, &stored);
+#else
+        fprintf(stderr, "%s: built without LZ4 support.\n", path);
+        ret = -1;
+#endif
+    }
+    else
+    {
+        char description[256];
+        int len = snprintf(description, sizeof(description), "camera=%d frame=%ld timestamp_ns=%lld",
+                           meta.camera_id, meta.frame_id, meta.timestamp_ns);
+        if (meta.has_trigger && len > 0 && len < (int) sizeof(description))
+            snprintf(description + len, sizeof(description) - len,
+                     " trigger=%ld trigger_ns=%lld pressure=%.2f temperature=%.2f",
+                     meta.trigger_id, meta.trigger_ns, meta.pressure, meta.temperature);
+
+        TiffOptions tiff;
+        tiff.description = description;
+        tiff.strip_bytes = options.strip_bytes;
+        tiff.compression = tiffCompression(options.codec);
+        tiff.level = options.level;
+        ret = writeTiff(buf, width, height, stride, path, tiff);
+        struct stat st;
+        if (ret == 0 && stat(path, &st) == 0)
+            stored = st.st_size;
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    if (result)
+    {
+        result->encode_ms = std::chrono::duration<double, std::milli>(t1 - t0).count();
+        result->raw_bytes = (size_t) width * height;
+        result->stored_bytes = stored;
+    }
+    return ret;
+}
@@ -0,0 +1,119 @@
+#ifndef __FRAMECODEC__
+#define __FRAMECODEC__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* How a frame is stored on the SD card. The TIFF codecs go through libtiff,
+* LZ4Raw writes an LZ4 block behind a small fixed header (see
+* Lz4FrameHeader) and is only available when built with liblz4.
+*/
+enum class StorageCodec
+{
+    None,
+    PackBits,
+    LZW,
+    Deflate,
+    LZ4Raw
+};
+
+struct CodecOptions
+{
+    StorageCodec codec = StorageCodec::PackBits;
+    // Deflate: zlib level 1-9. LZ4Raw: acceleration, higher is faster.
+    // 0 keeps the codec's default.
+    int level = 0;
+    // Uncompressed TIFF strip size, see TiffOptions
+    uint32_t strip_bytes = 128 * 1024;
+};
+
+/*
+* Cost of storing one frame
+*/
+struct EncodeResult
+{
+    double encode_ms;       // compression and write, including open/close
+    size_t raw_bytes;
+    size_t stored_bytes;
+};
+
+/*
+* What is stored alongside the pixels of one frame
+*/
+struct FrameMeta
+{
+    int camera_id;
+    long frame_id;
+    long long timestamp_ns;     // CLOCK_MONOTONIC arrival time
+    // From the minions trigger channel, valid if has_trigger
+    bool has_trigger;
+    long trigger_id;
+    long long trigger_ns;       // CLOCK_MONOTONIC trigger time
+    float pressure;
+    float temperature;
+};
+
+/*
+* On-disk layout of an LZ4Raw frame: this header, 64 bytes (48 up to
+* version 1, without the trigger fields; header_size tells), in host byte
+* order (little-endian on the Pi) followed by compressed_size bytes of one
+* LZ4 block. The block decompresses to height rows of width bytes.
+*/
+struct Lz4FrameHeader
+{
+    char magic[4];              // "MLZ4"
+    uint16_t version;           // LZ4_FRAME_VERSION
+    uint16_t header_size;       // sizeof(Lz4FrameHeader)
+    uint32_t width;
+    uint32_t height;
+    uint32_t camera_id;
+    uint32_t flags;             // LZ4_FRAME_HAS_TRIGGER
+    int64_t frame_id;
+    int64_t timestamp_ns;
+    uint32_t raw_size;
+    uint32_t compressed_size;
+    // version 2
+    int64_t trigger_ns;
+    float pressure;
+    float temperature;
+};
+
+#define LZ4_FRAME_VERSION 2
+#define LZ4_FRAME_HAS_TRIGGER 0x1
+
+bool parseStorageCodec(const char *name, StorageCodec *codec);
+const char *storageCodecName(StorageCodec codec);
+/*
+* File extension including the dot, ".tif" or ".lz4f"
+*/
+const char *storageCodecExtension(StorageCodec codec);
+/*
+* False if this build or the installed libtiff cannot produce the codec
+*/
+bool storageCodecAvailable(StorageCodec codec);
+
+/*
+* Upper bound of compressLz4Block's output for raw_bytes, 0 without LZ4
+*/
+size_t lz4BlockBound(size_t raw_bytes);
+/*
+* Compress height rows of width bytes, stride apart in buf, into one LZ4
+* block of at most capacity bytes. Returns its size or -1.
+*/
+int compressLz4Block(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                     int acceleration, char *dst, size_t capacity);
+/*
+* Decompress one LZ4 block of exactly raw_bytes. Returns 0 or -1.
+*/
+int decompressLz4Block(const char *src, size_t size, unsigned char *dst, size_t raw_bytes);
+
+/*
+* Store a single channel 8-bit frame as basename + extension. Rows are
+* stride bytes apart in buf. TIFFs carry meta in their ImageDescription,
+* LZ4 frames in the header. result may be NULL.
+*/
+int encodeFrame(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                const FrameMeta &meta, const char *basename, const CodecOptions &options, EncodeResult *result);
+
+#endif
@@ -0,0 +1,102 @@
+#include "framepool.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+FramePool::FramePool()
+{
+}
+
+FramePool::~FramePool()
+{
+    free();
+}
+
+bool FramePool::allocate(size_t buffer_size, int count, bool lock_memory)
+{
+    free();
+    if (buffer_size == 0 || count < 1)
+        return false;
+
+    // Round every buffer up to whole pages so each one starts page aligned
+    size_t page = sysconf(_SC_PAGESIZE);
+    buffer_stride_ = (buffer_size + page - 1) / page * page;
+    region_size_ = buffer_stride_ * count;
+
+    void *mem = nullptr;
+    if (posix_memalign(&mem, page, region_size_) != 0)
+    {
+        fprintf(stderr, "FramePool: cannot allocate %d x %zu bytes\n", count, buffer_size);
+        region_size_ = 0;
+        return false;
+    }
+    region_ = (unsigned char *) mem;
+    // Touch every page now rather than on the first frame
+    memset(region_, 0, region_size_);
+
+    if (lock_memory)
+    {
+        if (mlock(region_, region_size_) == 0)
+            locked_ = true;
+        else
+            perror("FramePool: mlock");
+    }
+
+    buffer_size_ = buffer_size;
+    count_ = count;
+    std::lock_guard<std::mutex> lck(mtx_);
+    free_.clear();
+    free_.reserve(count);
+    for (int i = count - 1; i >= 0; i--)
+        free_.push_back(region_ + i * buffer_stride_);
+    return true;
+}
+
+void FramePool::free()
+{
+    if (!region_)
+        return;
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if ((int) free_.size() != count_)
+            fprintf(stderr, "FramePool: freeing with %d buffers still in use\n",
+                    count_ - (int) free_.size());
+        free_.clear();
+    }
+    if (locked_)
+        munlock(region_, region_size_);
+    ::free(region_);
+    region_ = nullptr;
+    region_size_ = 0;
+    buffer_size_ = 0;
+    buffer_stride_ = 0;
+    count_ = 0;
+    locked_ = false;
+}
+
+unsigned char *FramePool::acquire()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (free_.empty())
+        return nullptr;
+    unsigned char *buffer = free_.back();
+    free_.pop_back();
+    return buffer;
+}
+
+void FramePool::release(unsigned char *buffer)
+{
+    if (!buffer)
+        return;
+    std::lock_guard<std::mutex> lck(mtx_);
+    // capacity was reserved in allocate(), so this never reallocates
+    free_.push_back(buffer);
+}
+
+int FramePool::available()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return free_.size();
+}
@@ -0,0 +1,56 @@
+#ifndef __FRAMEPOOL__
+#define __FRAMEPOOL__
+
+#include <stddef.h>
+#include <vector>
+#include <mutex>
+
+/*
+* Fixed set of equally sized, page aligned frame buffers carved out of one
+* allocation made before capture starts. acquire() and release() only move
+* pointers on a preallocated free stack, so the heap is never touched while
+* streaming. The whole region can be mlock()ed to keep it out of swap.
+*/
+class FramePool
+{
+    public:
+        FramePool();
+        ~FramePool();
+
+        FramePool(const FramePool&) = delete;
+        FramePool& operator= (const FramePool&) = delete;
+
+        /*
+        * Replace the pool with count buffers of at least buffer_size bytes.
+        * Every buffer must have been released. Returns false on failure.
+        */
+        bool allocate(size_t buffer_size, int count, bool lock_memory = false);
+        /*
+        * Give the memory back. Every buffer must have been released.
+        */
+        void free();
+
+        /*
+        * Take a buffer, NULL if all are in use
+        */
+        unsigned char *acquire();
+        void release(unsigned char *buffer);
+
+        size_t buffer_size() const { return buffer_size_; }
+        int capacity() const { return count_; }
+        int available();
+        bool locked() const { return locked_; }
+
+    private:
+        unsigned char *region_ = nullptr;
+        size_t region_size_ = 0;
+        size_t buffer_size_ = 0;
+        size_t buffer_stride_ = 0;
+        int count_ = 0;
+        bool locked_ = false;
+
+        std::mutex mtx_;
+        std::vector<unsigned char*> free_;
+};
+
+#endif
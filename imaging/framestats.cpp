@@ -0,0 +1,127 @@
+#include "framestats.h"
+#include "pixelkernels.h"
+
+#include <string.h>
+#include <strings.h>
+#include <algorithm>
+
+static const char *policy_names[] = {"keep", "drop", "thumb"};
+
+bool parseBlankPolicy(const char *name, BlankPolicy *policy)
+{
+    for (size_t i = 0; i < sizeof(policy_names) / sizeof(policy_names[0]); i++)
+    {
+        if (strcasecmp(name, policy_names[i]) == 0)
+        {
+            *policy = (BlankPolicy) i;
+            return true;
+        }
+    }
+    return false;
+}
+
+const char *blankPolicyName(BlankPolicy policy)
+{
+    return policy_names[(int) policy];
+}
+
+void computeFrameStats(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                       int margin, FrameStats *stats)
+{
+    memset(stats->histogram, 0, sizeof(stats->histogram));
+    uint64_t gradient = 0, gradient_n = 0;
+    for (uint32_t row = 0; row < height; row++)
+    {
+        const unsigned char *p = buf + (size_t) row * stride;
+        pixel_histogram(p, width, stats->histogram);
+        if (row % FRAME_STATS_ROW_STEP == 0 && width > 1)
+        {
+            // Horizontal neighbours, and the row below
+            gradient += pixel_abs_diff_sum(p, p + 1, width - 1);
+            gradient_n += width - 1;
+            if (row + 1 < height)
+            {
+                gradient += pixel_abs_diff_sum(p, p + stride, width);
+                gradient_n += width;
+            }
+        }
+    }
+
+    // Everything else comes from the histogram: 256 bins, not 5 Mpixels
+    uint64_t n = (uint64_t) width * height;
+    double sum = 0, sum2 = 0;
+    uint64_t below = 0;
+    bool have_median = false;
+    stats->median = 0;
+    stats->max = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        uint32_t count = stats->histogram[v];
+        sum += (double) count * v;
+        sum2 += (double) count * v * v;
+        below += count;
+        if (!have_median && 2 * below >= n && n > 0)
+        {
+            stats->median = v;
+            have_median = true;
+        }
+        if (count)
+            stats->max = v;
+    }
+    stats->mean = n ? sum / n : 0;
+    stats->variance = n ? sum2 / n - stats->mean * stats->mean : 0;
+    stats->sharpness = gradient_n ? (float) gradient / gradient_n : 0;
+
+    uint64_t bright = 0;
+    for (int v = stats->median + margin + 1; v < 256; v++)
+        bright += stats->histogram[v];
+    stats->content = n ? 100.0f * bright / n : 0;
+}
+
+int histogramPercentile(const FrameStats &stats, double percent)
+{
+    uint64_t n = 0;
+    for (int v = 0; v < 256; v++)
+        n += stats.histogram[v];
+    double limit = n * percent / 100.0;
+    uint64_t below = 0;
+    for (int v = 0; v < 256; v++)
+    {
+        below += stats.histogram[v];
+        if (below > 0 && below >= limit)
+            return v;
+    }
+    return 255;
+}
+
+bool isBlankFrame(const FrameStats &stats, const ContentFilter &filter)
+{
+    return filter.policy != BlankPolicy::Keep && stats.content < filter.min_content;
+}
+
+void downsampleFrame(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                     int scale, std::vector<unsigned char> &out)
+{
+    uint32_t w = width / scale, h = height / scale;
+    out.resize((size_t) w * h);
+    // Column sums of scale rows, then scale columns per output pixel
+    std::vector<uint32_t> sums(w * scale);
+    uint32_t area = scale * scale;
+    for (uint32_t y = 0; y < h; y++)
+    {
+        std::fill(sums.begin(), sums.end(), 0);
+        for (int r = 0; r < scale; r++)
+        {
+            const unsigned char *p = buf + (size_t) (y * scale + r) * stride;
+            for (uint32_t x = 0; x < w * scale; x++)
+                sums[x] += p[x];
+        }
+        for (uint32_t x = 0; x < w; x++)
+        {
+            uint32_t s = 0;
+            for (int c = 0; c < scale; c++)
+                s += sums[x * scale + c];
+            out[(size_t) y * w + x] = (s + area / 2) / area;
+        }
+    }
+}
@@ -0,0 +1,73 @@
+#ifndef __FRAMESTATS__
+#define __FRAMESTATS__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+* Summary of one GRAY8 frame, cheap enough to run on every frame before
+* it is stored
+*/
+struct FrameStats
+{
+    uint32_t histogram[256];
+    double mean;
+    double variance;
+    uint8_t median;
+    uint8_t max;
+    // Mean absolute difference between neighbouring pixels, on every
+    // FRAME_STATS_ROW_STEP'th row: near 0 for empty or defocused frames
+    float sharpness;
+    // Percent of the pixels more than ContentFilter::margin above the
+    // median: the particles and animals standing out from the water
+    float content;
+};
+
+#define FRAME_STATS_ROW_STEP 4
+
+/*
+* Which frames count as blank and what happens to them
+*/
+enum class BlankPolicy
+{
+    Keep,           // store every frame, only log the stats
+    Drop,           // store nothing but the stats
+    Thumbnail       // store a thumbnail_scale times smaller frame
+};
+
+struct ContentFilter
+{
+    BlankPolicy policy = BlankPolicy::Keep;
+    // Frames with less content in percent are blank
+    float min_content = 0.05f;
+    // Grey levels above the median that count as content, above the noise
+    int margin = 16;
+    int thumbnail_scale = 8;
+};
+
+bool parseBlankPolicy(const char *name, BlankPolicy *policy);
+const char *blankPolicyName(BlankPolicy policy);
+
+/*
+* Histogram, mean, variance, sharpness and content of a frame of width x
+* height pixels with rows stride bytes apart
+*/
+void computeFrameStats(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                       int margin, FrameStats *stats);
+
+/*
+* Smallest grey level with at least percent of the pixels at or below it
+*/
+int histogramPercentile(const FrameStats &stats, double percent);
+
+bool isBlankFrame(const FrameStats &stats, const ContentFilter &filter);
+
+/*
+* Box-filter a frame down by scale in both directions into out, which is
+* resized to (width / scale) * (height / scale) compact rows
+*/
+void downsampleFrame(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                     int scale, std::vector<unsigned char> &out);
+
+#endif
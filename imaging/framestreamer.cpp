@@ -0,0 +1,188 @@
+#include "framestreamer.h"
+#include "framestats.h"
+#include "lodepng.h"
+#include "rtthreads.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <netinet/ip.h>
+#include <sys/socket.h>
+#include <algorithm>
+#include <chrono>
+
+// UDP, IP and 802.11 framing per datagram, for the rate
+#define STREAM_OVERHEAD_BYTES 60
+// DSCP CS1, "lower effort": WMM maps it to the background access category
+#define STREAM_TOS 0x20
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+FrameStreamer::FrameStreamer(const StreamConfig &config)
+    : config_(config)
+{
+    if (config_.scale < 1)
+        config_.scale = 1;
+    interval_ns_ = config_.max_fps > 0 ? (long long) (1e9 / config_.max_fps) : 0;
+    memset(&addr_, 0, sizeof(addr_));
+}
+
+FrameStreamer::~FrameStreamer()
+{
+    stop();
+}
+
+bool FrameStreamer::start()
+{
+    if (config_.host.empty() || config_.max_fps <= 0 || config_.max_kbps <= 0)
+        return false;
+    struct addrinfo hints, *res = NULL;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_INET;
+    hints.ai_socktype = SOCK_DGRAM;
+    int err = getaddrinfo(config_.host.c_str(), NULL, &hints, &res);
+    if (err != 0 || res == NULL)
+    {
+        fprintf(stderr, "FrameStreamer: %s: %s\n", config_.host.c_str(), gai_strerror(err));
+        return false;
+    }
+    memcpy(&addr_, res->ai_addr, sizeof(addr_));
+    addr_.sin_port = htons(config_.port);
+    freeaddrinfo(res);
+
+    sock_ = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock_ < 0)
+    {
+        perror("FrameStreamer: socket");
+        return false;
+    }
+    int tos = STREAM_TOS;
+    if (setsockopt(sock_, IPPROTO_IP, IP_TOS, &tos, sizeof(tos)) == -1)
+        perror("FrameStreamer: IP_TOS");
+
+    std::lock_guard<std::mutex> lck(mtx_);
+    running_ = true;
+    thread_ = std::thread(&FrameStreamer::loop, this);
+    return true;
+}
+
+void FrameStreamer::stop()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (!running_)
+            return;
+        running_ = false;
+    }
+    ready_.notify_one();
+    thread_.join();
+    close(sock_);
+    sock_ = -1;
+}
+
+void FrameStreamer::offer(const Frame &frame)
+{
+    long long now = now_ns();
+    long long due = due_ns_.load(std::memory_order_relaxed);
+    if (now < due)
+        return;
+    // Whoever is in here, or a sender still busy with the last frame, wins
+    std::unique_lock<std::mutex> lck(mtx_, std::try_to_lock);
+    if (!lck.owns_lock() || !running_ || pending_ || busy_)
+        return;
+    due_ns_ = now + interval_ns_;
+
+    Pending &p = next_;
+    downsampleFrame(frame.data, frame.width, frame.height, frame.stride, config_.scale, p.pixels);
+    p.width = frame.width / config_.scale;
+    p.height = frame.height / config_.scale;
+    stream_header &h = p.header;
+    memset(&h, 0, sizeof(h));
+    h.scale = (uint8_t) std::min(config_.scale, 255);
+    h.frame_id = frame.frame_id;
+    h.timestamp_ns = (long long) frame.timestamp.tv_sec * 1000000000LL + frame.timestamp.tv_nsec;
+    h.trigger_id = frame.has_trigger ? frame.trigger_id : -1;
+    h.pressure = frame.pressure;
+    h.temperature = frame.temperature;
+    h.camera_id = (uint16_t) frame.camera_id;
+    h.width = (uint16_t) frame.width;
+    h.height = (uint16_t) frame.height;
+    pending_ = true;
+    lck.unlock();
+    ready_.notify_one();
+}
+
+void FrameStreamer::loop()
+{
+    // Only ever on time nothing else wants
+    setThreadRole(ThreadRole::Idle);
+    std::vector<unsigned char> pixels, png;
+    while (true)
+    {
+        stream_header header;
+        int width, height;
+        {
+            std::unique_lock<std::mutex> lck(mtx_);
+            ready_.wait(lck, [this] { return pending_ || !running_; });
+            if (!running_)
+                return;
+            pixels.swap(next_.pixels);
+            header = next_.header;
+            width = next_.width;
+            height = next_.height;
+            pending_ = false;
+            busy_ = true;
+        }
+        png.clear();
+        unsigned err = width > 0 && height > 0 ?
+            lodepng::encode_grey(png, pixels.data(), width, height, 0, lodepng::GREY_FAST) : 1;
+        if (err == 0)
+            send(png, header);
+        std::lock_guard<std::mutex> lck(mtx_);
+        busy_ = false;
+    }
+}
+
+// Paced at max_kbps; the frame is given up at the first datagram that
+// finds the socket buffer full
+void FrameStreamer::send(const std::vector<unsigned char> &png, stream_header header)
+{
+    size_t chunks = (png.size() + STREAM_CHUNK_BYTES - 1) / STREAM_CHUNK_BYTES;
+    if (chunks == 0 || chunks > 0xffff)
+        return;
+    header.seq = seq_++;
+    header.chunks = (uint16_t) chunks;
+    header.size = (uint32_t) png.size();
+    uint8_t buf[STREAM_DATAGRAM];
+    auto due = std::chrono::steady_clock::now();
+    for (size_t i = 0; i < chunks; i++)
+    {
+        size_t offset = i * STREAM_CHUNK_BYTES;
+        size_t n = std::min((size_t) STREAM_CHUNK_BYTES, png.size() - offset);
+        header.chunk = (uint16_t) i;
+        stream_encode(&header, buf);
+        memcpy(buf + STREAM_HEADER_SIZE, png.data() + offset, n);
+        std::this_thread::sleep_until(due);
+        ssize_t w = sendto(sock_, buf, STREAM_HEADER_SIZE + n, MSG_DONTWAIT,
+                           (struct sockaddr *) &addr_, sizeof(addr_));
+        if (w < 0)
+        {
+            // No room, or no route with the WiFi gone: try the next frame
+            dropped_++;
+            return;
+        }
+        long long bits = 8LL * (STREAM_HEADER_SIZE + n + STREAM_OVERHEAD_BYTES);
+        due += std::chrono::microseconds(bits * 1000 / config_.max_kbps);
+    }
+    // Busy until the last datagram's share of the rate is over too
+    std::this_thread::sleep_until(due);
+    sent_++;
+}
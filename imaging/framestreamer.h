@@ -0,0 +1,88 @@
+#ifndef __FRAMESTREAMER__
+#define __FRAMESTREAMER__
+
+#include <string>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <netinet/in.h>
+
+#include "framewriter.h"
+#include "streamproto.h"
+
+struct StreamConfig
+{
+    std::string host;           // the master, empty for no streaming
+    int port = STREAM_PORT;
+    int scale = 8;              // box filtered down by this
+    double max_fps = 1;         // frames of all cameras together
+    int max_kbps = 500;         // on air, UDP and IP headers included
+};
+
+/*
+* Live frames to the master over the sync link: downscaled, as PNG, with
+* their metadata, in UDP datagrams (streamproto.h). A frame is only taken
+* when the rate allows one and the last is out, so the writer threads
+* pay a clock read for every other frame. The sender runs at SCHED_IDLE
+* and paces its datagrams at max_kbps, marked CS1 so the WiFi queues them
+* behind everything else: the TPSN exchanges never wait behind a burst.
+* Datagrams the socket has no room for are dropped, not waited for.
+*/
+class FrameStreamer
+{
+    public:
+        explicit FrameStreamer(const StreamConfig &config);
+        ~FrameStreamer();
+
+        FrameStreamer(const FrameStreamer&) = delete;
+        FrameStreamer& operator= (const FrameStreamer&) = delete;
+
+        /*
+        * Open the socket and start the sender. False if the host does not
+        * resolve or there is no socket.
+        */
+        bool start();
+        void stop();
+        /*
+        * Take a frame for the stream if it is time for one. Thread safe,
+        * never waits for the sender.
+        */
+        void offer(const Frame &frame);
+
+        unsigned long sent() const { return sent_; }
+        unsigned long dropped() const { return dropped_; }
+
+    private:
+        struct Pending
+        {
+            std::vector<unsigned char> pixels;
+            stream_header header;
+            int width;
+            int height;
+        };
+
+        StreamConfig config_;
+        int sock_ = -1;
+        struct sockaddr_in addr_;
+        long long interval_ns_;
+        uint32_t seq_ = 0;
+
+        std::mutex mtx_;
+        std::condition_variable ready_;
+        bool running_ = false;
+        bool pending_ = false;
+        bool busy_ = false;
+        Pending next_;
+        std::atomic<long long> due_ns_{0};
+        std::thread thread_;
+
+        std::atomic<unsigned long> sent_{0};
+        std::atomic<unsigned long> dropped_{0};
+
+        void loop();
+        void send(const std::vector<unsigned char> &png, stream_header header);
+};
+
+#endif
@@ -0,0 +1,272 @@
+#include "framewriter.h"
+#include "rtthreads.h"
+#include <stdio.h>
+#include <cstring>
+#include <algorithm>
+
+// At most one drop report per interval, from outside the queue lock
+#define DROP_REPORT_NS 1000000000LL
+
+static long long monotonic_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+FrameWriter::FrameWriter(const FrameWriterConfig &config, size_t frame_size, WriteCallback callback)
+    : config_(config), frame_size_(frame_size), callback_(callback),
+      written_(0), dropped_(0), failed_(0), reported_drops_(0), drop_report_ns_(0),
+      last_drop_frame_(0), last_drop_camera_(0)
+{
+    if (config_.queue_depth < 1)
+        config_.queue_depth = 1;
+    if (config_.workers < 1)
+        config_.workers = 1;
+    if (config_.zero_copy)
+        frame_size_ = 0;
+
+    // Preallocate the whole ring so the streaming thread never allocates
+    if (frame_size_ > 0 && !pool_.allocate(frame_size_, config_.queue_depth, config_.lock_memory))
+    {
+        // Without slots every frame would be dropped, start() says so
+        frame_size_ = 0;
+        pool_failed_ = true;
+    }
+    slots_.resize(config_.queue_depth);
+    free_.reserve(config_.queue_depth);
+    pending_.resize(config_.queue_depth, -1);
+    for (int i = config_.queue_depth - 1; i >= 0; i--)
+    {
+        if (frame_size_ > 0)
+            slots_[i].buffer = pool_.acquire();
+        free_.push_back(i);
+    }
+}
+
+FrameWriter::~FrameWriter()
+{
+    stop();
+    for (Slot &s : slots_)
+    {
+        pool_.release(s.buffer);
+        s.buffer = nullptr;
+    }
+}
+
+bool FrameWriter::start()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    if (running_)
+        return true;
+    if (pool_failed_)
+    {
+        fprintf(stderr, "FrameWriter: no memory for %d frame slots, not starting\n", config_.queue_depth);
+        return false;
+    }
+    running_ = true;
+    for (int i = 0; i < config_.workers; i++)
+    {
+        workers_.push_back(std::thread(&FrameWriter::worker_loop, this));
+    }
+    return true;
+}
+
+void FrameWriter::stop()
+{
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (!running_)
+            return;
+        running_ = false;
+    }
+    ready_.notify_all();
+    space_.notify_all();
+    for (std::thread &t : workers_)
+    {
+        t.join();
+    }
+    workers_.clear();
+    printf("FrameWriter: %lu written, %lu dropped, %lu failed\n",
+           (unsigned long) written_, (unsigned long) dropped_, (unsigned long) failed_);
+}
+
+bool FrameWriter::submit(const unsigned char *data, size_t size, const Frame &info)
+{
+    if (size > frame_size_)
+    {
+        fprintf(stderr, "FrameWriter: frame of %zu bytes exceeds slot size %zu\n", size, frame_size_);
+        note_drop(info);
+        report_drops();
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lck(mtx_);
+    int slot = acquire_slot(lck);
+    if (slot < 0)
+    {
+        lck.unlock();
+        note_drop(info);
+        report_drops();
+        return false;
+    }
+    // The slot is off both lists, so the copy can run without the lock held
+    lck.unlock();
+    // DropOldest may have recycled a queued frame for this one
+    report_drops();
+
+    Slot &s = slots_[slot];
+    s.handle.release();
+    memcpy(s.buffer, data, size);
+    s.frame = info;
+    s.frame.data = s.buffer;
+    s.frame.size = size;
+
+    lck.lock();
+    push_pending(slot);
+    lck.unlock();
+    ready_.notify_one();
+    return true;
+}
+
+bool FrameWriter::submit(gsttcam::FrameHandle &&handle, const Frame &info)
+{
+    if (!handle.valid())
+    {
+        note_drop(info);
+        report_drops();
+        return false;
+    }
+
+    std::unique_lock<std::mutex> lck(mtx_);
+    int slot = acquire_slot(lck);
+    if (slot < 0)
+    {
+        lck.unlock();
+        // handle goes out of scope with the caller and returns the buffer
+        note_drop(info);
+        report_drops();
+        return false;
+    }
+    lck.unlock();
+    report_drops();
+
+    Slot &s = slots_[slot];
+    s.handle = std::move(handle);
+    s.frame = info;
+    s.frame.data = s.handle.data();
+    s.frame.size = s.handle.size();
+    s.frame.stride = s.handle.stride();
+
+    lck.lock();
+    push_pending(slot);
+    lck.unlock();
+    ready_.notify_one();
+    return true;
+}
+
+int FrameWriter::acquire_slot(std::unique_lock<std::mutex> &lck)
+{
+    if (!running_)
+        return -1;
+    if (free_.empty())
+    {
+        switch (config_.drop_policy)
+        {
+            case DropPolicy::Block:
+                space_.wait(lck, [this]{ return !free_.empty() || !running_; });
+                if (!running_)
+                    return -1;
+                break;
+            case DropPolicy::DropOldest:
+                if (pending_count_ > 0)
+                {
+                    int oldest = pop_pending();
+                    note_drop(slots_[oldest].frame);
+                    return oldest;
+                }
+                // every slot is being written right now
+                return -1;
+            case DropPolicy::DropNewest:
+            default:
+                return -1;
+        }
+    }
+    int slot = free_.back();
+    free_.pop_back();
+    return slot;
+}
+
+void FrameWriter::push_pending(int slot)
+{
+    pending_[(pending_head_ + pending_count_) % pending_.size()] = slot;
+    pending_count_++;
+    pending_peak_ = std::max(pending_peak_, pending_count_);
+}
+
+int FrameWriter::queue_peak()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    size_t peak = pending_peak_;
+    pending_peak_ = pending_count_;
+    return (int) peak;
+}
+
+int FrameWriter::pop_pending()
+{
+    int slot = pending_[pending_head_];
+    pending_head_ = (pending_head_ + 1) % pending_.size();
+    pending_count_--;
+    return slot;
+}
+
+void FrameWriter::note_drop(const Frame &info)
+{
+    // Only counts: this runs under mtx_ for DropOldest
+    last_drop_frame_.store(info.frame_id, std::memory_order_relaxed);
+    last_drop_camera_.store(info.camera_id, std::memory_order_relaxed);
+    ++dropped_;
+}
+
+void FrameWriter::report_drops()
+{
+    unsigned long n = dropped_;
+    if (n == reported_drops_.load(std::memory_order_relaxed))
+        return;
+    // The first drop right away, then one line per interval so the log
+    // and the streaming thread are not swamped
+    long long now = monotonic_ns();
+    long long last = drop_report_ns_;
+    if (now - last < DROP_REPORT_NS || !drop_report_ns_.compare_exchange_strong(last, now))
+        return;
+    unsigned long since = n - reported_drops_.exchange(n);
+    fprintf(stderr, "FrameWriter: dropped %lu frames, the last frame %ld of camera %d (%lu dropped so far)\n",
+            since, last_drop_frame_.load(std::memory_order_relaxed),
+            last_drop_camera_.load(std::memory_order_relaxed), n);
+}
+
+void FrameWriter::worker_loop()
+{
+    setThreadRole(ThreadRole::Writer);
+    std::unique_lock<std::mutex> lck(mtx_);
+    while (true)
+    {
+        ready_.wait(lck, [this]{ return pending_count_ > 0 || !running_; });
+        // Keep draining after stop() so nothing already queued is lost
+        if (pending_count_ == 0)
+            break;
+        int slot = pop_pending();
+        lck.unlock();
+
+        if (callback_(slots_[slot].frame) < 0)
+            failed_++;
+        else
+            written_++;
+        // Give a referenced buffer back to GStreamer as soon as possible
+        slots_[slot].handle.release();
+
+        lck.lock();
+        free_.push_back(slot);
+        space_.notify_one();
+    }
+}
@@ -0,0 +1,150 @@
+#ifndef __FRAMEWRITER__
+#define __FRAMEWRITER__
+
+#include <time.h>
+#include <stddef.h>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+
+#include "tcamcamera.h"
+#include "framepool.h"
+
+/*
+* What to do with a new frame when every ring slot is already queued
+* or being written.
+*/
+enum class DropPolicy
+{
+    DropNewest,     // discard the incoming frame
+    DropOldest,     // recycle the oldest frame that has not been written yet
+    Block           // wait for a writer to free a slot (stalls the streaming thread)
+};
+
+struct FrameWriterConfig
+{
+    int queue_depth = 8;
+    int workers = 1;
+    DropPolicy drop_policy = DropPolicy::DropNewest;
+    // Queue GstBuffer references instead of copies. Slots then hold no
+    // memory of their own, and queue_depth must stay below the number of
+    // buffers in the camera source's pool.
+    bool zero_copy = false;
+    // mlock() the ring so frames never page out
+    bool lock_memory = false;
+};
+
+/*
+* A frame waiting in the writer queue. data points into a ring slot or a
+* mapped GstBuffer owned by the FrameWriter and is only valid inside the
+* write callback.
+*/
+struct Frame
+{
+    const unsigned char *data;
+    size_t size;
+    int width;
+    int height;
+    int stride;
+    int camera_id;
+    long frame_id;
+    struct timespec timestamp;
+    // Filled in from the minions trigger channel when a trigger matched
+    bool has_trigger;
+    long trigger_id;
+    long long trigger_ns;
+    float pressure;
+    float temperature;
+};
+
+/*
+* Bounded queue between the GStreamer streaming thread and storage. All
+* ring slots come from a FramePool allocated up front; submit() only copies into a free slot
+* (or parks a frame handle there) and wakes a writer thread, which hands the
+* frame to the write callback.
+*/
+class FrameWriter
+{
+    public:
+        typedef std::function<int(const Frame &frame)> WriteCallback;
+
+        FrameWriter(const FrameWriterConfig &config, size_t frame_size, WriteCallback callback);
+        ~FrameWriter();
+
+        FrameWriter(const FrameWriter&) = delete;
+        FrameWriter& operator= (const FrameWriter&) = delete;
+
+        /*
+        * Start the writer threads. False if the ring could not be
+        * allocated, nothing could be queued.
+        */
+        bool start();
+        /*
+        * Write out everything still queued and join the writer threads
+        */
+        void stop();
+        /*
+        * Queue a copy of a frame. Returns false if the frame was dropped.
+        */
+        bool submit(const unsigned char *data, size_t size, const Frame &info);
+        /*
+        * Queue a frame by reference. The handle is released once written.
+        */
+        bool submit(gsttcam::FrameHandle &&handle, const Frame &info);
+
+        unsigned long written() const { return written_; }
+        unsigned long dropped() const { return dropped_; }
+        unsigned long failed() const { return failed_; }
+        /*
+        * Most frames waiting for a writer at once since the last call
+        */
+        int queue_peak();
+
+    private:
+        struct Slot
+        {
+            unsigned char *buffer = nullptr;
+            gsttcam::FrameHandle handle;
+            Frame frame;
+        };
+
+        FrameWriterConfig config_;
+        size_t frame_size_;
+        WriteCallback callback_;
+
+        FramePool pool_;
+        bool pool_failed_ = false;
+        std::vector<Slot> slots_;
+        std::vector<int> free_;         // stack of unused slot indices
+        std::vector<int> pending_;      // FIFO ring of slots waiting for a writer
+        size_t pending_head_ = 0;
+        size_t pending_count_ = 0;
+        size_t pending_peak_ = 0;
+
+        std::mutex mtx_;
+        std::condition_variable ready_;
+        std::condition_variable space_;
+        bool running_ = false;
+        std::vector<std::thread> workers_;
+
+        std::atomic<unsigned long> written_;
+        std::atomic<unsigned long> dropped_;
+        std::atomic<unsigned long> failed_;
+        // Drops up to the last report and when it was printed
+        std::atomic<unsigned long> reported_drops_;
+        std::atomic<long long> drop_report_ns_;
+        std::atomic<long> last_drop_frame_;
+        std::atomic<int> last_drop_camera_;
+
+        int acquire_slot(std::unique_lock<std::mutex> &lck);
+        void push_pending(int slot);
+        int pop_pending();
+        void note_drop(const Frame &info);
+        void report_drops();
+        void worker_loop();
+};
+
+#endif
@@ -35,8 +35,13 @@ Rename this file to lodepng.cpp to use it for C++, or to lodepng.c to use it for
 
 #ifdef LODEPNG_COMPILE_CPP
 #include <fstream>
+#include <string.h>
 #endif /*LODEPNG_COMPILE_CPP*/
 
+#ifdef LODEPNG_SYSTEM_ZLIB
+#include <zlib.h>
+#endif /*LODEPNG_SYSTEM_ZLIB*/
+
 #if defined(_MSC_VER) && (_MSC_VER >= 1310) /*Visual Studio: A few warning types are not desired here.*/
 #pragma warning( disable : 4244 ) /*implicit conversions: not warned by gcc -Wall -Wextra and requires too much casts*/
 #pragma warning( disable : 4996 ) /*VS does not like fopen, but fopen_s is not standard C so unusable here*/
@@ -1767,7 +1772,7 @@ static unsigned deflateDynamic(ucvector* out, size_t* bp, Hash* hash,
     else
     {
       if(!uivector_resize(&lz77_encoded, datasize)) ERROR_BREAK(83 /*alloc fail*/);
-      for(i = datapos; i < dataend; ++i) lz77_encoded.data[i] = data[i]; /*no LZ77, but still will be Huffman compressed*/
+      for(i = datapos; i < dataend; ++i) lz77_encoded.data[i - datapos] = data[i]; /*no LZ77, but still will be Huffman compressed*/
     }
 
     if(!uivector_resizev(&frequencies_ll, 286, 0)) ERROR_BREAK(83 /*alloc fail*/);
@@ -5903,6 +5908,7 @@ const char* lodepng_error_text(unsigned code)
     case 91: return "invalid decompressed idat size";
     case 92: return "too many pixels, not supported";
     case 93: return "zero width or height is invalid";
+    case 94: return "system zlib failed to compress";
   }
   return "unknown error code";
 }
@@ -6116,6 +6122,72 @@ unsigned encode(std::vector<unsigned char>& out,
   return encode(out, in.empty() ? 0 : &in[0], w, h, state);
 }
 
+#ifdef LODEPNG_SYSTEM_ZLIB
+/*zlib stream through the system's zlib, at the level custom_context points to*/
+static unsigned system_zlib_compress(unsigned char** out, size_t* outsize,
+                                     const unsigned char* in, size_t insize,
+                                     const LodePNGCompressSettings* settings)
+{
+  uLongf size = compressBound(insize);
+  *out = (unsigned char*)lodepng_malloc(size);
+  if(!*out) return 83; /*alloc fail*/
+  if(compress2(*out, &size, in, insize, *(const int*)settings->custom_context) != Z_OK)
+  {
+    lodepng_free(*out);
+    *out = 0;
+    return 94; /*zlib failed*/
+  }
+  *outsize = size;
+  return 0;
+}
+#endif /*LODEPNG_SYSTEM_ZLIB*/
+
+unsigned encode_grey(std::vector<unsigned char>& out,
+                     const unsigned char* in, unsigned w, unsigned h, unsigned stride,
+                     GreyPreset preset)
+{
+  /*lodepng wants contiguous rows*/
+  std::vector<unsigned char> packed;
+  if(stride && stride != w)
+  {
+    packed.resize((size_t)w * h);
+    for(unsigned y = 0; y < h; y++) memcpy(&packed[(size_t)y * w], in + (size_t)y * stride, w);
+    in = packed.empty() ? 0 : &packed[0];
+  }
+
+  State state;
+  state.info_raw.colortype = LCT_GREY;
+  state.info_raw.bitdepth = 8;
+  state.info_png.color.colortype = LCT_GREY;
+  state.info_png.color.bitdepth = 8;
+  state.encoder.auto_convert = 0;
+  state.encoder.add_id = 0;
+  if(preset == GREY_DEFAULT) return encode(out, in, w, h, state);
+
+  /*Sub only looks at the pixel to the left: one pass, and it suits the
+  smooth gradients of underwater frames*/
+  std::vector<unsigned char> filters(h, 1);
+  state.encoder.filter_strategy = LFS_PREDEFINED;
+  state.encoder.predefined_filters = filters.empty() ? 0 : &filters[0];
+  if(preset == GREY_FASTEST)
+  {
+    state.encoder.zlibsettings.use_lz77 = 0;
+  }
+  else
+  {
+#ifdef LODEPNG_SYSTEM_ZLIB
+    static const int level = 1;
+    state.encoder.zlibsettings.custom_zlib = system_zlib_compress;
+    state.encoder.zlibsettings.custom_context = &level;
+#else
+    state.encoder.zlibsettings.windowsize = 512;
+    state.encoder.zlibsettings.nicematch = 32;
+    state.encoder.zlibsettings.lazymatching = 0;
+#endif
+  }
+  return encode(out, in, w, h, state);
+}
+
 #ifdef LODEPNG_COMPILE_DISK
 unsigned encode(const std::string& filename,
                 const unsigned char* in, unsigned w, unsigned h,
@@ -842,6 +842,26 @@ unsigned encode(std::vector<unsigned char>& out,
 unsigned encode(std::vector<unsigned char>& out,
                 const std::vector<unsigned char>& in, unsigned w, unsigned h,
                 State& state);
+
+/*
+Effort presets for 8-bit greyscale images such as camera previews. All of them
+skip the color analysis of auto_convert and always write grey PNGs.
+*) GREY_FASTEST: Sub filter on every scanline, Huffman coding only, no LZ77.
+*) GREY_FAST: Sub filter, short LZ77 window without lazy matching. With
+   LODEPNG_SYSTEM_ZLIB defined, zlib at level 1 does the deflate instead.
+*) GREY_DEFAULT: the per-scanline filter search and deflate settings of encode().
+*/
+enum GreyPreset
+{
+  GREY_FASTEST,
+  GREY_FAST,
+  GREY_DEFAULT
+};
+
+/*Encode w x h 8-bit grey pixels, rows stride bytes apart (w if 0).*/
+unsigned encode_grey(std::vector<unsigned char>& out,
+                     const unsigned char* in, unsigned w, unsigned h, unsigned stride = 0,
+                     GreyPreset preset = GREY_FAST);
 #endif /*LODEPNG_COMPILE_ENCODER*/
 
 #ifdef LODEPNG_COMPILE_DISK
@@ -10,8 +10,30 @@
 #include <unistd.h>
 #include <fcntl.h>
 
-#include "tiffio.h"
 #include "tcamcamera.h"
+#include "capturemode.h"
+#include "framewriter.h"
+#include "framestreamer.h"
+#include "framecodec.h"
+#include "framestats.h"
+#include "preview.h"
+#include "segmentstore.h"
+#include "storagemanager.h"
+#include "exposure.h"
+#include "stereopair.h"
+#include "triggerchannel.h"
+#include "statejournal.h"
+#include "missionsettings.h"
+#include "rtthreads.h"
+#include "telemetry.h"
+#include <mutex>
+#include <vector>
+#include <memory>
+#include <map>
+#include <atomic>
+#include <algorithm>
+#include <pthread.h>
+#include <sched.h>
 
 //#include <fstream>
 //#include <omp.h>
@@ -26,6 +48,13 @@ typedef struct
     int ImageCounter;
     bool SaveNextImage;
     bool busy;
+    FrameWriter *writer;
+    gsttcam::TcamCamera *camera;
+    int index;          // position in the rig, used for stereo pairing
+    int cpu;            // core for this camera's streaming thread, RT_CPU_DEFAULT for the layout's
+    bool pinned;
+    StereoPairer *pairer;
+    TriggerMatcher *matcher;
 } CUSTOMDATA;
 
 
@@ -33,12 +62,97 @@ using namespace gsttcam;
 using namespace std;
 
 
-const string SN[2] = {"15410110", "41810422"}; //"43810451"}; //
+// The mission file (-M), shared with minions: camera serials by serial
+// index, capture format and where data goes. Options override it.
+MissionSettings settings;
+vector<string> serials;
 
 int k = 0;
 
-int writeTiff(unsigned char *buf, char* outFileName);
-struct timespec now;
+// Where local frame numbering stood, so a restart never reuses an id and
+// overwrites the images of the last run. Saved every FRAME_ID_SAVE_EVERY
+// ids; a restart skips that many.
+#define FRAME_ID_SAVE_EVERY 64
+string frameJournalPath;
+struct FrameIdRecord
+{
+    int64_t next_frame_id;
+};
+StateJournal frameJournal;
+std::mutex frameJournalMtx;
+
+int writeFrame(const Frame &frame);
+
+// Writer queue settings, overridden from the command line
+FrameWriterConfig writerConfig;
+CodecOptions codecOptions;
+
+// Per-frame encode time and stored size, one CSV line per frame, in the
+// data directory unless given
+string encodeLogPath;
+FILE *encodeLog = NULL;
+std::mutex encodeLogMtx;
+
+// Per-frame statistics, one CSV line per frame, and what to do with
+// frames that are blank by them
+string statsLogPath;
+FILE *statsLog = NULL;
+std::mutex statsLogMtx;
+ContentFilter contentFilter;
+std::atomic<unsigned long> blankFrames(0);
+
+// Preview pyramids, one rolling file and PNG per camera in previewDir.
+// Filled before the writer threads start, read-only afterwards.
+const char *previewDir = NULL;
+const uint32_t previewSlots = 512;
+const int previewPngIntervalMs = 1000;
+std::map<int, std::unique_ptr<PreviewStore>> previewStores;
+
+// Exposure and gain at start; the auto exposure (-A) adjusts them from
+// the frame histograms, for every camera alike
+const int initialExposureUs = 1500;
+const int initialGain = 16;
+ExposureConfig exposureConfig;
+std::unique_ptr<ExposureController> exposureController;
+std::vector<TcamCamera *> exposureCameras;
+
+// Segment mode (-g): frames go to large preallocated segment files in
+// segmentDir instead of one file each
+const char *segmentDir = NULL;
+long long segmentBytes = SEGMENT_BYTES;
+std::unique_ptr<SegmentStore> segmentStore;
+
+// Free space and write rate of the data filesystem. With a planned
+// mission duration (-D) storage steps down so capture lasts until its end.
+string dataDir;
+StorageConfig storageConfig;
+std::unique_ptr<StorageManager> storageManager;
+
+// Stereo mode: both cameras of the pair in this process
+bool stereoMode = false;
+// Streaming threads by camera (-a), else the thread layout's capture core
+std::vector<int> captureCpus;
+// -N: written to once streaming
+int readyFd = -1;
+
+// Longest time from a minions trigger to the frame arriving here
+int triggerLatencyMs = 400;
+
+// Readout of the sensor (capture_mode), and the smaller, faster one where
+// full frames are not needed (survey_mode) as the policy decides
+CaptureMode fullMode, surveyMode;
+std::unique_ptr<SurveyPolicy> surveyPolicy;
+// How often the main thread looks whether the mode has to change
+const int surveyPollMs = 500;
+
+// Live frames to the master (stream_host), NULL without
+std::unique_ptr<FrameStreamer> streamer;
+
+// CPU, temperature, throttling, the writer queue and store latency
+// (telemetry_period_s) in the data directory, to tell after recovery what
+// dropped frames
+Telemetry telemetry;
+LatencyRecorder *storeLatency = NULL;
 
 
 ////////////////////////////////////////////////////////////////////
@@ -54,27 +168,52 @@ void ListProperties(TcamCamera &cam)
     }
 }
 
-void setCameraProperty(TcamCamera &cam, string property, int value)
+// Journal a locally numbered id now and then
+void noteFrameId(long frame_id)
 {
-    shared_ptr<Property> Property = NULL;
-	try
-	{
-		Property = cam.get_property(property);
-	}
-	catch(std::exception &ex)    
-	{
-		printf("Error %s : %s\n",ex.what(), property.c_str());
-	}
-
-    if( Property != NULL){
-        Property->set(cam,value);
-        cout << property << " set to: " << value << endl;
-    } 
-	else 
-	{
-		cout << property << " setting failed!" << endl;
-	}
+    if (frame_id % FRAME_ID_SAVE_EVERY != 0)
+        return;
+    std::lock_guard<std::mutex> lck(frameJournalMtx);
+    FrameIdRecord rec = {frame_id + 1};
+    frameJournal.save(&rec);
 }
+
+// Stamp a new frame with its arrival time, id and the minions trigger that
+// exposed it. A matched frame takes the trigger's id, so every camera of the
+// rig names its frame of one trigger alike. Without minions the frames of one
+// trigger are paired by arrival time in stereo mode.
+void stampFrame(CUSTOMDATA *pCustomData, Frame &frame)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    long long now_n = (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+    frame.camera_id = pCustomData->ID;
+    frame.timestamp = now;
+
+    TriggerRecord trigger;
+    if (pCustomData->matcher && pCustomData->matcher->match(now_n, &trigger))
+    {
+        if (surveyPolicy)
+            surveyPolicy->notePressure(trigger.pressure);
+        frame.has_trigger = true;
+        frame.trigger_id = trigger.frame_id;
+        frame.trigger_ns = trigger.trigger_ns;
+        frame.pressure = trigger.pressure;
+        frame.temperature = trigger.temperature;
+        frame.frame_id = trigger.frame_id;
+    }
+    else if (pCustomData->pairer)
+    {
+        frame.frame_id = pCustomData->pairer->assign(pCustomData->index, now_n);
+        noteFrameId(frame.frame_id);
+    }
+    else
+    {
+        frame.frame_id = k++;
+        noteFrameId(frame.frame_id);
+    }
+}
+
 ////////////////////////////////////////////////////////////////////
 // Callback called for new images by the internal appsink
 GstFlowReturn new_frame_cb(GstAppSink *appsink, gpointer data)
@@ -88,9 +227,32 @@ GstFlowReturn new_frame_cb(GstAppSink *appsink, gpointer data)
     //     return GST_FLOW_OK;
     // pCustomData->SaveNextImage = false;
 
+    // GStreamer creates the streaming thread, so it takes its role on the
+    // first frame
+    if (!pCustomData->pinned)
+    {
+        setThreadRole(ThreadRole::Capture, pCustomData->cpu);
+        pCustomData->pinned = true;
+    }
+
     pCustomData->ImageCounter++;
     //printf("img%05d_%d\n", k, pCustomData->ID);
     //k++;
+    if (writerConfig.zero_copy)
+    {
+        // Queue a reference to GStreamer's buffer, no copy at all
+        FrameHandle handle = pCustomData->camera->pull_frame(appsink);
+        if (handle.valid() && handle.format() == "GRAY8")
+        {
+            Frame frame = Frame();
+            frame.width = handle.width();
+            frame.height = handle.height();
+            stampFrame(pCustomData, frame);
+            pCustomData->writer->submit(std::move(handle), frame);
+        }
+        return GST_FLOW_OK;
+    }
+
     // The following lines demonstrate, how to acces the image
     // data in the GstSample.
     GstSample *sample = gst_app_sink_pull_sample(appsink);
@@ -104,35 +266,22 @@ GstFlowReturn new_frame_cb(GstAppSink *appsink, gpointer data)
     if (info.data != NULL) 
     {
         // info.data contains the image data as blob of unsigned char 
-		clock_gettime(CLOCK_MONOTONIC, &now);
         GstCaps *caps = gst_sample_get_caps(sample);
         // Get a string containg the pixel format, width and height of the image        
         str = gst_caps_get_structure (caps, 0);    
 
         if( strcmp( gst_structure_get_string (str, "format"),"GRAY8") == 0)  
         {
-            // Now query the width and height of the image
-            //gst_structure_get_int (str, "width", &width);
-            //gst_structure_get_int (str, "height", &height);
-
-            // Create a cv::Mat, copy image data into that and save the image.
-            //pCustomData->frame.create(height,width,CV_8U);
-
-            // memcpy( pCustomData->frame.data, info.data, width*height);
-            // memcpy( pCustomData->frame.data, img.data, width*height);
-            //printf("img%05d_%d w: %d h: %d\n", k, pCustomData->ID, width, height);
-            // // cout <<"HE" <<endl;
-            char ImageFileName[256];
-			//cout << info.size << endl;
-	     
-            sprintf(ImageFileName,"/home/pi/data/image%05d_%d_%d_%d.tif", k, pCustomData->ID, now.tv_sec, now.tv_nsec);
-            //cout << ImageFileName << endl;
-            writeTiff(info.data, ImageFileName);
-            /*fstream myFile;
-            myFile.open(ImageFileName, fstream::out);
-            myFile << info.data;
-            myFile.close();*/
-            k++;
+            // Hand the frame to the writer threads; the TIFF is written
+            // off the streaming thread.
+            Frame frame = Frame();
+            frame.width = 2592;
+            frame.height = 1944;
+            gst_structure_get_int (str, "width", &frame.width);
+            gst_structure_get_int (str, "height", &frame.height);
+            frame.stride = frame.width;
+            stampFrame(pCustomData, frame);
+            pCustomData->writer->submit(info.data, info.size, frame);
         }
     }
     
@@ -144,114 +293,555 @@ GstFlowReturn new_frame_cb(GstAppSink *appsink, gpointer data)
     return GST_FLOW_OK;
 }
 
-int run_camera(string sn, int id)
+// Resolve a readout against what the camera offers, false if it has no
+// format for it
+bool resolveMode(TcamCamera &cam, CaptureMode &mode, FrameSize captureSize, const char *what)
 {
-    // Declare custom data structure for the callback
-    CUSTOMDATA CustomData;
-
-    CustomData.ImageCounter = 0;
-    CustomData.SaveNextImage = false;
-    CustomData.ID = id;
-    printf("Tcam OpenCV Image Sample\n");
-
-    // Open camera by serial number
-    // TcamCamera cam("43810451");
-    TcamCamera cam(sn); 
+    if (cam.resolve_capture_mode(mode, captureSize))
+        return true;
+    printf("%s: the camera has no %s format for %s\n", what, mode.format.c_str(), captureModeName(mode).c_str());
+    return false;
+}
 
+void setupCamera(TcamCamera &cam, CUSTOMDATA &CustomData, FrameSize captureSize, CaptureMode &mode)
+{
     // Set video format, resolution and frame rate
     // cam.set_capture_format("GRAY8", FrameSize{2592,1944}, FrameRate{15,2});
-    cam.set_capture_format("GRAY8", FrameSize{2592,1944}, FrameRate{15, 2});
+    if (resolveMode(cam, mode, captureSize, "capture_mode"))
+    {
+        if (!cam.set_capture_mode(mode))
+            printf("capture_mode: readout properties not set, the camera may not support %s\n",
+                   readout_name(mode.readout));
+    }
+    else
+    {
+        // As configured, tcambin will refuse it if the camera cannot
+        mode.readout = Readout::Full;
+        mode.size = captureSize;
+        cam.set_capture_format(mode.format, mode.size, mode.framerate);
+    }
     // Register a callback to be called for each new frame
     cam.set_new_frame_callback(new_frame_cb, &CustomData);
     // Start the camera
-	setCameraProperty(cam, "Exposure Auto", 0);
-	setCameraProperty(cam, "Gain Auto", 0);
-	setCameraProperty(cam, "Exposure", 1500); //us
-	setCameraProperty(cam, "Gain", 16);
-	setCameraProperty(cam, "Trigger Global Reset Shutter", 1);
-	setCameraProperty(cam, "Trigger Mode", 1);
+    PropertyBatch settings;
+    settings.set("Exposure Auto", 0);
+    settings.set("Gain Auto", 0);
+    settings.set("Exposure", initialExposureUs); //us
+    settings.set("Gain", initialGain);
+    settings.set("Trigger Global Reset Shutter", 1);
+    settings.set("Trigger Mode", 1);
+    if (cam.apply_properties(settings) == 0)
+        cout << "Camera properties set" << endl;
     
     //ListProperties(cam);
+}
+
+// Capture from one camera, or from every camera of the rig in stereo mode.
+// All cameras share one writer pool.
+int run_cameras(const vector<string> &serials, const vector<int> &ids)
+{
+    size_t n = serials.size();
+    struct timespec now;
+    printf("Tcam OpenCV Image Sample\n");
+
+    // Capture format; the writer ring is sized from it before streaming
+    FrameSize captureSize = {settings.capture_width, settings.capture_height};
+    FrameRate captureRate = {settings.capture_fps_num, settings.capture_fps_den};
+
+    // One GRAY8 frame per ring slot. Binned, skipped or a ROI are smaller
+    // than the size they are taken from, so the ring fits every mode and
+    // switching never reallocates; only a ROI may be larger.
+    size_t frameBytes = (size_t) captureSize.width * captureSize.height;
+    // Largest frame either way, the preview slots are sized for it
+    FrameSize largest = captureSize;
+    for (const CaptureMode *mode : {&fullMode, &surveyMode})
+        if (mode->readout == Readout::Roi)
+        {
+            frameBytes = std::max(frameBytes, (size_t) mode->size.width * mode->size.height);
+            largest.width = std::max(largest.width, mode->size.width);
+            largest.height = std::max(largest.height, mode->size.height);
+        }
+    FrameWriter writer(writerConfig, frameBytes, writeFrame);
+    encodeLog = fopen(encodeLogPath.c_str(), "a");
+    if (encodeLog == NULL)
+        fprintf(stderr, "%s: Cannot open encode log.\n", encodeLogPath.c_str());
+    else if (ftell(encodeLog) == 0)
+        fprintf(encodeLog, "frame,camera,codec,encode_ms,raw_bytes,stored_bytes\n");
+    statsLog = fopen(statsLogPath.c_str(), "a");
+    if (statsLog == NULL)
+        fprintf(stderr, "%s: Cannot open frame stats log.\n", statsLogPath.c_str());
+    else if (ftell(statsLog) == 0)
+        fprintf(statsLog, "frame,camera,mean,variance,median,max,sharpness,content,stored,exposure_us,gain\n");
+    if (segmentDir)
+    {
+        segmentStore.reset(new SegmentStore(segmentDir, segmentBytes, SEGMENT_INDEX_CAPACITY,
+                                            storageConfig.reserve_bytes));
+        printf("Storing frames as %s in %lld MB segments in %s\n",
+               codecOptions.codec == StorageCodec::LZ4Raw ? "lz4" : "raw",
+               segmentBytes >> 20, segmentDir);
+    }
+    else
+        printf("Storing frames as %s\n", storageCodecName(codecOptions.codec));
+    if (contentFilter.policy != BlankPolicy::Keep)
+        printf("Blank frames (content below %.3f%%): %s\n", contentFilter.min_content,
+               blankPolicyName(contentFilter.policy));
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    storageManager.reset(new StorageManager(segmentDir ? segmentDir : dataDir.c_str(), storageConfig,
+                                            (long long) now.tv_sec * 1000000000LL + now.tv_nsec,
+                                            segmentStore.get()));
+    if (storageConfig.mission_s > 0)
+        printf("Storage planned for %.1f h, %lld MB reserve\n", storageConfig.mission_s / 3600,
+               storageConfig.reserve_bytes >> 20);
+    if (previewDir)
+    {
+        for (size_t i = 0; i < n; i++)
+            previewStores[ids[i]].reset(new PreviewStore(previewDir, ids[i], previewSlots,
+                                                         previewPngIntervalMs, largest.width,
+                                                         largest.height));
+        printf("Previews in %s\n", previewDir);
+    }
+    if (settings.telemetry_period_s > 0)
+    {
+        // Before the writers start, they record into storeLatency
+        storeLatency = telemetry.addLatency("store");
+        telemetry.addGauge("write_queue", [&writer]{ return (long long) writer.queue_peak(); });
+        telemetry.addGauge("dropped", [&writer]{ return (long long) writer.dropped(); });
+        telemetry.addGauge("failed", [&writer]{ return (long long) writer.failed(); });
+        telemetry.addGauge("free_mb", []{ return storageManager->free_bytes() >> 20; });
+        clock_gettime(CLOCK_REALTIME, &now);
+        string path = dataDir + "/telemetry_" + to_string(ids[0]) + "_" + to_string((long long) now.tv_sec) + ".bin";
+        if (telemetry.start(path.c_str(), settings.telemetry_period_s) == -1)
+            fprintf(stderr, "%s: Cannot open telemetry log.\n", path.c_str());
+    }
+    if (!writer.start())
+    {
+        telemetry.stop();
+        if (segmentStore)
+            segmentStore->close();
+        if (encodeLog)
+            fclose(encodeLog);
+        if (statsLog)
+            fclose(statsLog);
+        return 1;
+    }
+    if (!settings.stream_host.empty())
+    {
+        StreamConfig streamConfig;
+        streamConfig.host = settings.stream_host;
+        streamConfig.port = settings.stream_port;
+        streamConfig.scale = settings.stream_scale;
+        streamConfig.max_fps = settings.stream_fps;
+        streamConfig.max_kbps = settings.stream_kbps;
+        streamer.reset(new FrameStreamer(streamConfig));
+        if (streamer->start())
+            printf("Streaming 1/%d frames to %s:%d, %.2f fps, %d kbit/s at most\n", streamConfig.scale,
+                   streamConfig.host.c_str(), streamConfig.port, streamConfig.max_fps, streamConfig.max_kbps);
+        else
+            streamer.reset();
+    }
+
+    // Frames of one trigger arrive well within half a frame period
+    long long period_ns = 1000000000LL * captureRate.denominator / captureRate.numerator;
+    StereoPairer pairer(n, period_ns / 2, k);
+
+    // Declare custom data structure for the callback, one per camera.
+    // Sized up front: the callbacks keep pointers into it.
+    vector<CUSTOMDATA> customData(n);
+    vector<CaptureMode> fullModes(n, fullMode), surveyModes(n, surveyMode);
+    vector<unique_ptr<TcamCamera>> cams;
+    vector<unique_ptr<TriggerMatcher>> matchers;
+    for (size_t i = 0; i < n; i++)
+    {
+        CUSTOMDATA &CustomData = customData[i];
+        CustomData.ImageCounter = 0;
+        CustomData.SaveNextImage = false;
+        CustomData.ID = ids[i];
+        CustomData.writer = &writer;
+        CustomData.index = i;
+        CustomData.cpu = i < captureCpus.size() ? captureCpus[i] : RT_CPU_DEFAULT;
+        CustomData.pinned = false;
+        CustomData.pairer = n > 1 ? &pairer : NULL;
+        // Each camera keeps its own cursor into the trigger channel
+        matchers.push_back(unique_ptr<TriggerMatcher>(
+            new TriggerMatcher(0, triggerLatencyMs * 1000000LL)));
+        CustomData.matcher = matchers.back().get();
+
+        // Open camera by serial number
+        // TcamCamera cam("43810451");
+        cams.push_back(unique_ptr<TcamCamera>(new TcamCamera(serials[i])));
+        CustomData.camera = cams.back().get();
+        fullModes[i].framerate = captureRate;
+        setupCamera(*cams.back(), CustomData, captureSize, fullModes[i]);
+        printf("Camera %d: %s\n", ids[i], captureModeName(fullModes[i]).c_str());
+        if (surveyPolicy && resolveMode(*cams.back(), surveyModes[i], captureSize, "survey_mode"))
+            printf("Camera %d survey: %s\n", ids[i], captureModeName(surveyModes[i]).c_str());
+        else if (surveyPolicy)
+            surveyPolicy.reset();
+    }
 
-    cam.start();
-    sleep(100000);
-    cam.stop();
+    if (exposureConfig.enabled)
+    {
+        exposureController.reset(new ExposureController(exposureConfig, initialExposureUs, initialGain));
+        for (auto &cam : cams)
+            exposureCameras.push_back(cam.get());
+        printf("Auto exposure: %.1f%% percentile at %d\n", exposureConfig.percentile, exposureConfig.target);
+    }
+    for (auto &cam : cams)
+        cam->start();
+    // Streaming and waiting for triggers: minions may start
+    notifyReady(readyFd);
+    bool surveying = false;
+    for (long long ms = 0; ms < 100000000LL; ms += surveyPollMs)
+    {
+        usleep(surveyPollMs * 1000);
+        if (!surveyPolicy || surveyPolicy->survey() == surveying)
+            continue;
+        // New caps only negotiate from a stopped pipeline; the frames of
+        // the triggers in between are lost
+        surveying = !surveying;
+        for (size_t i = 0; i < n; i++)
+        {
+            cams[i]->stop();
+            const CaptureMode &mode = surveying ? surveyModes[i] : fullModes[i];
+            if (!cams[i]->set_capture_mode(mode))
+                printf("Camera %d: readout properties of %s not set\n", ids[i], readout_name(mode.readout));
+            // GStreamer may stream from a new thread
+            customData[i].pinned = false;
+            cams[i]->start();
+        }
+        printf("Capture: %s\n", surveying ? "survey" : "full");
+    }
+    for (auto &cam : cams)
+        cam->stop();
+    writer.stop();
+    if (streamer)
+    {
+        streamer->stop();
+        printf("Streamed %lu frames, %lu given up\n", streamer->sent(), streamer->dropped());
+    }
+    telemetry.stop();
+    if (segmentStore)
+        segmentStore->close();
+    exposureCameras.clear();
+    for (size_t i = 0; i < n; i++)
+        printf("Camera %d: %lu frames matched to a trigger, %lu not\n", customData[i].ID,
+               matchers[i]->matched(), matchers[i]->unmatched());
+    if (n > 1)
+        printf("Stereo frames: %lu complete, %lu incomplete\n", pairer.complete(), pairer.incomplete());
+    if (contentFilter.policy != BlankPolicy::Keep)
+        printf("%lu blank frames %s\n", blankFrames.load(),
+               contentFilter.policy == BlankPolicy::Drop ? "dropped" : "stored as thumbnails");
+    printf("Storage: %.0f MB free at %s level\n", storageManager->free_bytes() / 1048576.0,
+           storageLevel(storageManager->level()).name);
+    if (encodeLog)
+        fclose(encodeLog);
+    if (statsLog)
+        fclose(statsLog);
     return 0;
 }
 
 ///////////////////////////////////////////////////////////////////////////////////////////////////
+void usage()
+{
+    printf("usage: simple-snapimage [-M mission file] [-q depth] [-w workers] [-p newest|oldest|block] [-z] [-m] [-s strip KB]\n"
+           "                        [-c none|packbits|lzw|deflate|lz4] [-l level] [-e encode log]\n"
+           "                        [-a cpu[,cpu]] [-t trigger latency ms] [-b keep|drop|thumb]\n"
+           "                        [-B min content %%] [-f stats log] [-P preview dir] [-A level]\n"
+           "                        [-g segment dir] [-G segment MB] [-D mission h] [-R reserve MB]\n"
+           "                        [-N ready fd]\n"
+           "                        <serial index> <id> | -S\n");
+}
+
 int main(int argc, char **argv)
 {
-    if (argc < 3) {
+    int opt;
+    const char *optstring = "M:q:w:p:zms:c:l:e:Sa:t:b:B:f:P:A:g:G:D:R:N:";
+    // The mission file first, whatever the order: options override it
+    const char *settingsPath = NULL;
+    opterr = 0;
+    while ((opt = getopt(argc, argv, optstring)) != -1)
+        if (opt == 'M')
+            settingsPath = optarg;
+    opterr = 1;
+    optind = 1;
+    string error;
+    if (settingsPath && loadMissionSettings(settingsPath, &settings, &error) == -1)
+    {
+        printf("%s\n", error.c_str());
+        return 1;
+    }
+    serials = splitList(settings.serials);
+    dataDir = settings.data_dir;
+    storageConfig.mission_s = settings.mission_hours * 3600;
+    while ((opt = getopt(argc, argv, optstring)) != -1)
+    {
+        switch (opt)
+        {
+            case 'M':
+                break;
+            case 'q':
+                writerConfig.queue_depth = atoi(optarg);
+                break;
+            case 'w':
+                writerConfig.workers = atoi(optarg);
+                break;
+            case 'p':
+                if (strcmp(optarg, "newest") == 0)
+                    writerConfig.drop_policy = DropPolicy::DropNewest;
+                else if (strcmp(optarg, "oldest") == 0)
+                    writerConfig.drop_policy = DropPolicy::DropOldest;
+                else if (strcmp(optarg, "block") == 0)
+                    writerConfig.drop_policy = DropPolicy::Block;
+                else
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'z':
+                writerConfig.zero_copy = true;
+                break;
+            case 'm':
+                writerConfig.lock_memory = true;
+                break;
+            case 's':
+                codecOptions.strip_bytes = atoi(optarg) * 1024;
+                break;
+            case 'c':
+                if (!parseStorageCodec(optarg, &codecOptions.codec))
+                {
+                    usage();
+                    return 1;
+                }
+                if (!storageCodecAvailable(codecOptions.codec))
+                {
+                    printf("Codec %s is not available in this build\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                codecOptions.level = atoi(optarg);
+                break;
+            case 'e':
+                encodeLogPath = optarg;
+                break;
+            case 'S':
+                stereoMode = true;
+                break;
+            case 'a':
+                for (char *tok = strtok(optarg, ","); tok; tok = strtok(NULL, ","))
+                    captureCpus.push_back(atoi(tok));
+                break;
+            case 't':
+                triggerLatencyMs = atoi(optarg);
+                break;
+            case 'b':
+                if (!parseBlankPolicy(optarg, &contentFilter.policy))
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'B':
+                contentFilter.min_content = atof(optarg);
+                break;
+            case 'f':
+                statsLogPath = optarg;
+                break;
+            case 'P':
+                previewDir = optarg;
+                break;
+            case 'A':
+                exposureConfig.enabled = true;
+                exposureConfig.target = atoi(optarg);
+                break;
+            case 'g':
+                segmentDir = optarg;
+                break;
+            case 'G':
+                segmentBytes = atoll(optarg) << 20;
+                break;
+            case 'D':
+                storageConfig.mission_s = atof(optarg) * 3600;
+                break;
+            case 'R':
+                storageConfig.reserve_bytes = atoll(optarg) << 20;
+                break;
+            case 'N':
+                readyFd = atoi(optarg);
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    // Before GStreamer starts its threads, which inherit from this one
+    setThreadLayout(threadLayoutOf(settings));
+    lockMemory();
+    setThreadRole(ThreadRole::Background);
+    if (encodeLogPath.empty())
+        encodeLogPath = dataDir + "/encode_stats.csv";
+    if (statsLogPath.empty())
+        statsLogPath = dataDir + "/frame_stats.csv";
+    frameJournalPath = dataDir + "/imaging_state.jnl";
+    if (!parseCaptureMode(settings.capture_mode, &fullMode) || !parseCaptureMode(settings.survey_mode, &surveyMode))
+    {
+        printf("capture_mode and survey_mode: full, binN, skipN or roi:WxH[+X+Y]\n");
+        return 1;
+    }
+    surveyMode.framerate = FrameRate{settings.survey_fps_num, settings.survey_fps_den};
+    SurveyConfig surveyConfig;
+    surveyConfig.above_depth = settings.survey_depth;
+    surveyConfig.hysteresis = settings.hysteresis;
+    surveyConfig.blank_frames = settings.survey_blank_frames;
+    if (surveyConfig.above_depth > 0 || surveyConfig.blank_frames > 0)
+        surveyPolicy.reset(new SurveyPolicy(surveyConfig));
+    if (segmentDir && codecOptions.codec != StorageCodec::LZ4Raw && codecOptions.codec != StorageCodec::None)
+    {
+        // Segments hold raw rows or LZ4 blocks, TIFFs are made by segment2tiff
+        printf("Segments store frames raw or as lz4, storing raw\n");
+        codecOptions.codec = StorageCodec::None;
+    }
+    // Carry on numbering where the last run stopped; frames matched to a
+    // minions trigger are numbered by minions, which journals its own
+    FrameIdRecord frameIds;
+    if (frameJournal.open(frameJournalPath.c_str(), sizeof(frameIds)) == 0 && frameJournal.load(&frameIds))
+    {
+        k = frameIds.next_frame_id + FRAME_ID_SAVE_EVERY;
+        printf("Resuming frame ids at %d\n", k);
+    }
+    // Stereo: both serials of the pair, stored under their serial index
+    if (stereoMode) {
+        if (serials.size() < 2)
+        {
+            printf("Stereo needs two serials\n");
+            return 1;
+        }
+        return run_cameras(vector<string>(serials.begin(), serials.begin() + 2), vector<int>{0, 1});
+    }
+    if (argc - optind < 2) {
         printf("Need Serial number");
+        usage();
         return 0;
     }
-    int sn_i = atoi(argv[1]);
-    int id = atoi(argv[2]);
-    run_camera(SN[sn_i], id);
-    return 0;
+    int sn_i = atoi(argv[optind]);
+    int id = atoi(argv[optind + 1]);
+    if (sn_i < 0 || sn_i >= (int) serials.size())
+    {
+        printf("Serial index %d, have %zu serials\n", sn_i, serials.size());
+        return 1;
+    }
+    return run_cameras(vector<string>{serials[sn_i]}, vector<int>{id});
 }
 
 
-
-int writeTiff(unsigned char *buf, char* outFileName)
+// Runs on a FrameWriter thread
+int writeFrame(const Frame &frame)
 {
-	int	fd, c;
-	uint32_t row, col, band;
-    uint32_t linebytes, bufsize;
-	TIFF	*out;
-
-	uint32_t width = 2592, length = 1944;
-    uint32_t nbands = 1, rowsperstrip=3; /* number of bands in input image*/
-	off_t	hdr_size = 0;		    /* size of the header to skip */
-	unsigned char *buf1 = NULL;
-
-
-	uint16_t	photometric = PHOTOMETRIC_MINISBLACK;
-	uint16_t	config = PLANARCONFIG_CONTIG;
-	uint16_t	fillorder = FILLORDER_LSB2MSB;
-	TIFFDataType dtype = TIFF_BYTE;
-    uint16_t compression = COMPRESSION_PACKBITS;
-    int16_t depth = TIFFDataWidth(dtype); /* bytes per pixel in input image */
-
-
-	out = TIFFOpen(outFileName, "w");
-	if (out == NULL) {
-		fprintf(stderr, "%s: Cannot open file for output.\n", outFileName);
-		return (-1);
-	}
-
-	TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
-	TIFFSetField(out, TIFFTAG_IMAGELENGTH, length);
-	TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-	TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, nbands);
-	TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, depth * 8);
-	TIFFSetField(out, TIFFTAG_FILLORDER, fillorder);
-	TIFFSetField(out, TIFFTAG_PLANARCONFIG, config);
-    TIFFSetField(out, TIFFTAG_PHOTOMETRIC, photometric);
-    TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-	TIFFSetField(out, TIFFTAG_COMPRESSION, compression);
-
-    linebytes = width * nbands * depth;
-	bufsize = width * nbands * depth;
-	//buf1 = (unsigned char *)_TIFFmalloc(bufsize);
-
-	/*rowsperstrip = TIFFDefaultStripSize(out, rowsperstrip);
-	if (rowsperstrip > length) {
-		rowsperstrip = length;
-	}*/
-	TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, rowsperstrip );
-
-	lseek(fd, hdr_size, SEEK_SET);		/* Skip the file header */
-	for (row = 0; row < length; row++) {
-		buf1 = buf + row * bufsize;	
-		if (TIFFWriteScanline(out, buf1, row, 0) < 0) {
-			fprintf(stderr,	"%s: scanline %lu: Write error.\n",
-                    outFileName, (unsigned long) row);
-			break;
-		}
-	}
-	TIFFClose(out);
-	return (0);
-}
+    char ImageFileName[256];
+    snprintf(ImageFileName, sizeof(ImageFileName), "%s/image%05ld_%d_%ld_%ld", dataDir.c_str(),
+             frame.frame_id, frame.camera_id, (long) frame.timestamp.tv_sec, frame.timestamp.tv_nsec);
+
+    FrameMeta meta;
+    meta.camera_id = frame.camera_id;
+    meta.frame_id = frame.frame_id;
+    meta.timestamp_ns = (long long) frame.timestamp.tv_sec * 1000000000LL + frame.timestamp.tv_nsec;
+    meta.has_trigger = frame.has_trigger;
+    meta.trigger_id = frame.trigger_id;
+    meta.trigger_ns = frame.trigger_ns;
+    meta.pressure = frame.pressure;
+    meta.temperature = frame.temperature;
+
+    // Codec and blank filter of the current storage level
+    CodecOptions codec;
+    ContentFilter filter;
+    applyStorageLevel(storageManager->level(), segmentStore != nullptr, codecOptions, contentFilter, &codec, &filter);
+
+    // Blank frames are stored as a thumbnail or not at all, but their
+    // stats always make it to the log
+    FrameStats stats;
+    computeFrameStats(frame.data, frame.width, frame.height, frame.stride,
+                      filter.margin, &stats);
+    bool blank = isBlankFrame(stats, filter);
+    if (blank)
+        blankFrames++;
+    if (surveyPolicy)
+        surveyPolicy->noteContent(blank);
+    // Whatever becomes of the frame here, blank or skipped ones included
+    if (streamer)
+        streamer->offer(frame);
+    int exposure_us = initialExposureUs, gain = initialGain;
+    if (exposureController)
+    {
+        if (exposureController->update(frame.camera_id, stats, meta.timestamp_ns, &exposure_us, &gain))
+        {
+            // Both cameras of the pair at the next frame boundary
+            PropertyBatch settings;
+            settings.set("Exposure", exposure_us);
+            settings.set("Gain", gain);
+            for (TcamCamera *cam : exposureCameras)
+                cam->queue_properties(settings);
+            printf("Auto exposure: %d us, gain %d\n", exposure_us, gain);
+        }
+    }
+    // Frames the storage level skips count as not stored
+    bool skip = !storageManager->keep(frame.frame_id);
+    const char *stored = skip ? "skip" : !blank ? "full" : filter.policy == BlankPolicy::Drop ? "none" : "thumb";
+    if (statsLog)
+    {
+        std::lock_guard<std::mutex> lck(statsLogMtx);
+        fprintf(statsLog, "%ld,%d,%.2f,%.2f,%d,%d,%.3f,%.4f,%s,%d,%d\n", frame.frame_id, frame.camera_id,
+                stats.mean, stats.variance, stats.median, stats.max, stats.sharpness,
+                stats.content, stored, exposure_us, gain);
+    }
+    if (skip || (blank && filter.policy == BlankPolicy::Drop))
+    {
+        storageManager->record(0, meta.timestamp_ns);
+        return 0;
+    }
+
+    auto preview = previewStores.find(frame.camera_id);
+    if (preview != previewStores.end())
+    {
+        // Per writer thread, like the thumbnail below
+        static thread_local PreviewPyramid pyramid;
+        buildPyramid(frame.data, frame.width, frame.height, frame.stride, &pyramid);
+        preview->second->add(pyramid, frame.frame_id, meta.timestamp_ns);
+    }
 
+    const unsigned char *data = frame.data;
+    int width = frame.width, height = frame.height, stride = frame.stride;
+    if (blank)
+    {
+        // Per writer thread, sized for the first thumbnail and then reused
+        static thread_local std::vector<unsigned char> thumbnail;
+        int scale = filter.thumbnail_scale;
+        downsampleFrame(frame.data, frame.width, frame.height, frame.stride, scale, thumbnail);
+        data = thumbnail.data();
+        width = stride = frame.width / scale;
+        height = frame.height / scale;
+        strcat(ImageFileName, "_thumb");
+    }
+
+    EncodeResult result;
+    int ret;
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    if (segmentStore)
+        ret = segmentStore->add(data, width, height, stride, meta, blank, codec, &result);
+    else
+        ret = encodeFrame(data, width, height, stride, meta, ImageFileName, codec, &result);
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    // Encoding and the write, or the copy into a segment
+    if (storeLatency)
+        storeLatency->record((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+    storageManager->record(ret == 0 ? result.stored_bytes : 0, meta.timestamp_ns);
+    if (ret == 0 && encodeLog)
+    {
+        std::lock_guard<std::mutex> lck(encodeLogMtx);
+        fprintf(encodeLog, "%ld,%d,%s,%.2f,%zu,%zu\n", frame.frame_id, frame.camera_id,
+                storageCodecName(codec.codec), result.encode_ms,
+                result.raw_bytes, result.stored_bytes);
+    }
+    return ret;
+}
@@ -0,0 +1,443 @@
+#include "pixelkernels.h"
+
+#include <algorithm>
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+#endif
+
+/*
+* Each kernel runs whole vectors first and finishes the last few pixels,
+* or everything without NEON, in the scalar loop. The scalar operations
+* are the reference: the vector ones have to give the same bits.
+*/
+
+#ifdef __ARM_NEON
+// One overload set per operation, so the kernels below are written once
+static inline uint8x16_t vload(const uint8_t *p) { return vld1q_u8(p); }
+static inline uint16x8_t vload(const uint16_t *p) { return vld1q_u16(p); }
+static inline float32x4_t vload(const float *p) { return vld1q_f32(p); }
+static inline void vstore(uint8_t *p, uint8x16_t v) { vst1q_u8(p, v); }
+static inline void vstore(uint16_t *p, uint16x8_t v) { vst1q_u16(p, v); }
+static inline void vstore(float *p, float32x4_t v) { vst1q_f32(p, v); }
+static inline uint8x16_t vdup(uint8_t c) { return vdupq_n_u8(c); }
+static inline uint16x8_t vdup(uint16_t c) { return vdupq_n_u16(c); }
+static inline float32x4_t vdup(float c) { return vdupq_n_f32(c); }
+
+static inline uint8x16_t vadd(uint8x16_t a, uint8x16_t b) { return vaddq_u8(a, b); }
+static inline uint16x8_t vadd(uint16x8_t a, uint16x8_t b) { return vaddq_u16(a, b); }
+static inline float32x4_t vadd(float32x4_t a, float32x4_t b) { return vaddq_f32(a, b); }
+static inline uint8x16_t vsub(uint8x16_t a, uint8x16_t b) { return vsubq_u8(a, b); }
+static inline uint16x8_t vsub(uint16x8_t a, uint16x8_t b) { return vsubq_u16(a, b); }
+static inline float32x4_t vsub(float32x4_t a, float32x4_t b) { return vsubq_f32(a, b); }
+static inline uint8x16_t vmul(uint8x16_t a, uint8x16_t b) { return vmulq_u8(a, b); }
+static inline uint16x8_t vmul(uint16x8_t a, uint16x8_t b) { return vmulq_u16(a, b); }
+static inline float32x4_t vmul(float32x4_t a, float32x4_t b) { return vmulq_f32(a, b); }
+static inline uint8x16_t vmin(uint8x16_t a, uint8x16_t b) { return vminq_u8(a, b); }
+static inline uint16x8_t vmin(uint16x8_t a, uint16x8_t b) { return vminq_u16(a, b); }
+static inline float32x4_t vmin(float32x4_t a, float32x4_t b) { return vminq_f32(a, b); }
+static inline uint8x16_t vmax(uint8x16_t a, uint8x16_t b) { return vmaxq_u8(a, b); }
+static inline uint16x8_t vmax(uint16x8_t a, uint16x8_t b) { return vmaxq_u16(a, b); }
+static inline float32x4_t vmax(float32x4_t a, float32x4_t b) { return vmaxq_f32(a, b); }
+
+// Any lane equal to zero
+static inline bool vany_zero(uint8x16_t v)
+{
+    uint64x2_t m = vreinterpretq_u64_u8(vceqq_u8(v, vdupq_n_u8(0)));
+    return (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) != 0;
+}
+static inline bool vany_zero(uint16x8_t v)
+{
+    uint64x2_t m = vreinterpretq_u64_u16(vceqq_u16(v, vdupq_n_u16(0)));
+    return (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) != 0;
+}
+static inline bool vany_zero(float32x4_t v)
+{
+    uint64x2_t m = vreinterpretq_u64_u32(vceqq_f32(v, vdupq_n_f32(0.0f)));
+    return (vgetq_lane_u64(m, 0) | vgetq_lane_u64(m, 1)) != 0;
+}
+
+template <typename T> struct Lanes { enum { n = 16 / sizeof(T) }; };
+#endif
+
+struct OpAdd
+{
+    template <typename T> static T one(T a, T b) { return (T) (a + b); }
+#ifdef __ARM_NEON
+    template <typename V> static V vec(V a, V b) { return vadd(a, b); }
+#endif
+};
+
+struct OpSub
+{
+    template <typename T> static T one(T a, T b) { return (T) (a - b); }
+#ifdef __ARM_NEON
+    template <typename V> static V vec(V a, V b) { return vsub(a, b); }
+#endif
+};
+
+struct OpMul
+{
+    template <typename T> static T one(T a, T b) { return (T) (a * b); }
+#ifdef __ARM_NEON
+    template <typename V> static V vec(V a, V b) { return vmul(a, b); }
+#endif
+};
+
+template <typename Op, typename T>
+static void binary(const T *a, const T *b, T *out, size_t n)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + Lanes<T>::n <= n; i += Lanes<T>::n)
+        vstore(out + i, Op::vec(vload(a + i), vload(b + i)));
+#endif
+    for (; i < n; i++)
+        out[i] = Op::one(a[i], b[i]);
+}
+
+template <typename Op, typename T>
+static void binary(const T *a, T c, T *out, size_t n)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    auto vc = vdup(c);
+    for (; i + Lanes<T>::n <= n; i += Lanes<T>::n)
+        vstore(out + i, Op::vec(vload(a + i), vc));
+#endif
+    for (; i < n; i++)
+        out[i] = Op::one(a[i], c);
+}
+
+void pixel_add(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n) { binary<OpAdd>(a, b, out, n); }
+void pixel_add(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n) { binary<OpAdd>(a, b, out, n); }
+void pixel_add(const float *a, const float *b, float *out, size_t n) { binary<OpAdd>(a, b, out, n); }
+void pixel_sub(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n) { binary<OpSub>(a, b, out, n); }
+void pixel_sub(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n) { binary<OpSub>(a, b, out, n); }
+void pixel_sub(const float *a, const float *b, float *out, size_t n) { binary<OpSub>(a, b, out, n); }
+void pixel_mul(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n) { binary<OpMul>(a, b, out, n); }
+void pixel_mul(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n) { binary<OpMul>(a, b, out, n); }
+void pixel_mul(const float *a, const float *b, float *out, size_t n) { binary<OpMul>(a, b, out, n); }
+
+void pixel_add(const uint8_t *a, uint8_t c, uint8_t *out, size_t n) { binary<OpAdd>(a, c, out, n); }
+void pixel_add(const uint16_t *a, uint16_t c, uint16_t *out, size_t n) { binary<OpAdd>(a, c, out, n); }
+void pixel_add(const float *a, float c, float *out, size_t n) { binary<OpAdd>(a, c, out, n); }
+void pixel_sub(const uint8_t *a, uint8_t c, uint8_t *out, size_t n) { binary<OpSub>(a, c, out, n); }
+void pixel_sub(const uint16_t *a, uint16_t c, uint16_t *out, size_t n) { binary<OpSub>(a, c, out, n); }
+void pixel_sub(const float *a, float c, float *out, size_t n) { binary<OpSub>(a, c, out, n); }
+void pixel_mul(const uint8_t *a, uint8_t c, uint8_t *out, size_t n) { binary<OpMul>(a, c, out, n); }
+void pixel_mul(const uint16_t *a, uint16_t c, uint16_t *out, size_t n) { binary<OpMul>(a, c, out, n); }
+void pixel_mul(const float *a, float c, float *out, size_t n) { binary<OpMul>(a, c, out, n); }
+
+// NEON has no integer division, and float division only on arm64. The
+// loops still vectorize for the compiler once the bounds checks are gone.
+template <typename T>
+static void divide(const T *a, const T *b, T *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = (T) (a[i] / b[i]);
+}
+
+void pixel_div(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n) { divide(a, b, out, n); }
+void pixel_div(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n) { divide(a, b, out, n); }
+
+void pixel_div(const float *a, const float *b, float *out, size_t n)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(out + i, vdivq_f32(vld1q_f32(a + i), vld1q_f32(b + i)));
+#endif
+    divide(a + i, b + i, out + i, n - i);
+}
+
+// Integer division by a constant: a multiply and a shift would do, but
+// nothing divides integer images by a scalar in a hot path yet.
+void pixel_div(const uint8_t *a, uint8_t c, uint8_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint8_t) (a[i] / c);
+}
+
+void pixel_div(const uint16_t *a, uint16_t c, uint16_t *out, size_t n)
+{
+    for (size_t i = 0; i < n; i++)
+        out[i] = (uint16_t) (a[i] / c);
+}
+
+void pixel_div(const float *a, float c, float *out, size_t n)
+{
+    size_t i = 0;
+#if defined(__ARM_NEON) && defined(__aarch64__)
+    float32x4_t vc = vdupq_n_f32(c);
+    for (; i + 4 <= n; i += 4)
+        vst1q_f32(out + i, vdivq_f32(vld1q_f32(a + i), vc));
+#endif
+    for (; i < n; i++)
+        out[i] = a[i] / c;
+}
+
+
+template <typename T>
+static bool any_zero(const T *in, size_t n)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + Lanes<T>::n <= n; i += Lanes<T>::n)
+        if (vany_zero(vload(in + i)))
+            return true;
+#endif
+    for (; i < n; i++)
+        if (in[i] == 0)
+            return true;
+    return false;
+}
+
+bool pixel_any_zero(const uint8_t *in, size_t n) { return any_zero(in, n); }
+bool pixel_any_zero(const uint16_t *in, size_t n) { return any_zero(in, n); }
+bool pixel_any_zero(const float *in, size_t n) { return any_zero(in, n); }
+
+
+void pixel_to_float(const uint8_t *in, float *out, size_t n, float scale)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 16 <= n; i += 16)
+    {
+        uint8x16_t v = vld1q_u8(in + i);
+        uint16x8_t lo = vmovl_u8(vget_low_u8(v)), hi = vmovl_u8(vget_high_u8(v));
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(lo))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(lo))), scale));
+        vst1q_f32(out + i + 8, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(hi))), scale));
+        vst1q_f32(out + i + 12, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(hi))), scale));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = in[i] * scale;
+}
+
+void pixel_to_float(const uint16_t *in, float *out, size_t n, float scale)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t v = vld1q_u16(in + i);
+        vst1q_f32(out + i, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_low_u16(v))), scale));
+        vst1q_f32(out + i + 4, vmulq_n_f32(vcvtq_f32_u32(vmovl_u16(vget_high_u16(v))), scale));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = in[i] * scale;
+}
+
+// in * scale + 0.5 limited to [0, max], truncated: rounds to nearest
+template <typename T>
+static T round_clamp(float v, float scale, float max)
+{
+    v = v * scale + 0.5f;
+    return (T) std::min(std::max(v, 0.0f), max);
+}
+
+#ifdef __ARM_NEON
+static inline uint32x4_t vround_clamp(float32x4_t v, float32x4_t scale, float32x4_t max)
+{
+    v = vaddq_f32(vmulq_f32(v, scale), vdupq_n_f32(0.5f));
+    return vcvtq_u32_f32(vminq_f32(vmaxq_f32(v, vdupq_n_f32(0.0f)), max));
+}
+#endif
+
+void pixel_from_float(const float *in, uint8_t *out, size_t n, float scale)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    float32x4_t vs = vdupq_n_f32(scale), vm = vdupq_n_f32(255.0f);
+    for (; i + 16 <= n; i += 16)
+    {
+        uint16x8_t lo = vcombine_u16(vmovn_u32(vround_clamp(vld1q_f32(in + i), vs, vm)),
+                                     vmovn_u32(vround_clamp(vld1q_f32(in + i + 4), vs, vm)));
+        uint16x8_t hi = vcombine_u16(vmovn_u32(vround_clamp(vld1q_f32(in + i + 8), vs, vm)),
+                                     vmovn_u32(vround_clamp(vld1q_f32(in + i + 12), vs, vm)));
+        vst1q_u8(out + i, vcombine_u8(vmovn_u16(lo), vmovn_u16(hi)));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = round_clamp<uint8_t>(in[i], scale, 255.0f);
+}
+
+void pixel_from_float(const float *in, uint16_t *out, size_t n, float scale)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    float32x4_t vs = vdupq_n_f32(scale), vm = vdupq_n_f32(65535.0f);
+    for (; i + 8 <= n; i += 8)
+        vst1q_u16(out + i, vcombine_u16(vmovn_u32(vround_clamp(vld1q_f32(in + i), vs, vm)),
+                                        vmovn_u32(vround_clamp(vld1q_f32(in + i + 4), vs, vm))));
+#endif
+    for (; i < n; i++)
+        out[i] = round_clamp<uint16_t>(in[i], scale, 65535.0f);
+}
+
+
+template <typename T>
+static void clamp(T *data, size_t n, T lo, T hi)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    auto vlo = vdup(lo), vhi = vdup(hi);
+    for (; i + Lanes<T>::n <= n; i += Lanes<T>::n)
+        vstore(data + i, vmin(vmax(vload(data + i), vlo), vhi));
+#endif
+    for (; i < n; i++)
+        data[i] = std::min(std::max(data[i], lo), hi);
+}
+
+void pixel_clamp(uint8_t *data, size_t n, uint8_t lo, uint8_t hi) { clamp(data, n, lo, hi); }
+void pixel_clamp(uint16_t *data, size_t n, uint16_t lo, uint16_t hi) { clamp(data, n, lo, hi); }
+void pixel_clamp(float *data, size_t n, float lo, float hi) { clamp(data, n, lo, hi); }
+
+
+template <typename T>
+static void min_max(const T *in, size_t n, T *lo, T *hi)
+{
+    T l = *lo, h = *hi;
+    size_t i = 0;
+#ifdef __ARM_NEON
+    if (n >= (size_t) Lanes<T>::n)
+    {
+        auto vl = vload(in), vh = vl;
+        for (i = Lanes<T>::n; i + Lanes<T>::n <= n; i += Lanes<T>::n)
+        {
+            auto v = vload(in + i);
+            vl = vmin(vl, v);
+            vh = vmax(vh, v);
+        }
+        T lanes[2][Lanes<T>::n];
+        vstore(lanes[0], vl);
+        vstore(lanes[1], vh);
+        for (int k = 0; k < Lanes<T>::n; k++)
+        {
+            l = std::min(l, lanes[0][k]);
+            h = std::max(h, lanes[1][k]);
+        }
+    }
+#endif
+    for (; i < n; i++)
+    {
+        l = std::min(l, in[i]);
+        h = std::max(h, in[i]);
+    }
+    *lo = l;
+    *hi = h;
+}
+
+void pixel_min_max(const uint8_t *in, size_t n, uint8_t *lo, uint8_t *hi) { min_max(in, n, lo, hi); }
+void pixel_min_max(const uint16_t *in, size_t n, uint16_t *lo, uint16_t *hi) { min_max(in, n, lo, hi); }
+void pixel_min_max(const float *in, size_t n, float *lo, float *hi) { min_max(in, n, lo, hi); }
+
+
+// Integer sums are exact on both paths
+double pixel_sum(const uint8_t *in, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#ifdef __ARM_NEON
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; i + 16 <= n; i += 16)
+        acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(vld1q_u8(in + i))));
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+    for (; i < n; i++)
+        sum += in[i];
+    return (double) sum;
+}
+
+double pixel_sum(const uint16_t *in, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#ifdef __ARM_NEON
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; i + 8 <= n; i += 8)
+        acc = vpadalq_u32(acc, vpaddlq_u16(vld1q_u16(in + i)));
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+    for (; i < n; i++)
+        sum += in[i];
+    return (double) sum;
+}
+
+// Float sums go through double every 1024 values, so large frames do not
+// lose the small pixels. The order differs from the scalar loop, the
+// last bits of the result may too.
+double pixel_sum(const float *in, size_t n)
+{
+    double sum = 0;
+    size_t i = 0;
+#ifdef __ARM_NEON
+    while (i + 4 <= n)
+    {
+        float32x4_t acc = vdupq_n_f32(0.0f);
+        size_t end = std::min(n & ~(size_t) 3, i + 1024);
+        for (; i < end; i += 4)
+            acc = vaddq_f32(acc, vld1q_f32(in + i));
+        float lanes[4];
+        vst1q_f32(lanes, acc);
+        sum += (double) lanes[0] + lanes[1] + lanes[2] + lanes[3];
+    }
+#endif
+    for (; i < n; i++)
+        sum += in[i];
+    return sum;
+}
+
+
+// Histograms do not vectorize: the work is in the scattered increments.
+// Four tables keep runs of equal pixels, which dark frames are full of,
+// from waiting on each other's stores.
+void pixel_histogram(const uint8_t *in, size_t n, uint32_t hist[256])
+{
+    uint32_t part[4][256] = {{0}};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4)
+    {
+        part[0][in[i]]++;
+        part[1][in[i + 1]]++;
+        part[2][in[i + 2]]++;
+        part[3][in[i + 3]]++;
+    }
+    for (; i < n; i++)
+        part[0][in[i]]++;
+    for (int k = 0; k < 256; k++)
+        hist[k] += part[0][k] + part[1][k] + part[2][k] + part[3][k];
+}
+
+uint64_t pixel_abs_diff_sum(const uint8_t *a, const uint8_t *b, size_t n)
+{
+    uint64_t sum = 0;
+    size_t i = 0;
+#ifdef __ARM_NEON
+    uint64x2_t acc = vdupq_n_u64(0);
+    for (; i + 16 <= n; i += 16)
+        acc = vpadalq_u32(acc, vpaddlq_u16(vpaddlq_u8(vabdq_u8(vld1q_u8(a + i), vld1q_u8(b + i)))));
+    sum = vgetq_lane_u64(acc, 0) + vgetq_lane_u64(acc, 1);
+#endif
+    for (; i < n; i++)
+        sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+    return sum;
+}
+
+void pixel_downsample2(const uint8_t *row0, const uint8_t *row1, uint8_t *out, size_t n)
+{
+    size_t i = 0;
+#ifdef __ARM_NEON
+    // Pairwise sums of each row, then a rounding shift: (s + 2) >> 2
+    for (; i + 8 <= n; i += 8)
+    {
+        uint16x8_t s = vaddq_u16(vpaddlq_u8(vld1q_u8(row0 + 2 * i)), vpaddlq_u8(vld1q_u8(row1 + 2 * i)));
+        vst1_u8(out + i, vrshrn_n_u16(s, 2));
+    }
+#endif
+    for (; i < n; i++)
+        out[i] = (uint8_t) ((row0[2 * i] + row0[2 * i + 1] + row1[2 * i] + row1[2 * i + 1] + 2) >> 2);
+}
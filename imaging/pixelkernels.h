@@ -0,0 +1,84 @@
+#ifndef __PIXELKERNELS__
+#define __PIXELKERNELS__
+
+#include <stdint.h>
+#include <stddef.h>
+
+/*
+* Inner loops over contiguous pixel runs, with NEON versions when built
+* for it (__ARM_NEON: always on arm64, -DENABLE_NEON=ON for 32-bit ARM)
+* and plain loops otherwise. Both give the same results: integer
+* arithmetic wraps like the C++ casts do, float division and float
+* conversions are IEEE on both paths. The differences: 32-bit NEON
+* flushes float denormals to zero, and float sums add in another order.
+*
+* in and out may be the same array, other overlaps are not allowed.
+*/
+
+// out = a op b
+void pixel_add(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+void pixel_add(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n);
+void pixel_add(const float *a, const float *b, float *out, size_t n);
+void pixel_sub(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+void pixel_sub(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n);
+void pixel_sub(const float *a, const float *b, float *out, size_t n);
+void pixel_mul(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+void pixel_mul(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n);
+void pixel_mul(const float *a, const float *b, float *out, size_t n);
+// b must not contain zeros, see pixel_any_zero
+void pixel_div(const uint8_t *a, const uint8_t *b, uint8_t *out, size_t n);
+void pixel_div(const uint16_t *a, const uint16_t *b, uint16_t *out, size_t n);
+void pixel_div(const float *a, const float *b, float *out, size_t n);
+
+// out = a op c
+void pixel_add(const uint8_t *a, uint8_t c, uint8_t *out, size_t n);
+void pixel_add(const uint16_t *a, uint16_t c, uint16_t *out, size_t n);
+void pixel_add(const float *a, float c, float *out, size_t n);
+void pixel_sub(const uint8_t *a, uint8_t c, uint8_t *out, size_t n);
+void pixel_sub(const uint16_t *a, uint16_t c, uint16_t *out, size_t n);
+void pixel_sub(const float *a, float c, float *out, size_t n);
+void pixel_mul(const uint8_t *a, uint8_t c, uint8_t *out, size_t n);
+void pixel_mul(const uint16_t *a, uint16_t c, uint16_t *out, size_t n);
+void pixel_mul(const float *a, float c, float *out, size_t n);
+void pixel_div(const uint8_t *a, uint8_t c, uint8_t *out, size_t n);
+void pixel_div(const uint16_t *a, uint16_t c, uint16_t *out, size_t n);
+void pixel_div(const float *a, float c, float *out, size_t n);
+
+bool pixel_any_zero(const uint8_t *in, size_t n);
+bool pixel_any_zero(const uint16_t *in, size_t n);
+bool pixel_any_zero(const float *in, size_t n);
+
+// out = in * scale
+void pixel_to_float(const uint8_t *in, float *out, size_t n, float scale);
+void pixel_to_float(const uint16_t *in, float *out, size_t n, float scale);
+// out = in * scale, rounded and clamped to the range of out
+void pixel_from_float(const float *in, uint8_t *out, size_t n, float scale);
+void pixel_from_float(const float *in, uint16_t *out, size_t n, float scale);
+
+// Limit data to [lo, hi] in place
+void pixel_clamp(uint8_t *data, size_t n, uint8_t lo, uint8_t hi);
+void pixel_clamp(uint16_t *data, size_t n, uint16_t lo, uint16_t hi);
+void pixel_clamp(float *data, size_t n, float lo, float hi);
+
+// Smallest and largest value, n > 0. Results are merged into *lo and
+// *hi, so set them to the first pixel before walking several runs.
+void pixel_min_max(const uint8_t *in, size_t n, uint8_t *lo, uint8_t *hi);
+void pixel_min_max(const uint16_t *in, size_t n, uint16_t *lo, uint16_t *hi);
+void pixel_min_max(const float *in, size_t n, float *lo, float *hi);
+
+// Sum of the values, divide by n for the mean
+double pixel_sum(const uint8_t *in, size_t n);
+double pixel_sum(const uint16_t *in, size_t n);
+double pixel_sum(const float *in, size_t n);
+
+// Add the values of in to hist, one bin per grey level
+void pixel_histogram(const uint8_t *in, size_t n, uint32_t hist[256]);
+
+// Sum of |a - b|, e.g. of a row against itself shifted by one pixel
+uint64_t pixel_abs_diff_sum(const uint8_t *a, const uint8_t *b, size_t n);
+
+// out[i] = rounded mean of the 2x2 block at 2i of rows row0 and row1,
+// which hold at least 2 * n pixels
+void pixel_downsample2(const uint8_t *row0, const uint8_t *row1, uint8_t *out, size_t n);
+
+#endif
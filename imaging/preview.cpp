@@ -0,0 +1,174 @@
+#include "preview.h"
+#include "pixelkernels.h"
+#include "lodepng.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+void buildPyramid(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                  PreviewPyramid *pyramid)
+{
+    const unsigned char *src = buf;
+    for (int l = 0; l < PREVIEW_LEVELS; l++)
+    {
+        uint32_t w = width / 2, h = height / 2;
+        pyramid->width[l] = w;
+        pyramid->height[l] = h;
+        pyramid->level[l].resize((size_t) w * h);
+        unsigned char *dst = pyramid->level[l].data();
+        for (uint32_t y = 0; y < h; y++)
+        {
+            const unsigned char *row0 = src + (size_t) (2 * y) * stride;
+            pixel_downsample2(row0, row0 + stride, dst + (size_t) y * w, w);
+        }
+        // The next level halves this one
+        src = dst;
+        width = w;
+        height = h;
+        stride = w;
+    }
+}
+
+static long long monotonic_ns()
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (long long) now.tv_sec * 1000000000LL + now.tv_nsec;
+}
+
+PreviewStore::PreviewStore(const std::string &dir, int camera_id, uint32_t slots, int png_interval_ms,
+                           uint32_t max_width, uint32_t max_height)
+    : camera_id_(camera_id), slots_(slots),
+      slot_width_(max_width >> PREVIEW_LEVELS), slot_height_(max_height >> PREVIEW_LEVELS),
+      png_interval_ns_(png_interval_ms * 1000000LL), last_png_ns_(0)
+{
+    ring_path_ = dir + "/preview_cam" + std::to_string(camera_id) + ".ring";
+    png_path_ = dir + "/latest_cam" + std::to_string(camera_id) + ".png";
+    memset(&header_, 0, sizeof(header_));
+}
+
+PreviewStore::~PreviewStore()
+{
+    if (fd_ >= 0)
+        close(fd_);
+}
+
+// Keep the previews of earlier runs if the file has the same layout
+int PreviewStore::open_ring()
+{
+    uint32_t width = slot_width_, height = slot_height_;
+    fd_ = open(ring_path_.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd_ < 0)
+    {
+        fprintf(stderr, "%s: %s\n", ring_path_.c_str(), strerror(errno));
+        return -1;
+    }
+    PreviewFileHeader old;
+    if (pread(fd_, &old, sizeof(old), 0) == sizeof(old) && memcmp(old.magic, "MPRV", 4) == 0
+        && old.version == PREVIEW_FILE_VERSION && old.header_size == sizeof(old)
+        && old.record_size == sizeof(PreviewRecord) && old.slots == slots_
+        && old.width == width && old.height == height && old.next < slots_)
+    {
+        header_ = old;
+        return 0;
+    }
+
+    memcpy(header_.magic, "MPRV", 4);
+    header_.version = PREVIEW_FILE_VERSION;
+    header_.header_size = sizeof(header_);
+    header_.record_size = sizeof(PreviewRecord);
+    header_.slots = slots_;
+    header_.width = width;
+    header_.height = height;
+    header_.next = 0;
+    header_.count = 0;
+    // Allocate the whole file up front, it never grows afterwards
+    off_t size = sizeof(header_) + (off_t) slots_ * (sizeof(PreviewRecord) + (off_t) width * height);
+    if (ftruncate(fd_, 0) != 0 || ftruncate(fd_, size) != 0
+        || pwrite(fd_, &header_, sizeof(header_), 0) != sizeof(header_))
+    {
+        fprintf(stderr, "%s: %s\n", ring_path_.c_str(), strerror(errno));
+        close(fd_);
+        fd_ = -1;
+        return -1;
+    }
+    return 0;
+}
+
+int PreviewStore::add(const PreviewPyramid &pyramid, long frame_id, long long timestamp_ns)
+{
+    const int top = PREVIEW_LEVELS - 1;
+    uint32_t width = pyramid.width[top], height = pyramid.height[top];
+    long long now_ns = monotonic_ns();
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (fd_ < 0 && open_ring() != 0)
+            return -1;
+        if (width > header_.width || height > header_.height)
+        {
+            if (!size_warned_)
+                fprintf(stderr, "%s: %ux%u preview does not fit the %ux%u slots, not stored\n",
+                        ring_path_.c_str(), width, height, header_.width, header_.height);
+            size_warned_ = true;
+            return -1;
+        }
+
+        PreviewRecord rec;
+        memset(&rec, 0, sizeof(rec));
+        rec.frame_id = frame_id;
+        rec.timestamp_ns = timestamp_ns;
+        rec.camera_id = camera_id_;
+        rec.level = 1 << (top + 1);
+        rec.width = width;
+        rec.height = height;
+        size_t pixels = (size_t) width * height;
+        size_t slot = (size_t) header_.width * header_.height;
+        off_t offset = sizeof(header_) + (off_t) header_.next * (sizeof(rec) + slot);
+        if (pwrite(fd_, &rec, sizeof(rec), offset) != sizeof(rec)
+            || pwrite(fd_, pyramid.level[top].data(), pixels, offset + sizeof(rec)) != (ssize_t) pixels)
+        {
+            fprintf(stderr, "%s: %s\n", ring_path_.c_str(), strerror(errno));
+            return -1;
+        }
+        header_.next = (header_.next + 1) % slots_;
+        if (header_.count < slots_)
+            header_.count++;
+        if (pwrite(fd_, &header_, sizeof(header_), 0) != sizeof(header_))
+            return -1;
+    }
+
+    // One writer thread wins the PNG of this interval, the rest skip it
+    long long last = last_png_ns_.load();
+    if (now_ns - last >= png_interval_ns_ && last_png_ns_.compare_exchange_strong(last, now_ns))
+        write_png(pyramid);
+    return 0;
+}
+
+// Written next to the target and renamed, so a reader never sees half a PNG
+void PreviewStore::write_png(const PreviewPyramid &pyramid)
+{
+    const int level = 1;    // 4x
+    std::vector<unsigned char> png;
+    unsigned err = lodepng::encode_grey(png, pyramid.level[level].data(), pyramid.width[level],
+                                        pyramid.height[level], 0, lodepng::GREY_FAST);
+    if (err)
+    {
+        fprintf(stderr, "%s: %s\n", png_path_.c_str(), lodepng_error_text(err));
+        return;
+    }
+    std::string tmp = png_path_ + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL)
+    {
+        fprintf(stderr, "%s: %s\n", tmp.c_str(), strerror(errno));
+        return;
+    }
+    bool ok = fwrite(png.data(), 1, png.size(), f) == png.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), png_path_.c_str()) != 0)
+        fprintf(stderr, "%s: %s\n", png_path_.c_str(), strerror(errno));
+}
@@ -0,0 +1,108 @@
+#ifndef __PREVIEW__
+#define __PREVIEW__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <string>
+#include <mutex>
+#include <atomic>
+
+#define PREVIEW_LEVELS 3   // 2x, 4x and 8x
+
+/*
+* A frame decimated by 2, 4 and 8 with a 2x2 box filter per level.
+* Odd rows and columns at the edge are dropped.
+*/
+struct PreviewPyramid
+{
+    std::vector<unsigned char> level[PREVIEW_LEVELS];
+    uint32_t width[PREVIEW_LEVELS];
+    uint32_t height[PREVIEW_LEVELS];
+};
+
+/*
+* Build all levels of pyramid, reusing its buffers
+*/
+void buildPyramid(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                  PreviewPyramid *pyramid);
+
+/*
+* On-disk layout of the rolling preview file: this header, then slots
+* records of a PreviewRecord followed by room for width * height GRAY8
+* pixels, the preview of the largest frame of any capture mode. A record's
+* own width * height pixels come first in its slot; binned or skipped
+* survey frames leave the rest unused. All in host byte order
+* (little-endian on the Pi). next is the slot written next, so the newest
+* record is the one before it.
+*/
+struct PreviewFileHeader
+{
+    char magic[4];              // "MPRV"
+    uint16_t version;           // PREVIEW_FILE_VERSION
+    uint16_t header_size;       // sizeof(PreviewFileHeader)
+    uint32_t record_size;       // sizeof(PreviewRecord)
+    uint32_t slots;
+    uint32_t width;             // slot size
+    uint32_t height;
+    uint32_t next;
+    uint32_t count;             // records written so far, up to slots
+};
+
+struct PreviewRecord
+{
+    int64_t frame_id;
+    int64_t timestamp_ns;       // CLOCK_MONOTONIC arrival time
+    uint32_t camera_id;
+    uint32_t level;             // decimation factor, 8 for the 8x level
+    uint32_t width;             // of this preview, at most the header's
+    uint32_t height;
+};
+
+#define PREVIEW_FILE_VERSION 2
+
+/*
+* Previews of one camera: every frame's 8x level goes to a fixed size
+* rolling file, so the newest slots frames are always on disk and the
+* file never grows. At most every png_interval_ms the 4x level is also
+* written as a PNG, for looking at the camera over WiFi. Slots fit the
+* largest frame given, so switching between full and survey modes keeps
+* the ring going. Safe to call from several writer threads.
+*/
+class PreviewStore
+{
+    public:
+        // max_width x max_height: the largest frame of any capture mode
+        PreviewStore(const std::string &dir, int camera_id, uint32_t slots, int png_interval_ms,
+                     uint32_t max_width, uint32_t max_height);
+        ~PreviewStore();
+
+        PreviewStore(const PreviewStore&) = delete;
+        PreviewStore& operator= (const PreviewStore&) = delete;
+
+        /*
+        * Store the previews of one frame. Returns 0 or -1 if the
+        * rolling file could not be written.
+        */
+        int add(const PreviewPyramid &pyramid, long frame_id, long long timestamp_ns);
+
+    private:
+        std::string ring_path_;
+        std::string png_path_;
+        int camera_id_;
+        uint32_t slots_;
+        uint32_t slot_width_;
+        uint32_t slot_height_;
+        long long png_interval_ns_;
+
+        std::mutex mtx_;
+        int fd_ = -1;
+        PreviewFileHeader header_;
+        std::atomic<long long> last_png_ns_;
+        bool size_warned_ = false;
+
+        int open_ring();
+        void write_png(const PreviewPyramid &pyramid);
+};
+
+#endif
@@ -0,0 +1,422 @@
+#include "segmentstore.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/statvfs.h>
+#include <chrono>
+#include <algorithm>
+
+static_assert(sizeof(SegmentIndexEntry) == 64, "SegmentIndexEntry layout changed");
+static_assert(sizeof(SegmentFileHeader) <= SEGMENT_ALIGN, "SegmentFileHeader too large");
+
+static uint64_t align_up(uint64_t n)
+{
+    return (n + SEGMENT_ALIGN - 1) / SEGMENT_ALIGN * SEGMENT_ALIGN;
+}
+
+/*
+* SEGMENT_ALIGN aligned scratch memory for O_DIRECT, grown as needed
+*/
+struct AlignedBuffer
+{
+    unsigned char *data = nullptr;
+    size_t size = 0;
+
+    ~AlignedBuffer() { free(data); }
+
+    bool reserve(size_t n)
+    {
+        if (n <= size)
+            return true;
+        void *mem = nullptr;
+        if (posix_memalign(&mem, SEGMENT_ALIGN, n) != 0)
+            return false;
+        free(data);
+        data = (unsigned char *) mem;
+        size = n;
+        return true;
+    }
+};
+
+static bool write_all(int fd, const void *buf, size_t len, off_t offset)
+{
+    const unsigned char *p = (const unsigned char *) buf;
+    while (len > 0)
+    {
+        ssize_t w = pwrite(fd, p, len, offset);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return false;
+        p += w;
+        len -= w;
+        offset += w;
+    }
+    return true;
+}
+
+SegmentStore::SegmentStore(const std::string &dir, long long segment_bytes, uint32_t index_capacity,
+                           long long reserve_bytes)
+    : dir_(dir), segment_bytes_(segment_bytes), index_capacity_(index_capacity),
+      reserve_bytes_(reserve_bytes), next_sequence_(0)
+{
+    data_offset_ = SEGMENT_ALIGN + align_up((uint64_t) index_capacity_ * sizeof(SegmentIndexEntry));
+
+    // Never touch the segments of earlier runs, carry on after them
+    DIR *d = opendir(dir_.c_str());
+    if (d)
+    {
+        struct dirent *ent;
+        while ((ent = readdir(d)) != NULL)
+        {
+            unsigned n;
+            int len = 0;
+            if (sscanf(ent->d_name, "seg%u.mseg%n", &n, &len) == 1 && len > 0
+                && ent->d_name[len] == '\0' && n >= next_sequence_)
+                next_sequence_ = n + 1;
+        }
+        closedir(d);
+    }
+}
+
+SegmentStore::~SegmentStore()
+{
+    close();
+}
+
+// Preallocate bytes of fd. On ENOSPC what is free above the reserve
+// instead, if that still holds need after the index; 0 if not even that
+static uint64_t allocate(int fd, const char *dir, uint64_t bytes, uint64_t min_bytes, long long reserve)
+{
+    if (fallocate(fd, 0, 0, bytes) == 0)
+        return bytes;
+    if (errno == EOPNOTSUPP)
+        return ftruncate(fd, bytes) == 0 ? bytes : 0;
+    if (errno != ENOSPC)
+        return 0;
+    // Give back whatever the failed call took before looking
+    if (ftruncate(fd, 0) != 0)
+        return 0;
+    struct statvfs st;
+    if (statvfs(dir, &st) != 0)
+        return 0;
+    long long avail = (long long) st.f_bavail * st.f_frsize - reserve;
+    uint64_t fit = avail > 0 ? (uint64_t) avail / SEGMENT_ALIGN * SEGMENT_ALIGN : 0;
+    fit = std::min(fit, bytes);
+    if (fit < min_bytes)
+    {
+        errno = ENOSPC;
+        return 0;
+    }
+    return fallocate(fd, 0, 0, fit) == 0 ? fit : 0;
+}
+
+std::shared_ptr<SegmentStore::Segment> SegmentStore::open_segment(uint64_t need)
+{
+    char path[512];
+    snprintf(path, sizeof(path), "%s/seg%06u.mseg", dir_.c_str(), next_sequence_);
+
+    std::shared_ptr<Segment> seg = std::make_shared<Segment>();
+    seg->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC | O_DIRECT, 0644);
+    if (seg->fd < 0 && errno == EINVAL)
+    {
+        // tmpfs and a few others have no O_DIRECT
+        seg->fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    }
+    if (seg->fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return nullptr;
+    }
+    // Allocate every block now: no allocation, and on ext4 no journal
+    // traffic, while frames are written
+    seg->bytes = allocate(seg->fd, dir_.c_str(), segment_bytes_, data_offset_ + need, reserve_bytes_);
+    if (seg->bytes == 0)
+    {
+        int err = errno;
+        ::close(seg->fd);
+        unlink(path);
+        if (err == ENOSPC)
+            fprintf(stderr, "%s: no space left above the %lld MB reserve, no more segments\n",
+                    dir_.c_str(), reserve_bytes_ >> 20);
+        else
+            fprintf(stderr, "%s: cannot allocate %lld bytes: %s, no more segments\n", path,
+                    segment_bytes_, strerror(err));
+        // Every later frame would only fail the same way, and say so
+        exhausted_ = true;
+        return nullptr;
+    }
+    if (seg->bytes < (uint64_t) segment_bytes_)
+        fprintf(stderr, "%s: %llu MB left above the reserve, last segment\n", path,
+                (unsigned long long) seg->bytes >> 20);
+
+    AlignedBuffer page;
+    if (!page.reserve(SEGMENT_ALIGN))
+    {
+        ::close(seg->fd);
+        unlink(path);
+        return nullptr;
+    }
+    memset(page.data, 0, SEGMENT_ALIGN);
+    SegmentFileHeader *hdr = (SegmentFileHeader *) page.data;
+    memcpy(hdr->magic, "MSEG", 4);
+    hdr->version = SEGMENT_FILE_VERSION;
+    hdr->header_size = sizeof(SegmentFileHeader);
+    hdr->entry_size = sizeof(SegmentIndexEntry);
+    hdr->index_capacity = index_capacity_;
+    hdr->data_offset = data_offset_;
+    hdr->segment_bytes = seg->bytes;
+    hdr->sequence = next_sequence_;
+    if (!write_all(seg->fd, page.data, SEGMENT_ALIGN, 0))
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        ::close(seg->fd);
+        unlink(path);
+        return nullptr;
+    }
+
+    seg->sequence = next_sequence_++;
+    seg->next = data_offset_;
+    seg->index.assign(index_capacity_, SegmentIndexEntry());
+    memset(seg->index.data(), 0, index_capacity_ * sizeof(SegmentIndexEntry));
+    return seg;
+}
+
+// Rewrite the index page holding slot. Called with mtx_ held.
+int SegmentStore::write_entry(Segment &seg, uint32_t slot)
+{
+    static thread_local AlignedBuffer page;
+    if (!page.reserve(SEGMENT_ALIGN))
+        return -1;
+    const uint32_t per_page = SEGMENT_ALIGN / sizeof(SegmentIndexEntry);
+    uint32_t first = slot / per_page * per_page;
+    uint32_t count = std::min(per_page, index_capacity_ - first);
+    memset(page.data, 0, SEGMENT_ALIGN);
+    memcpy(page.data, &seg.index[first], count * sizeof(SegmentIndexEntry));
+    off_t offset = SEGMENT_ALIGN + (off_t) first * sizeof(SegmentIndexEntry);
+    return write_all(seg.fd, page.data, SEGMENT_ALIGN, offset) ? 0 : -1;
+}
+
+// Header, truncate to the frames and sync. Called without mtx_, once no
+// frame is being written to seg any more.
+void SegmentStore::seal(Segment &seg)
+{
+    AlignedBuffer page;
+    if (page.reserve(SEGMENT_ALIGN) && pread(seg.fd, page.data, SEGMENT_ALIGN, 0) == SEGMENT_ALIGN)
+    {
+        SegmentFileHeader *hdr = (SegmentFileHeader *) page.data;
+        hdr->flags |= SEGMENT_SEALED;
+        hdr->frames = 0;
+        for (uint32_t i = 0; i < seg.entries; i++)
+            hdr->frames += seg.index[i].size > 0;
+        hdr->data_end = seg.next;
+        if (!write_all(seg.fd, page.data, SEGMENT_ALIGN, 0))
+            fprintf(stderr, "Segment %u: cannot seal: %s\n", seg.sequence, strerror(errno));
+    }
+    if (ftruncate(seg.fd, seg.next) != 0 || fdatasync(seg.fd) != 0)
+        fprintf(stderr, "Segment %u: %s\n", seg.sequence, strerror(errno));
+    ::close(seg.fd);
+    seg.fd = -1;
+}
+
+int SegmentStore::add(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                      const FrameMeta &meta, bool thumbnail, const CodecOptions &options,
+                      EncodeResult *result)
+{
+    auto t0 = std::chrono::steady_clock::now();
+    size_t raw = (size_t) width * height;
+    bool lz4 = options.codec == StorageCodec::LZ4Raw;
+
+    // Per writer thread, sized for the first frame and then reused.
+    // Raw frames in an aligned ring slot are written straight from it,
+    // only the tail of the last block goes through staging.
+    static thread_local AlignedBuffer staging;
+    const unsigned char *direct = nullptr;
+    size_t direct_bytes = 0, size;
+    if (lz4)
+    {
+        size_t bound = lz4BlockBound(raw);
+        if (!staging.reserve(align_up(bound)))
+            return -1;
+        int n = compressLz4Block(buf, width, height, stride, options.level,
+                                 (char *) staging.data, bound);
+        if (n < 0)
+        {
+            fprintf(stderr, "Frame %ld: LZ4 compression failed.\n", meta.frame_id);
+            return -1;
+        }
+        size = n;
+    }
+    else if ((uint32_t) stride == width && (uintptr_t) buf % SEGMENT_ALIGN == 0)
+    {
+        direct = buf;
+        direct_bytes = raw / SEGMENT_ALIGN * SEGMENT_ALIGN;
+        if (!staging.reserve(SEGMENT_ALIGN))
+            return -1;
+        memcpy(staging.data, buf + direct_bytes, raw - direct_bytes);
+        size = raw;
+    }
+    else
+    {
+        if (!staging.reserve(align_up(raw)))
+            return -1;
+        for (uint32_t row = 0; row < height; row++)
+            memcpy(staging.data + (size_t) row * width, buf + (size_t) row * stride, width);
+        size = raw;
+    }
+    size_t staged = size - direct_bytes;
+    size_t padded = align_up(staged);
+    memset(staging.data + staged, 0, padded - staged);
+
+    // Hand out the space, starting the next segment if this one is full
+    std::shared_ptr<Segment> seg, full;
+    uint64_t offset;
+    uint32_t slot;
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        uint64_t need = direct_bytes + padded;
+        if (current_ && (current_->entries == index_capacity_
+                         || current_->next + need > current_->bytes))
+        {
+            current_->full = true;
+            if (current_->writing == 0)
+                full = current_;
+            current_ = nullptr;
+        }
+        if (!current_ && !exhausted_)
+            current_ = open_segment(need);
+        if (current_ && data_offset_ + need <= current_->bytes)
+        {
+            seg = current_;
+            offset = seg->next;
+            slot = seg->entries++;
+            seg->next += need;
+            seg->writing++;
+        }
+    }
+    if (full)
+        seal(*full);
+    if (!seg)
+        return -1;
+
+    bool ok = (direct_bytes == 0 || write_all(seg->fd, direct, direct_bytes, offset))
+              && write_all(seg->fd, staging.data, padded, offset + direct_bytes);
+    if (!ok)
+        fprintf(stderr, "Segment %u: frame %ld: %s\n", seg->sequence, meta.frame_id, strerror(errno));
+
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (ok)
+        {
+            SegmentIndexEntry &e = seg->index[slot];
+            e.frame_id = meta.frame_id;
+            e.timestamp_ns = meta.timestamp_ns;
+            e.offset = offset;
+            e.trigger_id = meta.trigger_id;
+            e.trigger_ns = meta.trigger_ns;
+            e.size = size;
+            e.width = width;
+            e.height = height;
+            e.camera_id = meta.camera_id;
+            e.flags = (meta.has_trigger ? SEGMENT_FRAME_HAS_TRIGGER : 0)
+                      | (lz4 ? SEGMENT_FRAME_LZ4 : 0) | (thumbnail ? SEGMENT_FRAME_THUMBNAIL : 0);
+            e.pressure = meta.pressure;
+            e.temperature = meta.temperature;
+            if (write_entry(*seg, slot) != 0)
+            {
+                fprintf(stderr, "Segment %u: index: %s\n", seg->sequence, strerror(errno));
+                ok = false;
+            }
+        }
+        seg->writing--;
+        if (seg->full && seg->writing == 0)
+            full = seg;
+    }
+    if (full)
+        seal(*full);
+
+    if (result)
+    {
+        result->encode_ms = std::chrono::duration<double, std::milli>(
+            std::chrono::steady_clock::now() - t0).count();
+        result->raw_bytes = raw;
+        result->stored_bytes = size;
+    }
+    return ok ? 0 : -1;
+}
+
+long long SegmentStore::unwritten_bytes()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return current_ ? (long long) (current_->bytes - current_->next) : 0;
+}
+
+bool SegmentStore::exhausted()
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    return exhausted_;
+}
+
+void SegmentStore::close()
+{
+    std::shared_ptr<Segment> full;
+    {
+        std::lock_guard<std::mutex> lck(mtx_);
+        if (!current_)
+            return;
+        current_->full = true;
+        if (current_->writing == 0)
+            full = current_;
+        current_ = nullptr;
+    }
+    if (full)
+        seal(*full);
+}
+
+
+int openSegment(const char *path, SegmentFileHeader *header, std::vector<SegmentIndexEntry> *index)
+{
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0)
+    {
+        fprintf(stderr, "%s: %s\n", path, strerror(errno));
+        return -1;
+    }
+    if (pread(fd, header, sizeof(*header), 0) != sizeof(*header) || memcmp(header->magic, "MSEG", 4) != 0
+        || header->version != SEGMENT_FILE_VERSION || header->entry_size != sizeof(SegmentIndexEntry))
+    {
+        fprintf(stderr, "%s: not a segment file\n", path);
+        close(fd);
+        return -1;
+    }
+    index->resize(header->index_capacity);
+    size_t bytes = (size_t) header->index_capacity * sizeof(SegmentIndexEntry);
+    if (pread(fd, index->data(), bytes, SEGMENT_ALIGN) != (ssize_t) bytes)
+    {
+        fprintf(stderr, "%s: short index\n", path);
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+int readSegmentFrame(int fd, const SegmentIndexEntry &entry, std::vector<unsigned char> *pixels)
+{
+    size_t raw = (size_t) entry.width * entry.height;
+    pixels->resize(raw);
+    if (!(entry.flags & SEGMENT_FRAME_LZ4))
+    {
+        if (entry.size != raw)
+            return -1;
+        return pread(fd, pixels->data(), raw, entry.offset) == (ssize_t) raw ? 0 : -1;
+    }
+    std::vector<char> block(entry.size);
+    if (pread(fd, block.data(), entry.size, entry.offset) != (ssize_t) entry.size)
+        return -1;
+    return decompressLz4Block(block.data(), entry.size, pixels->data(), raw);
+}
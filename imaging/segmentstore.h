@@ -0,0 +1,160 @@
+#ifndef __SEGMENTSTORE__
+#define __SEGMENTSTORE__
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "framecodec.h"
+
+/*
+* On-disk layout of a segment file, all in host byte order (little-endian
+* on the Pi):
+*
+*   SEGMENT_ALIGN bytes     SegmentFileHeader, zero padded
+*   index_capacity entries  SegmentIndexEntry, padded to SEGMENT_ALIGN
+*   data                    frames, each starting SEGMENT_ALIGN aligned
+*
+* An entry is written only after its frame, so every entry with a size
+* points at complete pixels, also in a segment that was never sealed.
+* Entries of frames that failed to write stay zero.
+*/
+#define SEGMENT_ALIGN 4096
+#define SEGMENT_FILE_VERSION 1
+#define SEGMENT_INDEX_CAPACITY 4096
+#define SEGMENT_BYTES (1024LL * 1024 * 1024)
+
+struct SegmentFileHeader
+{
+    char magic[4];              // "MSEG"
+    uint16_t version;           // SEGMENT_FILE_VERSION
+    uint16_t header_size;       // sizeof(SegmentFileHeader)
+    uint32_t entry_size;        // sizeof(SegmentIndexEntry)
+    uint32_t index_capacity;
+    uint64_t data_offset;
+    uint64_t segment_bytes;     // preallocated size
+    uint32_t sequence;          // n of seg<n>.mseg
+    uint32_t flags;             // SEGMENT_SEALED
+    // Valid once sealed: frames stored and end of the last one, the file
+    // is truncated there
+    uint32_t frames;
+    uint32_t reserved;
+    uint64_t data_end;
+};
+
+#define SEGMENT_SEALED 0x1
+
+struct SegmentIndexEntry
+{
+    int64_t frame_id;
+    int64_t timestamp_ns;       // CLOCK_MONOTONIC arrival time
+    int64_t offset;             // of the frame in the file
+    int64_t trigger_id;
+    int64_t trigger_ns;
+    uint32_t size;              // stored bytes, 0 for an unused entry
+    uint16_t width;
+    uint16_t height;
+    uint32_t camera_id;
+    uint32_t flags;             // SEGMENT_FRAME_*
+    float pressure;
+    float temperature;
+};
+
+#define SEGMENT_FRAME_HAS_TRIGGER 0x1
+#define SEGMENT_FRAME_LZ4 0x2           // one LZ4 block, else raw rows
+#define SEGMENT_FRAME_THUMBNAIL 0x4     // a blank frame, downsampled
+
+/*
+* Stores frames in large preallocated segment files instead of one file
+* per frame: dir/seg<n>.mseg, numbered on from the highest one already in
+* dir. All writes are SEGMENT_ALIGN aligned and go through O_DIRECT where
+* the filesystem has it, so frames bypass the page cache. A segment is
+* sealed, synced and truncated to its data once it is full, and the next
+* one is started. Safe to call from several writer threads: only the
+* space of a frame is handed out under the lock, the frames themselves
+* are written in parallel. When a whole segment no longer fits, the next
+* one takes what is free above reserve_bytes; once not even that holds a
+* frame, the store is exhausted and takes no more frames.
+*/
+class SegmentStore
+{
+    public:
+        SegmentStore(const std::string &dir, long long segment_bytes = SEGMENT_BYTES,
+                     uint32_t index_capacity = SEGMENT_INDEX_CAPACITY, long long reserve_bytes = 0);
+        ~SegmentStore();
+
+        SegmentStore(const SegmentStore&) = delete;
+        SegmentStore& operator= (const SegmentStore&) = delete;
+
+        /*
+        * Store one frame, raw or as LZ4 (codec None or LZ4Raw of
+        * options). thumbnail marks a downsampled blank frame. Returns 0
+        * or -1, result may be NULL.
+        */
+        int add(const unsigned char *buf, uint32_t width, uint32_t height, int stride,
+                const FrameMeta &meta, bool thumbnail, const CodecOptions &options,
+                EncodeResult *result);
+
+        /*
+        * Seal the current segment. Frames added afterwards start a new one.
+        */
+        void close();
+
+        /*
+        * Preallocated bytes of the current segment no frame is in yet.
+        * statfs counts them as used.
+        */
+        long long unwritten_bytes();
+        /*
+        * No room for another segment above the reserve, or segments
+        * cannot be allocated at all
+        */
+        bool exhausted();
+
+    private:
+        struct Segment
+        {
+            int fd = -1;
+            uint32_t sequence = 0;
+            uint64_t bytes = 0;         // preallocated
+            uint64_t next = 0;          // where the next frame goes
+            uint32_t entries = 0;       // index entries handed out
+            int writing = 0;            // frames handed out but not written yet
+            bool full = false;
+            // In memory copy of the index, its pages are rewritten as
+            // entries are filled in
+            std::vector<SegmentIndexEntry> index;
+        };
+
+        std::string dir_;
+        long long segment_bytes_;
+        uint32_t index_capacity_;
+        uint64_t data_offset_;
+        long long reserve_bytes_;
+
+        std::mutex mtx_;
+        std::shared_ptr<Segment> current_;
+        uint32_t next_sequence_;
+        bool exhausted_ = false;
+
+        std::shared_ptr<Segment> open_segment(uint64_t need);
+        int write_entry(Segment &seg, uint32_t slot);
+        void seal(Segment &seg);
+};
+
+/*
+* Read the header and index of a segment file, for the export tool.
+* Returns the open fd or -1.
+*/
+int openSegment(const char *path, SegmentFileHeader *header, std::vector<SegmentIndexEntry> *index);
+
+/*
+* Read and, if needed, decompress the pixels of one entry into pixels,
+* width * height compact rows. Returns 0 or -1.
+*/
+int readSegmentFrame(int fd, const SegmentIndexEntry &entry, std::vector<unsigned char> *pixels);
+
+#endif
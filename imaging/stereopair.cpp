@@ -0,0 +1,38 @@
+#include "stereopair.h"
+#include <stdio.h>
+
+StereoPairer::StereoPairer(int cameras, long long window_ns, long first_id)
+    : full_mask_((1u << cameras) - 1), window_ns_(window_ns), next_id_(first_id),
+      complete_(0), incomplete_(0)
+{
+}
+
+long StereoPairer::assign(int camera, long long t_ns)
+{
+    unsigned int bit = 1u << camera;
+    std::lock_guard<std::mutex> lck(mtx_);
+
+    long long dt = t_ns - group_t_ns_;
+    if (group_id_ >= 0 && !(group_mask_ & bit) && dt >= -window_ns_ && dt <= window_ns_)
+    {
+        group_mask_ |= bit;
+        if (group_mask_ == full_mask_)
+            complete_++;
+        return group_id_;
+    }
+
+    // Start a new group; the previous one is done waiting
+    if (group_id_ >= 0 && group_mask_ != full_mask_)
+    {
+        unsigned long n = ++incomplete_;
+        if (n == 1 || n % 100 == 0)
+            fprintf(stderr, "StereoPairer: frame %ld incomplete (mask %x, %lu so far)\n",
+                    group_id_, group_mask_, n);
+    }
+    group_id_ = next_id_++;
+    group_t_ns_ = t_ns;
+    group_mask_ = bit;
+    if (group_mask_ == full_mask_)
+        complete_++;
+    return group_id_;
+}
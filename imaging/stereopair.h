@@ -0,0 +1,50 @@
+#ifndef __STEREOPAIR__
+#define __STEREOPAIR__
+
+#include <mutex>
+#include <atomic>
+
+/*
+* Groups frames from the cameras of a stereo rig by arrival time. Frames
+* that arrive within window_ns of the first frame of a group get the same
+* stereo frame id, so both images of one trigger are stored under one id.
+* A group that is replaced before every camera delivered is counted as
+* incomplete, which shows dropped or missed triggers while still running.
+*
+* Pairing is by id only: the two frames of a pair are still queued and
+* written one by one, each in a ring slot of its own, not held as one
+* unit. Holding a slot until the other camera delivers would tie up the
+* ring exactly when a camera drops frames, and couple the writers to the
+* slower camera; under one id the pair still ends up side by side in the
+* file names and the segment index.
+*/
+class StereoPairer
+{
+    public:
+        // Stereo frame ids count up from first_id
+        StereoPairer(int cameras, long long window_ns, long first_id = 0);
+
+        /*
+        * Called from each camera's streaming thread with the arrival time
+        * in CLOCK_MONOTONIC nanoseconds. Returns the stereo frame id.
+        */
+        long assign(int camera, long long t_ns);
+
+        unsigned long complete() const { return complete_; }
+        unsigned long incomplete() const { return incomplete_; }
+
+    private:
+        unsigned int full_mask_;
+        long long window_ns_;
+
+        std::mutex mtx_;
+        long next_id_ = 0;
+        long group_id_ = -1;
+        long long group_t_ns_ = 0;
+        unsigned int group_mask_ = 0;
+
+        std::atomic<unsigned long> complete_;
+        std::atomic<unsigned long> incomplete_;
+};
+
+#endif
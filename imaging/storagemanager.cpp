@@ -0,0 +1,168 @@
+#include "storagemanager.h"
+#include "segmentstore.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/statvfs.h>
+
+// Weight of the newest interval in the write rate
+#define STORAGE_RATE_ALPHA 0.3
+
+static const StorageLevel levels[] = {
+    {"full", false, BlankPolicy::Keep, 1.0f, 1},
+    {"compressed", true, BlankPolicy::Keep, 1.0f, 1},
+    {"blank thumbnails", true, BlankPolicy::Thumbnail, 2.0f, 1},
+    {"blank dropped", true, BlankPolicy::Drop, 4.0f, 1},
+    {"half rate", true, BlankPolicy::Drop, 4.0f, 2},
+    {"quarter rate", true, BlankPolicy::Drop, 4.0f, 4},
+    {"stats only", true, BlankPolicy::Drop, 4.0f, 0},
+};
+
+int storageLevels()
+{
+    return sizeof(levels) / sizeof(levels[0]);
+}
+
+const StorageLevel &storageLevel(int level)
+{
+    return levels[level];
+}
+
+// Keep < Thumbnail < Drop
+static int strictness(BlankPolicy policy)
+{
+    return policy == BlankPolicy::Keep ? 0 : policy == BlankPolicy::Thumbnail ? 1 : 2;
+}
+
+void applyStorageLevel(int level, bool segments, const CodecOptions &codec, const ContentFilter &filter,
+                       CodecOptions *out_codec, ContentFilter *out_filter)
+{
+    const StorageLevel &l = levels[level];
+    *out_codec = codec;
+    *out_filter = filter;
+    if (l.compress && codec.codec != StorageCodec::LZ4Raw && codec.codec != StorageCodec::Deflate)
+    {
+        // Raw segments become LZ4 where built with it and stay raw
+        // otherwise, TIFFs Deflate
+        if (segments && storageCodecAvailable(StorageCodec::LZ4Raw))
+            out_codec->codec = StorageCodec::LZ4Raw;
+        else if (!segments)
+            out_codec->codec = StorageCodec::Deflate;
+        out_codec->level = 0;
+    }
+    if (strictness(l.blank_policy) > strictness(filter.policy))
+        out_filter->policy = l.blank_policy;
+    out_filter->min_content = filter.min_content * l.content_scale;
+}
+
+StorageManager::StorageManager(const std::string &path, const StorageConfig &config, long long start_ns,
+                               SegmentStore *segments)
+    : path_(path), config_(config), start_ns_(start_ns), interval_ns_(config.interval_ms * 1000000LL),
+      segments_(segments), can_compress_(!segments || storageCodecAvailable(StorageCodec::LZ4Raw)),
+      level_(0), bytes_(0), last_check_ns_(start_ns), free_bytes_(-1), rate_(0), projected_s_(-1)
+{
+}
+
+bool StorageManager::same_as_previous(int level) const
+{
+    // Without a compressor a level that only adds compression stores the
+    // same as the one before it
+    const StorageLevel &l = levels[level], &prev = levels[level - 1];
+    return !can_compress_ && l.compress != prev.compress && l.blank_policy == prev.blank_policy &&
+           l.content_scale == prev.content_scale && l.keep_every == prev.keep_every;
+}
+
+int StorageManager::step_down(int level) const
+{
+    int next = level + 1;
+    while (next + 1 < storageLevels() && same_as_previous(next))
+        next++;
+    return next;
+}
+
+int StorageManager::step_up(int level) const
+{
+    int next = level - 1;
+    while (next > 0 && same_as_previous(next))
+        next--;
+    return next;
+}
+
+bool StorageManager::keep(long frame_id) const
+{
+    int every = levels[level_].keep_every;
+    return every > 0 && frame_id % every == 0;
+}
+
+void StorageManager::record(size_t bytes, long long now_ns)
+{
+    bytes_ += bytes;
+    // One writer thread wins the check of this interval, the rest go on
+    long long last = last_check_ns_.load();
+    if (now_ns - last >= interval_ns_ && last_check_ns_.compare_exchange_strong(last, now_ns))
+        check(now_ns, now_ns - last);
+}
+
+void StorageManager::check(long long now_ns, long long elapsed_ns)
+{
+    std::lock_guard<std::mutex> lck(mtx_);
+    struct statvfs st;
+    if (statvfs(path_.c_str(), &st) != 0)
+    {
+        fprintf(stderr, "%s: %s\n", path_.c_str(), strerror(errno));
+        return;
+    }
+    long long avail = (long long) st.f_bavail * st.f_frsize - config_.reserve_bytes;
+    if (segments_)
+    {
+        // The open segment is allocated in full up front, its tail is still
+        // free for frames. Once no segment fits there is no space at all.
+        if (segments_->exhausted())
+            avail = 0;
+        else
+            avail += segments_->unwritten_bytes();
+    }
+    if (avail < 0)
+        avail = 0;
+    free_bytes_ = avail;
+
+    unsigned long long total = bytes_;
+    double interval_rate = (total - checked_bytes_) / (elapsed_ns / 1e9);
+    checked_bytes_ = total;
+    double rate = rate_ > 0 ? STORAGE_RATE_ALPHA * interval_rate + (1 - STORAGE_RATE_ALPHA) * rate_
+                            : interval_rate;
+    rate_ = rate;
+    projected_s_ = rate > 0 ? avail / rate : -1;
+
+    int level = level_;
+    int next = level;
+    since_change_++;
+    if (avail == 0)
+    {
+        // Out of space whatever the mission: stop before the reserve goes
+        next = storageLevels() - 1;
+    }
+    else if (config_.mission_s > 0)
+    {
+        if (since_change_ <= config_.settle_checks)
+            return;
+        double remaining = config_.mission_s - (now_ns - start_ns_) / 1e9;
+        if (remaining > 0 && rate > 0 && avail / rate < remaining * config_.margin)
+            next = level + 1 < storageLevels() ? step_down(level) : level;
+        else if (level > 0 && (rate == 0 || avail / rate > remaining * config_.margin_up))
+            next = step_up(level);
+    }
+    else if (level > 0)
+    {
+        // Only monitoring, and above the reserve again
+        next = 0;
+    }
+    if (next != level)
+    {
+        level_ = next;
+        since_change_ = 0;
+        printf("Storage: %.0f MB free, %.2f MB/s, %.0f min left: %s\n", avail / 1048576.0,
+               rate / 1048576.0, rate > 0 ? avail / rate / 60 : -1.0, levels[next].name);
+    }
+}
@@ -0,0 +1,116 @@
+#ifndef __STORAGEMANAGER__
+#define __STORAGEMANAGER__
+
+#include <string>
+#include <mutex>
+#include <atomic>
+
+#include "framecodec.h"
+#include "framestats.h"
+
+class SegmentStore;
+
+/*
+* Free space and write rate targets. Without a planned mission duration
+* the manager only reports; with one it steps storage down whenever the
+* free space would run out before the end of the mission.
+*/
+struct StorageConfig
+{
+    // From the start of capture, 0 to only monitor
+    double mission_s = 0;
+    // Never written into, keeps the filesystem and the logs alive
+    long long reserve_bytes = 256LL * 1024 * 1024;
+    int interval_ms = 10000;
+    // Step down below margin times the remaining mission, back up once
+    // there is margin_up times more than needed
+    double margin = 1.1;
+    double margin_up = 2.5;
+    // Checks to wait after a change, so the write rate reflects it
+    int settle_checks = 3;
+};
+
+/*
+* What is stored at one storage level. Level 0 stores everything as
+* configured, each level after it roughly halves the bytes written.
+*/
+struct StorageLevel
+{
+    const char *name;
+    bool compress;              // Deflate TIFFs, LZ4 segments
+    BlankPolicy blank_policy;   // at least this strict
+    float content_scale;        // times ContentFilter::min_content
+    int keep_every;             // store every n'th frame id, 0 stores none
+};
+
+int storageLevels();
+const StorageLevel &storageLevel(int level);
+
+/*
+* The codec and blank filter a level turns the configured ones into.
+* segments: frames go to a SegmentStore, which only has raw and LZ4, so
+* without LZ4 in the build compressed levels leave them raw.
+*/
+void applyStorageLevel(int level, bool segments, const CodecOptions &codec, const ContentFilter &filter,
+                       CodecOptions *out_codec, ContentFilter *out_filter);
+
+/*
+* Tracks the bytes stored and the free space of the data filesystem and
+* projects how long capture can go on at the current rate. Every
+* interval_ms the projection is compared against the rest of the mission
+* and the level is stepped down or up one at a time, past levels that
+* would store the same with the codecs at hand. Frames going to segments
+* are given the store, whose preallocated tail counts as free and which
+* is out of space once it cannot open another segment. Safe to call from
+* several writer threads.
+*/
+class StorageManager
+{
+    public:
+        StorageManager(const std::string &path, const StorageConfig &config, long long start_ns,
+                       SegmentStore *segments = nullptr);
+
+        /*
+        * Count bytes stored at now_ns (CLOCK_MONOTONIC) and run the
+        * check when it is due
+        */
+        void record(size_t bytes, long long now_ns);
+
+        int level() const { return level_; }
+        /*
+        * Whether frame_id is stored at the current level
+        */
+        bool keep(long frame_id) const;
+
+        // From the last check: free bytes above the reserve, bytes/s and
+        // seconds left at that rate (-1 while unknown)
+        long long free_bytes() const { return free_bytes_; }
+        double rate() const { return rate_; }
+        double projected_s() const { return projected_s_; }
+
+    private:
+        std::string path_;
+        StorageConfig config_;
+        long long start_ns_;
+        long long interval_ns_;
+        SegmentStore *segments_;
+        bool can_compress_;
+
+        std::atomic<int> level_;
+        std::atomic<unsigned long long> bytes_;
+        std::atomic<long long> last_check_ns_;
+
+        std::mutex mtx_;
+        unsigned long long checked_bytes_ = 0;
+        int since_change_ = 0;
+        std::atomic<long long> free_bytes_;
+        std::atomic<double> rate_;
+        std::atomic<double> projected_s_;
+
+        void check(long long now_ns, long long elapsed_ns);
+        bool same_as_previous(int level) const;
+        int step_down(int level) const;
+        int step_up(int level) const;
+};
+
+#endif
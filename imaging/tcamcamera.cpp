@@ -2,6 +2,9 @@
 
 #include "tcamcamera.h"
 #include "tcamprop.h"
+#include "rtthreads.h"
+
+#include <gst/video/video.h>
 
 #include <vector>
 #include <string>
@@ -258,6 +261,143 @@ BooleanProperty::set(TcamCamera &cam, int value)
     return ret;
 }
 
+PropertyBatch::Setting &
+PropertyBatch::slot(const std::string &name)
+{
+    for (Setting &setting : settings_)
+        if (setting.name == name)
+            return setting;
+    settings_.push_back(Setting());
+    settings_.back().name = name;
+    return settings_.back();
+}
+
+void
+PropertyBatch::set(const std::string &name, int value)
+{
+    Setting &setting = slot(name);
+    setting.kind = Kind::Int;
+    setting.i = value;
+}
+
+void
+PropertyBatch::set(const std::string &name, double value)
+{
+    Setting &setting = slot(name);
+    setting.kind = Kind::Double;
+    setting.d = value;
+}
+
+void
+PropertyBatch::set(const std::string &name, const std::string &value)
+{
+    Setting &setting = slot(name);
+    setting.kind = Kind::String;
+    setting.s = value;
+}
+
+void
+PropertyBatch::merge(const PropertyBatch &other)
+{
+    for (const Setting &setting : other.settings_)
+        slot(setting.name) = setting;
+}
+
+FrameHandle::FrameHandle()
+{
+    info_.data = nullptr;
+    info_.size = 0;
+}
+
+FrameHandle::FrameHandle(GstSample *sample, guint64 frame_number)
+    : frame_number_(frame_number)
+{
+    info_.data = nullptr;
+    info_.size = 0;
+    if (!sample)
+        return;
+
+    buffer_ = gst_sample_get_buffer(sample);
+    if (!buffer_ || !gst_buffer_map(buffer_, &info_, GST_MAP_READ))
+    {
+        info_.data = nullptr;
+        info_.size = 0;
+        buffer_ = nullptr;
+        gst_sample_unref(sample);
+        return;
+    }
+    sample_ = sample;
+    timestamp_ = GST_BUFFER_PTS(buffer_);
+
+    GstVideoInfo vinfo;
+    GstCaps *caps = gst_sample_get_caps(sample_);
+    if (caps && gst_video_info_from_caps(&vinfo, caps))
+    {
+        width_ = GST_VIDEO_INFO_WIDTH(&vinfo);
+        height_ = GST_VIDEO_INFO_HEIGHT(&vinfo);
+        stride_ = GST_VIDEO_INFO_PLANE_STRIDE(&vinfo, 0);
+        const char *fmt = gst_structure_get_string(gst_caps_get_structure(caps, 0), "format");
+        if (fmt)
+            format_ = fmt;
+    }
+}
+
+FrameHandle::~FrameHandle()
+{
+    release();
+}
+
+FrameHandle::FrameHandle(FrameHandle &&other)
+{
+    info_.data = nullptr;
+    info_.size = 0;
+    take(other);
+}
+
+FrameHandle&
+FrameHandle::operator= (FrameHandle &&other)
+{
+    if (this != &other)
+    {
+        release();
+        take(other);
+    }
+    return *this;
+}
+
+void
+FrameHandle::take(FrameHandle &other)
+{
+    // GstMapInfo is a plain struct, so the mapping travels with the buffer
+    sample_ = other.sample_;
+    buffer_ = other.buffer_;
+    info_ = other.info_;
+    width_ = other.width_;
+    height_ = other.height_;
+    stride_ = other.stride_;
+    format_ = std::move(other.format_);
+    timestamp_ = other.timestamp_;
+    frame_number_ = other.frame_number_;
+
+    other.sample_ = nullptr;
+    other.buffer_ = nullptr;
+    other.info_.data = nullptr;
+    other.info_.size = 0;
+}
+
+void
+FrameHandle::release()
+{
+    if (!sample_)
+        return;
+    gst_buffer_unmap(buffer_, &info_);
+    gst_sample_unref(sample_);
+    sample_ = nullptr;
+    buffer_ = nullptr;
+    info_.data = nullptr;
+    info_.size = 0;
+}
+
 TcamCamera::TcamCamera(std::string serial = "")
 {
     gst_init(NULL, NULL);
@@ -278,6 +418,7 @@ TcamCamera::TcamCamera(std::string serial = "")
 
 TcamCamera::~TcamCamera()
 {
+    stop_applier();
     g_print("pipeline refcount at cleanup: %d\n", GST_OBJECT_REFCOUNT_VALUE(pipeline_));
     gst_object_unref(pipeline_);
 }
@@ -403,8 +544,8 @@ TcamCamera::initialize_format_list()
                 assert(min && max);
                 fmt.framerate_min.numerator = gst_value_get_fraction_numerator(min);
                 fmt.framerate_min.denominator = gst_value_get_fraction_denominator(min);
-                fmt.framerate_min.numerator = gst_value_get_fraction_numerator(min);
-                fmt.framerate_min.denominator = gst_value_get_fraction_denominator(min);
+                fmt.framerate_max.numerator = gst_value_get_fraction_numerator(max);
+                fmt.framerate_max.denominator = gst_value_get_fraction_denominator(max);
             }
             else
             {
@@ -535,6 +676,106 @@ TcamCamera::get_camera_property_list()
     return pptylist;
 }
 
+std::shared_ptr<Property>
+TcamCamera::find_property(const std::string &name)
+{
+    std::lock_guard<std::mutex> lck(registry_mtx_);
+    auto it = registry_.find(name);
+    if (it != registry_.end())
+        return it->second;
+    std::shared_ptr<Property> prop;
+    try
+    {
+        prop = get_property(name);
+    }
+    catch (std::exception &)
+    {
+        // Remembered as missing too, so it is not asked for again
+    }
+    registry_[name] = prop;
+    return prop;
+}
+
+int
+TcamCamera::apply_properties(const PropertyBatch &batch)
+{
+    int failed = 0;
+    for (const PropertyBatch::Setting &setting : batch.settings_)
+    {
+        std::shared_ptr<Property> prop = find_property(setting.name);
+        bool ok = false;
+        if (prop)
+        {
+            switch (setting.kind)
+            {
+                case PropertyBatch::Kind::Int:
+                    ok = prop->set(*this, setting.i);
+                    break;
+                case PropertyBatch::Kind::Double:
+                    ok = prop->set(*this, setting.d);
+                    break;
+                case PropertyBatch::Kind::String:
+                    ok = prop->set(*this, setting.s);
+                    break;
+            }
+        }
+        if (ok)
+        {
+            properties_applied_++;
+        }
+        else
+        {
+            properties_failed_++;
+            failed++;
+            std::cerr << "Setting property '" << setting.name << "' failed" << std::endl;
+        }
+    }
+    return failed;
+}
+
+void
+TcamCamera::queue_properties(const PropertyBatch &batch)
+{
+    std::lock_guard<std::mutex> lck(queue_mtx_);
+    queued_.merge(batch);
+    // Wait for a frame that arrives after this call
+    frame_boundary_ = false;
+    queue_pending_ = !queued_.empty();
+}
+
+void
+TcamCamera::applier_loop()
+{
+    setThreadRole(ThreadRole::Background);
+    std::unique_lock<std::mutex> lck(queue_mtx_);
+    while (true)
+    {
+        queue_cv_.wait(lck, [this] { return !applier_running_ || (frame_boundary_ && !queued_.empty()); });
+        if (!applier_running_)
+            return;
+        PropertyBatch batch;
+        std::swap(batch, queued_);
+        queue_pending_ = false;
+        frame_boundary_ = false;
+        lck.unlock();
+        apply_properties(batch);
+        lck.lock();
+    }
+}
+
+void
+TcamCamera::stop_applier()
+{
+    {
+        std::lock_guard<std::mutex> lck(queue_mtx_);
+        if (!applier_running_)
+            return;
+        applier_running_ = false;
+    }
+    queue_cv_.notify_one();
+    applier_.join();
+}
+
 bool
 TcamCamera::set_property(std::string name, GValue &value)
 {
@@ -561,9 +802,139 @@ TcamCamera::set_capture_format(std::string format, FrameSize size, FrameRate fra
     gst_caps_unref(caps);
 }
 
+const char *
+gsttcam::readout_name(Readout readout)
+{
+    switch (readout)
+    {
+        case Readout::Full:
+            return "full";
+        case Readout::Roi:
+            return "roi";
+        case Readout::Binning:
+            return "binning";
+        case Readout::Skipping:
+            return "skipping";
+    }
+    return "unknown";
+}
+
+// a < b for framerates
+static bool
+slower(const FrameRate &a, const FrameRate &b)
+{
+    return (long long) a.numerator * b.denominator < (long long) b.numerator * a.denominator;
+}
+
+bool
+TcamCamera::resolve_capture_mode(CaptureMode &mode, FrameSize full_size)
+{
+    if (mode.readout == Readout::Full)
+        mode.size = full_size;
+    else if (mode.readout != Readout::Roi)
+        mode.size = FrameSize{full_size.width / mode.factor, full_size.height / mode.factor};
+    if (mode.size.width <= 0 || mode.size.height <= 0)
+        return false;
+
+    // The fastest rate up to the one asked for, or the slowest there is
+    // if they are all faster
+    bool allowed = false, found = false;
+    FrameRate fastest = {0, 1}, slowest = {0, 1};
+    for (const VideoFormatCaps &caps : videocaps_)
+    {
+        bool has_format = false;
+        for (const std::string &f : caps.formats)
+            has_format |= f == mode.format;
+        bool fits = caps.size.width > 0 ?
+            caps.size.width == mode.size.width && caps.size.height == mode.size.height :
+            mode.size.width >= caps.size_min.width && mode.size.width <= caps.size_max.width &&
+            mode.size.height >= caps.size_min.height && mode.size.height <= caps.size_max.height;
+        if (!has_format || !fits)
+            continue;
+
+        std::vector<FrameRate> rates = caps.framerates;
+        if (rates.empty())
+        {
+            // A range: the rate asked for itself if it is inside
+            rates.push_back(caps.framerate_min);
+            rates.push_back(caps.framerate_max);
+            if (mode.framerate.numerator > 0 && !slower(mode.framerate, caps.framerate_min) &&
+                !slower(caps.framerate_max, mode.framerate))
+                rates.push_back(mode.framerate);
+        }
+        for (const FrameRate &r : rates)
+        {
+            if (r.numerator <= 0 || r.denominator <= 0)
+                continue;
+            if (!found || slower(r, slowest))
+                slowest = r;
+            found = true;
+            if ((mode.framerate.numerator <= 0 || !slower(mode.framerate, r)) &&
+                (!allowed || slower(fastest, r)))
+            {
+                fastest = r;
+                allowed = true;
+            }
+        }
+    }
+    if (found)
+        mode.framerate = allowed ? fastest : slowest;
+    return found;
+}
+
+bool
+TcamCamera::set_capture_mode(const CaptureMode &mode)
+{
+    // Not every model has all of these; a mode only fails for the ones it
+    // needs
+    int factor = mode.readout == Readout::Binning || mode.readout == Readout::Skipping ? mode.factor : 1;
+    bool ok = true;
+    PropertyBatch batch;
+    const char *binning[] = {"Binning Horizontal", "Binning Vertical"};
+    const char *skipping[] = {"Skipping Horizontal", "Skipping Vertical"};
+    for (int i = 0; i < 2; i++)
+    {
+        if (find_property(binning[i]))
+            batch.set(binning[i], mode.readout == Readout::Binning ? factor : 1);
+        else if (mode.readout == Readout::Binning)
+            ok = false;
+        if (find_property(skipping[i]))
+            batch.set(skipping[i], mode.readout == Readout::Skipping ? factor : 1);
+        else if (mode.readout == Readout::Skipping)
+            ok = false;
+    }
+    bool centered = mode.readout != Readout::Roi || mode.offset.width < 0 || mode.offset.height < 0;
+    if (find_property("Offset Auto Center"))
+        batch.set("Offset Auto Center", centered ? 1 : 0);
+    else if (mode.readout == Readout::Roi && centered)
+        ok = false;
+    if (!centered)
+    {
+        if (find_property("Offset X") && find_property("Offset Y"))
+        {
+            batch.set("Offset X", mode.offset.width);
+            batch.set("Offset Y", mode.offset.height);
+        }
+        else
+            ok = false;
+    }
+    if (apply_properties(batch) != 0)
+        ok = false;
+    set_capture_format(mode.format, mode.size, mode.framerate);
+    return ok;
+}
+
 bool
 TcamCamera::start()
 {
+    {
+        std::lock_guard<std::mutex> lck(queue_mtx_);
+        if (!applier_running_)
+        {
+            applier_running_ = true;
+            applier_ = std::thread(&TcamCamera::applier_loop, this);
+        }
+    }
     gst_element_set_state(pipeline_, GST_STATE_PLAYING);
     gst_element_get_state(pipeline_, NULL, NULL, GST_CLOCK_TIME_NONE);
     GST_DEBUG_BIN_TO_DOT_FILE(GST_BIN(pipeline_),
@@ -576,6 +947,7 @@ TcamCamera::stop()
 {
     gst_element_set_state(pipeline_, GST_STATE_NULL);
     gst_element_get_state(pipeline_, NULL, NULL, GST_CLOCK_TIME_NONE);
+    stop_applier();
     return TRUE;
 }
 
@@ -583,6 +955,17 @@ GstFlowReturn
 TcamCamera::new_frame_callback(GstAppSink *appsink, gpointer data)
 {
     TcamCamera *this_ = static_cast<TcamCamera *>(data);
+    this_->frame_count_++;
+    // Frame boundary: hand a queued batch to the applier thread. Only
+    // costs a lock when something is queued.
+    if (this_->queue_pending_.load(std::memory_order_relaxed))
+    {
+        {
+            std::lock_guard<std::mutex> lck(this_->queue_mtx_);
+            this_->frame_boundary_ = true;
+        }
+        this_->queue_cv_.notify_one();
+    }
     if (this_->callback_)
     {
         return this_->callback_(appsink, this_->callback_data_);
@@ -600,6 +983,12 @@ TcamCamera::set_new_frame_callback(std::function<GstFlowReturn(GstAppSink *appsi
     gst_app_sink_set_callbacks(GST_APP_SINK(capturesink_), &callbacks, this, nullptr);
 }
 
+FrameHandle
+TcamCamera::pull_frame(GstAppSink *appsink)
+{
+    return FrameHandle(gst_app_sink_pull_sample(appsink), frame_count_ - 1);
+}
+
 GstElement *
 TcamCamera::get_pipeline()
 {
@@ -5,6 +5,11 @@
 #include <string>
 #include <memory>
 #include <functional>
+#include <map>
+#include <mutex>
+#include <thread>
+#include <condition_variable>
+#include <atomic>
 
 #include <gst/gst.h>
 #include <gst/app/gstappsink.h>
@@ -45,6 +50,32 @@ struct FrameSize
     int height;
 };
 
+/*
+* How the sensor is read out for a frame
+*/
+enum class Readout
+{
+    Full,
+    Roi,        // a window of the sensor at full resolution
+    Binning,    // factor x factor pixels summed into one
+    Skipping    // every factor-th row and column
+};
+
+const char *readout_name(Readout readout);
+
+/*
+* A capture format together with the readout that produces it
+*/
+struct CaptureMode
+{
+    std::string format = "GRAY8";
+    Readout readout = Readout::Full;
+    int factor = 1;                     // of binning or skipping
+    FrameSize size = {0, 0};            // of a frame; set by resolve_capture_mode() unless a ROI
+    FrameSize offset = {-1, -1};        // of a ROI on the sensor, -1 to center it
+    FrameRate framerate = {0, 1};       // at most, 0 for the fastest the format allows
+};
+
 /*
 *
 */
@@ -150,6 +181,103 @@ private:
     virtual bool get(TcamCamera &cam, int &value) override;
 };
 
+/*
+* Values for several camera properties, to be applied together with
+* TcamCamera::apply_properties() or queue_properties(). Settings are
+* applied in the order they were first set; setting a property again
+* replaces its value.
+*/
+class PropertyBatch
+{
+public:
+    void set(const std::string &name, int value);
+    void set(const std::string &name, double value);
+    void set(const std::string &name, const std::string &value);
+    /*
+    * Add other's settings, its values win
+    */
+    void merge(const PropertyBatch &other);
+    bool empty() const { return settings_.empty(); }
+    void clear() { settings_.clear(); }
+
+private:
+    friend class TcamCamera;
+    enum class Kind { Int, Double, String };
+    struct Setting
+    {
+        std::string name;
+        Kind kind;
+        int i;
+        double d;
+        std::string s;
+    };
+    std::vector<Setting> settings_;
+
+    Setting &slot(const std::string &name);
+};
+
+/*
+* Reference to a frame delivered by the capture appsink. The GstSample is
+* kept alive and its buffer stays mapped until release() is called or the
+* handle is destroyed, so consumers read pixels straight from GStreamer's
+* memory instead of a copy. Handles are move-only.
+*
+* Every held handle pins one buffer of the source's pool; keep the number
+* of outstanding handles below the pool size or the camera will stall.
+*/
+class FrameHandle
+{
+public:
+    FrameHandle();
+    /*
+    * Takes over the caller's reference on sample
+    */
+    FrameHandle(GstSample *sample, guint64 frame_number);
+    ~FrameHandle();
+
+    FrameHandle(const FrameHandle&) = delete;
+    FrameHandle& operator= (const FrameHandle&) = delete;
+    FrameHandle(FrameHandle &&other);
+    FrameHandle& operator= (FrameHandle &&other);
+
+    bool valid() const { return sample_ != nullptr; }
+    const unsigned char *data() const { return info_.data; }
+    size_t size() const { return info_.size; }
+    int width() const { return width_; }
+    int height() const { return height_; }
+    /*
+    * Distance in bytes between the starts of two rows
+    */
+    int stride() const { return stride_; }
+    const std::string &format() const { return format_; }
+    /*
+    * Buffer presentation timestamp in nanoseconds, GST_CLOCK_TIME_NONE if unset
+    */
+    GstClockTime timestamp() const { return timestamp_; }
+    /*
+    * Number of the frame since the pipeline was created, counting every
+    * sample the appsink announced
+    */
+    guint64 frame_number() const { return frame_number_; }
+    /*
+    * Unmap the buffer and drop the sample reference
+    */
+    void release();
+
+private:
+    GstSample *sample_ = nullptr;
+    GstBuffer *buffer_ = nullptr;
+    GstMapInfo info_;
+    int width_ = 0;
+    int height_ = 0;
+    int stride_ = 0;
+    std::string format_;
+    GstClockTime timestamp_ = GST_CLOCK_TIME_NONE;
+    guint64 frame_number_ = 0;
+
+    void take(FrameHandle &other);
+};
+
 class TcamCamera
 {
     public:
@@ -193,15 +321,55 @@ class TcamCamera
 
         bool set_property(std::string name, GValue &val);
         /*
+        * Property handle from a registry filled on first use, so each name
+        * walks the tcam property tree only once. The value fields are those
+        * of that first query, call get() for current ones. NULL if the
+        * camera has no such property.
+        */
+        std::shared_ptr<Property> find_property(const std::string &name);
+        /*
+        * Apply a batch right away, in order. Returns the number of
+        * settings that failed.
+        */
+        int apply_properties(const PropertyBatch &batch);
+        /*
+        * Apply a batch at the next frame boundary: a background thread
+        * sets it right after the next frame arrived, so the new values
+        * take effect for the following exposure and the streaming thread
+        * never waits for the device. Batches queued before that merge,
+        * later values winning. Only applied while the camera is started.
+        */
+        void queue_properties(const PropertyBatch &batch);
+        unsigned long properties_applied() const { return properties_applied_; }
+        unsigned long properties_failed() const { return properties_failed_; }
+        /*
         * Set the video format for capturing
         */
         void set_capture_format(std::string format, FrameSize size, FrameRate framerate);
         /*
+        * Complete mode from the format list: the frame size binning or
+        * skipping make of full_size, and the fastest framerate the device
+        * offers at that size up to the one asked for. False if it has no
+        * such format.
+        */
+        bool resolve_capture_mode(CaptureMode &mode, FrameSize full_size);
+        /*
+        * Set the readout properties of a resolved mode, then its capture
+        * format. Only while stopped. False if the camera lacks a readout
+        * property the mode needs; the format is set regardless.
+        */
+        bool set_capture_mode(const CaptureMode &mode);
+        /*
         * Set a callback to be called for each new frame
         */
         void set_new_frame_callback(std::function<GstFlowReturn(GstAppSink *appsink, gpointer data)>callback,
                                     gpointer data);;
         /*
+        * Pull the pending sample from the appsink as a zero-copy frame handle.
+        * Only valid from inside the new frame callback.
+        */
+        FrameHandle pull_frame(GstAppSink *appsink);
+        /*
         * Start capturing video data
         */
         bool start();
@@ -234,8 +402,25 @@ class TcamCamera
         std::function<GstFlowReturn(GstAppSink *appsink, gpointer data)>callback_;
         gpointer callback_data_ = nullptr;
         guintptr window_handle_ = 0;
+        guint64 frame_count_ = 0;
+
+        std::mutex registry_mtx_;
+        std::map<std::string, std::shared_ptr<Property>> registry_;
+
+        // Queued batch and the thread applying it at frame boundaries
+        std::mutex queue_mtx_;
+        std::condition_variable queue_cv_;
+        PropertyBatch queued_;
+        std::atomic<bool> queue_pending_{false};
+        bool frame_boundary_ = false;
+        bool applier_running_ = false;
+        std::thread applier_;
+        std::atomic<unsigned long> properties_applied_{0};
+        std::atomic<unsigned long> properties_failed_{0};
 
         static GstFlowReturn new_frame_callback(GstAppSink *appsink, gpointer data);
+        void applier_loop();
+        void stop_applier();
         void ensure_ready_state();
         void create_pipeline();
         std::vector<VideoFormatCaps> initialize_format_list();
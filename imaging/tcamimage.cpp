@@ -2,6 +2,7 @@
 #include <unistd.h>
 #include <chrono>
 #include <cstring>
+#include <stdexcept>
 
 using namespace std;
 using namespace gsttcam;
@@ -10,6 +11,8 @@ TcamImage::TcamImage(std::string serial) : TcamCamera(serial)
 {
     _CustomData.ImageCounter = 0;
     _CustomData.SaveNextImage = false;
+    _CustomData.KeepHandle = false;
+    _CustomData.camera = this;
     _CustomData.bpp = 4;
     _CustomData.width = 0;
     _CustomData.height = 0;
@@ -18,13 +21,23 @@ TcamImage::TcamImage(std::string serial) : TcamCamera(serial)
 
 TcamImage::~TcamImage()
 {
-    if(_CustomData.image_data != NULL)
-    {
-        delete _CustomData.image_data;
-    }
+    _pool.release(_CustomData.image_data);
+    _CustomData.image_data = NULL;
 }
 
 void TcamImage::set_capture_format(std::string format, FrameSize size, FrameRate framerate)
+{
+    size_pool(format, size);
+    TcamCamera::set_capture_format(format, size, framerate);
+}
+
+bool TcamImage::set_capture_mode(const CaptureMode &mode)
+{
+    size_pool(mode.format, mode.size);
+    return TcamCamera::set_capture_mode(mode);
+}
+
+void TcamImage::size_pool(const std::string &format, FrameSize size)
 {
     // Allocate memory for one image buffer.
     if( format == "GRAY8")
@@ -36,19 +49,27 @@ void TcamImage::set_capture_format(std::string format, FrameSize size, FrameRate
     _CustomData.height = size.height;
     //_CustomData.image_data.resize( size.width * size.width * _CustomData.bpp );
 
-    TcamCamera::set_capture_format(format, size, framerate);
+    // Size the frame memory now so start() never allocates
+    _pool.release(_CustomData.image_data);
+    _CustomData.image_data = NULL;
+    if (!_pool.allocate(getImageDataSize(), 1, _lockMemory))
+        throw std::runtime_error("Could not allocate frame memory");
 }
 
 bool TcamImage::start()
 {
     // Register a callback to be called for each new frame
     set_new_frame_callback(new_frame_cb, &_CustomData);
-    if(_CustomData.image_data != NULL)
+    if(_CustomData.image_data == NULL)
     {
-        delete _CustomData.image_data;
+        _CustomData.image_data = _pool.acquire();
     }
-    _CustomData.image_data = new unsigned char[getImageDataSize()] ;
-    TcamCamera::start();
+    if(_CustomData.image_data == NULL)
+    {
+        // set_capture_format() was never called
+        return false;
+    }
+    return TcamCamera::start();
 }
 
 bool TcamImage::snapImage(int timeout_ms)
@@ -61,6 +82,19 @@ bool TcamImage::snapImage(int timeout_ms)
     return false;
 }
 
+FrameHandle TcamImage::snapFrame(int timeout_ms)
+{
+    std::unique_lock<std::mutex> lck(_CustomData.mtx);
+    _CustomData.frame.release();
+    _CustomData.KeepHandle = true;
+    _CustomData.SaveNextImage = true;
+    _CustomData.con.wait_for(lck, std::chrono::milliseconds(timeout_ms),
+                             [this]{ return _CustomData.frame.valid(); });
+    _CustomData.KeepHandle = false;
+    _CustomData.SaveNextImage = false;
+    return std::move(_CustomData.frame);
+}
+
 ////////////////////////////////////////////////////////////////////
 // Callback called for new images by the internal appsink
 GstFlowReturn TcamImage::new_frame_cb(GstAppSink *appsink, gpointer data)
@@ -74,6 +108,14 @@ GstFlowReturn TcamImage::new_frame_cb(GstAppSink *appsink, gpointer data)
     pCustomData->SaveNextImage = false;
     pCustomData->ImageCounter++;
 
+    if (pCustomData->KeepHandle)
+    {
+        // Zero-copy: keep a reference to the sample for snapFrame()
+        pCustomData->frame = pCustomData->camera->pull_frame(appsink);
+        pCustomData->con.notify_all();
+        return GST_FLOW_OK;
+    }
+
     // The following lines demonstrate, how to access the image
     // data in the GstSample.
     GstSample *sample = gst_app_sink_pull_sample(appsink);
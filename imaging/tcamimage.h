@@ -3,6 +3,7 @@
 #define __TCAMIMAGE__
 
 #include "tcamcamera.h"
+#include "framepool.h"
 #include <mutex>
 #include <condition_variable>
 #include <vector>
@@ -12,9 +13,28 @@ class TcamImage : public gsttcam::TcamCamera
     public:
         TcamImage(std::string serial = "");
         ~TcamImage();
+        /*
+        * Also sizes the frame pool for the new format
+        */
         void set_capture_format(std::string format, gsttcam::FrameSize size, gsttcam::FrameRate framerate);
+        /*
+        * Also sizes the frame pool for the mode's frames. Only while stopped.
+        */
+        bool set_capture_mode(const gsttcam::CaptureMode &mode);
+        /*
+        * mlock() frame memory. Takes effect at the next set_capture_format().
+        */
+        void setLockMemory(bool lock)
+        {
+            _lockMemory = lock;
+        }
         bool start();
         bool snapImage(int timeout_ms);
+        /*
+        * Wait for the next frame and return it without copying. The frame
+        * stays in GStreamer's buffer until the handle is released.
+        */
+        gsttcam::FrameHandle snapFrame(int timeout_ms);
         int getWidth()
         {
             return _CustomData.width;
@@ -43,6 +63,9 @@ class TcamImage : public gsttcam::TcamCamera
         {
             int ImageCounter;
             bool SaveNextImage;
+            bool KeepHandle;
+            gsttcam::TcamCamera *camera;
+            gsttcam::FrameHandle frame;
             std::mutex mtx;
             std::condition_variable con;
 
@@ -55,7 +78,10 @@ class TcamImage : public gsttcam::TcamCamera
         } CUSTOMDATA;
 
         CUSTOMDATA _CustomData;
+        FramePool _pool;
+        bool _lockMemory = false;
 
+        void size_pool(const std::string &format, gsttcam::FrameSize size);
         static GstFlowReturn new_frame_cb(GstAppSink *appsink, gpointer data);
 }; 
 
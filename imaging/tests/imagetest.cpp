@@ -0,0 +1,281 @@
+/* --------------------------------------------------------------------------
+ *   imagetest: ImageT<T> on its own. Owned and wrapped images, the lazy
+ *   image expressions and their kernels, the reductions and convert(),
+ *   checked against plain per-pixel loops. Sizes are odd on purpose, so
+ *   the kernels' scalar tails and row padding get exercised too.
+ *
+ *   usage: imagetest          exits 1 if any check fails
+ * --------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "Image.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+static bool near(float a, float b) { return std::fabs(a - b) < 1e-5f; }
+
+// W x H GRAY8 frame in rows of S bytes, the padding set apart
+static const int W = 37, H = 23, S = 41;
+static const uint8_t PAD = 0xA5;
+
+static std::vector<uint8_t> test_frame()
+{
+    std::vector<uint8_t> buf(S * H, PAD);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            buf[y * S + x] = (uint8_t) ((y * W + x) * 7);
+    return buf;
+}
+
+static bool padding_intact(const std::vector<uint8_t> &buf)
+{
+    for (int y = 0; y < H; y++)
+        for (int x = W; x < S; x++)
+            if (buf[y * S + x] != PAD)
+                return false;
+    return true;
+}
+
+static void test_owned()
+{
+    Image a(4, 3, 1);
+    CHECK(a.owns_data() && a.is_compact());
+    CHECK(a.width() == 4 && a.height() == 3 && a.channels() == 1 && a.number_of_elements() == 12);
+    a.set_color(0.5f);
+    CHECK(near(a(3, 2), 0.5f) && near(a(11), 0.5f));
+    a(1, 2) = 0.25f;
+    CHECK(near(a(1 + 2 * 4), 0.25f));
+
+    Image16 h(2, 2);
+    h.set_color(1.0f);
+    CHECK(h(1, 1) == 65535);
+
+    Image b(a);
+    b(0) = 1.0f;
+    CHECK(near(a(0), 0.5f) && near(b(0), 1.0f));
+    Image m = std::move(b);
+    CHECK(near(m(0), 1.0f) && near(m(1, 2), 0.25f));
+    Image c(1);
+    c = m;
+    CHECK(c.width() == 4 && near(c(1, 2), 0.25f));
+}
+
+static void test_wrapped()
+{
+    std::vector<uint8_t> buf = test_frame();
+    Image8 v(buf.data(), W, H, 0, S);
+    CHECK(!v.owns_data() && !v.is_compact() && v.data() == buf.data());
+    CHECK(v.stride(1) == S);
+    CHECK(v(W - 1, H - 1) == buf[(H - 1) * S + W - 1]);
+    // Linear indices skip the padding
+    CHECK(v(W + 1) == buf[S + 1]);
+
+    v(2, 3) = 9;
+    CHECK(buf[3 * S + 2] == 9);
+
+    // Copies own compact pixels
+    Image8 c(v);
+    CHECK(c.owns_data() && c.is_compact());
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(c(x, y) == v(x, y));
+    c(0) = 1;
+    CHECK(buf[0] == 0);
+    CHECK(padding_intact(buf));
+}
+
+static void test_expressions()
+{
+    Image a(4, 3, 1);
+    a.set_color(0.5f);
+    Image dark(4, 3, 1);
+    dark.set_color(0.25f);
+
+    Image b = a + a * 2.0f;
+    CHECK(near(b(1, 1), 1.5f));
+    Image flat = (a - dark) * 2.0f + 1.0f;
+    CHECK(near(flat(2, 2), 1.5f));
+    flat -= dark;
+    CHECK(near(flat(2, 2), 1.25f));
+    flat *= 2.0f;
+    CHECK(near(flat(2, 2), 2.5f));
+    flat = 1.0f - flat;
+    CHECK(near(flat(0, 0), -1.5f));
+    flat = flat / a;
+    CHECK(near(flat(0, 0), -3.0f));
+    flat += a;
+    CHECK(near(flat(3, 2), -2.5f));
+    flat /= 2.0f;
+    CHECK(near(flat(3, 2), -1.25f));
+
+    // Assigning an expression reshapes the target
+    Image w(1);
+    w = a * 3.0f;
+    CHECK(w.width() == 4 && w.height() == 3 && near(w(1, 1, 0), 1.5f));
+
+    // Longer than one block of the evaluator
+    Image g(1000, 3, 1);
+    g.set_color(0.2f);
+    Image g2 = g / (g * 2.0f);
+    CHECK(near(g2(0, 0), 0.5f) && near(g2(999, 2), 0.5f));
+
+    bool thrown = false;
+    Image e(3, 3);
+    try { Image x = a + e; } catch (MismatchedDimensionsException &) { thrown = true; }
+    CHECK(thrown);
+    thrown = false;
+    Image z(4, 3, 1);
+    try { Image x = a / z; } catch (DivideByZeroException &) { thrown = true; }
+    CHECK(thrown);
+}
+
+static void test_expressions_wrapped()
+{
+    std::vector<uint8_t> buf = test_frame();
+    std::vector<uint8_t> orig = buf;
+    Image8 v(buf.data(), W, H, 0, S);
+    Image8 c(v);
+
+    Image8 r = (v + c) * (uint8_t) 3 - v;
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+        {
+            uint8_t p = orig[y * S + x];
+            CHECK(r(x, y) == (uint8_t) ((uint8_t) ((uint8_t) (p + p) * 3) - p));
+        }
+
+    // In place on the wrapped frame, the operand aliasing the target
+    v = v + v;
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(v(x, y) == (uint8_t) (2 * c(x, y)));
+    v += (uint8_t) 1;
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(buf[y * S + x] == (uint8_t) (2 * orig[y * S + x] + 1));
+    CHECK(padding_intact(buf));
+}
+
+static void test_reductions()
+{
+    std::vector<uint8_t> buf = test_frame();
+    Image8 v(buf.data(), W, H, 0, S);
+
+    uint8_t lo, hi;
+    v.min_max(&lo, &hi);
+    uint8_t l2 = 255, h2 = 0;
+    double sum = 0;
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+        {
+            uint8_t p = buf[y * S + x];
+            l2 = std::min(l2, p);
+            h2 = std::max(h2, p);
+            sum += p;
+        }
+    CHECK(lo == l2 && hi == h2);
+    CHECK(std::fabs(v.mean() - sum / (W * H)) < 1e-9);
+
+    v.clamp(10, 200);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(v(x, y) >= 10 && v(x, y) <= 200);
+    CHECK(padding_intact(buf));
+
+    Image f(5, 1, 1);
+    for (int i = 0; i < 5; i++)
+        f(i) = i * 0.25f;
+    float flo, fhi;
+    f.min_max(&flo, &fhi);
+    CHECK(near(flo, 0.0f) && near(fhi, 1.0f) && std::fabs(f.mean() - 0.5) < 1e-6);
+    f.clamp(0.25f, 0.75f);
+    CHECK(near(f(0), 0.25f) && near(f(4), 0.75f) && near(f(2), 0.5f));
+}
+
+static void test_convert()
+{
+    std::vector<uint8_t> buf = test_frame();
+    Image8 v(buf.data(), W, H, 0, S);
+
+    Image f = convert<float>(v);
+    CHECK(f.owns_data() && f.width() == W && f.height() == H);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(near(f(x, y), v(x, y) / 255.0f));
+
+    // Round trips are exact for every 8 bit value
+    Image8 back = convert<uint8_t>(f);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(back(x, y) == v(x, y));
+    Image16 w = convert<uint16_t>(f);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(w(x, y) == v(x, y) * 257);
+    Image8 narrow = convert<uint8_t>(w);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(narrow(x, y) == v(x, y));
+
+    // Out of range floats saturate
+    Image o(3, 1, 1);
+    o(0) = -0.5f;
+    o(1) = 0.5f;
+    o(2) = 1.5f;
+    Image8 s = convert<uint8_t>(o);
+    CHECK(s(0) == 0 && (s(1) == 127 || s(1) == 128) && s(2) == 255);
+}
+
+static void test_png()
+{
+    char dir[] = "/tmp/imagetestXXXXXX";
+    if (mkdtemp(dir) == NULL)
+    {
+        perror("mkdtemp");
+        failures++;
+        return;
+    }
+    std::string path = std::string(dir) + "/frame.png";
+    std::vector<uint8_t> buf = test_frame();
+    Image8 v(buf.data(), W, H, 1, S);
+    v.write(path);
+    Image8 r(path);
+    CHECK(r.width() == W && r.height() == H);
+    for (int y = 0; y < H; y++)
+        for (int x = 0; x < W; x++)
+            CHECK(r(x, y, 0) == v(x, y));
+    unlink(path.c_str());
+    rmdir(dir);
+}
+
+int main()
+{
+    test_owned();
+    test_wrapped();
+    test_expressions();
+    test_expressions_wrapped();
+    test_reductions();
+    test_convert();
+    test_png();
+    if (failures)
+    {
+        fprintf(stderr, "imagetest: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("imagetest: ok\n");
+    return 0;
+}
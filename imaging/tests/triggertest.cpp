@@ -0,0 +1,127 @@
+/* --------------------------------------------------------------------------
+ *   triggertest: TriggerMatcher against a TriggerChannel of its own, the
+ *   way simple-snapimage pairs frames with minions' triggers. Triggers
+ *   come faster than the matching window is wide, and frames are dropped
+ *   or late; every frame that arrives has to get its own trigger.
+ *
+ *   usage: triggertest          exits 1 if any check fails
+ * --------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <string>
+#include <sys/mman.h>
+
+#include "triggerchannel.h"
+
+static int failures = 0;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if (!(cond)) {                                                  \
+            fprintf(stderr, "%s:%d: %s\n", __FILE__, __LINE__, #cond);  \
+            failures++;                                                 \
+        }                                                               \
+    } while (0)
+
+#define MS 1000000LL
+// The window of simple-snapimage's default -t 400
+#define MAX_LATENCY (400 * MS)
+// Past the matcher's once a second attach retry
+#define T0 (10000 * MS)
+
+struct Run
+{
+    int64_t period;     // between triggers
+    int64_t latency;    // trigger to frame arrival
+    int frames;
+    int drop;           // frame id never delivered, -1 for none
+    int drop_run;       // that many in a row
+};
+
+// Publish the triggers of run one by one and deliver their frames in
+// arrival order; returns the frames matched to the wrong trigger
+static int mismatches(const char *name, const Run &run, unsigned long *matched)
+{
+    TriggerChannel channel;
+    if (channel.create(name) < 0)
+        return -1;
+    TriggerMatcher matcher(0, MAX_LATENCY, name);
+    // Attaches at the current head, before the first trigger
+    TriggerRecord rec;
+    matcher.match(T0 - 1, &rec);
+
+    int wrong = 0;
+    int next_frame = 0;
+    for (int k = 0; k <= run.frames; k++)
+    {
+        int64_t t = T0 + k * run.period;
+        // Frames that arrive before trigger k fires
+        for (; next_frame < k && T0 + next_frame * run.period + run.latency < t; next_frame++)
+        {
+            if (next_frame >= run.drop && next_frame < run.drop + run.drop_run)
+                continue;
+            rec.frame_id = (uint64_t) -1;
+            if (!matcher.match(T0 + next_frame * run.period + run.latency, &rec) ||
+                rec.frame_id != (uint64_t) next_frame)
+                wrong++;
+        }
+        if (k < run.frames)
+        {
+            TriggerRecord trigger = {(uint64_t) k, t, 1000.0f + k, 10.0f};
+            channel.publish(trigger);
+        }
+    }
+    *matched = matcher.matched();
+    channel.close();
+    shm_unlink(name);
+    return wrong;
+}
+
+int main()
+{
+    std::string name = "/triggertest-" + std::to_string((long) getpid());
+    unsigned long matched;
+
+    // 10 fps, frames 30 ms after their trigger, nothing dropped
+    Run steady = {100 * MS, 30 * MS, 50, -1, 0};
+    CHECK(mismatches(name.c_str(), steady, &matched) == 0 && matched == 50);
+
+    // 20 fps, the window holds eight triggers: one drop must not shift
+    // every frame after it onto its predecessor's trigger
+    Run one = {50 * MS, 30 * MS, 50, 10, 1};
+    CHECK(mismatches(name.c_str(), one, &matched) == 0 && matched == 49);
+
+    // 30 fps, a burst of drops longer than the window
+    Run burst = {33 * MS, 20 * MS, 60, 20, 15};
+    CHECK(mismatches(name.c_str(), burst, &matched) == 0 && matched == 45);
+
+    // Delivery slower than the period pairs with the next trigger, which
+    // is what min_latency_ns is for: the same run with it set
+    {
+        TriggerChannel channel;
+        CHECK(channel.create(name.c_str()) == 0);
+        TriggerMatcher matcher(60 * MS, MAX_LATENCY, name.c_str());
+        TriggerRecord rec;
+        matcher.match(T0 - 1, &rec);
+        for (int k = 0; k < 3; k++)
+        {
+            TriggerRecord trigger = {(uint64_t) k, T0 + k * 50 * MS, 0, 0};
+            channel.publish(trigger);
+        }
+        // Frame 0 at 70 ms, after trigger 1 at 50 ms
+        CHECK(matcher.match(T0 + 70 * MS, &rec) && rec.frame_id == 0);
+        CHECK(matcher.match(T0 + 120 * MS, &rec) && rec.frame_id == 1);
+        channel.close();
+        shm_unlink(name.c_str());
+    }
+
+    if (failures)
+    {
+        fprintf(stderr, "triggertest: %d checks failed\n", failures);
+        return 1;
+    }
+    printf("triggertest: ok\n");
+    return 0;
+}
@@ -0,0 +1,88 @@
+#include "tiffwriter.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+uint32_t tiffRowsPerStrip(uint32_t width, uint32_t length, uint32_t bytes_per_pixel, uint32_t strip_bytes)
+{
+    uint32_t linebytes = width * bytes_per_pixel;
+    if (strip_bytes == 0 || linebytes == 0)
+        return length;
+    uint32_t rows = strip_bytes / linebytes;
+    if (rows < 1)
+        rows = 1;
+    if (rows > length)
+        rows = length;
+    return rows;
+}
+
+int writeTiff(const unsigned char *buf, uint32_t width, uint32_t length, int stride,
+              const char *outFileName, const TiffOptions &options)
+{
+    TIFF *out;
+    uint32_t nbands = 1;
+    uint16_t photometric = PHOTOMETRIC_MINISBLACK;
+    uint16_t config = PLANARCONFIG_CONTIG;
+    uint16_t fillorder = FILLORDER_LSB2MSB;
+    TIFFDataType dtype = TIFF_BYTE;
+    int16_t depth = TIFFDataWidth(dtype); /* bytes per pixel in input image */
+    uint32_t linebytes = width * nbands * depth;
+    uint32_t rowsperstrip = tiffRowsPerStrip(width, length, nbands * depth, options.strip_bytes);
+
+    // libtiff takes a writable buffer, but without a predictor and with
+    // 8-bit samples it leaves it untouched, so contiguous rows are encoded
+    // in place. Padded rows are packed here first; one buffer per writer
+    // thread, grown once and then reused.
+    static thread_local std::vector<unsigned char> scratch;
+
+    out = TIFFOpen(outFileName, "w");
+    if (out == NULL) {
+        fprintf(stderr, "%s: Cannot open file for output.\n", outFileName);
+        return (-1);
+    }
+
+    TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
+    TIFFSetField(out, TIFFTAG_IMAGELENGTH, length);
+    TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+    TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, nbands);
+    TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, depth * 8);
+    TIFFSetField(out, TIFFTAG_FILLORDER, fillorder);
+    TIFFSetField(out, TIFFTAG_PLANARCONFIG, config);
+    TIFFSetField(out, TIFFTAG_PHOTOMETRIC, photometric);
+    TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+    TIFFSetField(out, TIFFTAG_COMPRESSION, options.compression);
+    if (options.level > 0 && (options.compression == COMPRESSION_ADOBE_DEFLATE ||
+                              options.compression == COMPRESSION_DEFLATE))
+        TIFFSetField(out, TIFFTAG_ZIPQUALITY, options.level);
+    TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, rowsperstrip);
+    if (options.description)
+        TIFFSetField(out, TIFFTAG_IMAGEDESCRIPTION, options.description);
+
+    int ret = 0;
+    uint32_t nstrips = (length + rowsperstrip - 1) / rowsperstrip;
+    for (uint32_t strip = 0; strip < nstrips; strip++) {
+        uint32_t row = strip * rowsperstrip;
+        uint32_t rows = (row + rowsperstrip > length) ? length - row : rowsperstrip;
+        tmsize_t stripbytes = (tmsize_t) rows * linebytes;
+
+        unsigned char *data;
+        if ((uint32_t) stride == linebytes) {
+            data = (unsigned char *) buf + (size_t) row * stride;
+        } else {
+            if (scratch.size() < (size_t) stripbytes)
+                scratch.resize(stripbytes);
+            for (uint32_t r = 0; r < rows; r++)
+                memcpy(scratch.data() + r * linebytes, buf + (size_t) (row + r) * stride, linebytes);
+            data = scratch.data();
+        }
+
+        if (TIFFWriteEncodedStrip(out, strip, data, stripbytes) < 0) {
+            fprintf(stderr, "%s: strip %lu: Write error.\n",
+                    outFileName, (unsigned long) strip);
+            ret = -1;
+            break;
+        }
+    }
+    TIFFClose(out);
+    return ret;
+}
@@ -0,0 +1,34 @@
+#ifndef __TIFFWRITER__
+#define __TIFFWRITER__
+
+#include <stdint.h>
+#include "tiffio.h"
+
+/*
+* Layout and codec settings for stored frames
+*/
+struct TiffOptions
+{
+    // Target uncompressed size of one strip. Rounded down to whole rows,
+    // 0 puts the whole image in a single strip.
+    uint32_t strip_bytes = 128 * 1024;
+    uint16_t compression = COMPRESSION_PACKBITS;
+    // zlib level for Deflate, 0 keeps libtiff's default
+    int level = 0;
+    // Stored as the ImageDescription tag when set
+    const char *description = nullptr;
+};
+
+/*
+* Number of rows per strip that keeps a strip at or below strip_bytes
+*/
+uint32_t tiffRowsPerStrip(uint32_t width, uint32_t length, uint32_t bytes_per_pixel, uint32_t strip_bytes);
+
+/*
+* Write a single channel 8-bit image. Rows are stride bytes apart in buf.
+* Whole strips go through TIFFWriteEncodedStrip; buf is not modified.
+*/
+int writeTiff(const unsigned char *buf, uint32_t width, uint32_t length, int stride,
+              const char *outFileName, const TiffOptions &options);
+
+#endif
@@ -0,0 +1,436 @@
+/* --------------------------------------------------------------------------
+ *   capturebench: frames through the capture path of simple-snapimage
+ *   without a camera. videotestsrc (or frames replayed from raw GRAY8 files
+ *   through appsrc) stands in for tcambin; the appsink callback, the
+ *   FrameWriter queue, frame stats and the codec or segment store behind it
+ *   are the ones simple-snapimage uses. Reports the sustained frame rate,
+ *   drops, latency percentiles per stage, CPU and bytes stored.
+ *
+ *   usage: capturebench [-M mission file] [-W width] [-H height] [-f num/den]
+ *                       [-d seconds] [-s pattern | -r raw frame...]
+ *                       [-c codec] [-l level] [-g segment dir] [-G segment MB]
+ *                       [-o out dir] [-q depth] [-w workers] [-p policy] [-z]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <gst/gst.h>
+#include <gst/app/gstappsink.h>
+#include <gst/app/gstappsrc.h>
+
+#include "framewriter.h"
+#include "framecodec.h"
+#include "framestats.h"
+#include "segmentstore.h"
+#include "missionsettings.h"
+#include "rtthreads.h"
+
+
+static long long now_ns()
+{
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (long long) t.tv_sec * 1000000000LL + t.tv_nsec;
+}
+
+
+/*
+ * Latencies of one stage in ms, sorted for percentiles at the end
+ */
+class StageTimes
+{
+    public:
+        explicit StageTimes(const char *name) : name_(name) {}
+
+        void add(double ms)
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            ms_.push_back(ms);
+        }
+
+        void print()
+        {
+            std::lock_guard<std::mutex> lck(mtx_);
+            if (ms_.empty())
+            {
+                printf("%-10s %9s\n", name_, "-");
+                return;
+            }
+            std::sort(ms_.begin(), ms_.end());
+            printf("%-10s %9.3f %9.3f %9.3f %9.3f\n", name_, at(0.5), at(0.9), at(0.99), ms_.back());
+        }
+
+    private:
+        const char *name_;
+        std::mutex mtx_;
+        std::vector<double> ms_;
+
+        double at(double q) const { return ms_[std::min(ms_.size() - 1, (size_t) (q * ms_.size()))]; }
+};
+
+static StageTimes callbackTimes("callback");   // appsink callback, pull to submit
+static StageTimes queueTimes("queue");         // arrival to a writer taking it
+static StageTimes statsTimes("stats");         // computeFrameStats
+static StageTimes storeTimes("store");         // encode and write, or segment add
+static StageTimes totalTimes("total");         // arrival to stored
+
+static FrameWriterConfig writerConfig;
+static CodecOptions codecOptions;
+static std::string outDir = "/tmp/capturebench";
+static std::unique_ptr<SegmentStore> segmentStore;
+
+static std::atomic<long> frameCount{0};
+static std::atomic<long> sourceLost{0};
+static std::atomic<long long> storedBytes{0};
+static std::atomic<long long> rawBytes{0};
+static guint64 nextOffset = 0;
+static bool pinned = false;
+
+
+// Same steps as new_frame_cb in main.cpp, minus the trigger matching
+static GstFlowReturn new_sample_cb(GstAppSink *appsink, gpointer data)
+{
+    FrameWriter *writer = (FrameWriter *) data;
+    long long t_arrival = now_ns();
+    if (!pinned)
+    {
+        setThreadRole(ThreadRole::Capture);
+        pinned = true;
+    }
+    GstSample *sample = gst_app_sink_pull_sample(appsink);
+    if (sample == NULL)
+        return GST_FLOW_OK;
+    // The source numbers its buffers; a gap is what appsink dropped
+    GstBuffer *buffer = gst_sample_get_buffer(sample);
+    guint64 offset = GST_BUFFER_OFFSET(buffer);
+    if (offset != GST_BUFFER_OFFSET_NONE)
+    {
+        if (offset > nextOffset)
+            sourceLost += offset - nextOffset;
+        nextOffset = offset + 1;
+    }
+
+    Frame frame = Frame();
+    frame.frame_id = frameCount++;
+    frame.timestamp.tv_sec = t_arrival / 1000000000LL;
+    frame.timestamp.tv_nsec = t_arrival % 1000000000LL;
+    if (writerConfig.zero_copy)
+    {
+        gsttcam::FrameHandle handle(sample, frame.frame_id);
+        frame.width = handle.width();
+        frame.height = handle.height();
+        writer->submit(std::move(handle), frame);
+    }
+    else
+    {
+        GstMapInfo info;
+        gst_buffer_map(buffer, &info, GST_MAP_READ);
+        GstStructure *str = gst_caps_get_structure(gst_sample_get_caps(sample), 0);
+        gst_structure_get_int(str, "width", &frame.width);
+        gst_structure_get_int(str, "height", &frame.height);
+        frame.stride = frame.width;
+        writer->submit(info.data, info.size, frame);
+        gst_buffer_unmap(buffer, &info);
+        gst_sample_unref(sample);
+    }
+    callbackTimes.add((now_ns() - t_arrival) / 1e6);
+    return GST_FLOW_OK;
+}
+
+
+// Runs on a FrameWriter thread, like writeFrame in main.cpp at the full
+// storage level: stats, then the codec or the segment store
+static int benchWrite(const Frame &frame)
+{
+    long long t_arrival = (long long) frame.timestamp.tv_sec * 1000000000LL + frame.timestamp.tv_nsec;
+    long long t0 = now_ns();
+    queueTimes.add((t0 - t_arrival) / 1e6);
+
+    FrameStats stats;
+    computeFrameStats(frame.data, frame.width, frame.height, frame.stride, 0, &stats);
+    long long t1 = now_ns();
+    statsTimes.add((t1 - t0) / 1e6);
+
+    FrameMeta meta = FrameMeta();
+    meta.frame_id = frame.frame_id;
+    meta.timestamp_ns = t_arrival;
+    EncodeResult result;
+    int ret;
+    if (segmentStore)
+        ret = segmentStore->add(frame.data, frame.width, frame.height, frame.stride, meta, false,
+                                codecOptions, &result);
+    else
+    {
+        char name[256];
+        snprintf(name, sizeof(name), "%s/image%05ld_0", outDir.c_str(), frame.frame_id);
+        ret = encodeFrame(frame.data, frame.width, frame.height, frame.stride, meta, name,
+                          codecOptions, &result);
+    }
+    long long t2 = now_ns();
+    storeTimes.add((t2 - t1) / 1e6);
+    totalTimes.add((t2 - t_arrival) / 1e6);
+    if (ret == 0)
+    {
+        storedBytes += result.stored_bytes;
+        rawBytes += result.raw_bytes;
+    }
+    return ret;
+}
+
+
+// Replay: push the frames round robin at the capture rate, numbered like
+// videotestsrc numbers its buffers
+static void replayLoop(GstAppSrc *src, const std::vector<std::vector<unsigned char>> *frames,
+                       long long period_ns, std::atomic<bool> *running)
+{
+    long long t = now_ns();
+    for (guint64 n = 0; *running; n++)
+    {
+        t += period_ns;
+        struct timespec ts = {(time_t) (t / 1000000000LL), (long) (t % 1000000000LL)};
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+        const std::vector<unsigned char> &f = (*frames)[n % frames->size()];
+        GstBuffer *buffer = gst_buffer_new_allocate(NULL, f.size(), NULL);
+        gst_buffer_fill(buffer, 0, f.data(), f.size());
+        GST_BUFFER_OFFSET(buffer) = n;
+        GST_BUFFER_PTS(buffer) = n * period_ns;
+        GST_BUFFER_DURATION(buffer) = period_ns;
+        if (gst_app_src_push_buffer(src, buffer) != GST_FLOW_OK)
+            break;
+    }
+}
+
+
+static void usage()
+{
+    fprintf(stderr, "usage: capturebench [-M mission file] [-W width] [-H height] [-f num/den]\n"
+                    "                    [-d seconds] [-s pattern | -r raw frame...]\n"
+                    "                    [-c none|packbits|lzw|deflate|lz4] [-l level] [-g segment dir]\n"
+                    "                    [-G segment MB] [-o out dir] [-q depth] [-w workers]\n"
+                    "                    [-p newest|oldest|block] [-z]\n");
+}
+
+int main(int argc, char **argv)
+{
+    MissionSettings settings;
+    double seconds = 30;
+    std::string pattern = "snow";
+    std::vector<std::string> replay;
+    const char *segmentDir = NULL;
+    long long segmentBytes = SEGMENT_BYTES;
+    std::string error;
+    int opt;
+    while ((opt = getopt(argc, argv, "M:W:H:f:d:s:r:c:l:g:G:o:q:w:p:z")) != -1)
+    {
+        switch (opt)
+        {
+            case 'M':
+                // First, so the options after it win
+                if (loadMissionSettings(optarg, &settings, &error) == -1)
+                {
+                    fprintf(stderr, "%s\n", error.c_str());
+                    return 1;
+                }
+                break;
+            case 'W':
+                settings.capture_width = atoi(optarg);
+                break;
+            case 'H':
+                settings.capture_height = atoi(optarg);
+                break;
+            case 'f':
+                if (sscanf(optarg, "%d/%d", &settings.capture_fps_num, &settings.capture_fps_den) < 1)
+                {
+                    usage();
+                    return 1;
+                }
+                if (strchr(optarg, '/') == NULL)
+                    settings.capture_fps_den = 1;
+                break;
+            case 'd':
+                seconds = atof(optarg);
+                break;
+            case 's':
+                pattern = optarg;
+                break;
+            case 'r':
+                replay.push_back(optarg);
+                break;
+            case 'c':
+                if (!parseStorageCodec(optarg, &codecOptions.codec) || !storageCodecAvailable(codecOptions.codec))
+                {
+                    fprintf(stderr, "codec %s is not available\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'l':
+                codecOptions.level = atoi(optarg);
+                break;
+            case 'g':
+                segmentDir = optarg;
+                break;
+            case 'G':
+                segmentBytes = atoll(optarg) << 20;
+                break;
+            case 'o':
+                outDir = optarg;
+                break;
+            case 'q':
+                writerConfig.queue_depth = atoi(optarg);
+                break;
+            case 'w':
+                writerConfig.workers = atoi(optarg);
+                break;
+            case 'p':
+                if (strcmp(optarg, "newest") == 0)
+                    writerConfig.drop_policy = DropPolicy::DropNewest;
+                else if (strcmp(optarg, "oldest") == 0)
+                    writerConfig.drop_policy = DropPolicy::DropOldest;
+                else if (strcmp(optarg, "block") == 0)
+                    writerConfig.drop_policy = DropPolicy::Block;
+                else
+                {
+                    usage();
+                    return 1;
+                }
+                break;
+            case 'z':
+                writerConfig.zero_copy = true;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    int width = settings.capture_width, height = settings.capture_height;
+    int fpsNum = settings.capture_fps_num, fpsDen = settings.capture_fps_den;
+    if (width <= 0 || height <= 0 || fpsNum <= 0 || fpsDen <= 0 || seconds <= 0)
+    {
+        usage();
+        return 1;
+    }
+    size_t frameBytes = (size_t) width * height;
+    long long period_ns = 1000000000LL * fpsDen / fpsNum;
+    if (segmentDir && codecOptions.codec != StorageCodec::LZ4Raw && codecOptions.codec != StorageCodec::None)
+        codecOptions.codec = StorageCodec::None;
+
+    // Replayed frames must have the capture format
+    std::vector<std::vector<unsigned char>> frames;
+    for (const std::string &path : replay)
+    {
+        FILE *f = fopen(path.c_str(), "rb");
+        std::vector<unsigned char> pixels(frameBytes);
+        if (f == NULL || fread(pixels.data(), 1, frameBytes, f) != frameBytes)
+        {
+            fprintf(stderr, "%s: not a %dx%d GRAY8 frame\n", path.c_str(), width, height);
+            return 1;
+        }
+        fclose(f);
+        frames.push_back(std::move(pixels));
+    }
+
+    // Scheduled like simple-snapimage
+    setThreadLayout(threadLayoutOf(settings));
+    lockMemory();
+    setThreadRole(ThreadRole::Background);
+    gst_init(&argc, &argv);
+    mkdir(outDir.c_str(), 0755);
+    if (segmentDir)
+        segmentStore.reset(new SegmentStore(segmentDir, segmentBytes));
+
+    // tcambin ! capsfilter ! tee ! queue ! appsink in TcamCamera
+    char caps[128];
+    snprintf(caps, sizeof(caps), "video/x-raw,format=GRAY8,width=%d,height=%d,framerate=%d/%d",
+             width, height, fpsNum, fpsDen);
+    std::string source = frames.empty() ?
+        "videotestsrc is-live=true pattern=" + pattern + " ! " + caps :
+        std::string("appsrc name=src is-live=true format=time caps=") + caps;
+    std::string launch = source + " ! queue ! appsink name=sink max-buffers=4 drop=true sync=false";
+    GError *err = NULL;
+    GstElement *pipeline = gst_parse_launch(launch.c_str(), &err);
+    if (pipeline == NULL || err)
+    {
+        fprintf(stderr, "pipeline: %s\n", err ? err->message : "failed");
+        if (err)
+            g_error_free(err);
+        return 1;
+    }
+
+    FrameWriter writer(writerConfig, frameBytes, benchWrite);
+    if (!writer.start())
+    {
+        gst_object_unref(pipeline);
+        return 1;
+    }
+    GstElement *sink = gst_bin_get_by_name(GST_BIN(pipeline), "sink");
+    GstAppSinkCallbacks callbacks = {NULL, NULL, new_sample_cb};
+    gst_app_sink_set_callbacks(GST_APP_SINK(sink), &callbacks, &writer, NULL);
+
+    printf("%dx%d GRAY8 at %d/%d fps from %s for %.0f s, %s%s, %d workers, queue of %d%s\n",
+           width, height, fpsNum, fpsDen, frames.empty() ? ("videotestsrc " + pattern).c_str() : "replay",
+           seconds, segmentDir ? "segments " : "", storageCodecName(codecOptions.codec),
+           writerConfig.workers, writerConfig.queue_depth, writerConfig.zero_copy ? ", zero copy" : "");
+
+    struct rusage ru0, ru1;
+    getrusage(RUSAGE_SELF, &ru0);
+    long long t_start = now_ns();
+    gst_element_set_state(pipeline, GST_STATE_PLAYING);
+    std::atomic<bool> replaying{true};
+    std::thread feeder;
+    GstElement *src = gst_bin_get_by_name(GST_BIN(pipeline), "src");
+    if (src)
+        feeder = std::thread(replayLoop, GST_APP_SRC(src), &frames, period_ns, &replaying);
+
+    usleep((useconds_t) (seconds * 1e6));
+
+    replaying = false;
+    if (feeder.joinable())
+        feeder.join();
+    gst_element_set_state(pipeline, GST_STATE_NULL);
+    long long t_source = now_ns();
+    // Everything queued is still written, and counts
+    writer.stop();
+    if (segmentStore)
+        segmentStore->close();
+    long long t_end = now_ns();
+    getrusage(RUSAGE_SELF, &ru1);
+
+    double wall = (t_end - t_start) / 1e9, offered = (t_source - t_start) / 1e9;
+    double cpu = (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6
+               + (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6;
+    printf("\nframes: %ld arrived, %ld lost before the callback, %lu written, %lu dropped, %lu failed\n",
+           frameCount.load(), sourceLost.load(), writer.written(), writer.dropped(), writer.failed());
+    printf("sustained: %.2f fps written of %.2f fps offered, %.2f arrived\n",
+           writer.written() / wall, (double) fpsNum / fpsDen, frameCount.load() / offered);
+    printf("\n%-10s %9s %9s %9s %9s\n", "stage ms", "p50", "p90", "p99", "max");
+    callbackTimes.print();
+    queueTimes.print();
+    statsTimes.print();
+    storeTimes.print();
+    totalTimes.print();
+    printf("\ncpu: %.0f%% of one core (%.1f s user, %.1f s system), max rss %ld MB\n", 100 * cpu / wall,
+           (ru1.ru_utime.tv_sec - ru0.ru_utime.tv_sec) + (ru1.ru_utime.tv_usec - ru0.ru_utime.tv_usec) / 1e6,
+           (ru1.ru_stime.tv_sec - ru0.ru_stime.tv_sec) + (ru1.ru_stime.tv_usec - ru0.ru_stime.tv_usec) / 1e6,
+           ru1.ru_maxrss / 1024);
+    printf("stored: %.1f MB of %.1f MB raw, %.2f MB/s\n", storedBytes / 1048576.0, rawBytes / 1048576.0,
+           storedBytes / 1048576.0 / wall);
+
+    if (src)
+        gst_object_unref(src);
+    gst_object_unref(sink);
+    gst_object_unref(pipeline);
+    return 0;
+}
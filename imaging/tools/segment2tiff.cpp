@@ -0,0 +1,105 @@
+/* --------------------------------------------------------------------------
+ *   segment2tiff: write every frame of segment files (simple-snapimage -g,
+ *   see segmentstore.h) to a file of its own, named like simple-snapimage
+ *   names them without -g.
+ *
+ *   usage: segment2tiff [-c codec] [-o out dir] <seg.mseg>...
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <vector>
+
+#include "segmentstore.h"
+#include "framecodec.h"
+
+
+static void usage()
+{
+    fprintf(stderr, "usage: segment2tiff [-c none|packbits|lzw|deflate|lz4] [-o out dir] <seg.mseg>...\n");
+}
+
+int main(int argc, char **argv)
+{
+    CodecOptions options;
+    const char *outDir = ".";
+    int opt;
+    while ((opt = getopt(argc, argv, "c:o:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'c':
+                if (!parseStorageCodec(optarg, &options.codec) || !storageCodecAvailable(options.codec))
+                {
+                    fprintf(stderr, "codec %s is not available\n", optarg);
+                    return 1;
+                }
+                break;
+            case 'o':
+                outDir = optarg;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+    if (optind >= argc)
+    {
+        usage();
+        return 1;
+    }
+
+    unsigned long written = 0, failed = 0;
+    std::vector<unsigned char> pixels;
+    for (int i = optind; i < argc; i++)
+    {
+        SegmentFileHeader header;
+        std::vector<SegmentIndexEntry> index;
+        int fd = openSegment(argv[i], &header, &index);
+        if (fd < 0)
+        {
+            failed++;
+            continue;
+        }
+        if (!(header.flags & SEGMENT_SEALED))
+            fprintf(stderr, "%s: not sealed, exporting the frames it has\n", argv[i]);
+
+        for (const SegmentIndexEntry &entry : index)
+        {
+            if (entry.size == 0)
+                continue;
+            if (readSegmentFrame(fd, entry, &pixels) != 0)
+            {
+                fprintf(stderr, "%s: frame %lld: cannot read\n", argv[i], (long long) entry.frame_id);
+                failed++;
+                continue;
+            }
+
+            FrameMeta meta;
+            meta.camera_id = entry.camera_id;
+            meta.frame_id = entry.frame_id;
+            meta.timestamp_ns = entry.timestamp_ns;
+            meta.has_trigger = entry.flags & SEGMENT_FRAME_HAS_TRIGGER;
+            meta.trigger_id = entry.trigger_id;
+            meta.trigger_ns = entry.trigger_ns;
+            meta.pressure = entry.pressure;
+            meta.temperature = entry.temperature;
+
+            char basename[512];
+            snprintf(basename, sizeof(basename), "%s/image%05ld_%d_%ld_%ld%s", outDir, meta.frame_id,
+                     meta.camera_id, (long) (meta.timestamp_ns / 1000000000LL),
+                     (long) (meta.timestamp_ns % 1000000000LL),
+                     (entry.flags & SEGMENT_FRAME_THUMBNAIL) ? "_thumb" : "");
+            if (encodeFrame(pixels.data(), entry.width, entry.height, entry.width, meta,
+                            basename, options, NULL) == 0)
+                written++;
+            else
+                failed++;
+        }
+        close(fd);
+    }
+    printf("%lu frames written, %lu failed\n", written, failed);
+    return failed ? 1 : 0;
+}
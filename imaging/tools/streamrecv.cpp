@@ -0,0 +1,157 @@
+/* --------------------------------------------------------------------------
+ *   streamrecv: receive the live frames of simple-snapimage (stream_host,
+ *   see streamproto.h) on the master. The newest complete frame of every
+ *   camera of every sender goes to <out dir>/live_<sender>_<camera>.png,
+ *   replaced atomically so a viewer never reads half of one; with -a every
+ *   frame is also kept as live_<sender>_<camera>_<frame id>.png. A line per
+ *   frame on stdout.
+ *
+ *   usage: streamrecv [-p port] [-o out dir] [-a]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <map>
+#include <tuple>
+#include <string>
+#include <vector>
+
+#include "streamproto.h"
+
+
+// The frame of one camera of one sender being put together
+struct Assembly
+{
+    bool active = false;
+    stream_header header;
+    std::vector<unsigned char> png;
+    std::vector<bool> have;
+    unsigned received = 0;
+};
+
+static bool writeFile(const std::string &path, const std::vector<unsigned char> &data)
+{
+    std::string tmp = path + ".tmp";
+    FILE *f = fopen(tmp.c_str(), "wb");
+    if (f == NULL)
+    {
+        perror(tmp.c_str());
+        return false;
+    }
+    bool ok = fwrite(data.data(), 1, data.size(), f) == data.size();
+    ok = fclose(f) == 0 && ok;
+    if (!ok || rename(tmp.c_str(), path.c_str()) != 0)
+    {
+        perror(path.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void usage()
+{
+    fprintf(stderr, "usage: streamrecv [-p port] [-o out dir] [-a]\n");
+}
+
+int main(int argc, char **argv)
+{
+    int port = STREAM_PORT;
+    std::string outDir = ".";
+    bool keepAll = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:o:a")) != -1)
+    {
+        switch (opt)
+        {
+            case 'p':
+                port = atoi(optarg);
+                break;
+            case 'o':
+                outDir = optarg;
+                break;
+            case 'a':
+                keepAll = true;
+                break;
+            default:
+                usage();
+                return 1;
+        }
+    }
+
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (sock < 0 || bind(sock, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+    {
+        perror("bind");
+        return 1;
+    }
+    printf("Listening on port %d\n", port);
+
+    // By sender address and port, then camera: two floats may use one id
+    std::map<std::tuple<uint32_t, uint16_t, uint16_t>, Assembly> cameras;
+    unsigned long complete = 0, incomplete = 0;
+    uint8_t buf[STREAM_DATAGRAM];
+    while (true)
+    {
+        struct sockaddr_in from;
+        socklen_t fromLen = sizeof(from);
+        ssize_t n = recvfrom(sock, buf, sizeof(buf), 0, (struct sockaddr *) &from, &fromLen);
+        stream_header h;
+        if (n < 0 || stream_decode(buf, (size_t) n, &h) == -1)
+            continue;
+        size_t offset = (size_t) h.chunk * STREAM_CHUNK_BYTES;
+        size_t len = (size_t) n - STREAM_HEADER_SIZE;
+        if (offset + len > h.size)
+            continue;
+
+        Assembly &a = cameras[std::make_tuple(from.sin_addr.s_addr, from.sin_port, h.camera_id)];
+        if (!a.active || a.header.seq != h.seq)
+        {
+            // A new frame: what is left of the last one is lost
+            if (a.active)
+                incomplete++;
+            a.active = true;
+            a.header = h;
+            a.png.assign(h.size, 0);
+            a.have.assign(h.chunks, false);
+            a.received = 0;
+        }
+        // Checked against the frame the buffers were sized for, not this
+        // datagram's own header
+        if (h.chunks != a.header.chunks || h.size != a.header.size || h.chunk >= a.have.size() ||
+            offset + len > a.png.size())
+            continue;
+        if (a.have[h.chunk])
+            continue;
+        memcpy(a.png.data() + offset, buf + STREAM_HEADER_SIZE, len);
+        a.have[h.chunk] = true;
+        if (++a.received < h.chunks)
+            continue;
+
+        a.active = false;
+        complete++;
+        char name[96];
+        const char *sender = inet_ntoa(from.sin_addr);
+        snprintf(name, sizeof(name), "/live_%s_%u.png", sender, h.camera_id);
+        writeFile(outDir + name, a.png);
+        if (keepAll)
+        {
+            snprintf(name, sizeof(name), "/live_%s_%u_%lld.png", sender, h.camera_id, (long long) h.frame_id);
+            writeFile(outDir + name, a.png);
+        }
+        printf("%s camera %u frame %lld trigger %lld: %ux%u/%u, %.1f mbar %.2f C, %u bytes (%lu complete, %lu lost)\n",
+               inet_ntoa(from.sin_addr), h.camera_id, (long long) h.frame_id, (long long) h.trigger_id, h.width, h.height, h.scale,
+               h.pressure, h.temperature, h.size, complete, incomplete);
+        fflush(stdout);
+    }
+    return 0;
+}
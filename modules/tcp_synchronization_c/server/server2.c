@@ -9,34 +9,50 @@
  *   given the low performance of RPI, the synchroinzation might be difficult
  *   with the wireless communication. 
  * 
- *   This code opens a socket for TCP communication. It uses select to allow
- *   multiple clients to connect and communicate with the server in series. 
- *   The reference code is from 
- *   https://www.geeksforgeeks.org/socket-programming-in-cc-handling
- *   -multiple-clients-on-server-without-multi-threading/
+ *   This code opens a socket for TCP communication. One epoll loop serves
+ *   any number of clients; each has its own state object, and every packet
+ *   is answered as soon as it is complete, so TPSN rounds of different
+ *   clients interleave instead of queueing behind each other.
  * 
- *   For our application, we assume at most two clients (cameras). This code
- *   is meant to be used by the LED RPI.
+ *   -n sets how many clients (cameras, sensors) have to be ready before the
+ *   trigger starts, 2 by default for one stereo pair. This code is meant to
+ *   be used by the LED RPI.
  * 
  *   Once the network is ready, the clients and the server talk in the following
  *   procedure:
  *      .stepA
- *          - Clients A + B sends their time T1, and server responsds with its 
+ *          - Every client sends its time T1, and server responsds with its 
  *          T2 and T3. 
- *          - Repeat .stepA until all clients sends 0 in data buffer. 
+ *          - Repeat .stepA until all clients send SYNC_START_REQ. 
  *          This menas that the clients have accumulated sufficient number 
  *          of data for averaging (100).
  * 
  *      .stepB  
- *          - all clients are done averaging --> server sends time to start
- *          trigger cameras
- *          - clients acknowledges with response data "1"
+ *          - all clients are done averaging --> server announces the
+ *          time to start trigger cameras and the trigger period, once to
+ *          all of them over UDP multicast (SYNC_MCAST_GROUP), repeated
+ *          in case a datagram is lost, first after ANNOUNCE_MS and then at
+ *          doubling intervals up to ANNOUNCE_MAX_MS, until every client
+ *          has acknowledged. A start time request over TCP is answered
+ *          right away, with 0 until all clients asked.
+ *          - clients acknowledge with SYNC_READY
  * 
  *      .stepC
- *          - sockets are closed and LED strobing begins
+ *          - LED strobing begins. The clients keep their connection open,
+ *          and the server keeps answering .stepA and start time requests
+ *          so they can correct drift and resynchronize without
+ *          reconnecting.
  * 
+ *   Messages are the fixed size packets of common/include/syncproto.h;
+ *   build with -I../../../common/include.
  * 
- *      
+ *   -m gives the address of the interface to announce on, the access
+ *   point address by default.
+ * 
+ *   With -k the server takes T2 from the kernel (or NIC) receive timestamp
+ *   of the request rather than reading the clock after read() returns. T3
+ *   stays a clock reading right before send(), since it has to travel in
+ *   the reply it stamps.
  */
 
 
@@ -49,14 +65,24 @@
 #include <sys/types.h>  
 #include <sys/socket.h>  
 #include <netinet/in.h>  
-#include <sys/time.h>       // FD_SET, FD_ISSET, FD_ZERO macros  
+#include <netinet/tcp.h>    // TCP_NODELAY
+#include <sys/uio.h>        // struct iovec
+#include <linux/net_tstamp.h>   // SOF_TIMESTAMPING_*
+#include <linux/errqueue.h>     // struct scm_timestamping
+#include <sys/epoll.h>
 #include <time.h>           // time_sepc
 #include <wiringPi.h>       // for GPIO
 #include <signal.h>         // for 1 second interrupt
+#include "syncproto.h"      // packet format shared with the cameras
      
 #define PORT 8080               // Port number for communication
 #define BILLION 1000000000LL    // nanoseconds conversion
 #define TRIG_PIN 24             // pin number for LED trigger
+#define MAX_EVENTS 16           // epoll events handled per wake up
+#define ANNOUNCE_MS 1000         // first repeat interval of the multicast announcement
+#define ANNOUNCE_MAX_MS 8000     // the longest one
+#define ANNOUNCE_IF "192.168.4.1"   // default interface for it
+#define TRIG_PERIOD_NS BILLION  // LED trigger period
 
 
 /**
@@ -80,16 +106,6 @@ long long as_nsec(struct timespec *T)
 }
 
 
-/**
- * Convert bytes received by clients into 64-bit long nanoseconds
- */
-long long bytes_to_nsec(char *buffer)
-{
-    time_t sec = (buffer[3] << 24) | (buffer[2] << 16) | (buffer[1] << 8) | buffer[0];
-    int nsec = (buffer[7] << 24) | (buffer[6] << 16) | (buffer[5] << 8) | buffer[4];
-    return ((long long) sec) * BILLION + (long long) nsec;
-}
-
 /**
  * Convert 64-bit long nanoseconds into timespec
  */
@@ -101,35 +117,382 @@ void as_timespec(long long t, struct timespec *T)
 }     
 
 
+/**
+ * read() that also fills T with the receive timestamp of the data, if the
+ * socket has SO_TIMESTAMPING on. Hardware stamps win over software ones.
+ * Returns 1 in *stamped when T was set.
+ */
+ssize_t read_stamped(int sd, char *buffer, size_t len, struct timespec *T, int *stamped)
+{
+    char control[256];
+    struct iovec iov = {.iov_base = buffer, .iov_len = len};
+    struct msghdr msg = {0};
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    *stamped = 0;
+    ssize_t n = recvmsg(sd, &msg, 0);
+    if (n <= 0)
+        return n;
+    for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c))
+    {
+        if (c->cmsg_level != SOL_SOCKET || c->cmsg_type != SCM_TIMESTAMPING)
+            continue;
+        struct scm_timestamping *ts = (struct scm_timestamping *) CMSG_DATA(c);
+        struct timespec *t = (ts->ts[2].tv_sec || ts->ts[2].tv_nsec) ? &ts->ts[2] : &ts->ts[0];
+        if (t->tv_sec || t->tv_nsec)
+        {
+            *T = *t;
+            *stamped = 1;
+        }
+    }
+    return n;
+}
+
+
+/**
+ * Create a repeated timer interrupt that happens every second starting at
+ * T_start
+ */
+void start_trigger(struct timespec T_start)
+{
+    timer_t t_id;
+    struct itimerspec tim_spec = {.it_interval= {.tv_sec=1,.tv_nsec=0},
+                    .it_value = T_start};
+
+    struct sigaction act;
+    sigset_t set;
+
+    sigemptyset( &set );
+    sigaddset( &set, SIGALRM );
+
+    act.sa_flags = SA_RESTART;
+    act.sa_mask = set;
+    act.sa_handler = &handler;
+
+    sigaction( SIGALRM, &act, NULL );
+
+    if (timer_create(CLOCK_REALTIME, NULL, &t_id))
+        perror("timer_create");
+
+    if (timer_settime(t_id, TIMER_ABSTIME, &tim_spec, NULL))
+        perror("timer_settime");
+}
+
+
+/**
+ * State of one connected client
+ */
+struct client
+{
+    int fd;
+    struct sockaddr_in addr;
+    // partially received packet
+    uint8_t rxbuf[SYNC_PACKET_SIZE];
+    size_t rxlen;
+    // 0: time is not informed
+    // 1: start time is requested
+    // 2. start time is acknowledged and ready to trigger
+    int state;
+};
+
+/**
+ * Everything the event loop works on
+ */
+struct server
+{
+    int epfd;
+    int kernel_ts;              // -k
+    int expected;               // -n
+    struct client **clients;
+    int nclients, cap;
+    // Starting time of the trigger that is sent to clients eventually
+    struct timespec T_start;
+    int started;
+    // multicast announcement of T_start
+    int mcast_fd;
+    struct sockaddr_in mcast_addr;
+    uint32_t announce_seq;
+    long long next_announce;    // CLOCK_MONOTONIC, 0 while there is nothing to announce
+    int announce_ms;            // until the repeat after next_announce
+};
+
+
+long long monotonic_nsec()
+{
+    struct timespec T;
+    clock_gettime(CLOCK_MONOTONIC, &T);
+    return as_nsec(&T);
+}
+
+
+void add_client(struct server *srv, int fd, struct sockaddr_in *addr)
+{
+    struct client *cl = calloc(1, sizeof(*cl));
+    if (cl == NULL)
+    {
+        perror("calloc");
+        close(fd);
+        return;
+    }
+    cl->fd = fd;
+    cl->addr = *addr;
+
+    if (srv->nclients == srv->cap)
+    {
+        int cap = srv->cap ? 2 * srv->cap : 8;
+        struct client **clients = realloc(srv->clients, cap * sizeof(*clients));
+        if (clients == NULL)
+        {
+            perror("realloc");
+            free(cl);
+            close(fd);
+            return;
+        }
+        srv->clients = clients;
+        srv->cap = cap;
+    }
+
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = cl};
+    if (epoll_ctl(srv->epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        free(cl);
+        close(fd);
+        return;
+    }
+    srv->clients[srv->nclients++] = cl;
+    printf("Adding to list of sockets as %d (%d clients)\n", fd, srv->nclients);
+}
+
+
+void drop_client(struct server *srv, struct client *cl)
+{
+    printf("Host disconnected , ip %s , port %d \n",
+           inet_ntoa(cl->addr.sin_addr), ntohs(cl->addr.sin_port));
+    epoll_ctl(srv->epfd, EPOLL_CTL_DEL, cl->fd, NULL);
+    close(cl->fd);
+    for (int i = 0; i < srv->nclients; i++)
+    {
+        if (srv->clients[i] == cl)
+        {
+            srv->clients[i] = srv->clients[--srv->nclients];
+            break;
+        }
+    }
+    free(cl);
+}
+
+
+/**
+ * Number of clients that got at least as far as state
+ */
+int count_state(struct server *srv, int state)
+{
+    int n = 0;
+    for (int i = 0; i < srv->nclients; i++)
+        if (srv->clients[i]->state >= state)
+            n++;
+    return n;
+}
+
+
+/**
+ * Tell every subscribed client the trigger schedule with one datagram
+ */
+void announce(struct server *srv)
+{
+    struct timespec T_now;
+    clock_gettime(CLOCK_REALTIME, &T_now);
+    struct sync_packet pkt = {.type = SYNC_ANNOUNCE, .seq = srv->announce_seq, .t = {0}};
+    pkt.t[0] = as_nsec(&srv->T_start);
+    pkt.t[1] = TRIG_PERIOD_NS;
+    pkt.t[2] = as_nsec(&T_now);
+
+    uint8_t buf[SYNC_PACKET_SIZE];
+    sync_encode(&pkt, buf);
+    if (sendto(srv->mcast_fd, buf, SYNC_PACKET_SIZE, 0,
+               (struct sockaddr *) &srv->mcast_addr, sizeof(srv->mcast_addr)) != SYNC_PACKET_SIZE)
+        perror("announce");
+    // back off: the clients still missing may well be doing fine over TCP
+    srv->next_announce = monotonic_nsec() + srv->announce_ms * 1000000LL;
+    if (srv->announce_ms < ANNOUNCE_MAX_MS)
+        srv->announce_ms = srv->announce_ms * 2 < ANNOUNCE_MAX_MS ? srv->announce_ms * 2 : ANNOUNCE_MAX_MS;
+}
+
+
+/**
+ * epoll_wait() timeout until the next announcement is due
+ */
+int next_timeout(struct server *srv)
+{
+    if (srv->next_announce == 0)
+        return -1;
+    long long now = monotonic_nsec();
+    if (srv->next_announce <= now)
+        return 0;
+    return (int) ((srv->next_announce - now) / 1000000 + 1);
+}
+
+
+int open_announce(struct server *srv, const char *if_addr)
+{
+    srv->mcast_fd = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+    if (srv->mcast_fd < 0)
+    {
+        perror("announce socket");
+        return -1;
+    }
+    // local network only
+    unsigned char ttl = 1;
+    struct in_addr iface;
+    inet_pton(AF_INET, if_addr, &iface);
+    setsockopt(srv->mcast_fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+    if (setsockopt(srv->mcast_fd, IPPROTO_IP, IP_MULTICAST_IF, &iface, sizeof(iface)) < 0)
+        perror("IP_MULTICAST_IF");
+
+    memset(&srv->mcast_addr, 0, sizeof(srv->mcast_addr));
+    srv->mcast_addr.sin_family = AF_INET;
+    srv->mcast_addr.sin_port = htons(SYNC_MCAST_PORT);
+    inet_pton(AF_INET, SYNC_MCAST_GROUP, &srv->mcast_addr.sin_addr);
+    return 0;
+}
+
+
+void handle_packet(struct server *srv, struct client *cl, struct sync_packet *pkt,
+                   struct timespec *T2)
+{
+    struct timespec T3;
+    // replies echo the sequence number of the request
+    struct sync_packet reply = {.type = 0, .seq = pkt->seq, .t = {0}};
+    switch (pkt->type)
+    {
+        // clients are responding with its T1 value to receive
+        // more time information for synchronization
+        case SYNC_TPSN_REQ:
+            clock_gettime(CLOCK_REALTIME, &T3);
+            reply.type = SYNC_TPSN_REPLY;
+            reply.t[0] = as_nsec(T2);
+            reply.t[1] = as_nsec(&T3);
+            break;
+        // client lets server know that sychronization is complete and it
+        // is ready to receive trigger start time
+        case SYNC_START_REQ:
+            if (cl->state < 1)
+                cl->state = 1;
+            // Only when all clients are ready does the server set the
+            // start time of the trigger
+            if (srv->T_start.tv_sec == 0 && srv->T_start.tv_nsec == 0 &&
+                count_state(srv, 1) >= srv->expected)
+            {
+                as_timespec(as_nsec(T2) + 2*BILLION, &srv->T_start);
+                printf("Start time set, %d clients\n", srv->nclients);
+                srv->announce_seq++;
+                srv->announce_ms = ANNOUNCE_MS;
+                announce(srv);
+            }
+            reply.type = SYNC_START;
+            reply.t[0] = as_nsec(&srv->T_start);
+            reply.t[1] = TRIG_PERIOD_NS;
+            break;
+        // client is ready to trigger cameras
+        case SYNC_READY:
+            cl->state = 2;
+            reply.type = SYNC_READY_ACK;
+            break;
+        default:
+            printf("Unknown packet type %d from socket %d\n", pkt->type, cl->fd);
+            return;
+    }
+    if (sync_send(cl->fd, &reply) == -1)
+        perror("send");
+
+    if (!srv->started && count_state(srv, 2) >= srv->expected)
+    {
+        start_trigger(srv->T_start);
+        srv->started = 1;
+        // everyone has the schedule, later clients ask for it over TCP
+        srv->next_announce = 0;
+        printf("Trigger started\n");
+    }
+}
+
+
+/**
+ * Read what a client sent. Packets may arrive in pieces, so only read up to
+ * the end of the current one. Returns -1 if the client was dropped.
+ */
+int handle_readable(struct server *srv, struct client *cl)
+{
+    struct timespec T_rx, T2;
+    int stamped;
+    ssize_t valread = read_stamped(cl->fd, (char *) cl->rxbuf + cl->rxlen,
+                                   SYNC_PACKET_SIZE - cl->rxlen, &T_rx, &stamped);
+    clock_gettime(CLOCK_REALTIME, &T2);
+    if (valread < 0 && errno == EINTR)
+        return 0;
+    if (valread <= 0)
+    {
+        drop_client(srv, cl);
+        return -1;
+    }
+    cl->rxlen += valread;
+    if (cl->rxlen < SYNC_PACKET_SIZE)
+        return 0;
+    cl->rxlen = 0;
+
+    struct sync_packet pkt;
+    if (sync_decode(cl->rxbuf, &pkt) == -1)
+    {
+        printf("Bad packet from socket %d, dropping it\n", cl->fd);
+        drop_client(srv, cl);
+        return -1;
+    }
+    if (stamped)
+        T2 = T_rx;
+    handle_packet(srv, cl, &pkt, &T2);
+    return 0;
+}
+
+
 /**
  * Entrance to the entire code. 
  */
 int main(int argc , char *argv[])   
 {   
+    struct server srv = {0};
+    srv.expected = 2;
+    const char *announce_if = ANNOUNCE_IF;
+
+    // -k: kernel receive timestamps for T2
+    // -n: number of clients to wait for
+    // -m: interface address for the announcements
+    int c;
+    while ((c = getopt(argc, argv, "kn:m:")) != -1)
+    {
+        if (c == 'k')
+            srv.kernel_ts = 1;
+        else if (c == 'n' && atoi(optarg) > 0)
+            srv.expected = atoi(optarg);
+        else if (c == 'm')
+            announce_if = optarg;
+        else
+        {
+            printf("usage: server2 [-k] [-n clients] [-m interface address]\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+
     // Set up wiring Pi for controlling the RPI
     wiringPiSetup();
     pinMode(TRIG_PIN, OUTPUT);
 
     int opt = 1;   
-    int master_socket , addrlen , new_socket , client_socket[30] ,  
-          max_clients = 2 , activity, i , valread , sd;   
-    int max_sd;   
+    int master_socket , addrlen , new_socket;   
     struct sockaddr_in address;   
          
-    char buffer[1025];  //data buffer of 1K  
-         
-    //set of socket descriptors  
-    fd_set readfds;   
-         
-    //a message  
-    char *message = "ECHO Daemon v1.0 \r\n";   
-     
-    //initialise all client_socket[] to 0 so not checked  
-    for (i = 0; i < max_clients; i++)   
-    {   
-        client_socket[i] = 0;   
-    }   
-         
     //create a master socket  
     if( (master_socket = socket(AF_INET , SOCK_STREAM , 0)) == 0)   
     {   
@@ -159,187 +522,89 @@ int main(int argc , char *argv[])
     }   
     printf("Listener on port %d \n", PORT);   
          
-    //try to specify maximum of 3 pending connections for the master socket  
-    if (listen(master_socket, 3) < 0)   
+    //try to specify maximum of 16 pending connections for the master socket  
+    if (listen(master_socket, 16) < 0)   
     {   
         perror("listen");   
         exit(EXIT_FAILURE);   
     }   
+
+    if (open_announce(&srv, announce_if) < 0)
+        exit(EXIT_FAILURE);
+
+    srv.epfd = epoll_create1(0);
+    if (srv.epfd < 0)
+    {
+        perror("epoll_create1");
+        exit(EXIT_FAILURE);
+    }
+    // the master socket is the one event without a client
+    struct epoll_event ev = {.events = EPOLLIN, .data.ptr = NULL};
+    if (epoll_ctl(srv.epfd, EPOLL_CTL_ADD, master_socket, &ev) < 0)
+    {
+        perror("epoll_ctl");
+        exit(EXIT_FAILURE);
+    }
          
-    //accept the incoming connection  
-    addrlen = sizeof(address);   
     puts("Waiting for connections ...");   
 
-    // Starting time of the trigger that is sent to clients eventually
-    struct timespec T_start = {.tv_sec=0, .tv_nsec=0};
-    // T2 and T3 for synchronization
-    struct timespec T2, T3;
+    // Handle network for good: once all clients have responded saying that
+    // they are synchronized and ready, the trigger starts and the clients
+    // keep using their connections for drift and resynchronization.
+    struct epoll_event events[MAX_EVENTS];
+    while(1)   
+    {   
+        int n = epoll_wait(srv.epfd, events, MAX_EVENTS, next_timeout(&srv));
+        // the trigger timer interrupts us every second
+        if (n < 0)
+        {
+            if (errno != EINTR)
+                perror("epoll_wait");
+            continue;
+        }
 
-    // simple status indication array for each client
-    // 0: time is not informed
-    // 1: start time is sent
-    // 2. start time is acknowledged and ready to trigger
-    uint8_t sync[2] = {0};    
+        for (int i = 0; i < n; i++)
+        {
+            struct client *cl = events[i].data.ptr;
+            if (cl != NULL)
+            {
+                handle_readable(&srv, cl);
+                continue;
+            }
 
-    // Handle network until both cameras have responded saying that they are
-    // synchronized and ready to trigger cameras.
-    while(sync[0] != 2 || sync[1] != 2)   
-    {   
-        //clear the socket set  
-        FD_ZERO(&readfds);   
-     
-        //add master socket to set  
-        FD_SET(master_socket, &readfds);   
-        max_sd = master_socket;   
-             
-        //add child sockets to set  
-        for ( i = 0 ; i < max_clients ; i++)   
-        {   
-            //socket descriptor  
-            sd = client_socket[i];   
-                 
-            //if valid socket descriptor then add to read list  
-            if(sd > 0)   
-                FD_SET( sd , &readfds);   
-                 
-            //highest file descriptor number, need it for the select function  
-            if(sd > max_sd)   
-                max_sd = sd;   
-        }   
-     
-        //wait for an activity on one of the sockets , timeout is NULL ,  
-        //so wait indefinitely  
-        activity = select( max_sd + 1 , &readfds , NULL , NULL , NULL);   
-       
-        if ((activity < 0) && (errno!=EINTR))   
-        {   
-            printf("select error");   
-        }   
-        //If something happened on the master socket ,  
-        //then its an incoming connection  
-        if (FD_ISSET(master_socket, &readfds))   
-        {   
+            //If something happened on the master socket ,  
+            //then its an incoming connection  
+            addrlen = sizeof(address);   
             if ((new_socket = accept(master_socket,  
                     (struct sockaddr *)&address, (socklen_t*)&addrlen))<0)   
             {   
                 perror("accept");   
-                exit(EXIT_FAILURE);   
+                continue;
             }   
              
+            // replies are single small packets, send them right away, and
+            // never let one stuck client block the others for long
+            struct timeval tv = {.tv_sec = 1, .tv_usec = 0};
+            setsockopt(new_socket, IPPROTO_TCP, TCP_NODELAY, (char *)&opt, sizeof(opt));
+            setsockopt(new_socket, SOL_SOCKET, SO_SNDTIMEO, &tv, sizeof(tv));
+            if (srv.kernel_ts)
+            {
+                int flags = SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_RX_HARDWARE |
+                            SOF_TIMESTAMPING_SOFTWARE | SOF_TIMESTAMPING_RAW_HARDWARE;
+                if (setsockopt(new_socket, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0)
+                    perror("SO_TIMESTAMPING");
+            }
+
             //inform user of socket number - used in send and receive commands  
             printf("New connection , socket fd is %d , ip is : %s , port : %d\n", 
                 new_socket , inet_ntoa(address.sin_addr) , ntohs(address.sin_port));   
+            add_client(&srv, new_socket, &address);
+        }
 
-            //add new socket to array of sockets  
-            for (i = 0; i < max_clients; i++)   
-            {   
-                //if position is empty  
-                if( client_socket[i] == 0 )   
-                {   
-                    client_socket[i] = new_socket;   
-                    printf("Adding to list of sockets as %d\n" , i);   
-                         
-                    break;   
-                }   
-            }   
-        }   
-        //else its some IO operation on some other socket 
-        for (i = 0; i < max_clients; i++)   
-        {   
-            sd = client_socket[i];   
-                 
-            if (FD_ISSET( sd , &readfds))   
-            {   
-                //Check if it was for closing , and also read the  
-                //incoming message  
-                if ((valread = read( sd , buffer, 1024)) == 0)   
-                {   
-                    //Somebody disconnected , get his details and print  
-                    getpeername(sd , (struct sockaddr*)&address, (socklen_t*)&addrlen);   
-                    printf("Host disconnected , ip %s , port %d \n",  
-                          inet_ntoa(address.sin_addr) , ntohs(address.sin_port));   
-                         
-                    //Close the socket and mark as 0 in list for reuse  
-                    close( sd );   
-                    client_socket[i] = 0;   
-                }
-                // handle synchronization 
-                else 
-                {   
-                    clock_gettime(CLOCK_REALTIME, &T2);
-                    long long rec_T = bytes_to_nsec(buffer);
-                    // clients are responding with its T1 value to receive
-                    // more time information for synchronization
-                    if (rec_T > 1) 
-                    {
-                        usleep(1000);
-                        clock_gettime(CLOCK_REALTIME, &T3);
-                        
-                        char timeData[16] = {0};
-                        char *T2_arr = (char *) &(T2.tv_sec);
-                        char *T3_arr = (char *) &(T3.tv_sec);
-                        for (int i = 0; i < 8; i++) {
-                            timeData[i] = T2_arr[i];
-                            timeData[8+i] = T3_arr[i];
-                        }
-                        send(sd, timeData, 16, 0);   
-                    }
-                    // client sends 0 to let server know that sychronization is
-                    // complete and it is ready to receive trigger start time.
-                    // convert the status to 1.
-                    else if (rec_T == 0)
-                    {
-                        sync[i] = 1;
-                        // Only when both clients are ready does the server
-                        // set the start time of the trigger
-                        if (sync[0] == 1 && sync[1] == 1)
-                        {
-                            if (T_start.tv_sec == 0 && T_start.tv_nsec == 0)
-                            {
-                                long long T2n = as_nsec(&T2);
-                                T2n += 2*BILLION;
-                                as_timespec(T2n, &T_start);
-                            }
-                        }
-                        send(sd, (char *) &T_start, 8, 0);
-                    }
-                    // client is ready to trigger cameras, convert the status
-                    // to 2
-                    else if (rec_T == 1)
-                    {
-                        sync[i] = 2;
-                        char timeData[8] = {0};
-                        timeData[4] = 1;
-                        send(sd, timeData, 8, 0); 
-                    }
-                }
-            }   
-        }   
+        // keep repeating the schedule for clients that missed it
+        if (srv.next_announce && monotonic_nsec() >= srv.next_announce)
+            announce(&srv);
     }   
     
-    // Create a repeated timer interrupt that happens every second starting at
-    // T_start
-    timer_t t_id;
-    struct itimerspec tim_spec = {.it_interval= {.tv_sec=1,.tv_nsec=0},
-                    .it_value = T_start};
-
-    struct sigaction act;
-    sigset_t set;
-
-    sigemptyset( &set );
-    sigaddset( &set, SIGALRM );
-
-    act.sa_flags = 0;
-    act.sa_mask = set;
-    act.sa_handler = &handler;
-
-    sigaction( SIGALRM, &act, NULL );
-
-    if (timer_create(CLOCK_REALTIME, NULL, &t_id))
-        perror("timer_create");
-
-    if (timer_settime(t_id, TIMER_ABSTIME, &tim_spec, NULL))
-        perror("timer_settime");
-    while(1);
     return 0;   
 }
@@ -29,147 +29,213 @@
 
 // #include "tif_config.h"
 
+/*
+ * Strip size / compression sweep for the frame writer in imaging/.
+ *
+ * Build on the Pi with
+ *   g++ -O2 -std=c++11 -I../../imaging tiff_test.cpp ../../imaging/tiffwriter.cpp \
+ *       ../../imaging/framecodec.cpp -ltiff -o test
+ * (add -DHAVE_LZ4 ... -llz4 to include the raw+LZ4 codec)
+ *
+ * Usage: ./test [raw GRAY8 frame] [repeats] [output file]
+ *
+ * Every combination of codec and strip size is written `repeats` times with
+ * writeTiff() from imaging/tiffwriter.cpp, plus the old scanline writer
+ * (3 rows per strip, TIFFWriteScanline) as a baseline. The raw+LZ4 codec
+ * is timed last when available.
+ */
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/stat.h>
 #include <sys/types.h>
-#include <math.h>
-#include <ctype.h>
 #include <iostream>
 #include <chrono>
+#include <vector>
+#include <string>
 
 # include <unistd.h>
 # include <fcntl.h>
 // # include <io.h>
 #include "tiffio.h"
-
-#ifndef HAVE_GETOPT
-extern int getopt(int, char**, char*);
-#endif
+#include "tiffwriter.h"
+#include "framecodec.h"
 
 #ifndef O_BINARY
 # define O_BINARY 0
 #endif
 
-typedef enum {
-	PIXEL,
-	BAND
-} InterleavingType;
+typedef std::chrono::high_resolution_clock Time;
+typedef std::chrono::duration<double, std::milli> fms;
+
+struct Codec
+{
+	const char *name;
+	uint16 compression;
+};
+
+static const Codec codecs[] = {
+	{"none", COMPRESSION_NONE},
+	{"packbits", COMPRESSION_PACKBITS},
+	{"lzw", COMPRESSION_LZW},
+	{"deflate", COMPRESSION_ADOBE_DEFLATE},
+};
+
+/* 0 means one strip for the whole image */
+static const uint32 strip_sizes[] = {
+	8 * 1024, 32 * 1024, 64 * 1024, 128 * 1024, 256 * 1024, 1024 * 1024, 0
+};
+
+/* The writer simple-snapimage used before strips: 3 rows, one scanline per call */
+static int
+writeScanlines(const unsigned char *buf, uint32 width, uint32 length,
+               const char *outfilename, uint16 compression)
+{
+	TIFF *out = TIFFOpen(outfilename, "w");
+	if (out == NULL) {
+		fprintf(stderr, "%s: Cannot open file for output.\n", outfilename);
+		return (-1);
+	}
+	TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
+	TIFFSetField(out, TIFFTAG_IMAGELENGTH, length);
+	TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
+	TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, 1);
+	TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, 8);
+	TIFFSetField(out, TIFFTAG_FILLORDER, FILLORDER_LSB2MSB);
+	TIFFSetField(out, TIFFTAG_PLANARCONFIG, PLANARCONFIG_CONTIG);
+	TIFFSetField(out, TIFFTAG_PHOTOMETRIC, PHOTOMETRIC_MINISBLACK);
+	TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
+	TIFFSetField(out, TIFFTAG_COMPRESSION, compression);
+	TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, 3);
+	for (uint32 row = 0; row < length; row++) {
+		if (TIFFWriteScanline(out, (void *) (buf + row * width), row, 0) < 0) {
+			fprintf(stderr, "%s: scanline %lu: Write error.\n",
+			        outfilename, (unsigned long) row);
+			break;
+		}
+	}
+	TIFFClose(out);
+	return (0);
+}
 
-static	uint16 compression = (uint16) -1;
-static	int jpegcolormode = JPEGCOLORMODE_RGB;
-static	int quality = 75;		/* JPEG quality */
-static	uint16 predictor = 0;
+static long
+fileSize(const char *path)
+{
+	struct stat st;
+	if (stat(path, &st) < 0)
+		return -1;
+	return (long) st.st_size;
+}
 
-static void swapBytesInScanline(void *, uint32, TIFFDataType);
+static void
+report(const char *codec, const char *layout, uint32 rowsperstrip,
+       const std::vector<double> &times, long bytes, size_t rawbytes)
+{
+	double mean = 0, best = times[0], worst = times[0];
+	for (double t : times) {
+		mean += t;
+		if (t < best) best = t;
+		if (t > worst) worst = t;
+	}
+	mean /= times.size();
+	printf("%-9s %-10s %6lu %9.1f %9.1f %9.1f %8.1f %10ld %6.3f\n",
+	       codec, layout, (unsigned long) rowsperstrip, mean, best, worst,
+	       rawbytes / (mean * 1e3), bytes, (double) bytes / rawbytes);
+}
 
 int
 main(int argc, char* argv[])
 {
-    typedef std::chrono::high_resolution_clock Time;
-    typedef std::chrono::milliseconds ms;
-    typedef std::chrono::duration<float> fsec;
-	uint32	width = 2592, length = 1944, linebytes, bufsize;
-	uint32	nbands = 1;		    /* number of bands in input image*/
-	off_t	hdr_size = 0;		    /* size of the header to skip */
-	TIFFDataType dtype = TIFF_BYTE;
-	int16	depth = 1;		    /* bytes per pixel in input image */
-	int	swab = 0;		    /* byte swapping flag */
-	uint32  rowsperstrip = 3; //(uint32) -1;
-	uint16	photometric = PHOTOMETRIC_MINISBLACK;
-	uint16	config = PLANARCONFIG_CONTIG;
-	uint16	fillorder = FILLORDER_LSB2MSB;
+	uint32	width = 2592, length = 1944;
+	size_t	bufsize = width * length;
+	const char *infilename = "image00000_2.bin";
+	const char *outfilename = "test_jj2.tif";
+	int	repeats = 5;
 	int	fd;
-	char	*outfilename = NULL, *infilename = NULL;
-	TIFF	*out;
-
-	uint32 row, col, band;
-	int	c;
-	unsigned char *buf = NULL;
-    bufsize = width*length;
-    unsigned char buf1[bufsize];
-	extern int optind;
-	extern char* optarg;
-
-
-    compression = COMPRESSION_PACKBITS;
-    //compression = COMPRESSION_LZW;
-    dtype = TIFF_BYTE;
-
-    depth = TIFFDataWidth(dtype);
-    outfilename = "test_jj2.tif";
-    infilename = "image00000_2.bin";
-    fd = open(infilename, O_RDONLY|O_BINARY, 0);
+
+	if (argc > 1)
+		infilename = argv[1];
+	if (argc > 2)
+		repeats = atoi(argv[2]);
+	if (argc > 3)
+		outfilename = argv[3];
+	if (repeats < 1)
+		repeats = 1;
+
+	std::vector<unsigned char> buf1(bufsize);
+	fd = open(infilename, O_RDONLY|O_BINARY, 0);
 	if (fd < 0) {
 		fprintf(stderr, "%s: Cannot open input file.\n", infilename);
 		return (-1);
 	}
-
-    if (read(fd, buf1, bufsize) < 0) {
-        fprintf(stderr,
-            "scanline %lu: Read error.\n",
-            (unsigned long) row);
-        return -1;
-    }
-    auto t0 = Time::now();
-	out = TIFFOpen(outfilename, "w");
-	if (out == NULL) {
-		fprintf(stderr, "%s: Cannot open file for output.\n", outfilename);
+	if (read(fd, buf1.data(), bufsize) != (ssize_t) bufsize) {
+		fprintf(stderr, "%s: short read, expected %lu bytes.\n",
+		        infilename, (unsigned long) bufsize);
+		close(fd);
 		return (-1);
 	}
-	TIFFSetField(out, TIFFTAG_IMAGEWIDTH, width);
-	TIFFSetField(out, TIFFTAG_IMAGELENGTH, length);
-	TIFFSetField(out, TIFFTAG_ORIENTATION, ORIENTATION_TOPLEFT);
-	TIFFSetField(out, TIFFTAG_SAMPLESPERPIXEL, nbands);
-	TIFFSetField(out, TIFFTAG_BITSPERSAMPLE, depth * 8);
-	TIFFSetField(out, TIFFTAG_FILLORDER, fillorder);
-	TIFFSetField(out, TIFFTAG_PLANARCONFIG, config);
-    TIFFSetField(out, TIFFTAG_PHOTOMETRIC, photometric);
-    TIFFSetField(out, TIFFTAG_SAMPLEFORMAT, SAMPLEFORMAT_UINT);
-	
-	TIFFSetField(out, TIFFTAG_COMPRESSION, compression);
-    //TIFFSetField(out, TIFFTAG_PREDICTOR, 2);
-
-    linebytes = width * nbands * depth;
-	bufsize = width * nbands * depth;
-    unsigned char *buf2 = NULL; //(unsigned char *)_TIFFmalloc(bufsize);
+	close(fd);
+
+	printf("%-9s %-10s %6s %9s %9s %9s %8s %10s %6s\n", "codec", "strip",
+	       "rows", "mean ms", "min ms", "max ms", "MB/s", "bytes", "ratio");
+	for (const Codec &codec : codecs) {
+		if (!TIFFIsCODECConfigured(codec.compression)) {
+			printf("%-9s not configured in this libtiff\n", codec.name);
+			continue;
+		}
 
-	/*rowsperstrip = TIFFDefaultStripSize(out, rowsperstrip);
-	if (rowsperstrip > length) {
-		rowsperstrip = length;
+		std::vector<double> times;
+		for (int i = 0; i < repeats; i++) {
+			auto t0 = Time::now();
+			writeScanlines(buf1.data(), width, length, outfilename, codec.compression);
+			times.push_back(fms(Time::now() - t0).count());
+		}
+		report(codec.name, "scanline", 3, times, fileSize(outfilename), bufsize);
+
+		for (uint32 strip_bytes : strip_sizes) {
+			TiffOptions options;
+			options.strip_bytes = strip_bytes;
+			options.compression = codec.compression;
+			char layout[16];
+			if (strip_bytes == 0)
+				snprintf(layout, sizeof(layout), "single");
+			else
+				snprintf(layout, sizeof(layout), "%uK", strip_bytes / 1024);
+
+			times.clear();
+			for (int i = 0; i < repeats; i++) {
+				auto t0 = Time::now();
+				writeTiff(buf1.data(), width, length, width, outfilename, options);
+				times.push_back(fms(Time::now() - t0).count());
+			}
+			report(codec.name, layout, tiffRowsPerStrip(width, length, 1, strip_bytes),
+			       times, fileSize(outfilename), bufsize);
+		}
 	}
-    std::cout << rowsperstrip << std::endl;*/
-	TIFFSetField(out, TIFFTAG_ROWSPERSTRIP, rowsperstrip );
-
-	//lseek(fd, hdr_size, SEEK_SET);		/* Skip the file header */
-	for (row = 0; row < length; row++) {
-       /* if (read(fd, buf1, bufsize) < 0) {
-            fprintf(stderr,
-                "scanline %lu: Read error.\n",
-                (unsigned long) row);
-            break;
-        }*/
-		buf2 = buf1 + row * bufsize;		
-		if (TIFFWriteScanline(out, buf2, row, 0) < 0) {
-			fprintf(stderr,	"%s: scanline %lu: Write error.\n",
-                    outfilename, (unsigned long) row);
-			break;
+
+	if (storageCodecAvailable(StorageCodec::LZ4Raw)) {
+		CodecOptions options;
+		options.codec = StorageCodec::LZ4Raw;
+		std::string base(outfilename);
+		base = base.substr(0, base.rfind('.'));
+		FrameMeta meta = FrameMeta();
+		for (int acceleration = 1; acceleration <= 8; acceleration *= 2) {
+			std::vector<double> times;
+			EncodeResult result;
+			options.level = acceleration;
+			for (int i = 0; i < repeats; i++) {
+				meta.frame_id = i;
+				encodeFrame(buf1.data(), width, length, width, meta,
+				            base.c_str(), options, &result);
+				times.push_back(result.encode_ms);
+			}
+			char layout[16];
+			snprintf(layout, sizeof(layout), "accel %d", acceleration);
+			report("lz4", layout, length, times, (long) result.stored_bytes, bufsize);
 		}
+	} else {
+		printf("%-9s not built in (HAVE_LZ4)\n", "lz4");
 	}
-	/*if (buf)
-		_TIFFfree(buf);
-	if (buf1)
-		_TIFFfree(buf1);*/
-    auto t1 = Time::now();
-	TIFFClose(out);
-    auto t2=Time::now();
-    fsec fs1 = t1-t0;
-    fsec fs2 = t2-t1;
-    ms d1 = std::chrono::duration_cast<ms>(fs1);
-    ms d2 = std::chrono::duration_cast<ms>(fs2);
-    //std::cout << fs1.count() << "s\n";
-    std::cout << d1.count() << "ms" << std::endl; 
-    std::cout << d2.count() << "ms" << std::endl;
 	return (0);
 }
@@ -2,16 +2,19 @@
 
 cpu_freq -s 1200000
 
-#Core_c=2
-#Core_i=3
-#Core=6
-#CoreMask=`echo "16 o 2 $Core ^ p" | dc`
-#echo $CoreMask
-
+# Keep everything else off cores 1-3. Both programs pin and schedule their
+# own threads inside the shield (trigger_cpu, capture_cpu, service_cpu in
+# the mission file), so they need no chrt.
 cset shield --cpu=1-3 --kthread=on
-#cset set --cpu=$Core_c --set=c_set
-#cset set --cpu=$Core_i --set=i_set
 
-cset shield --exec -- chrt -rr 97 /home/pi/imaging/build/simple-snapimage 0 1 &
-sleep 10
-cset shield --exec  -- chrt -rr 98 /home/pi/camera/build/minions
+# Readiness: each program writes a line to fd 3 once it is up
+ready=$(mktemp -u)
+mkfifo "$ready"
+exec 3<>"$ready"
+rm "$ready"
+
+cset shield --exec -- /home/pi/imaging/build/simple-snapimage -N 3 0 1 &
+if ! read -t 30 -u 3; then
+    echo "simple-snapimage not streaming after 30 s, starting minions anyway"
+fi
+cset shield --exec -- /home/pi/camera/build/minions -N 3